@@ -206,4 +206,21 @@ with the smallest m/z distance:
     return 0;
 }
 \endcode
+
+\section nearest Nearest Box Queries
+As only the closest candidate is of interest, the example program skips the
+adjacency list altogether and asks \c fbi::Nearest for the single nearest
+precursor of every XIC. \c Nearest uses the same \c Traits and box functors
+as \c SetA; the distance is the sum of per-dimension distances returned by a
+user metric. Here, the metric returns the m/z gap in ppm and makes pairs
+outside of the m/z and retention time tolerances infinitely far apart:
+
+\code
+    typedef Nearest<MS2Scan, 0, 1> NearestMS2Scan;
+    NearestMS2Scan::ResultType neighbors = NearestMS2Scan::find(1,
+      ms2scans, MS2ScanBoxGenerator(0.0, 0.0),
+      xics, XicBoxGenerator(0.0, 0.0),
+      PrecursorMetric(options.prescanPpm_ + options.fullscanPpm_, 
+        2 * options.rtWindow_));
+\endcode
 */
@@ -0,0 +1,139 @@
+/* $Id: benchmark-batch.cpp 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+#include "example-xic-construction.h"
+#include <fbi/batch.h>
+
+/*
+ * Cut the centroids of example-xic-construction into a number of runs of
+ * random size, as if they came from independent LC-MS runs, and intersect
+ * every run: one SetA::intersect call after the other, and with a 
+ * fbi::Batch on one thread (reusing the key buffers only) and on all 
+ * threads. 
+ */
+
+typedef fbi::SetA<Centroid, 1, 2> CentroidSet;
+typedef fbi::Batch<Centroid, 1, 2> CentroidBatch;
+typedef fbi::BatchJob<std::vector<Centroid>, BoxGenerator, BoxGenerator> Job;
+
+int main(int argc, char* argv[])
+{
+  namespace po = boost::program_options;
+  using namespace boost::posix_time;
+  ProgramOptions options;
+  options.mzWindowLow_ = -std::numeric_limits<double>::max();
+  options.mzWindowHigh_ = std::numeric_limits<double>::max();
+  options.snWindowLow_ = -std::numeric_limits<double>::max();
+  options.snWindowHigh_ = std::numeric_limits<double>::max();
+  unsigned int numRuns, threads;
+  std::size_t memoryLimit;
+
+  po::options_description visible("Allowed options");
+  visible.add_options()
+    ("help", "Display this help message")
+    ("inputfile,i", po::value<std::string>(&options.inputfileName_), "input file")
+    ("runs,n", po::value<unsigned int>(&numRuns)->default_value(200),
+      "number of runs to cut the centroids into")
+    ("threads,t", po::value<unsigned int>(&threads)->default_value(0),
+      "number of threads of the batch, 0 for one per core")
+    ("memory,m", po::value<std::size_t>(&memoryLimit)->default_value(0),
+      "memory limit of the batch in MB, 0 means no limit")
+    ;
+  po::positional_options_description p;
+  p.add("inputfile", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(
+    visible).positional(p).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help") || !vm.count("inputfile")) {
+    std::cout << visible << "\n";
+    return vm.count("help") ? 0 : -1;
+  }
+  if (numRuns == 0) numRuns = 1;
+  std::vector<Centroid> centroids = parseFileFast(options);
+
+  // cut at random positions, such that the runs have different sizes
+  std::mt19937 engine(46);
+  std::uniform_int_distribution<std::size_t> cut(0, centroids.size());
+  std::vector<std::size_t> cuts(numRuns - 1);
+  for (std::size_t i = 0; i < cuts.size(); ++i) cuts[i] = cut(engine);
+  cuts.push_back(0);
+  cuts.push_back(centroids.size());
+  std::sort(cuts.begin(), cuts.end());
+  std::vector<std::vector<Centroid> > runs(numRuns);
+  std::vector<Job> jobs;
+  for (std::size_t r = 0; r < numRuns; ++r) {
+    runs[r].assign(centroids.begin() + cuts[r], 
+      centroids.begin() + cuts[r + 1]);
+    jobs.push_back(fbi::makeBatchJob(runs[r], BoxGenerator(10, 2), 
+      BoxGenerator(10, 2)));
+  }
+  std::cout << centroids.size() << " centroids in " << numRuns << " runs"
+    << std::endl;
+
+  ptime start = microsec_clock::universal_time();
+  std::vector<CentroidSet::ResultType> reference(numRuns);
+  for (std::size_t r = 0; r < numRuns; ++r) {
+    reference[r] = CentroidSet::intersect(runs[r], BoxGenerator(10, 2), 
+      BoxGenerator(10, 2));
+  }
+  const double baseline = (microsec_clock::universal_time() - start)
+    .total_microseconds() * 1e-6;
+  std::cout << "mode\tthreads\tseconds\tspeedup" << std::endl;
+  std::cout << "intersect\t1\t" << baseline << "\t1" << std::endl;
+
+  int status = 0;
+  const unsigned int batchThreads[] = {1, threads};
+  for (int b = 0; b < 2; ++b) {
+    CentroidBatch batch(batchThreads[b], memoryLimit << 20);
+    start = microsec_clock::universal_time();
+    std::vector<CentroidSet::ResultType> results = batch.run(jobs);
+    const double seconds = (microsec_clock::universal_time() - start)
+      .total_microseconds() * 1e-6;
+    std::cout << "batch\t" << batch.numThreads() << "\t" << seconds << "\t" 
+      << baseline / seconds;
+    if (results != reference) {
+      std::cout << "\tMISMATCH";
+      status = 1;
+    }
+    std::cout << std::endl;
+  }
+  return status;
+}
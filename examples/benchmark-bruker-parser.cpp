@@ -0,0 +1,141 @@
+/* $Id: benchmark-bruker-parser.cpp 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <boost/program_options.hpp>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+#include "fbi/tuple.h"
+#include "fbi/tuplegenerator.h"
+#include "fbi/fbi.h"
+#include "fbi/connectedcomponents.h"
+#include "centroid.h"
+#include "splitter.h"
+
+/*
+ * Compare the throughput of getline/parseString with the memory mapped
+ * BrukerReader/parseLine on a Bruker CSV file and check that both produce
+ * the same centroids.
+ */
+
+struct GetlineReader 
+{
+  std::ifstream ifs_;
+  int sn_;
+
+  GetlineReader(const std::string & filename) : ifs_(filename.c_str()), sn_(0) {}
+
+  bool operator()(std::vector<Centroid> & centroids) {
+    std::string str;
+    if (!std::getline(ifs_, str)) return false;
+    parseString(str, centroids, sn_);
+    ++sn_;
+    return true;
+  }
+};
+
+template <class Reader>
+double throughput(const std::string & filename, std::size_t fileSize, 
+  unsigned int repetitions, std::vector<Centroid> & centroids)
+{
+  using namespace boost::posix_time;
+  ptime start = microsec_clock::universal_time();
+  for (unsigned int i = 0; i < repetitions; ++i) {
+    Reader reader(filename);
+    centroids.clear();
+    while (reader(centroids));
+  }
+  double seconds = (microsec_clock::universal_time() - start)
+    .total_microseconds() * 1e-6;
+  return fileSize * double(repetitions) / (1024.0 * 1024.0) / seconds;
+}
+
+bool same(const double & a, const double & b)
+{
+  return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+bool equal(const std::vector<Centroid> & a, const std::vector<Centroid> & b)
+{
+  if (a.size() != b.size()) return false;
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (!same(a[i].mz_, b[i].mz_) || a[i].sn_ != b[i].sn_ 
+      || !same(a[i].rt_, b[i].rt_)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  namespace po = boost::program_options;
+  std::string filename;
+  unsigned int repetitions;
+
+  po::options_description visible("Allowed options");
+  visible.add_options()
+    ("help", "Display this help message")
+    ("inputfile,i", po::value<std::string>(&filename), "input file")
+    ("repetitions,r", po::value<unsigned int>(&repetitions)->default_value(5),
+      "number of times each parser reads the file")
+    ;
+  po::positional_options_description p;
+  p.add("inputfile", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(
+    visible).positional(p).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help") || !vm.count("inputfile")) {
+    std::cout << visible << "\n";
+    return vm.count("help") ? 0 : -1;
+  }
+  std::size_t fileSize = fastparse::MappedText(filename).size();
+  if (repetitions == 0) repetitions = 1;
+
+  std::vector<Centroid> reference, centroids;
+  std::cout << "parser\tMB/s" << std::endl;
+  std::cout << "getline\t" << throughput<GetlineReader>(filename, fileSize, 
+    repetitions, reference) << std::endl;
+  std::cout << "fast\t" << throughput<BrukerReader>(filename, fileSize, 
+    repetitions, centroids);
+  int status = 0;
+  if (!equal(reference, centroids)) {
+    std::cout << "\tMISMATCH";
+    status = 1;
+  }
+  std::cout << std::endl << reference.size() << " centroids, " << fileSize 
+    << " bytes" << std::endl;
+  return status;
+}
@@ -0,0 +1,121 @@
+/* $Id: benchmark-estimate.cpp 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+#include "example-xic-construction.h"
+
+
+/*
+ * Estimate the pairs, the runtime and the peak memory of the XIC 
+ * construction intersection with SetA::estimate and compare with the 
+ * intersection itself.
+ */
+
+typedef fbi::SetA<Centroid, 1, 2> CentroidSet;
+
+int main(int argc, char* argv[])
+{
+  namespace po = boost::program_options;
+  using namespace boost::posix_time;
+  ProgramOptions options;
+  options.mzWindowLow_ = -std::numeric_limits<double>::max();
+  options.mzWindowHigh_ = std::numeric_limits<double>::max();
+  options.snWindowLow_ = -std::numeric_limits<double>::max();
+  options.snWindowHigh_ = std::numeric_limits<double>::max();
+  double ppm;
+  unsigned int scans;
+
+  po::options_description visible("Allowed options");
+  visible.add_options()
+    ("help", "Display this help message")
+    ("inputfile,i", po::value<std::string>(&options.inputfileName_), "input file")
+    ("ppm,p", po::value<double>(&ppm)->default_value(10),
+      "half window width in m/z (ppm)")
+    ("scans,s", po::value<unsigned int>(&scans)->default_value(2),
+      "half window width in scans")
+    ;
+  po::positional_options_description p;
+  p.add("inputfile", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(
+    visible).positional(p).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help") || !vm.count("inputfile")) {
+    std::cout << visible << "\n";
+    return vm.count("help") ? 0 : -1;
+  }
+  std::vector<Centroid> centroids = parseFileFast(options);
+  std::cout << centroids.size() << " centroids" << std::endl;
+
+  fbi::IntersectOptions intersectOptions;
+  ptime start = microsec_clock::universal_time();
+  const fbi::IntersectEstimate estimate = CentroidSet::estimate(
+    intersectOptions, centroids, BoxGenerator(ppm, scans), 
+    BoxGenerator(ppm, scans));
+  const double estimateSeconds = (microsec_clock::universal_time() - start)
+    .total_microseconds() * 1e-6;
+
+  start = microsec_clock::universal_time();
+  CentroidSet::ResultType result = CentroidSet::intersect(intersectOptions,
+    centroids, BoxGenerator(ppm, scans), BoxGenerator(ppm, scans));
+  const double seconds = (microsec_clock::universal_time() - start)
+    .total_microseconds() * 1e-6;
+  std::size_t numEdges = 0, capacity = 0;
+  for (std::size_t i = 0; i < result.size(); ++i) {
+    numEdges += result[i].size();
+    capacity += result[i].capacity();
+  }
+  const double bytes = static_cast<double>(result.size()) * 
+    sizeof(CentroidSet::ResultType::value_type) + 
+    static_cast<double>(capacity) * sizeof(unsigned int);
+
+  std::cout << "estimate took " << estimateSeconds << " seconds from " 
+    << estimate.sampleSize_ << " sampled queries" << std::endl;
+  std::cout << "quantity\tlow\testimate\thigh\tactual" << std::endl;
+  std::cout << "pairs\t" << estimate.pairs_.low_ << "\t" 
+    << estimate.pairs_.value_ << "\t" << estimate.pairs_.high_ << "\t" 
+    << numEdges << std::endl;
+  std::cout << "seconds\t" << estimate.seconds_.low_ << "\t" 
+    << estimate.seconds_.value_ << "\t" << estimate.seconds_.high_ << "\t" 
+    << seconds << std::endl;
+  std::cout << "result bytes\t" << estimate.peakBytes_.low_ << "\t" 
+    << estimate.peakBytes_.value_ << "\t" << estimate.peakBytes_.high_ 
+    << "\t" << bytes << " (without keys)" << std::endl;
+  return 0;
+}
@@ -0,0 +1,129 @@
+/* $Id: benchmark-numa.cpp 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+#include "example-xic-construction.h"
+
+/*
+ * Time SetA::intersect on the boxes of example-xic-construction with and
+ * without NUMA-aware partitions (see fbi::IntersectOptions::partitions_):
+ * a single scan on the calling thread, one partition per node without
+ * pinning, and one pinned partition per node. Run on a multi-socket 
+ * machine with multithreading enabled to see the effect of local memory;
+ * without multithreading the partitions run one after the other.
+ */
+
+typedef fbi::SetA<Centroid, 1, 2> CentroidSet;
+
+double timeIntersect(const std::vector<Centroid> & centroids, 
+  const fbi::IntersectOptions & options, unsigned int repetitions, 
+  CentroidSet::ResultType & result)
+{
+  using namespace boost::posix_time;
+  ptime start = microsec_clock::universal_time();
+  for (unsigned int i = 0; i < repetitions; ++i) {
+    result = CentroidSet::intersect(options, centroids, 
+      BoxGenerator(10, 2), BoxGenerator(10, 2));
+  }
+  return (microsec_clock::universal_time() - start)
+    .total_microseconds() * 1e-6 / repetitions;
+}
+
+int main(int argc, char* argv[])
+{
+  namespace po = boost::program_options;
+  ProgramOptions options;
+  options.mzWindowLow_ = -std::numeric_limits<double>::max();
+  options.mzWindowHigh_ = std::numeric_limits<double>::max();
+  options.snWindowLow_ = -std::numeric_limits<double>::max();
+  options.snWindowHigh_ = std::numeric_limits<double>::max();
+  unsigned int repetitions, partitions;
+
+  po::options_description visible("Allowed options");
+  visible.add_options()
+    ("help", "Display this help message")
+    ("inputfile,i", po::value<std::string>(&options.inputfileName_), "input file")
+    ("repetitions,r", po::value<unsigned int>(&repetitions)->default_value(3),
+      "number of runs per configuration")
+    ("partitions,p", po::value<unsigned int>(&partitions)->default_value(
+      static_cast<unsigned int>(fbi::NumaTopology::get().numNodes())),
+      "number of partitions, defaults to the number of NUMA nodes")
+    ;
+  po::positional_options_description p;
+  p.add("inputfile", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(
+    visible).positional(p).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help") || !vm.count("inputfile")) {
+    std::cout << visible << "\n";
+    return vm.count("help") ? 0 : -1;
+  }
+  if (repetitions == 0) repetitions = 1;
+  std::vector<Centroid> centroids = parseFileFast(options);
+
+  const fbi::NumaTopology & topology = fbi::NumaTopology::get();
+  std::cout << centroids.size() << " centroids, " << topology.numNodes() 
+    << " NUMA node(s)" << std::endl;
+  for (std::size_t node = 0; node < topology.numNodes(); ++node) {
+    std::cout << "node " << node << ": " << topology.cpus(node).size() 
+      << " cpu(s)" << std::endl;
+  }
+
+  fbi::IntersectOptions intersectOptions;
+  CentroidSet::ResultType reference, result;
+  const double baseline = timeIntersect(centroids, intersectOptions, 
+    repetitions, reference);
+  std::cout << "mode\tpartitions\tseconds\tspeedup" << std::endl;
+  std::cout << "single\t1\t" << baseline << "\t1" << std::endl;
+
+  int status = 0;
+  for (int pin = 0; pin < 2; ++pin) {
+    intersectOptions.partitions_ = partitions;
+    intersectOptions.pinPartitions_ = (pin == 1);
+    const double seconds = timeIntersect(centroids, intersectOptions, 
+      repetitions, result);
+    std::cout << (pin ? "pinned" : "unpinned") << "\t" << partitions 
+      << "\t" << seconds << "\t" << baseline / seconds;
+    if (result != reference) {
+      std::cout << "\tMISMATCH";
+      status = 1;
+    }
+    std::cout << std::endl;
+  }
+  return status;
+}
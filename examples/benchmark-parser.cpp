@@ -0,0 +1,141 @@
+/* $Id: benchmark-parser.cpp 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+#include "example-xic-construction.h"
+
+/*
+ * Compare the throughput of the iostream based parseFile with the memory
+ * mapped parser in fast-parser.h on a centroid file (rt mz sn abundance)
+ * and check that both produce the same centroids.
+ */
+
+bool equal(const std::vector<Centroid> & a, const std::vector<Centroid> & b)
+{
+  if (a.size() != b.size()) return false;
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (std::memcmp(&a[i], &b[i], sizeof(Centroid)) != 0) return false;
+  }
+  return true;
+}
+
+template <class Parser>
+double throughput(const Parser & parser, std::size_t fileSize, 
+  unsigned int repetitions, std::vector<Centroid> & centroids)
+{
+  using namespace boost::posix_time;
+  ptime start = microsec_clock::universal_time();
+  for (unsigned int i = 0; i < repetitions; ++i) {
+    centroids = parser();
+  }
+  double seconds = (microsec_clock::universal_time() - start)
+    .total_microseconds() * 1e-6;
+  return fileSize * double(repetitions) / (1024.0 * 1024.0) / seconds;
+}
+
+struct IostreamParser
+{
+  ProgramOptions & options_;
+  IostreamParser(ProgramOptions & options) : options_(options) {}
+  std::vector<Centroid> operator()() const { return parseFile(options_); }
+};
+
+struct FastParser
+{
+  ProgramOptions & options_;
+  std::size_t numChunks_;
+  FastParser(ProgramOptions & options, std::size_t numChunks) 
+    : options_(options), numChunks_(numChunks) {}
+  std::vector<Centroid> operator()() const 
+  { 
+    return parseFileFast(options_, numChunks_); 
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  namespace po = boost::program_options;
+  ProgramOptions options;
+  options.mzWindowLow_ = -std::numeric_limits<double>::max();
+  options.mzWindowHigh_ = std::numeric_limits<double>::max();
+  options.snWindowLow_ = -std::numeric_limits<double>::max();
+  options.snWindowHigh_ = std::numeric_limits<double>::max();
+  unsigned int repetitions, maxChunks;
+
+  po::options_description visible("Allowed options");
+  visible.add_options()
+    ("help", "Display this help message")
+    ("inputfile,i", po::value<std::string>(&options.inputfileName_), "input file")
+    ("repetitions,r", po::value<unsigned int>(&repetitions)->default_value(5),
+      "number of times each parser reads the file")
+    ("chunks,c", po::value<unsigned int>(&maxChunks)->default_value(
+      static_cast<unsigned int>(fastparse::defaultNumChunks())),
+      "maximum number of chunks for the fast parser")
+    ;
+  po::positional_options_description p;
+  p.add("inputfile", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(
+    visible).positional(p).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help") || !vm.count("inputfile")) {
+    std::cout << visible << "\n";
+    return vm.count("help") ? 0 : -1;
+  }
+  std::size_t fileSize = fastparse::MappedText(options.inputfileName_).size();
+  if (repetitions == 0) repetitions = 1;
+
+  std::vector<Centroid> reference, centroids;
+  std::cout << "parser\tchunks\tMB/s" << std::endl;
+  std::cout << "iostream\t1\t" << throughput(IostreamParser(options), 
+    fileSize, repetitions, reference) << std::endl;
+  int status = 0;
+  for (unsigned int chunks = 1; chunks <= std::max(maxChunks, 1u); chunks *= 2) {
+    std::cout << "fast\t" << chunks << "\t" << throughput(
+      FastParser(options, chunks), fileSize, repetitions, centroids);
+    if (!equal(reference, centroids)) {
+      std::cout << "\tMISMATCH";
+      status = 1;
+    }
+    std::cout << std::endl;
+  }
+  std::cout << reference.size() << " centroids, " << fileSize 
+    << " bytes" << std::endl;
+  return status;
+}
@@ -0,0 +1,131 @@
+/* $Id: benchmark-sweep.cpp 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+#include "example-xic-construction.h"
+
+/*
+ * Time SetA::intersect on the boxes of example-xic-construction with the
+ * segment trees (HybridScanner) and the sweep-and-prune engine (see 
+ * fbi::IntersectOptions::engine_), on the mz dimension alone, the scan 
+ * number dimension alone and both. Use the centroid files of 
+ * test/testdata.zip as input.
+ */
+
+template <class Set>
+double timeIntersect(const std::vector<Centroid> & centroids, 
+  const fbi::IntersectOptions & options, const BoxGenerator & boxes,
+  unsigned int repetitions, typename Set::ResultType & result)
+{
+  using namespace boost::posix_time;
+  ptime start = microsec_clock::universal_time();
+  for (unsigned int i = 0; i < repetitions; ++i) {
+    result = Set::intersect(options, centroids, boxes, boxes);
+  }
+  return (microsec_clock::universal_time() - start)
+    .total_microseconds() * 1e-6 / repetitions;
+}
+
+template <class Set>
+int compareEngines(const char * name, const std::vector<Centroid> & centroids,
+  const BoxGenerator & boxes, unsigned int repetitions)
+{
+  fbi::IntersectOptions intersectOptions;
+  intersectOptions.engine_ = fbi::IntersectOptions::ENGINE_SEGMENT_TREE;
+  typename Set::ResultType reference, result;
+  const double baseline = timeIntersect<Set>(centroids, intersectOptions, 
+    boxes, repetitions, reference);
+  intersectOptions.engine_ = fbi::IntersectOptions::ENGINE_SWEEP;
+  const double seconds = timeIntersect<Set>(centroids, intersectOptions, 
+    boxes, repetitions, result);
+  std::cout << name << "\t" << baseline << "\t" << seconds << "\t" 
+    << baseline / seconds;
+  if (result != reference) {
+    std::cout << "\tMISMATCH";
+  }
+  std::cout << std::endl;
+  return result != reference ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+  namespace po = boost::program_options;
+  ProgramOptions options;
+  options.mzWindowLow_ = -std::numeric_limits<double>::max();
+  options.mzWindowHigh_ = std::numeric_limits<double>::max();
+  options.snWindowLow_ = -std::numeric_limits<double>::max();
+  options.snWindowHigh_ = std::numeric_limits<double>::max();
+  unsigned int repetitions;
+  double ppm, snWindow;
+
+  po::options_description visible("Allowed options");
+  visible.add_options()
+    ("help", "Display this help message")
+    ("inputfile,i", po::value<std::string>(&options.inputfileName_), "input file")
+    ("repetitions,r", po::value<unsigned int>(&repetitions)->default_value(3),
+      "number of runs per configuration")
+    ("ppm", po::value<double>(&ppm)->default_value(10.0), 
+      "mz window in ppm")
+    ("sn", po::value<double>(&snWindow)->default_value(2.0), 
+      "scan number window")
+    ;
+  po::positional_options_description p;
+  p.add("inputfile", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(
+    visible).positional(p).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help") || !vm.count("inputfile")) {
+    std::cout << visible << "\n";
+    return vm.count("help") ? 0 : -1;
+  }
+  if (repetitions == 0) repetitions = 1;
+  std::vector<Centroid> centroids = parseFileFast(options);
+  std::cout << centroids.size() << " centroids" << std::endl;
+  const BoxGenerator boxes(ppm, snWindow);
+
+  std::cout << "dimensions\tsegment-tree\tsweep\tspeedup" << std::endl;
+  int status = 0;
+  status |= compareEngines<fbi::SetA<Centroid, 1> >("mz", centroids, 
+    boxes, repetitions);
+  status |= compareEngines<fbi::SetA<Centroid, 2> >("sn", centroids, 
+    boxes, repetitions);
+  status |= compareEngines<fbi::SetA<Centroid, 1, 2> >("mz,sn", centroids, 
+    boxes, repetitions);
+  return status;
+}
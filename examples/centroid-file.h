@@ -0,0 +1,352 @@
+/* $Id: centroid-file.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __LIBFBI_EXAMPLES_CENTROIDFILE_H__
+#define __LIBFBI_EXAMPLES_CENTROIDFILE_H__
+
+/*
+ * A columnar binary format for centroids and a memory-mapped container that
+ * can be passed to SetA::intersect without building a std::vector<Centroid>.
+ *
+ * Layout (native byte order):
+ *   Header                  magic, version, byte order mark, #columns, #rows
+ *   ColumnDescriptor[n]     name, value type, encoding, offset and size
+ *   column data             every column starts at a 64 byte boundary
+ *
+ * Plain columns are used in place from the mapped file. Run-length encoded
+ * columns (pairs of value and run length) are decoded into memory once when
+ * the file is opened; the retention time column compresses very well as all
+ * centroids of a spectrum share the same value.
+ */
+
+#include <stdint.h>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <iterator>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "example-xic-construction.h"
+
+namespace centroidfile {
+
+enum ValueType { Float64 = 1, Float32 = 2 };
+enum Encoding { Plain = 0, RunLength = 1 };
+enum Columns { RtColumn = 0, MzColumn, SnColumn, AbundanceColumn, NumColumns };
+
+const char magic[8] = {'F', 'B', 'I', 'C', 'E', 'N', 'T', '\0'};
+const uint32_t version = 1;
+const uint32_t byteOrderMark = 0x01020304;
+const uint64_t alignment = 64;
+
+struct Header
+{
+  char magic_[8];
+  uint32_t version_;
+  uint32_t byteOrderMark_;
+  uint32_t numColumns_;
+  uint32_t reserved_;
+  uint64_t numRows_;
+};
+
+struct ColumnDescriptor
+{
+  char name_[16];
+  uint32_t valueType_;
+  uint32_t encoding_;
+  uint64_t offset_;
+  uint64_t size_;
+};
+
+const char * const columnNames[NumColumns] = {"rt", "mz", "sn", "abundance"};
+
+inline uint64_t align(uint64_t offset)
+{
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * encode a column as (value, run length) pairs
+ */
+inline std::vector<char> runLengthEncode(const std::vector<double> & values)
+{
+  std::vector<char> bytes;
+  std::size_t i = 0;
+  while (i < values.size()) {
+    uint64_t run = 1;
+    while (i + run < values.size() && values[i + run] == values[i]) ++run;
+    const char * value = reinterpret_cast<const char *>(&values[i]);
+    const char * length = reinterpret_cast<const char *>(&run);
+    bytes.insert(bytes.end(), value, value + sizeof(double));
+    bytes.insert(bytes.end(), length, length + sizeof(uint64_t));
+    i += run;
+  }
+  return bytes;
+}
+
+/*
+ * Write centroids into a binary centroid file. If compress is set, every
+ * column for which run-length encoding saves space is stored encoded.
+ */
+inline void write(const std::string & filename, 
+  const std::vector<Centroid> & centroids, bool compress)
+{
+  std::vector<std::vector<double> > values(NumColumns, 
+    std::vector<double>(centroids.size()));
+  for (std::size_t i = 0; i < centroids.size(); ++i) {
+    values[RtColumn][i] = centroids[i].rt_;
+    values[MzColumn][i] = centroids[i].mz_;
+    values[SnColumn][i] = centroids[i].sn_;
+    values[AbundanceColumn][i] = centroids[i].abundance_;
+  }
+
+  Header header;
+  std::memcpy(header.magic_, magic, sizeof(magic));
+  header.version_ = version;
+  header.byteOrderMark_ = byteOrderMark;
+  header.numColumns_ = NumColumns;
+  header.reserved_ = 0;
+  header.numRows_ = centroids.size();
+
+  std::vector<ColumnDescriptor> descriptors(NumColumns);
+  std::vector<std::vector<char> > data(NumColumns);
+  uint64_t offset = align(sizeof(Header) + NumColumns * sizeof(ColumnDescriptor));
+  for (std::size_t c = 0; c < NumColumns; ++c) {
+    ColumnDescriptor & d = descriptors[c];
+    std::memset(d.name_, 0, sizeof(d.name_));
+    std::strncpy(d.name_, columnNames[c], sizeof(d.name_) - 1);
+    d.valueType_ = Float64;
+    d.encoding_ = Plain;
+    const char * raw = reinterpret_cast<const char *>(values[c].data());
+    data[c].assign(raw, raw + values[c].size() * sizeof(double));
+    if (compress) {
+      std::vector<char> encoded = runLengthEncode(values[c]);
+      if (encoded.size() < data[c].size()) {
+        d.encoding_ = RunLength;
+        data[c].swap(encoded);
+      }
+    }
+    d.offset_ = offset;
+    d.size_ = data[c].size();
+    offset = align(offset + d.size_);
+  }
+
+  std::ofstream ofs(filename.c_str(), std::ios::binary);
+  ofs.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+  ofs.write(reinterpret_cast<const char *>(&descriptors[0]), 
+    NumColumns * sizeof(ColumnDescriptor));
+  uint64_t position = sizeof(Header) + NumColumns * sizeof(ColumnDescriptor);
+  const char padding[alignment] = {0};
+  for (std::size_t c = 0; c < NumColumns; ++c) {
+    ofs.write(padding, descriptors[c].offset_ - position);
+    ofs.write(data[c].data(), data[c].size());
+    position = descriptors[c].offset_ + data[c].size();
+  }
+  if (!ofs) {
+    throw std::runtime_error("could not write centroid file " + filename);
+  }
+}
+
+/*
+ * return true if the file starts with the binary centroid file magic
+ */
+inline bool isCentroidFile(const std::string & filename)
+{
+  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  char buffer[sizeof(magic)];
+  return ifs.read(buffer, sizeof(buffer)) && 
+    std::memcmp(buffer, magic, sizeof(magic)) == 0;
+}
+
+/*
+ * Read-only, memory-mapped view of a binary centroid file. The container
+ * offers size(), empty(), operator[] and a const_iterator; dereferencing
+ * assembles a Centroid from the columns on the fly.
+ */
+class MappedCentroids
+{
+ public:
+  typedef Centroid value_type;
+  typedef std::size_t size_type;
+
+  class const_iterator
+  {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Centroid value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Centroid * pointer;
+    typedef Centroid reference;
+
+    const_iterator() : container_(0), index_(0) {}
+    const_iterator(const MappedCentroids * container, std::size_t index)
+      : container_(container), index_(index) {}
+    Centroid operator*() const { return (*container_)[index_]; }
+    const_iterator & operator++() { ++index_; return *this; }
+    const_iterator operator++(int) { 
+      const_iterator it(*this);
+      ++index_; 
+      return it; 
+    }
+    bool operator==(const const_iterator & rhs) const { 
+      return index_ == rhs.index_; 
+    }
+    bool operator!=(const const_iterator & rhs) const { 
+      return index_ != rhs.index_; 
+    }
+   private:
+    const MappedCentroids * container_;
+    std::size_t index_;
+  };
+
+  explicit MappedCentroids(const std::string & filename)
+    : file_(filename), size_(0)
+  {
+    if (file_.size() < sizeof(Header)) {
+      throw std::runtime_error("truncated centroid file " + filename);
+    }
+    Header header;
+    std::memcpy(&header, file_.data(), sizeof(Header));
+    if (std::memcmp(header.magic_, magic, sizeof(magic)) != 0 ||
+      header.version_ != version || header.byteOrderMark_ != byteOrderMark) {
+      throw std::runtime_error("not a centroid file: " + filename);
+    }
+    size_ = static_cast<std::size_t>(header.numRows_);
+    std::vector<ColumnDescriptor> descriptors(header.numColumns_);
+    if (file_.size() < sizeof(Header) + 
+      header.numColumns_ * sizeof(ColumnDescriptor)) {
+      throw std::runtime_error("truncated centroid file " + filename);
+    }
+    std::memcpy(&descriptors[0], file_.data() + sizeof(Header), 
+      header.numColumns_ * sizeof(ColumnDescriptor));
+    for (std::size_t c = 0; c < NumColumns; ++c) {
+      bool found = false;
+      for (std::size_t d = 0; d < descriptors.size() && !found; ++d) {
+        if (std::strncmp(descriptors[d].name_, columnNames[c], 
+          sizeof(descriptors[d].name_)) == 0) {
+          columns_[c] = openColumn(descriptors[d], decoded_[c]);
+          found = true;
+        }
+      }
+      if (!found) {
+        throw std::runtime_error(std::string("missing column ") + 
+          columnNames[c] + " in " + filename);
+      }
+    }
+  }
+
+  size_type size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  Centroid operator[](std::size_t i) const
+  {
+    return Centroid(columns_[RtColumn].at(i), columns_[MzColumn].at(i),
+      columns_[SnColumn].at(i), columns_[AbundanceColumn].at(i));
+  }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size_); }
+
+ private:
+  /* typed view on a column, either in the mapped file or decoded */
+  struct Column
+  {
+    const char * data_;
+    uint32_t valueType_;
+    Column() : data_(0), valueType_(Float64) {}
+    double at(std::size_t i) const 
+    {
+      if (valueType_ == Float64) {
+        return reinterpret_cast<const double *>(data_)[i];
+      }
+      return reinterpret_cast<const float *>(data_)[i];
+    }
+  };
+
+  Column openColumn(const ColumnDescriptor & d, std::vector<double> & decoded)
+  {
+    if (d.offset_ + d.size_ > file_.size() || d.offset_ % alignment != 0) {
+      throw std::runtime_error("corrupt column in centroid file");
+    }
+    Column column;
+    column.valueType_ = d.valueType_;
+    column.data_ = file_.data() + d.offset_;
+    if (d.valueType_ != Float64 && d.valueType_ != Float32) {
+      throw std::runtime_error("unknown value type in centroid file");
+    }
+    const std::size_t width = 
+      d.valueType_ == Float64 ? sizeof(double) : sizeof(float);
+    if (d.encoding_ == Plain) {
+      if (d.size_ != size_ * width) {
+        throw std::runtime_error("corrupt column in centroid file");
+      }
+      return column;
+    }
+    if (d.encoding_ != RunLength) {
+      throw std::runtime_error("unknown encoding in centroid file");
+    }
+    // decode (value, run length) pairs into memory
+    const std::size_t pairSize = width + sizeof(uint64_t);
+    decoded.reserve(size_);
+    for (uint64_t p = 0; p + pairSize <= d.size_; p += pairSize) {
+      double value;
+      if (d.valueType_ == Float64) {
+        std::memcpy(&value, column.data_, sizeof(double));
+      } else {
+        float f;
+        std::memcpy(&f, column.data_, sizeof(float));
+        value = f;
+      }
+      uint64_t run;
+      std::memcpy(&run, column.data_ + width, sizeof(uint64_t));
+      decoded.insert(decoded.end(), run, value);
+      column.data_ += pairSize;
+    }
+    if (decoded.size() != size_) {
+      throw std::runtime_error("corrupt column in centroid file");
+    }
+    column.data_ = reinterpret_cast<const char *>(decoded.data());
+    column.valueType_ = Float64;
+    return column;
+  }
+
+  /* columns may point into decoded_, hence no copies */
+  MappedCentroids(const MappedCentroids &);
+  MappedCentroids & operator=(const MappedCentroids &);
+
+  boost::iostreams::mapped_file_source file_;
+  std::size_t size_;
+  Column columns_[NumColumns];
+  std::vector<double> decoded_[NumColumns];
+};
+
+} //end namespace centroidfile
+
+#endif
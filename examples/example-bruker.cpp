@@ -29,23 +29,19 @@ int main(int argc, char * argv[]) {
   if (!parseProgramOptions(argc, argv, options)) {
     return 0;
   }
-  typedef SetA<Centroid,1,0 > SetType;
-  typedef SetType::ResultType ResultType;
+  typedef SlabPipeline<Centroid,1,0 > PipelineType;
+  typedef PipelineType::ResultType ResultType;
   typedef unsigned int LabelType;
 
   ptime start = microsec_clock::universal_time();
   
-  SNSplitter<SetType, LabelType> splitter(options);
+  SNSplitter<PipelineType, LabelType> splitter(options);
 
   CentroidBoxGenerator gen(10,1);
-  ResultType test = std::vector<std::vector<unsigned int> >();
-  boost::function<ResultType(std::deque<Centroid>)> boostFunctor =
-  boost::bind(
-  &SetType::intersect<const std::deque<Centroid>&,const CentroidBoxGenerator&, const CentroidBoxGenerator&>
-  , _1, gen, gen);
   
   std::cout << "Looking for overlaps" << std::endl;
-  ResultType fullAdjList = splitter.findOverlaps(boostFunctor);
+  std::vector<Centroid> centroids;
+  ResultType fullAdjList = splitter.findOverlaps(gen, centroids);
   ptime end = microsec_clock::universal_time();
   time_duration td = end - start;
   std::cout << "elapsed time in seconds: " 
@@ -53,22 +49,13 @@ int main(int argc, char * argv[]) {
     << std::endl;
   std::cout << "finding connected components... ";
   std::vector<LabelType> labels;
-  unsigned int nComponents = findConnectedComponents(fullAdjList, labels);
+  unsigned int nComponents = findConnectedComponentsParallel(fullAdjList, labels);
   fullAdjList.clear();
   ResultType().swap(fullAdjList);
 
-  std::cout << "Rereading centroids file" << std::endl;
-  std::vector<Centroid> centroids;
-  std::ifstream ifs(options.inputfileName_);
-  std::string str;
-  while (std::getline(ifs, str)) {
-    parseString(str, centroids, 0);
-  }
-  ifs.close();
-
   std::vector<unsigned int> counter(nComponents);
   std::cout << "Creating Xics" << std::endl;
-  std::vector<Xic> xics = createXicVector(centroids.begin(), centroids.end(), labels.begin(), labels.end(), counter);
+  std::vector<Xic> xics = createXicVector(centroids, labels, counter);
 
   std::ofstream ofs(options.outputfileName_.c_str());
 
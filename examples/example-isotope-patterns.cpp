@@ -32,6 +32,8 @@
 #include "fbi/tuplegenerator.h"
 #include "fbi/fbi.h"
 #include "fbi/connectedcomponents.h"
+#include "fbi/cluster.h"
+#include "fbi/shiftedjoin.h"
 
 #include "example-isotope-patterns.h"
 #include "example-xic-construction-opts.h"
@@ -46,61 +48,47 @@ int main(int argc, char* argv[])
     return 0;
   }
 
-  std::vector<Centroid> centroids = parseFile(options);
+  std::vector<Centroid> centroids = parseFileFast(options);
 
 
+  // cluster the centroids into xics without storing the intersections
   ptime start = microsec_clock::universal_time();
-  SetA<Centroid,1,2>::ResultType centroidResults = SetA<Centroid, 1, 2>::
-      intersect(centroids, BoxGenerator(2, 2.1), BoxGenerator(2, 2.1));
+  typedef Clustering<Centroid, 1, 2> CentroidClustering;
+  typedef CentroidClustering::IntType LabelType;
+  std::vector<LabelType> labels;
+  std::vector<std::tuple<double, double, double> > summaries = 
+    CentroidClustering::cluster(labels, centroids, 
+      reducers(mean(member(&Centroid::mz_)), mean(member(&Centroid::rt_)),
+        sum(member(&Centroid::abundance_))),
+      BoxGenerator(2, 2.1), BoxGenerator(2, 2.1));
   ptime end = microsec_clock::universal_time();
   time_duration td = end - start;
 
   std::cout << "elapsed time in seconds: " 
     << td.total_seconds()
     << std::endl;
+  std::cout << summaries.size() << " components found." << std::endl;
 
-  std::cout << "finding connected components... ";
-  typedef SetA<Centroid, 1, 2>::IntType LabelType;
-  std::vector<LabelType> labels;
-  LabelType nComponents = findConnectedComponents(centroidResults, labels); 
-  std::cout << nComponents << " components found." << std::endl;
-
-  typedef std::vector<std::vector<LabelType> > VecVec;
-  VecVec groups(nComponents);
-  typedef std::vector<LabelType>::iterator IT;
-  LabelType k = 0;
-  for (IT i = labels.begin(); i != labels.end(); ++i, ++k) {
-    groups[*i-1].push_back(k);
-  }
-  std::vector<Xic> xics;
-  typedef VecVec::iterator VIT;
-  for (VIT i = groups.begin(); i != groups.end(); ++i) {
-    Xic xic;
-    for (IT j = i->begin(); j != i->end(); ++j) {
-      xic.mz_ += centroids[*j].mz_;
-      xic.rt_ += centroids[*j].rt_;
-      xic.abundance_ += centroids[*j].abundance_;
-    }
-    double n = static_cast<double>(i->size());
-    xic.mz_ /= n;
-    xic.rt_ /= n;
-    xics.push_back(xic);
+  std::vector<Xic> xics(summaries.size());
+  for (std::size_t i = 0; i < summaries.size(); ++i) {
+    xics[i].mz_ = std::get<0>(summaries[i]);
+    xics[i].rt_ = std::get<1>(summaries[i]);
+    xics[i].abundance_ = std::get<2>(summaries[i]);
   }
 
-  std::vector<XicBoxGenerator> boxGenerators;
+  // search for isotope pattern candidates: every isotope shift is a
+  // translation of the same xic boxes in m/z
+  typedef ShiftedJoin<Xic, 0, 1> XicJoin;
+  std::vector<XicJoin::offset_type> shifts;
   for (double i = 0.0; i < 4; i = i + 1) {
-    boxGenerators.push_back(XicBoxGenerator(i/3., 2, 0.0, 12.0));
+    shifts.push_back(XicJoin::offset_type(i/3., 0.0));
   }
 
-
-
-  // search for isotope pattern candidates
-  typedef SetA<Xic, 0, 1> XicSet;
-  
   start = microsec_clock::universal_time();
-  
-  XicSet::ResultType xicResults = XicSet::
-    intersect(xics, XicBoxGenerator(0.0,2,0.0,12.0), boxGenerators);
+
+  const XicBoxGenerator xicBoxes(0.0, 2, 0.0, 12.0);
+  XicJoin::ResultType shiftedResults = 
+    XicJoin::intersect(xics, xicBoxes, xicBoxes, shifts);
 
   end = microsec_clock::universal_time();
   td = end - start;
@@ -108,10 +96,24 @@ int main(int argc, char* argv[])
   std::cout << "elapsed time in seconds: "
     << td.total_seconds()<< std::endl;
 
+  std::vector<std::size_t> pairsPerShift(shifts.size(), 0);
+  for (std::size_t i = 0; i < shiftedResults.size(); ++i) {
+    for (std::size_t j = 0; j < shiftedResults[i].size(); ++j) {
+      ++pairsPerShift[shiftedResults[i][j].second];
+    }
+  }
+  for (std::size_t k = 0; k < shifts.size(); ++k) {
+    std::cout << "m/z shift " << std::get<0>(shifts[k]) << ": " 
+      << pairsPerShift[k] << " pairs" << std::endl;
+  }
+  typedef SetA<Xic, 0, 1> XicSet;
+  XicSet::ResultType xicResults = XicJoin::toAdjacencyList(shiftedResults);
+  XicJoin::ResultType().swap(shiftedResults);
+
   std::cout << "finding connected components...";
   typedef XicSet::IntType IsotopeLabelType;
   std::vector<IsotopeLabelType> isotopeLabels;
-  IsotopeLabelType nIsotopePatterns = findConnectedComponents(xicResults, isotopeLabels); 
+  IsotopeLabelType nIsotopePatterns = findConnectedComponentsParallel(xicResults, isotopeLabels); 
   std::cout << nIsotopePatterns << " components found." << std::endl;
 
   std::ofstream ofs(options.outputfileName_.c_str());
@@ -38,6 +38,8 @@
 #include "fbi/tuplegenerator.h"
 #include "fbi/fbi.h"
 #include "fbi/connectedcomponents.h"
+#include "fbi/nearest.h"
+#include "fast-parser.h"
 
 /*
  * User classes
@@ -139,6 +141,50 @@ MS2ScanBoxGenerator::get<1>(const MS2Scan & ms2scan) const
   return std::make_pair(ms2scan.rt_ - rtWindow_, ms2scan.rt_ + rtWindow_);
 }
 
+/*
+ * distance between a XIC and a precursor: the m/z distance, infinite if the
+ * boxes of XicBoxGenerator and MS2ScanBoxGenerator would not intersect.
+ */
+struct PrecursorMetric
+{
+  template <std::size_t N>
+  double get(const std::pair<double, double> & xic, 
+    const std::pair<double, double> & ms2scan) const;
+
+  double fullScanPpm_;
+  double preScanPpm_;
+  double rtWindow_;
+
+  PrecursorMetric(double fullScanPpm, double preScanPpm, double rtWindow)
+    : fullScanPpm_(fullScanPpm), preScanPpm_(preScanPpm), 
+      rtWindow_(rtWindow)
+  {}
+};
+
+template <>
+double
+PrecursorMetric::get<0>(const std::pair<double, double> & xic, 
+  const std::pair<double, double> & ms2scan) const
+{
+  bool overlap = 
+    xic.first * (1 - fullScanPpm_ * 1E-6) < 
+      ms2scan.second * (1 + preScanPpm_ * 1E-6) &&
+    ms2scan.first * (1 - preScanPpm_ * 1E-6) < 
+      xic.second * (1 + fullScanPpm_ * 1E-6);
+  return overlap ? fbi::BoxGapMetric().get<0>(xic, ms2scan) : 
+    std::numeric_limits<double>::infinity();
+}
+
+template <>
+double
+PrecursorMetric::get<1>(const std::pair<double, double> & xic, 
+  const std::pair<double, double> & ms2scan) const
+{
+  bool overlap = xic.first - rtWindow_ < ms2scan.second + rtWindow_ &&
+    ms2scan.first - rtWindow_ < xic.second + rtWindow_;
+  return overlap ? 0.0 : std::numeric_limits<double>::infinity();
+}
+
 /*
  * store and process user options
  */
@@ -248,36 +294,35 @@ int parseProgramOptions(int argc, char* argv[], ProgramOptions& options)
 /*
  * load xics from file
  */
-std::vector<Xic> parseXicFile(ProgramOptions& options)
+struct XicBuilder
 {
-  std::vector<Xic> xics;
-  std::ifstream ifs(options.xicFileName_.c_str());
-  ifs.setf(std::ios::fixed, std::ios::floatfield);
-
-  double mz, rt, abundance;
-
-  while (ifs >> rt >> mz >> abundance) {
-    xics.push_back(Xic(rt, mz, abundance));
+  void operator()(const double * f, std::vector<Xic> & xics) const
+  {
+    xics.push_back(Xic(f[0], f[1], f[2]));
   }
-  return xics;
+};
+
+std::vector<Xic> parseXicFile(ProgramOptions& options)
+{
+  return fastparse::parseFile<3, Xic>(options.xicFileName_, XicBuilder());
 }
 
 /*
  * load MS2 scans from file
  */
-std::vector<MS2Scan> parseMS2ScanFile(ProgramOptions & options)
+struct MS2ScanBuilder
 {
-  std::vector<MS2Scan> ms2scans;
-  std::ifstream ifs(options.ms2scanFileName_.c_str());
-  ifs.setf(std::ios::fixed, std::ios::floatfield);
-
-  double mz, rt;
-
-  while (ifs >> rt >> mz) {
+  void operator()(const double * f, std::vector<MS2Scan> & ms2scans) const
+  {
     MS2Scan::Ions ions;
-    ms2scans.push_back(MS2Scan(rt, mz, ions));
+    ms2scans.push_back(MS2Scan(f[0], f[1], ions));
   }
-  return ms2scans;
+};
+
+std::vector<MS2Scan> parseMS2ScanFile(ProgramOptions & options)
+{
+  return fastparse::parseFile<2, MS2Scan>(options.ms2scanFileName_, 
+    MS2ScanBuilder());
 }
 
 
@@ -298,39 +343,27 @@ int main(int argc, char* argv[])
     // std::cerr << "# ms2scans: " << ms2scans.size() << std::endl;
     
   ptime start = microsec_clock::universal_time();
-    SetA<Xic,0,1>::ResultType adjList = SetA<Xic, 0, 1>::SetB<MS2Scan, 0, 1>::intersect(
-      xics, XicBoxGenerator(options.fullscanPpm_, options.rtWindow_),
-      ms2scans, MS2ScanBoxGenerator(options.prescanPpm_, options.rtWindow_));
+    // the boxes are points, the metric applies the tolerances of the box
+    // generators and picks the precursor with the closest m/z
+    typedef Nearest<MS2Scan, 0, 1> NearestMS2Scan;
+    NearestMS2Scan::ResultType neighbors = NearestMS2Scan::find(1,
+      ms2scans, MS2ScanBoxGenerator(0.0, 0.0),
+      xics, XicBoxGenerator(0.0, 0.0),
+      PrecursorMetric(options.fullscanPpm_, options.prescanPpm_, 
+        options.rtWindow_));
 
   ptime end = microsec_clock::universal_time();
   time_duration td = end - start;
     std::cout << "fbi elapsed run time: "
       << td.total_seconds() << '\n';
 
-    // std::cerr << "size of adjecency list: " << adjList.size() << std::endl;
-
     std::ofstream ofs(options.outputFileName_.c_str());
     ofs.setf(std::ios::fixed, std::ios::floatfield);
     std::size_t nXics = xics.size();
     for (std::size_t i = 0; i < nXics; ++i) {
-        if (!adjList[i].empty()) {
-            typedef SetA<Xic,0,1>::ResultType::value_type ListType;
-            typedef ListType::const_iterator SI;
-            SI best = adjList[i].begin();
-            double bestDist = std::numeric_limits<double>::max();
-            // resolve conflict by choosing the closest m/z
-            for (SI j = adjList[i].begin(); j != adjList[i].end(); ++j) {
-                std::size_t k = *j - nXics;
-                double dist = std::abs(xics[i].mz_ - ms2scans[k].mz_);
-                // std::cerr << "d(" << xics[i].mz_ << "[" << i << "]," 
-                //   << ms2scans[k].mz_ << "[" << k << "]) = " << dist << std::endl;
-                if (dist < bestDist) {
-                    best = j;
-                    bestDist = dist;
-                }
-            }
+        if (!neighbors[i].empty()) {
             // print the pair (current precursor -> new precursor)
-            std::size_t k = *best - nXics;
+            std::size_t k = neighbors[i].front().first;
             ofs << xics[i].mz_ << '\t' << xics[i].rt_
               << "\t->\t" << ms2scans[k].mz_ << '\t' << ms2scans[k].rt_ << '\n';
        }
@@ -33,43 +33,56 @@
 #include "fbi/tuplegenerator.h"
 #include "fbi/fbi.h"
 #include "fbi/connectedcomponents.h"
+#include "fbi/cluster.h"
 
 #include "example-xic-construction.h"
 #include "example-xic-construction-opts.h"
+#include "centroid-file.h"
 
-int main(int argc, char* argv[])
+template <class CentroidContainer>
+void findXics(const CentroidContainer & centroids, ProgramOptions & options)
 {
   using namespace fbi;
   using namespace boost::posix_time;
 
-  ProgramOptions options;
-  if (!parseProgramOptions(argc, argv, options)) {
-    return 0;
-  }
-
-  std::vector<Centroid> centroids = parseFile(options);
-
+  // the intersections are only needed for the labels, don't store them
+  typedef Clustering<Centroid, 1, 2>::IntType LabelType;
+  std::vector<LabelType> labels;
   ptime start = microsec_clock::universal_time();
-  SetA<Centroid, 1, 2>::ResultType results = SetA<Centroid, 1, 2>::
-      intersect(centroids, BoxGenerator(2, 2.1), BoxGenerator(2, 2.1));
+  Clustering<Centroid, 1, 2>::label(labels, 
+      centroids, BoxGenerator(2, 2.1), BoxGenerator(2, 2.1));
   ptime end = microsec_clock::universal_time();
 
   time_duration td = end - start;
   std::cout << centroids.size() << "\t" << td.total_seconds()
     << std::endl;
 
-  typedef SetA<Centroid, 1, 2>::IntType LabelType;
-  std::vector<LabelType> labels;
-  findConnectedComponents(results, labels); 
-
   std::ofstream ofs(options.outputfileName_.c_str());
   ofs.setf(std::ios::fixed, std::ios::floatfield);
   for (size_t i = 0;i < centroids.size();++i) {
-    Centroid& c = centroids[i];
+    const Centroid c = centroids[i];
     ofs << c.rt_ << "\t" << c.mz_ << "\t" << c.sn_ << "\t" 
       << c.abundance_ << "\t" << labels[i] << "\n";
   }
-  return 0;
 }
 
+int main(int argc, char* argv[])
+{
+  ProgramOptions options;
+  if (!parseProgramOptions(argc, argv, options)) {
+    return 0;
+  }
 
+  // binary centroid files are used in place, see convert-centroids; only
+  // the centroids inside the mz and sn windows are used, like for text files
+  if (centroidfile::isCentroidFile(options.inputfileName_)) {
+    centroidfile::MappedCentroids mapped(options.inputfileName_);
+    WindowedCentroids<centroidfile::MappedCentroids> centroids(mapped, 
+      options);
+    findXics(centroids, options);
+  } else {
+    std::vector<Centroid> centroids = parseFileFast(options);
+    findXics(centroids, options);
+  }
+  return 0;
+}
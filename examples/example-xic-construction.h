@@ -27,10 +27,13 @@
 #ifndef __LIBFBI_EXAMPLES_EXAMPLEXICCONSTRUCTION_H__
 #define __LIBFBI_EXAMPLES_EXAMPLEXICCONSTRUCTION_H__
 
+#include <iterator>
 #include <utility>
+#include <vector>
 #include "fbi/tuple.h"
 #include "fbi/fbi.h"
 #include "fbi/tuplegenerator.h"
+#include "fast-parser.h"
 
 struct ProgramOptions 
 {
@@ -104,6 +107,16 @@ BoxGenerator::get<2>(const Centroid & centroid) const
     snOffset_ + centroid.sn_ + snWindow_ + 0.3 );
 }
 
+/*
+ * true if a centroid lies inside the mz and sn windows of the options
+ */
+inline bool inWindow(const ProgramOptions & options, const double mz, 
+  const double sn)
+{
+  return mz >= options.mzWindowLow_ && mz <= options.mzWindowHigh_ &&
+    sn >= options.snWindowLow_ && sn <= options.snWindowHigh_;
+}
+
 std::vector<Centroid> parseFile(ProgramOptions & options)
 {
   std::vector<Centroid> centroids;
@@ -114,14 +127,109 @@ std::vector<Centroid> parseFile(ProgramOptions & options)
 
   while (ifs >> rt >> mz >> sn >> abundance)
   {
-    if (mz >=options.mzWindowLow_ && mz <= options.mzWindowHigh_ &&
-      sn >= options.snWindowLow_ && sn <= options.snWindowHigh_) {
+    if (inWindow(options, mz, sn)) {
         centroids.insert(centroids.end(), Centroid(rt, mz, sn, abundance));
     }
   }
   return centroids;
 }
 
+/*
+ * Turns the columns of a centroid file into Centroids, applying the same
+ * mz and sn windows as parseFile
+ */
+struct CentroidBuilder
+{
+  const ProgramOptions & options_;
+  CentroidBuilder(const ProgramOptions & options) : options_(options) {}
+  void operator()(const double * f, std::vector<Centroid> & centroids) const
+  {
+    const double & mz = f[1];
+    const double & sn = f[2];
+    if (inWindow(options_, mz, sn)) {
+        centroids.push_back(Centroid(f[0], mz, sn, f[3]));
+    }
+  }
+};
+
+/*
+ * Memory mapped version of parseFile, see fast-parser.h
+ */
+std::vector<Centroid> parseFileFast(const ProgramOptions & options,
+  std::size_t numChunks = fastparse::defaultNumChunks())
+{
+  return fastparse::parseFile<4, Centroid>(options.inputfileName_, 
+    CentroidBuilder(options), numChunks);
+}
+
+/*
+ * Read-only view of the centroids of a container that lie inside the mz 
+ * and sn windows, i.e. the ones parseFile keeps. Only the indices of these
+ * centroids are stored, the container (e.g. a memory-mapped binary 
+ * centroid file) is used in place. Offers the same interface as 
+ * centroidfile::MappedCentroids.
+ */
+template <class Container>
+class WindowedCentroids
+{
+ public:
+  typedef Centroid value_type;
+  typedef std::size_t size_type;
+
+  class const_iterator
+  {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Centroid value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Centroid * pointer;
+    typedef Centroid reference;
+
+    const_iterator() : view_(0), index_(0) {}
+    const_iterator(const WindowedCentroids * view, std::size_t index)
+      : view_(view), index_(index) {}
+    Centroid operator*() const { return (*view_)[index_]; }
+    const_iterator & operator++() { ++index_; return *this; }
+    const_iterator operator++(int) { 
+      const_iterator it(*this);
+      ++index_; 
+      return it; 
+    }
+    bool operator==(const const_iterator & rhs) const { 
+      return index_ == rhs.index_; 
+    }
+    bool operator!=(const const_iterator & rhs) const { 
+      return index_ != rhs.index_; 
+    }
+   private:
+    const WindowedCentroids * view_;
+    std::size_t index_;
+  };
+
+  WindowedCentroids(const Container & container, 
+    const ProgramOptions & options)
+    : container_(container)
+  {
+    for (std::size_t i = 0; i < container.size(); ++i) {
+      const Centroid c = container[i];
+      if (inWindow(options, c.mz_, c.sn_)) indices_.push_back(i);
+    }
+  }
+
+  size_type size() const { return indices_.size(); }
+  bool empty() const { return indices_.empty(); }
+  Centroid operator[](std::size_t i) const 
+  { 
+    return container_[indices_[i]]; 
+  }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+
+ private:
+  const Container & container_;
+  std::vector<std::size_t> indices_;
+};
+
 
 
 
@@ -0,0 +1,349 @@
+/* $Id: fast-parser.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __LIBFBI_EXAMPLES_FASTPARSER_H__
+#define __LIBFBI_EXAMPLES_FASTPARSER_H__
+
+/*
+ * Fast readers for the text formats used by the examples. The file is mapped
+ * into memory, cut into chunks at line boundaries (parsed concurrently if
+ * libfbi multithreading is enabled) and every line is scanned once.
+ *
+ * Lines are found with memchr, which libc implements with vector
+ * instructions. Numbers are converted with the classic fast path: if all
+ * significant digits fit into the mantissa and the power of ten is exactly
+ * representable, a single multiplication or division gives the correctly
+ * rounded result. Everything else falls back to strtod/strtof, so the results
+ * are bit-identical to the iostream and sscanf based readers.
+ *
+ * Unlike operator>>, records must not span several lines.
+ */
+
+#include <stdint.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <fbi/config.h>
+#ifdef __LIBFBI_USE_MULTITHREADING__
+#include <functional>
+#include <thread>
+#endif
+
+namespace fastparse {
+
+/*
+ * read-only view of a whole file, empty if the file cannot be mapped
+ */
+class MappedText
+{
+ public:
+  explicit MappedText(const std::string & filename) : begin_(0), end_(0)
+  {
+    try {
+      file_.open(filename);
+      begin_ = file_.data();
+      end_ = begin_ + file_.size();
+    } catch (const std::exception &) {
+      // missing or empty files yield no records, just like an ifstream
+    }
+  }
+  const char * begin() const { return begin_; }
+  const char * end() const { return end_; }
+  std::size_t size() const { return end_ - begin_; }
+
+ private:
+  boost::iostreams::mapped_file_source file_;
+  const char * begin_;
+  const char * end_;
+};
+
+template <typename T> struct FastPath;
+
+template <> struct FastPath<double>
+{
+  enum { maxExponent = 22 };
+  static const uint64_t maxMantissa = (uint64_t(1) << 53);
+  static double power(int e)
+  {
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 
+      1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+      1e20, 1e21, 1e22};
+    return powers[e];
+  }
+  static double convert(const char * str) { return std::strtod(str, 0); }
+};
+
+template <> struct FastPath<float>
+{
+  enum { maxExponent = 10 };
+  static const uint64_t maxMantissa = (uint64_t(1) << 24);
+  static float power(int e)
+  {
+    static const float powers[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 
+      1e7f, 1e8f, 1e9f, 1e10f};
+    return powers[e];
+  }
+  static float convert(const char * str) { return std::strtof(str, 0); }
+};
+
+inline bool isSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool isDigit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+/*
+ * Parse a decimal number starting at p, advance p behind it.
+ * Returns false if there is no number at p.
+ */
+template <typename T>
+inline bool parseNumber(const char * & p, const char * end, T & value)
+{
+  const char * start = p;
+  bool negative = false;
+  if (p != end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    ++p;
+  }
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  bool exact = true;
+  for (; p != end && isDigit(*p); ++p) {
+    any = true;
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      if (mantissa != 0) ++digits;
+    } else {
+      ++exponent;
+      exact = exact && *p == '0';
+    }
+  }
+  if (p != end && *p == '.') {
+    for (++p; p != end && isDigit(*p); ++p) {
+      any = true;
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa != 0) ++digits;
+        --exponent;
+      } else {
+        exact = exact && *p == '0';
+      }
+    }
+  }
+  if (!any) {
+    p = start;
+    return false;
+  }
+  if (p != end && (*p == 'e' || *p == 'E')) {
+    const char * q = p + 1;
+    bool negativeExponent = false;
+    if (q != end && (*q == '-' || *q == '+')) {
+      negativeExponent = (*q == '-');
+      ++q;
+    }
+    if (q == end || !isDigit(*q)) {
+      // a dangling exponent is treated differently by strtod and scanf
+      p = start;
+      return false;
+    }
+    int e = 0;
+    for (; q != end && isDigit(*q); ++q) {
+      if (e < 100000) e = e * 10 + (*q - '0');
+    }
+    exponent += negativeExponent ? -e : e;
+    p = q;
+  }
+  if (exact && mantissa <= FastPath<T>::maxMantissa && 
+    exponent >= -FastPath<T>::maxExponent && 
+    exponent <= FastPath<T>::maxExponent) {
+    value = static_cast<T>(mantissa);
+    if (exponent < 0) value /= FastPath<T>::power(-exponent);
+    else value *= FastPath<T>::power(exponent);
+    if (negative) value = -value;
+    return true;
+  }
+  // slow path: let the C library round
+  char buffer[128];
+  std::size_t length = p - start;
+  if (length >= sizeof(buffer)) {
+    std::string token(start, p);
+    value = FastPath<T>::convert(token.c_str());
+  } else {
+    std::memcpy(buffer, start, length);
+    buffer[length] = '\0';
+    value = FastPath<T>::convert(buffer);
+  }
+  return true;
+}
+
+/* Parse an unsigned integer (like sscanf's %u) */
+inline bool parseUnsigned(const char * & p, const char * end, unsigned int & value)
+{
+  if (p == end || !isDigit(*p)) return false;
+  value = 0;
+  for (; p != end && isDigit(*p); ++p) value = value * 10 + (*p - '0');
+  return true;
+}
+
+inline const char * skipSpace(const char * p, const char * end)
+{
+  while (p != end && isSpace(*p)) ++p;
+  return p;
+}
+
+inline const char * lineEnd(const char * p, const char * end)
+{
+  const char * nl = static_cast<const char *>(std::memchr(p, '\n', end - p));
+  return nl ? nl : end;
+}
+
+/*
+ * Parse all lines of [begin, end) with N whitespace separated numbers each
+ * and hand them to builder(fields, records). Blank lines are skipped; the
+ * first malformed line stops parsing, as a failing operator>> would.
+ * Returns false if parsing stopped early.
+ */
+template <std::size_t N, class Record, class Builder>
+bool parseColumns(const char * begin, const char * end, 
+  const Builder & builder, std::vector<Record> & records)
+{
+  double fields[N];
+  while (begin != end) {
+    const char * eol = lineEnd(begin, end);
+    const char * p = skipSpace(begin, eol);
+    if (p != eol) {
+      for (std::size_t i = 0; i < N; ++i) {
+        p = skipSpace(p, eol);
+        if (!parseNumber(p, eol, fields[i]) || (p != eol && !isSpace(*p))) {
+          return false;
+        }
+      }
+      if (skipSpace(p, eol) != eol) return false;
+      builder(fields, records);
+    }
+    begin = (eol == end) ? end : eol + 1;
+  }
+  return true;
+}
+
+template <std::size_t N, class Record, class Builder>
+struct ChunkParser
+{
+  static void parse(const char * begin, const char * end,
+    const Builder & builder, std::vector<Record> & records, char & complete)
+  {
+    complete = parseColumns<N>(begin, end, builder, records);
+  }
+};
+
+/*
+ * Split [begin, end) into numChunks pieces that end at line boundaries.
+ */
+inline std::vector<const char *> 
+splitLines(const char * begin, const char * end, std::size_t numChunks)
+{
+  std::vector<const char *> bounds(1, begin);
+  const std::size_t size = end - begin;
+  for (std::size_t i = 1; i < numChunks; ++i) {
+    const char * p = begin + size / numChunks * i;
+    if (p <= bounds.back()) continue;
+    p = lineEnd(p, end);
+    if (p != end) ++p;
+    if (p > bounds.back() && p < end) bounds.push_back(p);
+  }
+  bounds.push_back(end);
+  return bounds;
+}
+
+/*
+ * one chunk per hardware thread if multithreading is enabled
+ */
+inline std::size_t defaultNumChunks()
+{
+#ifdef __LIBFBI_USE_MULTITHREADING__
+  std::size_t n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+#else
+  return 1;
+#endif
+}
+
+/*
+ * Read a file of whitespace separated records with N numbers per line.
+ * \param numChunks The file is parsed in this many pieces, concurrently if
+ * multithreading is enabled.
+ */
+template <std::size_t N, class Record, class Builder>
+std::vector<Record> parseFile(const std::string & filename, 
+  const Builder & builder, std::size_t numChunks = defaultNumChunks())
+{
+  MappedText text(filename);
+  std::vector<const char *> bounds = 
+    splitLines(text.begin(), text.end(), numChunks > 0 ? numChunks : 1);
+  const std::size_t n = bounds.size() - 1;
+  std::vector<std::vector<Record> > chunks(n);
+  // std::vector<bool> is not safe for concurrent writes
+  std::vector<char> complete(n, 0);
+#ifdef __LIBFBI_USE_MULTITHREADING__
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < n; ++i) {
+    threads.push_back(std::thread(std::bind(
+      &ChunkParser<N, Record, Builder>::parse, bounds[i], bounds[i+1],
+      std::cref(builder), std::ref(chunks[i]), 
+      std::ref(complete[i]))));
+  }
+  for (std::size_t i = 0; i < n; ++i) threads[i].join();
+#else
+  for (std::size_t i = 0; i < n; ++i) {
+    ChunkParser<N, Record, Builder>::parse(bounds[i], bounds[i+1],
+      builder, chunks[i], complete[i]);
+  }
+#endif
+  std::vector<Record> records;
+  std::size_t total = 0;
+  for (std::size_t i = 0; i < n; ++i) total += chunks[i].size();
+  records.reserve(total);
+  for (std::size_t i = 0; i < n; ++i) {
+    records.insert(records.end(), chunks[i].begin(), chunks[i].end());
+    if (!complete[i]) break;
+  }
+  return records;
+}
+
+} //end namespace fastparse
+
+#endif
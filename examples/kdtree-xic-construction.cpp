@@ -47,7 +47,7 @@ int main(int argc, char* argv[])
     return 0;
   }
 
-  std::vector<Centroid> centroids = parseFile(options);
+  std::vector<Centroid> centroids = parseFileFast(options);
 
   double mzWindowPpm = 2.0;
   double snWindow = 2.1;
@@ -1,12 +1,10 @@
 #include <boost/tokenizer.hpp>
-#include <boost/iostreams/device/file.hpp>
-#include <boost/bind.hpp>
-#include <boost/function.hpp>
 #include <vector>
-#include <deque>
 #include <fstream>
 #include <cstdio>
 #include "centroid.h"
+#include "fast-parser.h"
+#include "fbi/pipeline.h"
 #ifndef __LIBFBI_EXAMPLES_SPLITTER_H__
 #define __LIBFBI_EXAMPLES_SPLITTER_H__
 struct ProgramOptions 
@@ -105,25 +103,96 @@ parseString(const std::string & str, ContainerType & centroids, int sn, bool onl
   return numentries;
 }
 
-template <class SetType, class LabelType = unsigned int>
+/*
+ * Same as parseString, but works on the raw line without copying or
+ * tokenizing it. Lines the fast path does not understand are handed to
+ * parseString, so both produce the same centroids and diagnostics.
+ */
+template <typename ContainerType>
+unsigned int 
+parseLine(const char * begin, const char * end, ContainerType & centroids, int sn) {
+  using namespace fastparse;
+  float rt = 0, massrange_lo = 0, massrange_hi = 0;
+  unsigned int numentries = 0;
+  const char * p = skipSpace(begin, end);
+  bool ok = parseNumber(p, end, rt) && p != end && *p++ == ',' 
+    && p != end && *p != ',' && ++p != end && *p++ == ',';
+  // mode, mslevel, unknown, line
+  for (int i = 0; ok && i < 4; ++i) {
+    const char * q = p;
+    while (q != end && *q != ',') ++q;
+    ok = q != p && q - p <= 100 && q != end;
+    p = q + 1;
+  }
+  ok = ok && parseNumber(p = skipSpace(p, end), end, massrange_lo) 
+    && p != end && *p++ == '-' 
+    && parseNumber(p = skipSpace(p, end), end, massrange_hi)
+    && p != end && *p++ == ','
+    && parseUnsigned(p = skipSpace(p, end), end, numentries)
+    && p != end && *p++ == ',';
+  if (!ok) {
+    return parseString(std::string(begin, end), centroids, sn);
+  }
+  while (p != end) {
+    const char * q = p;
+    while (q != end && *q != ',') ++q;
+    if (q != p) {
+      float mz = 0;
+      unsigned int intensity = 0;
+      const char * r = skipSpace(p, q);
+      if (parseNumber(r, q, mz) && parseUnsigned(r = skipSpace(r, q), q, intensity)) {
+        centroids.push_back(Centroid(mz, sn, rt));
+      } else {
+        std::string mz_int_pair(p, q);
+        int intensity = 0;
+        if (sscanf(mz_int_pair.c_str(), "%f %u", &mz, &intensity) == 2) {
+          centroids.push_back(Centroid(mz, sn, rt));
+        }
+      }
+    }
+    p = (q == end) ? end : q + 1;
+  }
+  return numentries;
+}
+
+/*
+ * Read a memory mapped Bruker CSV file, every line is a segment (spectrum)
+ */
+struct BrukerReader {
+  fastparse::MappedText text_;
+  const char * pos_;
+  int sn_;
+
+  BrukerReader(const std::string & filename) 
+    : text_(filename), pos_(text_.begin()), sn_(0) {}
+
+  bool operator()(std::vector<Centroid> & centroids) {
+    if (pos_ == text_.end()) return false;
+    const char * eol = fastparse::lineEnd(pos_, text_.end());
+    parseLine(pos_, eol, centroids, sn_);
+    pos_ = (eol == text_.end()) ? eol : eol + 1;
+    ++sn_;
+    return true;
+  }
+};
+
+template <class PipelineType, class LabelType = unsigned int>
 struct
 SNSplitter {
   private:
     ProgramOptions options_;
     unsigned int overlap_;
-    unsigned int adjListCounter_;
 
   public:
-    typedef typename SetType::ResultType ResultType;
+    typedef typename PipelineType::ResultType ResultType;
     typedef typename std::vector<unsigned int>::size_type size_type;
     SNSplitter(const ProgramOptions& options) : options_(options) {
 
       overlap_ = std::max(options_.minClusterSize_ * options_.snWindowSize_ - 1, options_.snWindowSize_);
-      adjListCounter_ = 0;
     }
 
     ResultType
-      filterAdjList(ResultType & adjList) {
+      filterAdjList(ResultType & adjList) const {
         std::vector<LabelType> labels;
         LabelType nComponents = findConnectedComponents(adjList, labels); 
         std::vector<unsigned int> counter(nComponents, 0);
@@ -134,94 +203,23 @@ SNSplitter {
         for (size_type i = 0; i < labels.size(); ++i) {
           if (counter[labels[i]-1] < options_.minClusterSize_) { 
             InnerType().swap(adjList[i]);
-            //std::copy(adjList[i].begin(), adjList[i].end(), std::back_inserter(filteredAdjList[i]));
           }
         }
         return adjList;
       }
-    ResultType
-      joinAdjLists(const ResultType & filteredAdjList, ResultType & fullAdjList, size_type offset) {
-        //fullAdjList.resize(filteredAdjList.size() + offset);
-        size_type index;
-        typedef typename ResultType::value_type InnerType;
-        typename ResultType::value_type::const_iterator it1;
-        for (index = 0; index < filteredAdjList.size(); ++index) {
-          for (it1 = filteredAdjList[index].begin(); it1 != filteredAdjList[index].end(); ++it1) {
-            fullAdjList[index + offset].insert(fullAdjList[index + offset].end(), typename ResultType::value_type::value_type(*it1 + offset));
-            adjListCounter_++;
-          }
-          //InnerType().swap(filteredAdjList[index]);
-        }
-
-        return fullAdjList;
-      }
-    ResultType
-      createShortAdjList(boost::function<ResultType(std::deque<Centroid>)> & intersectFunctor, const std::deque<Centroid> & centroids) {
-        ResultType shortAdjList = intersectFunctor(centroids);
-
-        filterAdjList(shortAdjList);
-
-        return shortAdjList;
-      }
-    template <typename IteratorType>
-      IteratorType
-      makeUnique(IteratorType begin, IteratorType end) {
-        for (;begin != end; ++begin) {
-          typename ResultType::value_type & vec = *begin;
-          std::sort(vec.begin(), vec.end());
-          vec.resize(std::unique(vec.begin(), vec.end()) - vec.begin());
-        }
-        return begin;
-      }
 
+    /* slab filter for the pipeline */
+    void operator()(ResultType & adjList) const {
+      filterAdjList(adjList);
+    }
 
+    template <class BoxGenerator>
     ResultType
-      findOverlaps(boost::function<ResultType(std::deque<Centroid>)> & intersectFunctor) {
-
-        boost::iostreams::stream<boost::iostreams::file_source> ifs(options_.inputfileName_);
-        std::string str;
-        std::deque<Centroid> centroids;
-        unsigned int segmentCounter = 0;
-        unsigned int centroidCounter = 0;
-        unsigned int oldCentroidCounter = 0;
-        unsigned int nextCentroidCounter = 0;
-
-        ResultType fullAdjList;
-        unsigned int countAllCentroids = 0;
-        while(std::getline(ifs, str)) {
-          bool onlyheader = true;
-          countAllCentroids += parseString(str, centroids, segmentCounter, onlyheader);
-        }
-        fullAdjList.resize(countAllCentroids);
-        std::cout << countAllCentroids << " centroids found" << std::endl;
-        ifs.clear();
-        ifs.seekg(0);
-        while(std::getline(ifs, str)) {
-          unsigned int numEntries = parseString(str, centroids, segmentCounter);
-          segmentCounter++;
-          centroidCounter += numEntries;
-          if (segmentCounter % options_.segmentSize_ == 0) {
-            nextCentroidCounter = centroidCounter;
-          }
-
-          if (segmentCounter % options_.segmentSize_ == overlap_ && segmentCounter >= options_.segmentSize_) {
-            ResultType filteredAdjList = createShortAdjList(intersectFunctor, centroids);
-
-            joinAdjLists(filteredAdjList, fullAdjList, oldCentroidCounter);
-            makeUnique(fullAdjList.begin() + oldCentroidCounter, fullAdjList.begin() + centroidCounter);
-            unsigned int numNewCentroids = nextCentroidCounter - oldCentroidCounter;
-            oldCentroidCounter = nextCentroidCounter;
-            centroids.erase(centroids.begin(), centroids.begin() + numNewCentroids);
-            ResultType().swap(filteredAdjList); 
-
-          }
-        }
-        ifs.close();
-        ResultType filteredAdjList = createShortAdjList(intersectFunctor, centroids);
-        joinAdjLists(filteredAdjList, fullAdjList, oldCentroidCounter);
-
-        makeUnique(fullAdjList.begin()+oldCentroidCounter, fullAdjList.end());
-
+      findOverlaps(const BoxGenerator & gen, std::vector<Centroid> & centroids) {
+        BrukerReader reader(options_.inputfileName_);
+        PipelineType pipeline(options_.segmentSize_, overlap_);
+        ResultType fullAdjList = pipeline.run(reader, *this, centroids, gen, gen);
+        std::cout << centroids.size() << " centroids found" << std::endl;
         return fullAdjList;
       }
 
@@ -1,5 +1,7 @@
-#include <algorithm>
 #include <iostream>
+#include <tuple>
+#include <vector>
+#include "fbi/cluster.h"
 
 struct Xic {
   double mz_;
@@ -11,23 +13,25 @@ std::ostream & operator<< ( std::ostream & os, const Xic & xic) {
   return os;
 }
 
-template <class CentroidIterType, class LabelIterType>
+/*
+ * Average mz and rt of every cluster, counter receives the cluster sizes
+ * and has to hold one entry per cluster.
+ */
+template <class CentroidContainer, class LabelType>
 std::vector<Xic>
-createXicVector(CentroidIterType CIT, CentroidIterType CEND, LabelIterType LIT, LabelIterType LEND, std::vector<unsigned int> & counter) {
-
-  std::vector<Xic> xics(counter.size());
-  std::fill(counter.begin(), counter.end(), 0);
-
-  for (; CIT != CEND && LIT != LEND; ++CIT, ++LIT) {
-    xics[*LIT-1].mz_ += CIT->mz_;
-    xics[*LIT-1].rt_ += CIT->rt_;
-    counter[*LIT-1] += 1;
-  }
+createXicVector(const CentroidContainer & centroids, const std::vector<LabelType> & labels, std::vector<unsigned int> & counter) {
+  typedef typename CentroidContainer::value_type CentroidType;
+  std::vector<std::tuple<std::size_t, double, double> > summaries = 
+    fbi::aggregate(centroids, labels, counter.size(), fbi::reducers(
+      fbi::Count(), fbi::mean(fbi::member(&CentroidType::mz_)), 
+      fbi::mean(fbi::member(&CentroidType::rt_))));
+
+  std::vector<Xic> xics(summaries.size());
   for (std::vector<Xic>::size_type i = 0; i < xics.size(); ++i) {
-    xics[i].mz_ /= counter[i];
-    xics[i].rt_ /= counter[i];
+    counter[i] = static_cast<unsigned int>(std::get<0>(summaries[i]));
+    xics[i].mz_ = std::get<1>(summaries[i]);
+    xics[i].rt_ = std::get<2>(summaries[i]);
   }
-  
   return xics;
 }
 
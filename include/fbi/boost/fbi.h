@@ -61,6 +61,9 @@ namespace fbi {
    *  dimensions, given as a parameter pack of std::size_t.
    * \note The user has to specify at least one index to work on, 
    *  empty TIndices won't return any results.
+   * \note This backend for compilers without variadic templates is a 
+   *  separate implementation and only offers intersect and thetaIntersect,
+   *  see INSTALL.txt.
    */
   
 #ifdef __LIBFBI_USE_MULTITHREADING__
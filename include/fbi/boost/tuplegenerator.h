@@ -57,6 +57,10 @@
 
 #include <boost/tuple/tuple.hpp> 
 
+#if MAX_DIMENSIONS > 10
+  #error "boost::tuples supports at most 10 elements, set MAX_DIMENSIONS <= 10"
+#endif
+
 
 namespace fbi {
 
@@ -443,11 +447,12 @@ typedef
 template<BOOST_PP_ENUM_PARAMS(MAX_DIMENSIONS, int TIndex)>
 struct CountNonNegative {
   
+  // summed up in plain arithmetic, boost::mpl::minus only takes up to 
+  // BOOST_MPL_LIMIT_METAFUNCTION_ARITY (5) arguments
   enum { 
-    value = boost::mpl::minus<boost::mpl::int_<MAX_DIMENSIONS>,
-      BOOST_PP_ENUM(MAX_DIMENSIONS, PREPOSTWRAPPER, \
-	  (typename equal_to_neg1<)(TIndex)(>::type))
-    >::type::value
+    value = MAX_DIMENSIONS 
+      BOOST_PP_REPEAT(MAX_DIMENSIONS, PREPOSTWRAPPER, \
+	  (- equal_to_neg1<)(TIndex)(>::type::value))
 
   };
   
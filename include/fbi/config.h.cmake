@@ -47,11 +47,14 @@
 #else
   #define __FBI_MSWORKAROUND__ 0
 #endif
+/* Only used by the boost backend, the variadic one has no such limits.
+ * Set with -DLIBFBI_MAX_DIMENSIONS/-DLIBFBI_MAX_QFUNCTORS when configuring
+ * or define before including libfbi. */
 #ifndef MAX_DIMENSIONS 
-  #define MAX_DIMENSIONS 4
+  #define MAX_DIMENSIONS @LIBFBI_MAX_DIMENSIONS@
 #endif
 #ifndef MAX_QFUNCTORS
-  #define MAX_QFUNCTORS 2
+  #define MAX_QFUNCTORS @LIBFBI_MAX_QFUNCTORS@
 #endif
 
 #endif 
@@ -0,0 +1,318 @@
+/* $Id: batch.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LIBFBI_INCLUDE_FBI_BATCH_H__
+#define __LIBFBI_INCLUDE_FBI_BATCH_H__
+
+//C++
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <fbi/config.h>
+#include <fbi/fbi.h>
+#include <fbi/connectedcomponents.h>
+
+#ifdef __LIBFBI_USE_MULTITHREADING__
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace fbi {
+
+/**
+ * \class BatchJob
+ * \brief One self-join of a \ref Batch: the boxes and the functors that 
+ * create their keys, see \ref SetA::intersect.
+ *
+ * \tparam QueryFunctor A functor or a std::vector of functors, to create
+ * several query keys per box.
+ */
+template <class BoxContainer, typename IntervalFunctor, typename QueryFunctor>
+struct BatchJob {
+  BatchJob(const BoxContainer & data, const IntervalFunctor & ifunctor,
+    const QueryFunctor & qfunctor, const std::size_t memoryLimit = 0)
+    : data_(&data), ifunctor_(ifunctor), qfunctor_(qfunctor), 
+      memoryLimit_(memoryLimit) {}
+
+  /** The boxes, they have to live until \ref Batch::run returns */
+  const BoxContainer * data_;
+  IntervalFunctor ifunctor_;
+  QueryFunctor qfunctor_;
+  /**
+   * Bytes the keys of this job may take, 0 means no limit. The query keys
+   * are then created for as few query functors at a time as necessary,
+   * see \ref IntersectOptions::queryBatchSize_. The data keys and the keys
+   * of one query functor are always needed. The limit only covers the 
+   * keys and key pointers, not the result of the job, which does not 
+   * depend on the batch size.
+   */
+  std::size_t memoryLimit_;
+};
+
+/** Create a \ref BatchJob without spelling out its type */
+template <class BoxContainer, typename IntervalFunctor, typename QueryFunctor>
+BatchJob<BoxContainer, IntervalFunctor, QueryFunctor> 
+makeBatchJob(const BoxContainer & data, const IntervalFunctor & ifunctor,
+  const QueryFunctor & qfunctor, const std::size_t memoryLimit = 0)
+{
+  return BatchJob<BoxContainer, IntervalFunctor, QueryFunctor>(
+    data, ifunctor, qfunctor, memoryLimit);
+}
+
+/**
+ * \class Batch
+ * \brief Run many independent self-joins (e.g. one per LC-MS run) on a 
+ * shared pool of threads.
+ *
+ * Every thread takes the next job, intersects its boxes with 
+ * \ref SetA::SetB::intersect and keeps the buffers of the keys in a 
+ * \ref SetA::SetB::Workspace of its own for the next job, also across 
+ * calls of \ref run. Compared to one process (or one intersect call) per 
+ * job this saves the allocation and first touch of the keys for all but 
+ * the largest jobs, and keeps all cores busy with small jobs that do not
+ * scale on their own. Every job sinks its edges under a lock of its own,
+ * so the jobs do not wait for each other.
+ *
+ * Without multithreading the jobs run one after the other on the calling
+ * thread, still sharing a single workspace.
+ *
+ * \tparam BoxType The type of the boxes of every job.
+ * \tparam TIndices The dimensions to intersect in, see \ref SetA.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+class Batch {
+ public:
+  typedef SetA<BoxType, TIndices...> SetType;
+  typedef typename SetType::template SetB<BoxType, TIndices...> JoinType;
+  typedef typename SetType::ResultType ResultType;
+  typedef typename JoinType::Workspace Workspace;
+
+  /**
+   * \param numThreads Number of jobs that run at the same time, 0 for one
+   * per core.
+   * \param memoryLimit Bytes the keys and the results of all running jobs
+   * may take together, 0 means no limit. The result of a job is estimated
+   * from a sample of its boxes, see \ref resultMemory. A job waits until 
+   * enough of the running ones have finished, but it always runs if no 
+   * other job does. Workspaces that grew beyond their share of the limit
+   * are released after their job.
+   * \param options Used for every job, queryBatchSize_ is lowered as far 
+   * as the memory limits of the jobs require.
+   */
+  explicit Batch(const std::size_t numThreads = 0, 
+    const std::size_t memoryLimit = 0, 
+    const IntersectOptions & options = IntersectOptions())
+    : numThreads_(numThreads == 0 ? defaultNumThreads() : numThreads),
+      memoryLimit_(memoryLimit), options_(options), 
+      workspaces_(numThreads_)
+  {}
+
+  /**
+   * \brief Intersect the boxes of every job.
+   *
+   * \param[in] jobs The jobs, usually made with \ref makeBatchJob.
+   * \return The result of \ref SetA::intersect for every job, in the 
+   * order of jobs.
+   */
+  template <class Job>
+  std::vector<ResultType> run(const std::vector<Job> & jobs)
+  {
+    std::vector<ResultType> results(jobs.size());
+    Schedule schedule(jobs.size());
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+      schedule.batchSizes_[i] = queryBatchSize(jobs[i]);
+      schedule.memory_[i] = keyMemory(jobs[i], schedule.batchSizes_[i]);
+      if (memoryLimit_ != 0) {
+        schedule.memory_[i] += resultMemory(jobs[i]);
+      }
+    }
+#ifdef __LIBFBI_USE_MULTITHREADING__
+    const std::size_t numThreads = std::max<std::size_t>(1, 
+      std::min(numThreads_, jobs.size()));
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < numThreads; ++t) {
+      threads.push_back(std::thread(std::bind(
+        &Batch::template work<Job>, this, std::cref(jobs), 
+        std::ref(schedule), std::ref(results), t)));
+    }
+    for (std::size_t t = 0; t < numThreads; ++t) threads[t].join();
+#else
+    work(jobs, schedule, results, 0);
+#endif
+    return results;
+  }
+
+  /**
+   * Bytes of the keys and key pointers of a job if the query keys are 
+   * created for queryBatchSize query functors at a time (0 for all).
+   */
+  template <class Job>
+  static std::size_t keyMemory(const Job & job, 
+    const std::size_t queryBatchSize)
+  {
+    const std::size_t numQueries = 
+      mpl::FunctorChecker::count(job.qfunctor_);
+    const std::size_t batchSize = (queryBatchSize == 0) ? 
+      numQueries : std::min(queryBatchSize, numQueries);
+    return job.data_->size() * keysPerBox(job, batchSize);
+  }
+
+  /**
+   * Estimated bytes of the result of a job: its adjacency list for the
+   * number of edges \ref SetA::SetB::estimateEdges expects from a sample 
+   * of the boxes.
+   */
+  template <class Job>
+  std::size_t resultMemory(const Job & job) const
+  {
+    return static_cast<std::size_t>(JoinType::adjacencyListMemory(
+      job.data_->size(), JoinType::estimateEdges(options_, *job.data_, 
+        job.ifunctor_, *job.data_, job.qfunctor_)));
+  }
+
+  /** Number of jobs that run at the same time */
+  std::size_t numThreads() const { return numThreads_; }
+
+  /** Give the memory of all workspaces back */
+  void release()
+  {
+    for (std::size_t t = 0; t < workspaces_.size(); ++t) {
+      workspaces_[t].release();
+    }
+  }
+
+ private:
+  /** Not copyable, the workspaces cannot be shared */
+  Batch(const Batch &);
+  Batch & operator=(const Batch &);
+
+  typedef typename 
+    mpl::TypeExtractor<Traits<BoxType>, TIndices...>::key_type key_type;
+
+  /** Which job is next and how much memory the running ones take */
+  struct Schedule {
+    explicit Schedule(const std::size_t numJobs) 
+      : batchSizes_(numJobs), memory_(numJobs), next_(0), running_(0), 
+        memoryInUse_(0) {}
+    /** The queryBatchSize_ of every job */
+    std::vector<std::size_t> batchSizes_;
+    /** 
+     * The bytes of the keys of every job, and of its result if there is a
+     * memory limit
+     */
+    std::vector<std::size_t> memory_;
+    std::size_t next_;
+    std::size_t running_;
+    std::size_t memoryInUse_;
+#ifdef __LIBFBI_USE_MULTITHREADING__
+    std::mutex mutex_;
+    std::condition_variable finished_;
+#endif
+  };
+
+  /** Bytes per box for the data keys and batchSize query keys */
+  template <class Job>
+  static std::size_t keysPerBox(const Job & job, const std::size_t batchSize)
+  {
+    return (mpl::FunctorChecker::count(job.ifunctor_) + batchSize) * 
+      (sizeof(key_type) + sizeof(const key_type *));
+  }
+
+  /** The largest query batch size that keeps the keys within the limit */
+  template <class Job>
+  std::size_t queryBatchSize(const Job & job) const
+  {
+    const std::size_t numQueries = 
+      mpl::FunctorChecker::count(job.qfunctor_);
+    std::size_t batchSize = (options_.queryBatchSize_ == 0) ? 
+      numQueries : std::min(options_.queryBatchSize_, numQueries);
+    if (job.memoryLimit_ == 0 || job.data_->empty()) return batchSize;
+    const std::size_t perBox = job.memoryLimit_ / job.data_->size();
+    const std::size_t perKey = sizeof(key_type) + sizeof(const key_type *);
+    const std::size_t dataKeys = mpl::FunctorChecker::count(job.ifunctor_);
+    const std::size_t fitting = (perBox / perKey > dataKeys) ? 
+      perBox / perKey - dataKeys : 0;
+    return std::max<std::size_t>(1, std::min(batchSize, fitting));
+  }
+
+  /** Run jobs until none is left, with the workspace of thread t */
+  template <class Job>
+  void work(const std::vector<Job> & jobs, Schedule & schedule, 
+    std::vector<ResultType> & results, const std::size_t t)
+  {
+    Workspace & workspace = workspaces_[t];
+    IntersectOptions options = options_;
+    while (true) {
+#ifdef __LIBFBI_USE_MULTITHREADING__
+      std::unique_lock<std::mutex> lck(schedule.mutex_);
+#endif
+      if (schedule.next_ == jobs.size()) return;
+      const std::size_t i = schedule.next_++;
+      const std::size_t memory = schedule.memory_[i];
+#ifdef __LIBFBI_USE_MULTITHREADING__
+      while (memoryLimit_ != 0 && schedule.running_ > 0 && 
+        schedule.memoryInUse_ + memory > memoryLimit_) {
+        schedule.finished_.wait(lck);
+      }
+#endif
+      ++schedule.running_;
+      schedule.memoryInUse_ += memory;
+#ifdef __LIBFBI_USE_MULTITHREADING__
+      lck.unlock();
+#endif
+
+      const Job & job = jobs[i];
+      options.queryBatchSize_ = schedule.batchSizes_[i];
+      results[i] = JoinType::intersect(options, workspace, *job.data_, 
+        job.ifunctor_, *job.data_, job.qfunctor_);
+      if (memoryLimit_ != 0 && 
+        workspace.capacity() > memoryLimit_ / numThreads_) {
+        workspace.release();
+      }
+
+#ifdef __LIBFBI_USE_MULTITHREADING__
+      lck.lock();
+#endif
+      --schedule.running_;
+      schedule.memoryInUse_ -= memory;
+#ifdef __LIBFBI_USE_MULTITHREADING__
+      schedule.finished_.notify_all();
+#endif
+    }
+  }
+
+  const std::size_t numThreads_;
+  const std::size_t memoryLimit_;
+  const IntersectOptions options_;
+  /** One per thread, kept between the jobs and calls of \ref run */
+  std::vector<Workspace> workspaces_;
+};
+
+} //end namespace fbi
+
+#endif
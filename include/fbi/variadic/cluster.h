@@ -0,0 +1,691 @@
+/* $Id: cluster.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef __LIBFBI_INCLUDE_FBI_CLUSTER_H__
+#define __LIBFBI_INCLUDE_FBI_CLUSTER_H__
+
+//C++
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+//c++0x
+#include <tuple>
+
+#include <fbi/config.h>
+#include <fbi/fbi.h>
+#include <fbi/connectedcomponents.h>
+
+namespace fbi {
+
+/**
+ * \class Member
+ * \brief Extract a data member of a box, e.g. member(&Centroid::mz_)
+ */
+template <typename BoxType, typename T>
+struct Member {
+  T BoxType::* member_;
+  Member(T BoxType::* member) : member_(member) {}
+  double operator()(const BoxType & box) const 
+  { 
+    return static_cast<double>(box.*member_); 
+  }
+};
+
+template <typename BoxType, typename T>
+Member<BoxType, T> member(T BoxType::* m)
+{
+  return Member<BoxType, T>(m);
+}
+
+/**
+ * \class Count
+ * \brief Reducer: number of boxes in a cluster.
+ *
+ * A reducer summarizes the boxes of a cluster. It has to provide
+ *  - state_type and result_type typedefs,
+ *  - \verbatim state_type init() const \endverbatim for an empty cluster,
+ *  - \verbatim void add(state_type &, const BoxType &) const \endverbatim,
+ *  - \verbatim void merge(state_type &, const state_type &) const \endverbatim
+ *    to combine partial states,
+ *  - \verbatim result_type result(const state_type &) const \endverbatim.
+ *
+ * Boxes are added in the order of their index.
+ */
+struct Count {
+  typedef std::size_t state_type;
+  typedef std::size_t result_type;
+  state_type init() const { return 0; }
+  template <typename BoxType>
+  void add(state_type & state, const BoxType &) const { ++state; }
+  void merge(state_type & state, const state_type & other) const 
+  { 
+    state += other; 
+  }
+  result_type result(const state_type & state) const { return state; }
+};
+
+/**
+ * \class Sum
+ * \brief Reducer: sum of the values extracted from the boxes of a cluster.
+ * \tparam Extractor Provides \verbatim double operator()(const BoxType &) const \endverbatim
+ */
+template <typename Extractor>
+struct Sum {
+  typedef double state_type;
+  typedef double result_type;
+  Extractor extractor_;
+  Sum(const Extractor & extractor) : extractor_(extractor) {}
+  state_type init() const { return 0.0; }
+  template <typename BoxType>
+  void add(state_type & state, const BoxType & box) const 
+  { 
+    state += extractor_(box); 
+  }
+  void merge(state_type & state, const state_type & other) const 
+  { 
+    state += other; 
+  }
+  result_type result(const state_type & state) const { return state; }
+};
+
+/**
+ * \class Mean
+ * \brief Reducer: arithmetic mean of the extracted values.
+ */
+template <typename Extractor>
+struct Mean {
+  typedef std::pair<double, std::size_t> state_type;
+  typedef double result_type;
+  Extractor extractor_;
+  Mean(const Extractor & extractor) : extractor_(extractor) {}
+  state_type init() const { return state_type(0.0, 0); }
+  template <typename BoxType>
+  void add(state_type & state, const BoxType & box) const 
+  { 
+    state.first += extractor_(box); 
+    ++state.second;
+  }
+  void merge(state_type & state, const state_type & other) const 
+  { 
+    state.first += other.first; 
+    state.second += other.second;
+  }
+  result_type result(const state_type & state) const 
+  { 
+    return state.first / static_cast<double>(state.second); 
+  }
+};
+
+/**
+ * \class Min
+ * \brief Reducer: smallest extracted value.
+ */
+template <typename Extractor>
+struct Min {
+  typedef double state_type;
+  typedef double result_type;
+  Extractor extractor_;
+  Min(const Extractor & extractor) : extractor_(extractor) {}
+  state_type init() const { return std::numeric_limits<double>::max(); }
+  template <typename BoxType>
+  void add(state_type & state, const BoxType & box) const 
+  { 
+    state = std::min(state, static_cast<double>(extractor_(box))); 
+  }
+  void merge(state_type & state, const state_type & other) const 
+  { 
+    state = std::min(state, other); 
+  }
+  result_type result(const state_type & state) const { return state; }
+};
+
+/**
+ * \class Max
+ * \brief Reducer: largest extracted value.
+ */
+template <typename Extractor>
+struct Max {
+  typedef double state_type;
+  typedef double result_type;
+  Extractor extractor_;
+  Max(const Extractor & extractor) : extractor_(extractor) {}
+  state_type init() const { return -std::numeric_limits<double>::max(); }
+  template <typename BoxType>
+  void add(state_type & state, const BoxType & box) const 
+  { 
+    state = std::max(state, static_cast<double>(extractor_(box))); 
+  }
+  void merge(state_type & state, const state_type & other) const 
+  { 
+    state = std::max(state, other); 
+  }
+  result_type result(const state_type & state) const { return state; }
+};
+
+template <typename Extractor>
+Sum<Extractor> sum(const Extractor & e) { return Sum<Extractor>(e); }
+template <typename Extractor>
+Mean<Extractor> mean(const Extractor & e) { return Mean<Extractor>(e); }
+template <typename Extractor>
+Min<Extractor> minimum(const Extractor & e) { return Min<Extractor>(e); }
+template <typename Extractor>
+Max<Extractor> maximum(const Extractor & e) { return Max<Extractor>(e); }
+
+namespace mpl {
+
+/** Apply the reducers of a \ref ReducerList element by element */
+template <std::size_t I, std::size_t N>
+struct ReducerLoop {
+  template <class Reducers, class States, class BoxType>
+  static void add(const Reducers & r, States & s, const BoxType & box)
+  {
+    std::get<I>(r).add(std::get<I>(s), box);
+    ReducerLoop<I + 1, N>::add(r, s, box);
+  }
+  template <class Reducers, class States>
+  static void merge(const Reducers & r, States & s, const States & o)
+  {
+    std::get<I>(r).merge(std::get<I>(s), std::get<I>(o));
+    ReducerLoop<I + 1, N>::merge(r, s, o);
+  }
+};
+
+template <std::size_t N>
+struct ReducerLoop<N, N> {
+  template <class Reducers, class States, class BoxType>
+  static void add(const Reducers &, States &, const BoxType &) {}
+  template <class Reducers, class States>
+  static void merge(const Reducers &, States &, const States &) {}
+};
+
+} //end namespace mpl
+
+/**
+ * \class ReducerList
+ * \brief Combine several reducers into one whose states and results are
+ * tuples, see \ref reducers.
+ */
+template <class ... Reducers>
+class ReducerList {
+ public:
+  typedef std::tuple<typename Reducers::state_type...> state_type;
+  typedef std::tuple<typename Reducers::result_type...> result_type;
+
+  ReducerList(const Reducers & ... reducers) : reducers_(reducers...) {}
+
+  state_type init() const { return init(mpl::Indices<>()); }
+
+  template <typename BoxType>
+  void add(state_type & state, const BoxType & box) const
+  {
+    mpl::ReducerLoop<0, sizeof...(Reducers)>::add(reducers_, state, box);
+  }
+
+  void merge(state_type & state, const state_type & other) const
+  {
+    mpl::ReducerLoop<0, sizeof...(Reducers)>::merge(reducers_, state, other);
+  }
+
+  result_type result(const state_type & state) const 
+  { 
+    return result(state, mpl::Indices<>()); 
+  }
+
+ private:
+  template <std::size_t ... I>
+  typename std::enable_if<sizeof...(I) == sizeof...(Reducers), state_type>::type
+  init(mpl::Indices<I...>) const
+  {
+    return state_type(std::get<I>(reducers_).init()...);
+  }
+
+  template <std::size_t ... I>
+  typename std::enable_if<sizeof...(I) < sizeof...(Reducers), state_type>::type
+  init(mpl::Indices<I...>) const
+  {
+    return init(mpl::Indices<I..., sizeof...(I)>());
+  }
+
+  template <std::size_t ... I>
+  typename std::enable_if<sizeof...(I) == sizeof...(Reducers), result_type>::type
+  result(const state_type & state, mpl::Indices<I...>) const
+  {
+    return result_type(std::get<I>(reducers_).result(std::get<I>(state))...);
+  }
+
+  template <std::size_t ... I>
+  typename std::enable_if<sizeof...(I) < sizeof...(Reducers), result_type>::type
+  result(const state_type & state, mpl::Indices<I...>) const
+  {
+    return result(state, mpl::Indices<I..., sizeof...(I)>());
+  }
+
+  std::tuple<Reducers...> reducers_;
+};
+
+/** Create a \ref ReducerList */
+template <class ... Reducers>
+ReducerList<Reducers...> reducers(const Reducers & ... r)
+{
+  return ReducerList<Reducers...>(r...);
+}
+
+/**
+ * \class LabelGrouping
+ * \brief Indices of the boxes sorted by their cluster label.
+ *
+ * The boxes of cluster l are order_[offsets_[l-1]] .. order_[offsets_[l]-1]
+ * in ascending order of their index (the sort is stable).
+ */
+template <typename IndexType>
+struct LabelGrouping {
+  std::vector<std::size_t> offsets_;
+  std::vector<IndexType> order_;
+
+  std::size_t numClusters() const 
+  { 
+    return offsets_.empty() ? 0 : offsets_.size() - 1; 
+  }
+};
+
+enum {
+  /** 
+   * Most bits of the label sorted per pass of \ref groupByLabel if the 
+   * labels do not fit into a single pass
+   */
+  LABEL_RADIX_BITS = 12
+};
+
+/** Count one digit of the labels of one range, see \ref groupByLabel */
+template <typename LabelType>
+struct LabelDigitCounter {
+  const std::vector<LabelType> & labels_;
+  const unsigned int shift_;
+  const std::size_t mask_;
+  std::vector<std::vector<std::size_t> > & counts_;
+  LabelDigitCounter(const std::vector<LabelType> & labels, 
+    const unsigned int shift, const std::size_t mask,
+    std::vector<std::vector<std::size_t> > & counts)
+    : labels_(labels), shift_(shift), mask_(mask), counts_(counts) {}
+  void operator()(std::size_t begin, std::size_t end, std::size_t t) const
+  {
+    std::vector<std::size_t> & counts = counts_[t];
+    std::fill(counts.begin(), counts.end(), 0);
+    for (std::size_t i = begin; i < end; ++i) {
+      ++counts[(static_cast<std::size_t>(labels_[i]) >> shift_) & mask_];
+    }
+  }
+};
+
+/** 
+ * Turn the counts of a range of digits into the first position of every 
+ * (digit, thread) pair, see \ref groupByLabel. The first call sums the 
+ * counts of the range into totals_, the second one starts at totals_ and, 
+ * if the digits are whole labels, also writes the offsets of the clusters.
+ */
+struct DigitPrefix {
+  std::vector<std::vector<std::size_t> > & counts_;
+  std::vector<std::size_t> & totals_;
+  const bool scan_;
+  std::vector<std::size_t> * offsets_;
+  DigitPrefix(std::vector<std::vector<std::size_t> > & counts,
+    std::vector<std::size_t> & totals, const bool scan, 
+    std::vector<std::size_t> * offsets = 0)
+    : counts_(counts), totals_(totals), scan_(scan), offsets_(offsets) {}
+  void operator()(std::size_t begin, std::size_t end, std::size_t r) const
+  {
+    std::size_t position = scan_ ? totals_[r] : 0;
+    for (std::size_t d = begin; d < end; ++d) {
+      // labels are 1-based
+      if (offsets_ && d > 0) (*offsets_)[d - 1] = position;
+      for (std::size_t t = 0; t < counts_.size(); ++t) {
+        const std::size_t count = counts_[t][d];
+        if (scan_) counts_[t][d] = position;
+        position += count;
+      }
+    }
+    if (!scan_) totals_[r] = position;
+  }
+};
+
+/** 
+ * Scatter the (label, index) pairs of one range to their positions by one
+ * digit of the label, see \ref groupByLabel. A null order stands for the 
+ * identity, i.e. the pairs of the first pass, a null sortedLabels for a 
+ * last pass that does not need the labels any more.
+ */
+template <typename LabelType, typename IndexType>
+struct LabelDigitScatter {
+  const std::vector<LabelType> & labels_;
+  const std::vector<IndexType> * order_;
+  const unsigned int shift_;
+  const std::size_t mask_;
+  std::vector<std::vector<std::size_t> > & positions_;
+  std::vector<LabelType> * sortedLabels_;
+  std::vector<IndexType> & sortedOrder_;
+  LabelDigitScatter(const std::vector<LabelType> & labels, 
+    const std::vector<IndexType> * order, const unsigned int shift,
+    const std::size_t mask, std::vector<std::vector<std::size_t> > & positions,
+    std::vector<LabelType> * sortedLabels, 
+    std::vector<IndexType> & sortedOrder)
+    : labels_(labels), order_(order), shift_(shift), mask_(mask),
+      positions_(positions), sortedLabels_(sortedLabels), 
+      sortedOrder_(sortedOrder) {}
+  void operator()(std::size_t begin, std::size_t end, std::size_t t) const
+  {
+    std::vector<std::size_t> & positions = positions_[t];
+    for (std::size_t i = begin; i < end; ++i) {
+      const std::size_t p = positions[
+        (static_cast<std::size_t>(labels_[i]) >> shift_) & mask_]++;
+      if (sortedLabels_) (*sortedLabels_)[p] = labels_[i];
+      sortedOrder_[p] = order_ ? (*order_)[i] : static_cast<IndexType>(i);
+    }
+  }
+};
+
+/** 
+ * Find the offsets of the clusters that start in one range of the sorted 
+ * order, see \ref groupByLabel. Every offset is written by exactly one 
+ * range.
+ */
+template <typename LabelType>
+struct ClusterStarts {
+  const std::vector<LabelType> & labels_;
+  const std::vector<LabelType> & order_;
+  std::vector<std::size_t> & offsets_;
+  ClusterStarts(const std::vector<LabelType> & labels, 
+    const std::vector<LabelType> & order, std::vector<std::size_t> & offsets)
+    : labels_(labels), order_(order), offsets_(offsets) {}
+  void operator()(std::size_t begin, std::size_t end, std::size_t) const
+  {
+    std::size_t previous = (begin == 0) ? 0 : labels_[order_[begin - 1]];
+    for (std::size_t k = begin; k < end; ++k) {
+      const std::size_t label = labels_[order_[k]];
+      for (std::size_t c = previous; c < label; ++c) {
+        offsets_[c] = k;
+      }
+      previous = label;
+    }
+  }
+};
+
+/**
+ * \brief Stable sort of the boxes by their 1-based cluster label.
+ *
+ * A least significant digit radix sort of the (label, index) pairs. Every 
+ * thread counts the digits of a contiguous range of pairs; with the prefix 
+ * sums over (digit, thread), computed in parallel over ranges of digits, 
+ * every thread knows where to put its pairs, so every pass is stable 
+ * without any synchronisation. 
+ *
+ * If one histogram over all labels per thread takes no more than one 
+ * count per box, a single counting sort pass does and the offsets are 
+ * read off the histogram. Otherwise the labels are sorted by at most
+ * LABEL_RADIX_BITS per pass: the histograms stay small and cache-resident
+ * however many clusters there are, at the cost of a second copy of the 
+ * pairs, and the offsets are read off the sorted order in parallel.
+ * \param[in] labels The 1-based cluster of every box.
+ * \param[in] numClusters The number of clusters.
+ * \param[in] numThreads Only used if multithreading is enabled.
+ */
+template <typename LabelType>
+LabelGrouping<LabelType> groupByLabel(const std::vector<LabelType> & labels,
+  const std::size_t numClusters, 
+  const std::size_t numThreads = defaultNumThreads())
+{
+  const std::size_t n = labels.size();
+  const std::size_t numRanges = 
+    std::max<std::size_t>(1, std::min(numThreads, n));
+  unsigned int numBits = 0;
+  while (numBits < 8 * sizeof(std::size_t) && 
+    (numClusters >> numBits) != 0) {
+    ++numBits;
+  }
+  const bool singlePass = numBits <= LABEL_RADIX_BITS || 
+    numRanges * (numClusters + 1) <= n;
+  const unsigned int numPasses = singlePass ? (numBits > 0) : 
+    (numBits + LABEL_RADIX_BITS - 1) / LABEL_RADIX_BITS;
+  const unsigned int digitBits = 
+    numPasses ? (numBits + numPasses - 1) / numPasses : 0;
+  const std::size_t numDigits = singlePass ? 
+    numClusters + 1 : std::size_t(1) << digitBits;
+  const std::size_t mask = singlePass ? 
+    ~std::size_t(0) : numDigits - 1;
+  const std::size_t numDigitRanges = std::min(numRanges, numDigits);
+
+  LabelGrouping<LabelType> grouping;
+  grouping.offsets_.resize(numClusters + 1);
+  grouping.order_.resize(n);
+  // pass p reads the pairs written by pass p - 1 and writes the order into
+  // grouping.order_ if numPasses - p is odd, so the last pass ends there;
+  // the last pass does not need to write the labels
+  std::vector<LabelType> labelBuffers[2];
+  std::vector<LabelType> nextOrder;
+  if (numPasses > 1) {
+    labelBuffers[0].resize(n);
+    nextOrder.resize(n);
+  }
+  if (numPasses > 2) labelBuffers[1].resize(n);
+  std::vector<std::vector<std::size_t> > counts(numRanges);
+  for (std::size_t t = 0; t < numRanges; ++t) {
+    counts[t].resize(numDigits);
+  }
+  std::vector<std::size_t> totals(numDigitRanges);
+  for (unsigned int p = 0; p < numPasses; ++p) {
+    const unsigned int shift = p * digitBits;
+    const std::vector<LabelType> & source = 
+      (p == 0) ? labels : labelBuffers[(p + 1) % 2];
+    std::vector<LabelType> & order = 
+      ((numPasses - p) % 2 == 1) ? grouping.order_ : nextOrder;
+    const std::vector<LabelType> * sourceOrder = (p == 0) ? 0 :
+      ((&order == &grouping.order_) ? &nextOrder : &grouping.order_);
+    forEachRange(n, numRanges, 
+      LabelDigitCounter<LabelType>(source, shift, mask, counts));
+    forEachRange(numDigits, numDigitRanges, 
+      DigitPrefix(counts, totals, false));
+    std::size_t position = 0;
+    for (std::size_t r = 0; r < numDigitRanges; ++r) {
+      const std::size_t total = totals[r];
+      totals[r] = position;
+      position += total;
+    }
+    forEachRange(numDigits, numDigitRanges, DigitPrefix(counts, totals, 
+      true, singlePass ? &grouping.offsets_ : 0));
+    forEachRange(n, numRanges, LabelDigitScatter<LabelType, LabelType>(
+      source, sourceOrder, shift, mask, counts, 
+      (p + 1 < numPasses) ? &labelBuffers[p % 2] : 0, order));
+  }
+  if (numPasses == 0) {
+    for (std::size_t i = 0; i < n; ++i) {
+      grouping.order_[i] = static_cast<LabelType>(i);
+    }
+  } else if (!singlePass) {
+    forEachRange(n, numRanges, 
+      ClusterStarts<LabelType>(labels, grouping.order_, grouping.offsets_));
+    for (std::size_t c = n ? labels[grouping.order_[n - 1]] : 0; 
+      c < numClusters; ++c) {
+      grouping.offsets_[c] = n;
+    }
+  }
+  grouping.offsets_[numClusters] = n;
+  return grouping;
+}
+
+/** Reduce the clusters of one range, see \ref aggregate */
+template <class BoxContainer, typename IndexType, class Reducer>
+struct ClusterReduction {
+  const BoxContainer & boxes_;
+  const LabelGrouping<IndexType> & grouping_;
+  const std::vector<std::size_t> & bounds_;
+  const Reducer & reducer_;
+  std::vector<typename Reducer::result_type> & results_;
+  ClusterReduction(const BoxContainer & boxes, 
+    const LabelGrouping<IndexType> & grouping,
+    const std::vector<std::size_t> & bounds, const Reducer & reducer,
+    std::vector<typename Reducer::result_type> & results)
+    : boxes_(boxes), grouping_(grouping), bounds_(bounds), 
+      reducer_(reducer), results_(results) {}
+  void operator()(std::size_t, std::size_t, std::size_t t) const
+  {
+    for (std::size_t c = bounds_[t]; c < bounds_[t + 1]; ++c) {
+      typename Reducer::state_type state = reducer_.init();
+      const std::size_t end = grouping_.offsets_[c + 1];
+      for (std::size_t k = grouping_.offsets_[c]; k < end; ++k) {
+        reducer_.add(state, boxes_[grouping_.order_[k]]);
+      }
+      results_[c] = reducer_.result(state);
+    }
+  }
+};
+
+/**
+ * \brief Summarize the boxes of every cluster.
+ *
+ * The boxes are grouped with \ref groupByLabel, then the clusters are
+ * split into one contiguous range per thread, balanced by the number of
+ * boxes, and every thread reduces its own clusters. The boxes of a cluster
+ * are added in ascending order of their index, the results do not depend on
+ * the number of threads.
+ * \param[in] boxes Random access container with the boxes.
+ * \param[in] labels 1-based cluster label of every box, as returned by
+ * findConnectedComponents.
+ * \param[in] numClusters The number of clusters.
+ * \param[in] reducer See \ref Count for the interface.
+ * \param[in] numThreads Only used if multithreading is enabled.
+ * \return One result per cluster, cluster l is at position l-1.
+ */
+template <class BoxContainer, typename LabelType, class Reducer>
+std::vector<typename Reducer::result_type> 
+aggregate(const BoxContainer & boxes, const std::vector<LabelType> & labels,
+  const std::size_t numClusters, const Reducer & reducer,
+  const std::size_t numThreads = defaultNumThreads())
+{
+  const LabelGrouping<LabelType> grouping = 
+    groupByLabel(labels, numClusters, numThreads);
+  const std::size_t numRanges = 
+    std::max<std::size_t>(1, std::min(numThreads, numClusters));
+  // cluster ranges with about the same number of boxes
+  std::vector<std::size_t> bounds(1, 0);
+  for (std::size_t t = 1; t < numRanges; ++t) {
+    const std::size_t target = labels.size() * t / numRanges;
+    bounds.push_back(std::max(bounds.back(), static_cast<std::size_t>(
+      std::upper_bound(grouping.offsets_.begin(), 
+        grouping.offsets_.end() - 1, target) - grouping.offsets_.begin())));
+  }
+  bounds.push_back(numClusters);
+
+  std::vector<typename Reducer::result_type> results(numClusters);
+  forEachRange(numRanges, numRanges, ClusterReduction<BoxContainer, 
+    LabelType, Reducer>(boxes, grouping, bounds, reducer, results));
+  return results;
+}
+
+/**
+ * \class Clustering
+ * \brief Fused intersection and clustering.
+ *
+ * Computes the connected components of the intersection graph of
+ * \ref SetA::intersect without storing it: every intersecting pair is
+ * united in a \ref ConcurrentUnionFind as soon as it is found, so the
+ * memory is O(n) instead of O(n + E). The labels are the same as those of
+ * findConnectedComponents on the result of SetA::intersect.
+ *
+ * \tparam BoxType The type of the boxes, Traits<BoxType> has to be defined.
+ * \tparam TIndices The dimensions to intersect in, see \ref SetA.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+class Clustering {
+ private:
+  /** Keep ctor private, Clustering is not meant to be instantiated.*/
+  Clustering();
+
+ public:
+  typedef typename SetA<BoxType, TIndices...>::IntType IntType;
+
+  /** Unites the boxes of every intersecting pair */
+  struct UnionVisitor {
+    ConcurrentUnionFind<IntType> & sets_;
+    UnionVisitor(ConcurrentUnionFind<IntType> & sets) : sets_(sets) {}
+    void operator()(const IntType head, const IntType tail) 
+    { 
+      sets_.unite(head, tail); 
+    }
+  };
+
+  /**
+   * \brief Label the connected components of the intersection graph.
+   * \param[out] labels The 1-based component of every box.
+   * \param[in] dataContainer The boxes, see \ref SetA::intersect.
+   * \param[in] ifunctor see \ref SetA::intersect
+   * \param[in] qfunctors see \ref SetA::intersect
+   * \return The number of components
+   */
+  template <class BoxContainer, typename IntervalFunctor, 
+    typename ... QueryFunctors>
+  static IntType label(
+      std::vector<IntType> & labels,
+      const BoxContainer & dataContainer,
+      const IntervalFunctor & ifunctor,
+      const QueryFunctors & ... qfunctors)
+  {
+    ConcurrentUnionFind<IntType> sets(dataContainer.size());
+    UnionVisitor visitor(sets);
+    SetA<BoxType, TIndices...>::visitIntersections(visitor, dataContainer, 
+      ifunctor, qfunctors...);
+    return labelComponents(sets, labels, defaultNumThreads());
+  }
+
+  /**
+   * \brief Cluster the boxes and summarize every cluster.
+   * \param[out] labels The 1-based cluster of every box.
+   * \param[in] dataContainer Random access container with the boxes.
+   * \param[in] reducer Summarizes a cluster, e.g. 
+   * reducers(Count(), mean(member(&Centroid::mz_))), see \ref Count.
+   * \param[in] ifunctor see \ref SetA::intersect
+   * \param[in] qfunctors see \ref SetA::intersect
+   * \return One summary per cluster, cluster l is at position l-1.
+   */
+  template <class BoxContainer, class Reducer, typename IntervalFunctor, 
+    typename ... QueryFunctors>
+  static std::vector<typename Reducer::result_type> cluster(
+      std::vector<IntType> & labels,
+      const BoxContainer & dataContainer,
+      const Reducer & reducer,
+      const IntervalFunctor & ifunctor,
+      const QueryFunctors & ... qfunctors)
+  {
+    const IntType numClusters = 
+      label(labels, dataContainer, ifunctor, qfunctors...);
+    return aggregate(dataContainer, labels, numClusters, reducer);
+  }
+};
+
+} //end namespace fbi
+
+#endif
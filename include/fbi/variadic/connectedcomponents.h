@@ -27,8 +27,16 @@
 #ifndef __LIBFBI_INCLUDE_FBI_CONNECTEDCOMPONENTS_H__
 #define __LIBFBI_INCLUDE_FBI_CONNECTEDCOMPONENTS_H__
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
+#include <fbi/config.h>
+#ifdef __LIBFBI_USE_MULTITHREADING__
+#include <functional>
+#include <thread>
+#endif
+
 template < class Container >
 typename Container::value_type::value_type
 findConnectedComponents(const Container & adjacencyList,
@@ -60,4 +68,239 @@ findConnectedComponents(const Container & adjacencyList,
   return currentLabel-1;
 }
 
+namespace fbi {
+
+/**
+ * \class ConcurrentUnionFind
+ * \brief Lock-free disjoint sets over the nodes 0..n-1.
+ *
+ * Roots are only ever linked below smaller roots, hence every tree is rooted
+ * at the smallest node of its set. The parents are updated with
+ * compare-and-swap, so unite and find may be called from several threads.
+ */
+template <typename T>
+class ConcurrentUnionFind {
+ public:
+  explicit ConcurrentUnionFind(const std::size_t n) : parents_(n)
+  {
+    for (std::size_t i = 0; i < n; ++i) {
+      parents_[i].store(static_cast<T>(i), std::memory_order_relaxed);
+    }
+  }
+
+  /** Find the root of x, halving the path on the way */
+  T find(T x)
+  {
+    T parent = parents_[x].load(std::memory_order_relaxed);
+    while (parent != x) {
+      T grandparent = parents_[parent].load(std::memory_order_relaxed);
+      if (grandparent != parent) {
+        parents_[x].compare_exchange_weak(parent, grandparent, 
+          std::memory_order_relaxed);
+      }
+      x = parent;
+      parent = parents_[x].load(std::memory_order_relaxed);
+    }
+    return x;
+  }
+
+  void unite(T x, T y)
+  {
+    while (true) {
+      x = find(x);
+      y = find(y);
+      if (x == y) return;
+      if (x < y) std::swap(x, y);
+      // x is the larger root, it must still be a root to be linked
+      T expected = x;
+      if (parents_[x].compare_exchange_strong(expected, y)) return;
+    }
+  }
+
+  bool isRoot(const T x) const
+  {
+    return parents_[x].load(std::memory_order_relaxed) == x;
+  }
+
+  std::size_t size() const { return parents_.size(); }
+
+ private:
+  std::vector<std::atomic<T> > parents_;
+};
+
+/**
+ * Split [0, n) into one range per thread and call 
+ * function(begin, end, thread) for each of them, concurrently if 
+ * multithreading is enabled.
+ */
+template <class Function>
+void forEachRange(const std::size_t n, std::size_t numThreads, 
+  const Function & function)
+{
+  numThreads = std::max<std::size_t>(1, std::min(numThreads, n));
+#ifdef __LIBFBI_USE_MULTITHREADING__
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < numThreads; ++t) {
+    threads.push_back(std::thread(std::bind(std::cref(function), 
+      n * t / numThreads, n * (t + 1) / numThreads, t)));
+  }
+  for (std::size_t t = 0; t < numThreads; ++t) threads[t].join();
+#else
+  for (std::size_t t = 0; t < numThreads; ++t) {
+    function(n * t / numThreads, n * (t + 1) / numThreads, t);
+  }
+#endif
+}
+
+/** One thread per core if multithreading is enabled, otherwise 1 */
+inline std::size_t defaultNumThreads()
+{
+#ifdef __LIBFBI_USE_MULTITHREADING__
+  const std::size_t n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+#else
+  return 1;
+#endif
+}
+
+/**
+ * Unite the endpoints of all edges of an adjacency list 
+ * (e.g. SetA::ResultType)
+ */
+template <class Container, typename T>
+struct AdjacencyListLinker {
+  const Container & adjacencyList_;
+  ConcurrentUnionFind<T> & sets_;
+  AdjacencyListLinker(const Container & adjacencyList, 
+    ConcurrentUnionFind<T> & sets) 
+    : adjacencyList_(adjacencyList), sets_(sets) {}
+  void operator()(std::size_t begin, std::size_t end, std::size_t) const
+  {
+    typedef typename Container::value_type::const_iterator IT; 
+    for (std::size_t node = begin; node < end; ++node) {
+      IT it = adjacencyList_[node].begin();
+      const IT last = adjacencyList_[node].end();
+      for (; it != last; ++it) sets_.unite(static_cast<T>(node), *it);
+    }
+  }
+};
+
+/** Unite the endpoints of all edges of a graph in CSR form */
+template <typename OffsetType, typename T>
+struct CSRLinker {
+  const std::vector<OffsetType> & offsets_;
+  const std::vector<T> & targets_;
+  ConcurrentUnionFind<T> & sets_;
+  CSRLinker(const std::vector<OffsetType> & offsets, 
+    const std::vector<T> & targets, ConcurrentUnionFind<T> & sets) 
+    : offsets_(offsets), targets_(targets), sets_(sets) {}
+  void operator()(std::size_t begin, std::size_t end, std::size_t) const
+  {
+    for (std::size_t node = begin; node < end; ++node) {
+      for (OffsetType e = offsets_[node]; e < offsets_[node + 1]; ++e) {
+        sets_.unite(static_cast<T>(node), targets_[e]);
+      }
+    }
+  }
+};
+
+/**
+ * Number the roots in ascending order (count per range, prefix sum, assign)
+ * and copy the label of its root to every other node.
+ */
+template <typename T>
+struct ComponentLabeler {
+  ConcurrentUnionFind<T> & sets_;
+  std::vector<T> & labels_;
+  std::vector<T> & counts_;
+  int phase_;
+  ComponentLabeler(ConcurrentUnionFind<T> & sets, std::vector<T> & labels,
+    std::vector<T> & counts) 
+    : sets_(sets), labels_(labels), counts_(counts), phase_(0) {}
+  void operator()(std::size_t begin, std::size_t end, std::size_t t) const
+  {
+    if (phase_ == 0) {
+      T roots = 0;
+      for (std::size_t node = begin; node < end; ++node) {
+        if (sets_.isRoot(static_cast<T>(node))) ++roots;
+      }
+      counts_[t] = roots;
+    } else if (phase_ == 1) {
+      T label = counts_[t];
+      for (std::size_t node = begin; node < end; ++node) {
+        if (sets_.isRoot(static_cast<T>(node))) labels_[node] = ++label;
+      }
+    } else {
+      for (std::size_t node = begin; node < end; ++node) {
+        if (!sets_.isRoot(static_cast<T>(node))) {
+          labels_[node] = labels_[sets_.find(static_cast<T>(node))];
+        }
+      }
+    }
+  }
+};
+
+template <typename T>
+T labelComponents(ConcurrentUnionFind<T> & sets, std::vector<T> & labels,
+  const std::size_t numThreads)
+{
+  const std::size_t n = sets.size();
+  const std::size_t numRanges = std::max<std::size_t>(1, std::min(numThreads, n));
+  labels.assign(n, 0);
+  std::vector<T> counts(numRanges, 0);
+  ComponentLabeler<T> labeler(sets, labels, counts);
+  forEachRange(n, numRanges, labeler);
+  T numComponents = 0;
+  for (std::size_t t = 0; t < numRanges; ++t) {
+    const T count = counts[t];
+    counts[t] = numComponents;
+    numComponents += count;
+  }
+  labeler.phase_ = 1;
+  forEachRange(n, numRanges, labeler);
+  labeler.phase_ = 2;
+  forEachRange(n, numRanges, labeler);
+  return numComponents;
+}
+
+} //end namespace fbi
+
+/**
+ * Parallel version of findConnectedComponents, the labels are identical:
+ * components are numbered from 1 in the order of their smallest node.
+ * \param adjacencyList e.g. SetA::ResultType
+ * \param labels The component of every node
+ * \param numThreads Only used if multithreading is enabled.
+ * \return The number of components
+ */
+template < class Container >
+typename Container::value_type::value_type
+findConnectedComponentsParallel(const Container & adjacencyList,
+  std::vector<typename Container::value_type::value_type>& labels,
+  const std::size_t numThreads = fbi::defaultNumThreads())
+{
+  typedef typename Container::value_type::value_type T;
+  fbi::ConcurrentUnionFind<T> sets(adjacencyList.size());
+  fbi::forEachRange(adjacencyList.size(), numThreads, 
+    fbi::AdjacencyListLinker<Container, T>(adjacencyList, sets));
+  return fbi::labelComponents(sets, labels, numThreads);
+}
+
+/**
+ * Same as above for a graph in compressed sparse row form: the neighbors of
+ * node i are targets[offsets[i]] .. targets[offsets[i+1]-1], offsets has
+ * one entry more than there are nodes.
+ */
+template <typename OffsetType, typename T>
+T findConnectedComponentsParallel(const std::vector<OffsetType> & offsets,
+  const std::vector<T> & targets, std::vector<T> & labels,
+  const std::size_t numThreads = fbi::defaultNumThreads())
+{
+  const std::size_t n = offsets.empty() ? 0 : offsets.size() - 1;
+  fbi::ConcurrentUnionFind<T> sets(n);
+  fbi::forEachRange(n, numThreads, 
+    fbi::CSRLinker<OffsetType, T>(offsets, targets, sets));
+  return fbi::labelComponents(sets, labels, numThreads);
+}
+
 #endif
@@ -0,0 +1,375 @@
+/* $Id: dimensionorder.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#ifndef __LIBFBI_INCLUDE_FBI_DIMENSIONORDER_H__
+#define __LIBFBI_INCLUDE_FBI_DIMENSIONORDER_H__
+
+//C++
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <vector>
+//c++0x
+#include <tuple>
+
+#include <fbi/config.h>
+#include <fbi/fbi.h>
+
+namespace fbi {
+
+/**
+ * \class DimensionOrder
+ * \brief Pick the dimension the HybridScanner splits first at runtime.
+ *
+ * SetA splits in the order of its TIndices, so SetA<Centroid,1,0> and 
+ * SetA<Centroid,0,1> find the same intersections in very different times:
+ * the first dimension decides how many boxes end up in the segment trees 
+ * of the next ones. DimensionOrder estimates for every dimension how 
+ * likely two boxes overlap in it from a sample of both sets (average 
+ * extent relative to the spread of the sample) and runs the SetA whose
+ * first dimension is the most selective one. The others keep their order, 
+ * which bounds the number of instantiated SetA types to the number of 
+ * dimensions instead of all permutations; for two dimensions this is 
+ * every order. The result is the same as the one of SetA<BoxType, 
+ * TIndices...>.
+ *
+ * Dimensions whose type is not arithmetic are never moved to the front.
+ *
+ * \tparam BoxType The type of the boxes, Traits<BoxType> has to be defined.
+ * \tparam TIndices The dimensions to intersect in, see \ref SetA.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+class DimensionOrder {
+ public:
+  typedef typename 
+    mpl::TypeExtractor<Traits<BoxType>, TIndices...>::key_type key_type;
+  typedef typename SetA<BoxType, TIndices...>::ResultType ResultType;
+  enum {NUMDIMS = sizeof...(TIndices)};
+  /** Number of boxes per set used to estimate the selectivities */
+  static const std::size_t defaultSampleSize = 1000;
+
+  /**
+   * \brief Estimate for every dimension the fraction of pairs of a data 
+   * and a query box that overlap in it, lower means more selective.
+   *
+   * For a sample of both sets this is (mean data extent + mean query 
+   * extent) / (max upper endpoint - min lower endpoint), which is the 
+   * overlap probability of uniformly placed intervals, capped at 1. 
+   * Dimensions of non-arithmetic type get 1.
+   * \param[in] sampleSize Take at most this many boxes of each container,
+   *  evenly spread.
+   * \see \ref SetA::SetB::intersect for the remaining parameters
+   */
+  template <class BoxContainer, class IntervalFunctor, class QContainer, 
+    class ... QueryFunctors>
+  static std::vector<double> selectivity(
+      const std::size_t sampleSize,
+      const BoxContainer & dataContainer,
+      const IntervalFunctor & ifunctor,
+      const QContainer & qdataContainer,
+      const QueryFunctors & ... qfunctors
+    )
+  {
+    return estimate(sampleSize, dataContainer, ifunctor, 
+      mpl::Indices<TIndices...>(), qdataContainer, qfunctors...);
+  }
+
+  /**
+   * Return the position (in TIndices) of the most selective dimension, the
+   * first one on ties.
+   */
+  static std::size_t leadingDimension(const std::vector<double> & selectivity)
+  {
+    return std::min_element(selectivity.begin(), selectivity.end()) - 
+      selectivity.begin();
+  }
+
+  /**
+   * \brief Self-intersection like \ref SetA::intersect, split in the 
+   * estimated best order.
+   */
+  template <class BoxContainer, class IntervalFunctor, 
+    class ... QueryFunctors>
+  static ResultType intersect(
+      const IntersectOptions & options,
+      const BoxContainer & dataContainer,
+      const IntervalFunctor & ifunctor,
+      const QueryFunctors & ... qfunctors
+    )
+  {
+    return SetB<BoxType, TIndices...>::intersect(options, dataContainer, 
+      ifunctor, dataContainer, qfunctors...);
+  }
+
+  /**
+   * \brief Bipartite intersection like \ref SetA::SetB, split in the 
+   * estimated best order. QIndices are reordered along with TIndices.
+   */
+  template <typename QBoxType, std::size_t ... QIndices>
+  struct SetB {
+    static_assert(sizeof...(QIndices) == sizeof...(TIndices), 
+      "Your number of query-dimensions doesn't match your initial indices");
+
+    template <class BoxContainer, class IntervalFunctor, class QContainer, 
+      class ... QueryFunctors>
+    static ResultType intersect(
+        const IntersectOptions & options,
+        const BoxContainer & dataContainer,
+        const IntervalFunctor & ifunctor,
+        const QContainer & qdataContainer,
+        const QueryFunctors & ... qfunctors
+      )
+    {
+      const std::size_t leading = leadingDimension(estimate(
+        defaultSampleSize, dataContainer, ifunctor, 
+        mpl::Indices<QIndices...>(), qdataContainer, qfunctors...));
+      ResultType result;
+      Dispatcher<NUMDIMS, QBoxType, QIndices...>::intersect(leading, result,
+        options, dataContainer, ifunctor, qdataContainer, qfunctors...);
+      return result;
+    }
+
+    /**
+     * Like \ref SetA::SetB::visitIntersections, the indices are the same 
+     * for every order.
+     */
+    template <class Visitor, class BoxContainer, class IntervalFunctor, 
+      class QContainer, class ... QueryFunctors>
+    static void visitIntersections(
+        Visitor & visitor,
+        const BoxContainer & dataContainer,
+        const IntervalFunctor & ifunctor,
+        const QContainer & qdataContainer,
+        const QueryFunctors & ... qfunctors
+      )
+    {
+      const std::size_t leading = leadingDimension(estimate(
+        defaultSampleSize, dataContainer, ifunctor, 
+        mpl::Indices<QIndices...>(), qdataContainer, qfunctors...));
+      Dispatcher<NUMDIMS, QBoxType, QIndices...>::visit(leading, visitor,
+        dataContainer, ifunctor, qdataContainer, qfunctors...);
+    }
+  };
+
+ private:
+  /** \ref selectivity with the indices of the query boxes */
+  template <class BoxContainer, class IntervalFunctor, class QContainer, 
+    std::size_t ... QIndices, class ... QueryFunctors>
+  static std::vector<double> estimate(
+      const std::size_t sampleSize,
+      const BoxContainer & dataContainer,
+      const IntervalFunctor & ifunctor,
+      mpl::Indices<QIndices...> queryIndices,
+      const QContainer & qdataContainer,
+      const QueryFunctors & ... qfunctors
+    )
+  {
+    std::vector<key_type> dataKeys, queryKeys;
+    appendKeys(dataKeys, sample(dataContainer, sampleSize), 
+      mpl::Indices<TIndices...>(), ifunctor);
+    appendKeys(queryKeys, sample(qdataContainer, sampleSize), queryIndices, 
+      qfunctors...);
+    std::vector<double> result(NUMDIMS, 1.0);
+    Estimator<0, NUMDIMS>::estimate(dataKeys, queryKeys, result);
+    return result;
+  }
+
+  /** Create the keys of all boxes with a functor, see \ref SetA::intersect */
+  template <class Container, std::size_t ... Indices, class Functor>
+  static void appendKeys(std::vector<key_type> & keys, 
+    const Container & boxes, mpl::Indices<Indices...>, const Functor & functor)
+  {
+    typename Container::const_iterator it = boxes.begin();
+    for (; it != boxes.end(); ++it) {
+      keys.push_back(key_type(functor.template get<Indices>(*it)...));
+    }
+  }
+
+  /** A vector of functors creates one key per functor and box */
+  template <class Container, std::size_t ... Indices, class Functor>
+  static void appendKeys(std::vector<key_type> & keys, 
+    const Container & boxes, mpl::Indices<Indices...> indices, 
+    const std::vector<Functor> & functors)
+  {
+    for (std::size_t i = 0; i < functors.size(); ++i) {
+      appendKeys(keys, boxes, indices, functors[i]);
+    }
+  }
+
+  template <class Container, std::size_t ... Indices, class Functor, 
+    class NextFunctor, class ... Functors>
+  static void appendKeys(std::vector<key_type> & keys, 
+    const Container & boxes, mpl::Indices<Indices...> indices, 
+    const Functor & functor, const NextFunctor & next, 
+    const Functors & ... functors)
+  {
+    appendKeys(keys, boxes, indices, functor);
+    appendKeys(keys, boxes, indices, next, functors...);
+  }
+
+  /** Copy at most sampleSize evenly spread objects of container */
+  template <class Container>
+  static std::vector<typename Container::value_type> 
+  sample(const Container & container, const std::size_t sampleSize)
+  {
+    std::vector<typename Container::value_type> result;
+    if (container.empty() || sampleSize == 0) return result;
+    const std::size_t step = 
+      std::max<std::size_t>(1, container.size() / sampleSize);
+    result.reserve(container.size() / step + 1);
+    typename Container::const_iterator it = container.begin();
+    for (std::size_t i = 0; i < container.size(); ++i, ++it) {
+      if (i % step == 0) result.push_back(*it);
+    }
+    return result;
+  }
+
+  /** Fill in the selectivity of the dimensions [Dim, Limit) */
+  template <std::size_t Dim, std::size_t Limit>
+  struct Estimator {
+    typedef typename std::tuple_element<Dim, key_type>::type::first_type T;
+
+    static void estimate(const std::vector<key_type> & dataKeys, 
+      const std::vector<key_type> & queryKeys, std::vector<double> & result)
+    {
+      result[Dim] = estimate(dataKeys, queryKeys, 
+        mpl::Bool2Type<std::is_arithmetic<T>::value>());
+      Estimator<Dim+1, Limit>::estimate(dataKeys, queryKeys, result);
+    }
+
+    static double estimate(const std::vector<key_type> &, 
+      const std::vector<key_type> &, mpl::Bool2Type<false>)
+    {
+      return 1.0;
+    }
+
+    static double estimate(const std::vector<key_type> & dataKeys, 
+      const std::vector<key_type> & queryKeys, mpl::Bool2Type<true>)
+    {
+      if (dataKeys.empty() || queryKeys.empty()) return 1.0;
+      double lower = std::numeric_limits<double>::max();
+      double upper = -std::numeric_limits<double>::max();
+      const double extent = meanExtent(dataKeys, lower, upper) + 
+        meanExtent(queryKeys, lower, upper);
+      if (!(upper > lower)) return 1.0;
+      return std::min(1.0, extent / (upper - lower));
+    }
+
+    static double meanExtent(const std::vector<key_type> & keys,
+      double & lower, double & upper)
+    {
+      double sum = 0.0;
+      for (std::size_t i = 0; i < keys.size(); ++i) {
+        const double head = static_cast<double>(std::get<Dim>(keys[i]).first);
+        const double tail = static_cast<double>(std::get<Dim>(keys[i]).second);
+        sum += tail - head;
+        lower = std::min(lower, head);
+        upper = std::max(upper, tail);
+      }
+      return sum / keys.size();
+    }
+  };
+
+  template <std::size_t Limit>
+  struct Estimator<Limit, Limit> {
+    static void estimate(const std::vector<key_type> &, 
+      const std::vector<key_type> &, std::vector<double> &) {}
+  };
+
+  /** Run a SetA::SetB with the given (reordered) index lists */
+  template <class DataIndices, class QueryIndices, typename QBoxType>
+  struct Runner;
+
+  template <std::size_t ... DIndices, std::size_t ... RQIndices, 
+    typename QBoxType>
+  struct Runner<mpl::Indices<DIndices...>, mpl::Indices<RQIndices...>, 
+    QBoxType> {
+    typedef typename SetA<BoxType, DIndices...>::template 
+      SetB<QBoxType, RQIndices...> SETB;
+  };
+
+  /**
+   * Select the SetA whose first dimension is the one at position 
+   * NUMDIMS - DimsLeft of TIndices if that one is leading, otherwise 
+   * try the next one.
+   */
+  template <std::size_t DimsLeft, typename QBoxType, std::size_t ... QIndices>
+  struct Dispatcher {
+    enum {Dim = NUMDIMS - DimsLeft};
+    typedef typename Runner<
+      typename mpl::MoveToFront<Dim, mpl::Indices<>, TIndices...>::type,
+      typename mpl::MoveToFront<Dim, mpl::Indices<>, QIndices...>::type,
+      QBoxType>::SETB SETB;
+    typedef Dispatcher<DimsLeft - 1, QBoxType, QIndices...> Next;
+
+    template <class BoxContainer, class IntervalFunctor, class QContainer, 
+      class ... QueryFunctors>
+    static void intersect(const std::size_t leading, ResultType & result,
+      const IntersectOptions & options, const BoxContainer & dataContainer,
+      const IntervalFunctor & ifunctor, const QContainer & qdataContainer,
+      const QueryFunctors & ... qfunctors)
+    {
+      if (leading != static_cast<std::size_t>(Dim)) {
+        Next::intersect(leading, result, options, dataContainer, ifunctor, 
+          qdataContainer, qfunctors...);
+        return;
+      }
+      result = SETB::intersect(options, dataContainer, ifunctor, 
+        qdataContainer, qfunctors...);
+    }
+
+    template <class Visitor, class BoxContainer, class IntervalFunctor, 
+      class QContainer, class ... QueryFunctors>
+    static void visit(const std::size_t leading, Visitor & visitor,
+      const BoxContainer & dataContainer, const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer, const QueryFunctors & ... qfunctors)
+    {
+      if (leading != static_cast<std::size_t>(Dim)) {
+        Next::visit(leading, visitor, dataContainer, ifunctor, 
+          qdataContainer, qfunctors...);
+        return;
+      }
+      SETB::visitIntersections(visitor, dataContainer, ifunctor, 
+        qdataContainer, qfunctors...);
+    }
+  };
+
+  /** All positions tried, cannot happen for a valid leading dimension */
+  template <typename QBoxType, std::size_t ... QIndices>
+  struct Dispatcher<0, QBoxType, QIndices...> {
+    template <class ... Args>
+    static void intersect(Args && ...) {}
+    template <class ... Args>
+    static void visit(Args && ...) {}
+  };
+};
+
+} // end namespace fbi
+
+#endif
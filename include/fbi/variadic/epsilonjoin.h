@@ -0,0 +1,404 @@
+/* $Id: epsilonjoin.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+
+#ifndef __LIBFBI_INCLUDE_FBI_EPSILONJOIN_H__
+#define __LIBFBI_INCLUDE_FBI_EPSILONJOIN_H__
+
+//C99
+#include <stdint.h>
+//C++
+#include <algorithm>
+#include <utility>
+#include <vector>
+//c++0x
+#include <array>
+#include <tuple>
+
+#include <fbi/config.h>
+#include <fbi/fbi.h>
+#include <fbi/connectedcomponents.h>
+#include <fbi/sortedjoin.h>
+
+namespace fbi {
+
+/**
+ * \struct Tolerance
+ * \brief The tolerance of one dimension of an \ref EpsilonJoin.
+ *
+ * A point x stands for the interval (lower(x), upper(x)), which is 
+ * [x - value, x + value] for an absolute tolerance and 
+ * [x * (1 - value * 1E-6), x * (1 + value * 1E-6)] for a relative one. These
+ * are the intervals the box generators of the examples build by hand, and
+ * they are computed with the same expressions, so the join finds the same 
+ * pairs as \ref SetA::intersect on the generated boxes. Relative tolerances 
+ * assume positive coordinates, e.g. m/z values.
+ */
+struct Tolerance {
+  enum Kind { ABSOLUTE, PPM };
+  Kind kind_;
+  double value_;
+
+  Tolerance() : kind_(ABSOLUTE), value_(0.0) {}
+  Tolerance(const Kind kind, const double value) 
+    : kind_(kind), value_(value) {}
+
+  static Tolerance absolute(const double value) {
+    return Tolerance(ABSOLUTE, value);
+  }
+  static Tolerance ppm(const double value) {
+    return Tolerance(PPM, value);
+  }
+
+  /**
+   * The interval of a point as x * lowerFactor_ - shift_ and 
+   * x * upperFactor_ + shift_, such that the kind is resolved once and not
+   * for every point. Multiplying by 1 and shifting by 0 are exact, hence
+   * the bounds are the same as the ones of \ref lower and \ref upper.
+   */
+  struct Bounds {
+    double lowerFactor_;
+    double upperFactor_;
+    double shift_;
+
+    template <typename T>
+    T lower(const T & x) const { return T(x * lowerFactor_ - shift_); }
+    template <typename T>
+    T upper(const T & x) const { return T(x * upperFactor_ + shift_); }
+  };
+
+  Bounds bounds() const {
+    const Bounds ppm = { 1 - value_ * 1E-6, 1 + value_ * 1E-6, 0.0 };
+    const Bounds absolute = { 1.0, 1.0, value_ };
+    return kind_ == PPM ? ppm : absolute;
+  }
+
+  template <typename T>
+  T lower(const T & x) const { return bounds().lower(x); }
+  template <typename T>
+  T upper(const T & x) const { return bounds().upper(x); }
+};
+
+/**
+ * \class EpsilonJoin
+ * \brief Find all pairs of points that lie within a per-dimension tolerance
+ *  of each other.
+ *
+ * Two points match if their tolerance intervals (see \ref Tolerance) 
+ * overlap in every dimension. Instead of keys with two endpoints per 
+ * dimension, the join stores a single coordinate per dimension, which halves
+ * the memory of the keys, and applies the tolerances when comparing. The
+ * points are sorted by their first coordinate once; as the tolerance 
+ * intervals are ordered the same way, the partners of a point in the first
+ * dimension form a contiguous window of the sorted points, and only those are
+ * tested in the remaining dimensions. The first dimension should hence be the
+ * most selective.
+ *
+ * The point functors have to provide get<N>(point) for every N in TIndices,
+ * returning the coordinate of the point in that dimension.
+ *
+ * \tparam PointType The type of the points, Traits<PointType> has to be 
+ *  defined, the coordinates have the type of the lower endpoints of its keys.
+ * \tparam TIndices The dimensions to join in, see \ref SetA.
+ */
+template <typename PointType, std::size_t ... TIndices>
+class EpsilonJoin {
+ public:
+  typedef uint32_t IntType;
+  typedef typename 
+    mpl::TypeExtractor<Traits<PointType>, TIndices...>::comp_type comp_type;
+  /** The coordinates of a point, one value per dimension */
+  typedef std::tuple<
+    typename std::tuple_element<TIndices, 
+      typename Traits<PointType>::key_type>::type::first_type ...
+    > point_type;
+  typedef std::array<Tolerance, sizeof...(TIndices)> tolerance_type;
+  /** Same layout as the result of \ref SetA::intersect */
+  typedef typename SetA<PointType, TIndices...>::ResultType ResultType;
+
+ private:
+  enum {NUMDIMS = sizeof...(TIndices)};
+  typedef typename std::tuple_element<0, point_type>::type HeadType;
+  typedef typename std::tuple_element<0, comp_type>::type HeadLess;
+  /** The \ref Tolerance::Bounds of every dimension */
+  typedef std::array<Tolerance::Bounds, sizeof...(TIndices)> bounds_type;
+
+  static bounds_type getBounds(const tolerance_type & tolerances)
+  {
+    bounds_type bounds;
+    for (std::size_t i = 0; i < bounds.size(); ++i) {
+      bounds[i] = tolerances[i].bounds();
+    }
+    return bounds;
+  }
+
+  /** Check if the tolerance intervals of a and b overlap in [Dim,Limit) */
+  template <std::size_t Dim, std::size_t Limit>
+  struct Tester {
+    static bool test(const point_type & a, const point_type & b, 
+      const bounds_type & bounds)
+    {
+      typename std::tuple_element<Dim, comp_type>::type less;
+      const Tolerance::Bounds & t = bounds[Dim];
+      return less(t.lower(std::get<Dim>(a)), t.upper(std::get<Dim>(b))) &&
+        less(t.lower(std::get<Dim>(b)), t.upper(std::get<Dim>(a))) &&
+        Tester<Dim+1, Limit>::test(a, b, bounds);
+    }
+  };
+
+  template <std::size_t Limit>
+  struct Tester<Limit, Limit> {
+    static bool test(const point_type &, const point_type &, 
+      const bounds_type &)
+    {
+      return true;
+    }
+  };
+
+  /** Order points by their first coordinate */
+  struct PointLess {
+    bool operator()(const point_type & a, const point_type & b) const {
+      return HeadLess()(std::get<0>(a), std::get<0>(b));
+    }
+  };
+
+  /** The points of one set, sorted by their first coordinate */
+  typedef sortedjoin::SortedTuples<point_type, PointLess, TIndices...> 
+    SortedPoints;
+
+  /** 
+   * True for the data points whose tolerance interval in the first 
+   * dimension ends at or before the one of the query point starts.
+   */
+  struct EndsBefore {
+    const Tolerance::Bounds & tolerance_;
+    explicit EndsBefore(const Tolerance::Bounds & tolerance) 
+      : tolerance_(tolerance) {}
+    bool operator()(const point_type & d, const point_type & q) const {
+      return !HeadLess()(tolerance_.lower(std::get<0>(q)), 
+        tolerance_.upper(std::get<0>(d)));
+    }
+  };
+
+  /** 
+   * Report the matching pairs of the points [begin, end) with themselves
+   * and the points after them.
+   */
+  template <class Visitor>
+  static void sweep(Visitor & visitor, const SortedPoints & data, 
+    const bounds_type & bounds, const std::size_t begin, 
+    const std::size_t end)
+  {
+    const std::vector<point_type> & points = data.tuples_;
+    const Tolerance::Bounds & t = bounds[0];
+    HeadLess less;
+    for (std::size_t i = begin; i < end; ++i) {
+      const HeadType lower = t.lower(std::get<0>(points[i]));
+      const HeadType upper = t.upper(std::get<0>(points[i]));
+      if (Tester<0, NUMDIMS>::test(points[i], points[i], bounds)) {
+        visitor(data.index_[i], data.index_[i]);
+      }
+      for (std::size_t j = i + 1; j < points.size() && 
+        less(t.lower(std::get<0>(points[j])), upper); ++j) {
+        if (less(lower, t.upper(std::get<0>(points[j]))) &&
+          Tester<1, NUMDIMS>::test(points[i], points[j], bounds)) {
+          visitor(data.index_[i], data.index_[j]);
+        }
+      }
+    }
+  }
+
+  /** Report the matching pairs of the query points [begin, end) */
+  template <class Visitor>
+  static void sweep(Visitor & visitor, const SortedPoints & data, 
+    const SortedPoints & queries, const bounds_type & bounds, 
+    const std::size_t begin, const std::size_t end)
+  {
+    const std::vector<point_type> & dpoints = data.tuples_;
+    const std::vector<point_type> & qpoints = queries.tuples_;
+    if (begin == end) return;
+    const Tolerance::Bounds & t = bounds[0];
+    HeadLess less;
+    std::size_t first = std::lower_bound(dpoints.begin(), dpoints.end(), 
+      qpoints[begin], EndsBefore(t)) - dpoints.begin();
+    for (std::size_t q = begin; q < end; ++q) {
+      const HeadType lower = t.lower(std::get<0>(qpoints[q]));
+      const HeadType upper = t.upper(std::get<0>(qpoints[q]));
+      while (first < dpoints.size() && 
+        !less(lower, t.upper(std::get<0>(dpoints[first])))) {
+        ++first;
+      }
+      for (std::size_t d = first; d < dpoints.size() && 
+        less(t.lower(std::get<0>(dpoints[d])), upper); ++d) {
+        if (Tester<1, NUMDIMS>::test(qpoints[q], dpoints[d], bounds)) {
+          visitor(data.index_[d], queries.index_[q]);
+        }
+      }
+    }
+  }
+
+  typedef std::pair<IntType, IntType> Edge;
+
+  /** Sweep a range of sorted points for \ref intersect */
+  struct PointSweep {
+    const SortedPoints & data_;
+    const SortedPoints * queries_;
+    const bounds_type & bounds_;
+
+    PointSweep(const SortedPoints & data, const SortedPoints * queries,
+      const bounds_type & bounds)
+      : data_(data), queries_(queries), bounds_(bounds) {}
+
+    template <class Visitor>
+    void operator()(Visitor & visitor, const std::size_t begin, 
+      const std::size_t end) const 
+    {
+      if (queries_) {
+        sweep(visitor, data_, *queries_, bounds_, begin, end);
+      } else {
+        sweep(visitor, data_, bounds_, begin, end);
+      }
+    }
+  };
+
+  /** Collect the edges of all threads in an undirected adjacency list */
+  static void collect(std::vector<std::vector<Edge> > & edges, 
+    const std::size_t offset, ResultType & result)
+  {
+    for (std::size_t t = 0; t < edges.size(); ++t) {
+      for (std::size_t i = 0; i < edges[t].size(); ++i) {
+        const IntType a = edges[t][i].first;
+        const IntType b = static_cast<IntType>(offset + edges[t][i].second);
+        result[a].insert(result[a].end(), b);
+        if (a != b) {
+          result[b].insert(result[b].end(), a);
+        }
+      }
+      std::vector<Edge>().swap(edges[t]);
+    }
+#ifndef __LIBFBI_USE_SET_FOR_RESULT__
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      std::sort(result[i].begin(), result[i].end());
+    }
+#endif
+  }
+
+ public:
+  /**
+   * Call visitor(a, b) once for every pair of matching points a and b in 
+   * data, including a == b for points whose tolerance intervals are not 
+   * empty.
+   *
+   * \param[in,out] visitor Called with two IntType values.
+   * \param[in] data Container of points.
+   * \param[in] functor Extracts the coordinates of the points.
+   * \param[in] tolerances The tolerance of every dimension.
+   */
+  template <class Visitor, class Container, class PointFunctor>
+  static void visit(Visitor & visitor, const Container & data, 
+    const PointFunctor & functor, const tolerance_type & tolerances)
+  {
+    const SortedPoints points(data, functor);
+    sweep(visitor, points, getBounds(tolerances), 0, points.size());
+  }
+
+  /**
+   * Call visitor(d, q) for every data point d and query point q that match.
+   *
+   * \param[in,out] visitor Called with two IntType values.
+   * \param[in] data Container of data points.
+   * \param[in] functor Extracts the coordinates of the data points.
+   * \param[in] queries Container of query points.
+   * \param[in] qfunctor Extracts the coordinates of the query points.
+   * \param[in] tolerances The tolerance of every dimension, used for both
+   *  sets.
+   */
+  template <class Visitor, class Container, class QContainer, 
+    class PointFunctor, class QueryFunctor>
+  static void visit(Visitor & visitor, const Container & data, 
+    const PointFunctor & functor, const QContainer & queries, 
+    const QueryFunctor & qfunctor, const tolerance_type & tolerances)
+  {
+    const SortedPoints dpoints(data, functor);
+    const SortedPoints qpoints(queries, qfunctor);
+    sweep(visitor, dpoints, qpoints, getBounds(tolerances), 0, 
+      qpoints.size());
+  }
+
+  /**
+   * Like the self-join \ref visit, but return the pairs as an adjacency
+   * list, which is what \ref SetA::intersect gives for the boxes built from
+   * the tolerance intervals.
+   * \param[in] numThreads The points are split between that many threads
+   *  if multithreading is enabled.
+   */
+  template <class Container, class PointFunctor>
+  static ResultType intersect(const Container & data, 
+    const PointFunctor & functor, const tolerance_type & tolerances,
+    const std::size_t numThreads = defaultNumThreads())
+  {
+    const SortedPoints points(data, functor);
+    const std::size_t n = points.size();
+    const bounds_type bounds = getBounds(tolerances);
+    std::vector<std::vector<Edge> > edges = sortedjoin::collectEdges<Edge>(
+      n, numThreads, PointSweep(points, 0, bounds));
+    ResultType result(n);
+    collect(edges, 0, result);
+    return result;
+  }
+
+  /**
+   * Like the bipartite \ref visit, but return the pairs as an adjacency 
+   * list with the layout of the bipartite \ref SetB::intersect: the query
+   * points are identified by |data|..|data|+|queries|-1.
+   * \param[in] numThreads The query points are split between that many 
+   *  threads if multithreading is enabled.
+   */
+  template <class Container, class QContainer, 
+    class PointFunctor, class QueryFunctor>
+  static ResultType intersect(const Container & data, 
+    const PointFunctor & functor, const QContainer & queries, 
+    const QueryFunctor & qfunctor, const tolerance_type & tolerances,
+    const std::size_t numThreads = defaultNumThreads())
+  {
+    const SortedPoints dpoints(data, functor);
+    const SortedPoints qpoints(queries, qfunctor);
+    const std::size_t n = qpoints.size();
+    const bounds_type bounds = getBounds(tolerances);
+    std::vector<std::vector<Edge> > edges = sortedjoin::collectEdges<Edge>(
+      n, numThreads, PointSweep(dpoints, &qpoints, bounds));
+    ResultType result(dpoints.size() + n);
+    collect(edges, dpoints.size(), result);
+    return result;
+  }
+};
+
+} // end namespace fbi
+
+#endif
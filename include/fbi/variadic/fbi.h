@@ -29,17 +29,21 @@
 
 //C99
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 //C++
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <set>
 #include <utility>
 #include <vector>
 #include <iostream>
 #include <functional>
 //c++0x
+#include <chrono>
 #include <random>
 #include <tuple>
 //tree
@@ -47,8 +51,10 @@
 #include <fbi/traits.h>
 
 #include <fbi/tuplegenerator.h>
+#include <fbi/numa.h>
 
 #ifdef __LIBFBI_USE_MULTITHREADING__
+#include <mutex>
 #include <thread>
 #endif
 
@@ -83,6 +89,162 @@ namespace mutex {
 }
 #endif
 
+/**
+ * \class IntersectOptions
+ * \brief Runtime knobs for \ref SetA::intersect and
+ *  \ref SetA::SetB::intersect, only overlaps_ changes the result.
+ */
+struct IntersectOptions {
+  /**
+   * Also known as theta: if the number of points or intervals in a
+   * HybridScanner call falls below this value, switch to brute-force scanning.
+   */
+  std::size_t cutoff_;
+  /**
+   * Sort the keys of both sets along a Morton (Z-order) curve over the box
+   * centers before the scan. Boxes that are close in space are then close in
+   * memory, which reduces cache and TLB misses in the partition loops for
+   * large inputs given in no particular order. Dimensions with
+   * non-arithmetic key types do not contribute to the curve.
+   */
+  bool spatialOrder_;
+  /**
+   * Maximum number of query functors whose keys are held in memory at the
+   * same time (every element of a functor vector counts as one). The scan
+   * then runs once per batch against the same data keys, so memory for the
+   * query keys stays O(|queries| * queryBatchSize_) no matter how many 
+   * functors are passed, at the price of repartitioning the data keys in
+   * every pass. 0 means all functors at once.
+   */
+  std::size_t queryBatchSize_;
+  /**
+   * Only used by \ref SetA::annotatedIntersect: also store the overlap of
+   * the two keys of every edge.
+   */
+  bool overlaps_;
+  /**
+   * Split the data boxes into that many contiguous ranges and scan every
+   * range against all query boxes in a worker thread of its own (one after
+   * the other without multithreading). Every worker creates the data keys it
+   * scans itself, so that their memory is first touched, and hence placed,
+   * by the thread that reads it. The query keys of a batch (see 
+   * queryBatchSize_) are created once on the calling thread and shared 
+   * read-only by all workers. 0 and 1 mean a single scan on the calling 
+   * thread.
+   */
+  std::size_t partitions_;
+  /**
+   * Pin the worker of partition p to the CPUs of NUMA node
+   * p % NumaTopology::numNodes() before it creates its keys, see
+   * \ref NumaTopology. Use partitions_ = NumaTopology::get().numNodes() 
+   * (or a multiple of it) to keep every node busy with local memory.
+   */
+  bool pinPartitions_;
+  /**
+   * Only build segment trees over the first scanDimensions_ dimensions; 
+   * below them, the candidates are swept in the last of these dimensions
+   * and the remaining ones are checked box by box. Every dimension the
+   * HybridScanner recurses into multiplies the number of partitions, which
+   * does not pay off for many (say more than 4) dimensions with few
+   * selective ones, e.g. feature vectors. Put the most selective dimensions
+   * first. 0 means all dimensions.
+   */
+  std::size_t scanDimensions_;
+  /** The algorithms \ref engine_ can choose from */
+  enum Engine {
+    /** 
+     * SWEEP for one dimension, else GRID if the boxes qualify for it, 
+     * SEGMENT_TREE otherwise 
+     */
+    ENGINE_AUTO,
+    /** The HybridScanner, i.e. segment trees and sweeps */
+    ENGINE_SEGMENT_TREE,
+    /** Hash boxes into grid cells the size of the largest box */
+    ENGINE_GRID,
+    /** A single sweep along the first dimension */
+    ENGINE_SWEEP
+  };
+  /**
+   * How to find the intersections. ENGINE_GRID bins the boxes into cells
+   * of a uniform grid over the first two dimensions, sized from the 
+   * largest extent in each, and only tests boxes in neighboring cells. 
+   * This beats the segment trees if all boxes have about the same size 
+   * (e.g. XIC construction), and is useless if a few large boxes blow up
+   * the cells. ENGINE_AUTO picks it if the mean extent is at least half of
+   * the largest one and the grid has at least four cells in both 
+   * dimensions. Both dimensions need arithmetic types ordered by 
+   * std::less, otherwise the segment trees are used.
+   * ENGINE_SWEEP sorts both sets by their lower endpoint in the first 
+   * dimension and sweeps over them once, keeping the boxes that are still
+   * open in a plain list and testing the remaining dimensions pair by 
+   * pair. It has none of the overhead of the segment trees (medians, 
+   * three-way partitions, two passes), so ENGINE_AUTO always uses it for
+   * a single dimension. For two or more dimensions it pays off if nearly
+   * all selectivity is in the first one.
+   */
+  Engine engine_;
+  /**
+   * Bytes the edges may take while they are collected, 0 means no limit.
+   * \ref SetA::intersect estimates the size of the adjacency list from a 
+   * sample of the query boxes first. If it would exceed the budget, the 
+   * edges are collected in a flat buffer of at most this size instead,
+   * which is sorted and written to a temporary file whenever it is full,
+   * and the rows of the result are only allocated at the end, with their
+   * exact sizes. This avoids the slack of growing rows and the 
+   * duplicate edges reported by several query functors. The result itself
+   * can still exceed the budget; use \ref SetA::compactIntersect for a 
+   * smaller result and queryBatchSize_ to bound the memory of the keys.
+   */
+  std::size_t memoryBudget_;
+
+  IntersectOptions() 
+    : cutoff_(250), spatialOrder_(false), queryBatchSize_(0), overlaps_(false),
+      partitions_(0), pinPartitions_(false), scanDimensions_(0), 
+      engine_(ENGINE_AUTO), memoryBudget_(0)
+  {}
+};
+
+/**
+ * \class IntersectEstimate
+ * \brief What an intersection will cost, see \ref SetA::estimate.
+ *
+ * Every quantity comes as an estimate with a lower and an upper bound.
+ */
+struct IntersectEstimate {
+  /** An estimated quantity and its bounds */
+  struct Range {
+    double value_;
+    double low_;
+    double high_;
+    Range() : value_(0.0), low_(0.0), high_(0.0) {}
+  };
+  /**
+   * Number of intersecting pairs of a query key and a data key, which is
+   * the number of edges the scanners report (an edge between two boxes is
+   * reported once per query functor that finds it, and twice in a
+   * self-join). The bounds are a 95% confidence interval from the spread
+   * of the counts of the sampled query boxes.
+   */
+  Range pairs_;
+  /**
+   * Seconds the intersection takes on the calling thread: the scan, 
+   * extrapolated from timed runs on samples of increasing size, and the
+   * recording of the pairs. The bounds follow from the bounds of pairs_ 
+   * and from how badly the runtime model fits the samples, at least 25%.
+   */
+  Range seconds_;
+  /**
+   * Bytes of the keys, the key pointers and the result at the end of the
+   * scan. The bounds follow from the bounds of pairs_ and from rows that 
+   * are filled exactly or up to twice their size.
+   */
+  Range peakBytes_;
+  /** Number of query boxes the pair counts are based on */
+  std::size_t sampleSize_;
+
+  IntersectEstimate() : sampleSize_(0) {}
+};
+
 template <typename BoxType, std::size_t ... TIndices>
 class SetA{
 
@@ -165,6 +327,17 @@ typedef typename
     mpl::TypeExtractor<Traits<value_type>, TIndices...>::comp_type
       comp_type;
 
+  enum {
+    /**
+     * All dimensions hold the same arithmetic type with std::less, the 
+     * \ref OneWayScanner then compares the keys as flat arrays of 
+     * endpoints, see \ref mpl::FlatKey.
+     */
+    FLATKEYS = mpl::FlatKey<key_type, comp_type>::value
+  };
+  /** The type of all endpoints if FLATKEYS is set, void otherwise */
+  typedef typename mpl::FlatKey<key_type, comp_type>::value_type flat_type;
+
  public:
   /** 
    * Every intersection between two elements will be represented by their 
@@ -186,6 +359,50 @@ typedef typename
   typedef std::vector<std::vector<IntType> > ResultType; 
 #endif
 
+  /**
+   * The result of \ref annotatedIntersect. 
+   *
+   * edges_[q] holds a (neighbor, functor) pair for every box whose key
+   * intersects the query key that query functor number functor created for
+   * box q, sorted and without duplicates. The query functors are numbered in
+   * the order they were passed, every element of a functor vector counts as
+   * one. Box indices are the same as in ResultType, but every edge is only
+   * stored once, in the row of its query box.
+   * If requested (see \ref IntersectOptions::overlaps_), overlaps_[q][i] 
+   * is the intersection of the two keys of edges_[q][i], otherwise 
+   * overlaps_ is empty.
+   */
+  struct AnnotatedResultType {
+    typedef std::pair<IntType, IntType> edge_type;
+    /** Per dimension, the interval both keys have in common */
+    typedef key_type overlap_type;
+    std::vector<std::vector<edge_type> > edges_;
+    std::vector<std::vector<overlap_type> > overlaps_;
+  };
+
+  /** A neighbor and its score, see \ref scoredIntersect */
+  typedef std::pair<IntType, double> ScoredEdge;
+
+  /**
+   * The result of \ref scoredIntersect: per query box, the best scoring
+   * neighbors by ascending score (ties are broken by index), like 
+   * Nearest::ResultType.
+   */
+  typedef std::vector<std::vector<ScoredEdge> > ScoredResultType;
+
+  /**
+   * The result of \ref compactIntersect: the adjacency list of 
+   * ResultType in compressed sparse row form. The neighbors of box i are
+   * targets_[offsets_[i]] .. targets_[offsets_[i+1]-1], sorted and without
+   * duplicates; offsets_ has one entry more than there are boxes. This 
+   * needs a single allocation for all edges instead of one per box, see
+   * also findConnectedComponentsParallel.
+   */
+  struct CompactResultType {
+    std::vector<std::size_t> offsets_;
+    std::vector<IntType> targets_;
+  };
+
 
   /** 
     * \class SetB
@@ -326,6 +543,34 @@ typedef typename
   struct IntersectionTester<Limit, Limit>;
 #endif
 
+  /** 
+   * \class FlatCopier
+   * \brief Copy the endpoints of a key in all dimensions in [Dim,Limit) 
+   * to flat arrays, see \ref FLATKEYS.
+   */
+  template <std::size_t Dim, std::size_t Limit>
+  struct FlatCopier;
+
+#ifdef __INTEL_COMPILER
+  /* Extra Declaration for ICC */
+  template <std::size_t Limit>
+  struct FlatCopier<Limit, Limit>;
+#endif
+
+  /**
+   * \class GridScanner
+   * \brief Join boxes of similar size through a uniform grid, 
+   * see \ref IntersectOptions::ENGINE_GRID.
+   */
+  struct GridScanner;
+
+  /**
+   * \class SweepScanner
+   * \brief Sweep-and-prune along the first dimension, 
+   * see \ref IntersectOptions::ENGINE_SWEEP.
+   */
+  struct SweepScanner;
+
   /** 
    * \class KeyPrinter 
    * \brief For Debug reasons, print all dimensions of a given key via cout.
@@ -338,6 +583,56 @@ typedef typename
   struct KeyPrinter<Limit, Limit>;
 #endif
 
+  /**
+   * \class CurveEncoder
+   * \brief Map the centers of keys in dimensions [Dim,Limit) to cells of a
+   *  regular grid, used to order the keys along a space-filling curve.
+   * \see \ref IntersectOptions::spatialOrder_
+   */
+  template <std::size_t Dim, std::size_t Limit>
+  struct CurveEncoder;
+#ifdef __INTEL_COMPILER
+  /* Extra Declaration for ICC */
+  template <std::size_t Limit>
+  struct CurveEncoder<Limit, Limit>;
+#endif
+
+  /**
+   * \class OverlapCalculator
+   * \brief Intersect two keys in all dimensions in [Dim,Limit), see 
+   *  \ref AnnotatedResultType.
+   */
+  template <std::size_t Dim, std::size_t Limit>
+  struct OverlapCalculator;
+#ifdef __INTEL_COMPILER
+  /* Extra Declaration for ICC */
+  template <std::size_t Limit>
+  struct OverlapCalculator<Limit, Limit>;
+#endif
+
+  /**
+   * \class TopKCollector
+   * \brief Keep the k best scoring neighbors of every query box in a 
+   *  bounded heap, see \ref scoredIntersect.
+   */
+  template <class Scorer, class BoxContainer, class QContainer>
+  struct TopKCollector;
+
+  /**
+   * \class EdgeSpool
+   * \brief Collect edges in a bounded buffer that spills to a temporary 
+   *  file, see \ref IntersectOptions::memoryBudget_.
+   */
+  struct EdgeSpool;
+
+  /**
+   * \class EdgeBatch
+   * \brief Pass the intersections a scanner finds to the sink in batches,
+   *  holding the sink mutex only while a batch is added.
+   */
+  template <class Sink>
+  struct EdgeBatch;
+
  public:
 
 
@@ -458,6 +753,209 @@ typedef typename
                 thetaIntersect(cutoff, dataContainer, ifunctor, dataContainer, qfunctors...);
           }
 
+  /**
+   * \brief Like \ref intersect, but with explicit tuning parameters.
+   *
+   * \param[in] options See \ref IntersectOptions, the result is the same
+   * for all options.
+   * \see \ref SetB::intersect
+   */
+  template <
+  class BoxContainer,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+          static
+          ResultType intersect(
+            const IntersectOptions & options,
+            const BoxContainer & dataContainer,
+            const IntervalFunctor & ifunctor,
+            const QueryFunctors & ... qfunctors
+            )
+          {
+            return SetB<BoxType, TIndices...>::
+                intersect(options, dataContainer, ifunctor, dataContainer, qfunctors...);
+          }
+
+  /**
+   * \brief Like \ref intersect, but also report which query functor 
+   * produced every edge.
+   *
+   * \see \ref SetB::annotatedIntersect
+   */
+  template <
+  class BoxContainer,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+          static
+          AnnotatedResultType annotatedIntersect(
+            const IntersectOptions & options,
+            const BoxContainer & dataContainer,
+            const IntervalFunctor & ifunctor,
+            const QueryFunctors & ... qfunctors
+            )
+          {
+            return SetB<BoxType, TIndices...>::annotatedIntersect(options, 
+                dataContainer, ifunctor, dataContainer, qfunctors...);
+          }
+
+  /** \brief \ref annotatedIntersect with the default options */
+  template <
+  class BoxContainer,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+          static
+          AnnotatedResultType annotatedIntersect(
+            const BoxContainer & dataContainer,
+            const IntervalFunctor & ifunctor,
+            const QueryFunctors & ... qfunctors
+            )
+          {
+            return SetB<BoxType, TIndices...>::annotatedIntersect(
+                IntersectOptions(), dataContainer, ifunctor, dataContainer, 
+                qfunctors...);
+          }
+
+  /**
+   * \brief Like \ref intersect, but return the adjacency list in 
+   * compressed sparse row form.
+   *
+   * \see \ref SetB::compactIntersect
+   */
+  template <
+  class BoxContainer,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+          static
+          CompactResultType compactIntersect(
+            const IntersectOptions & options,
+            const BoxContainer & dataContainer,
+            const IntervalFunctor & ifunctor,
+            const QueryFunctors & ... qfunctors
+            )
+          {
+            return SetB<BoxType, TIndices...>::compactIntersect(options, 
+                dataContainer, ifunctor, dataContainer, qfunctors...);
+          }
+
+  /**
+   * \brief Estimate what \ref intersect with the same arguments will cost.
+   *
+   * \see \ref SetB::estimate
+   */
+  template <
+  class BoxContainer,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+          static
+          IntersectEstimate estimate(
+            const IntersectOptions & options,
+            const BoxContainer & dataContainer,
+            const IntervalFunctor & ifunctor,
+            const QueryFunctors & ... qfunctors
+            )
+          {
+            return SetB<BoxType, TIndices...>::estimate(options, 
+                dataContainer, ifunctor, dataContainer, qfunctors...);
+          }
+
+  /**
+   * \brief Like \ref intersect, but only keep the k best scoring 
+   * neighbors of every box.
+   *
+   * \see \ref SetB::scoredIntersect
+   */
+  template <
+  class Scorer,
+  class BoxContainer,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+          static
+          ScoredResultType scoredIntersect(
+            const IntersectOptions & options,
+            const std::size_t k,
+            const Scorer & scorer,
+            const BoxContainer & dataContainer,
+            const IntervalFunctor & ifunctor,
+            const QueryFunctors & ... qfunctors
+            )
+          {
+            return SetB<BoxType, TIndices...>::scoredIntersect(options, k, 
+                scorer, dataContainer, ifunctor, dataContainer, qfunctors...);
+          }
+
+  /** \brief \ref scoredIntersect with the default options */
+  template <
+  class Scorer,
+  class BoxContainer,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+          static
+          ScoredResultType scoredIntersect(
+            const std::size_t k,
+            const Scorer & scorer,
+            const BoxContainer & dataContainer,
+            const IntervalFunctor & ifunctor,
+            const QueryFunctors & ... qfunctors
+            )
+          {
+            return SetB<BoxType, TIndices...>::scoredIntersect(
+                IntersectOptions(), k, scorer, dataContainer, ifunctor, 
+                dataContainer, qfunctors...);
+          }
+
+  /**
+   * \brief Like \ref intersect, but hand every intersecting pair to a 
+   * visitor instead of building the adjacency list.
+   *
+   * \see \ref SetB::visitIntersections
+   */
+  template <
+  class Visitor,
+  class BoxContainer,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+          static
+          void visitIntersections(
+            const IntersectOptions & options,
+            Visitor & visitor,
+            const BoxContainer & dataContainer,
+            const IntervalFunctor & ifunctor,
+            const QueryFunctors & ... qfunctors
+            )
+          {
+            SetB<BoxType, TIndices...>::visitIntersections(options, visitor, 
+                dataContainer, ifunctor, dataContainer, qfunctors...);
+          }
+
+  /** \brief \ref visitIntersections with the default options */
+  template <
+  class Visitor,
+        typename = typename std::enable_if<!std::is_same<typename std::remove_const<Visitor>::type, IntersectOptions>::value>::type,
+  class BoxContainer,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+          static
+          void visitIntersections(
+            Visitor & visitor,
+            const BoxContainer & dataContainer,
+            const IntervalFunctor & ifunctor,
+            const QueryFunctors & ... qfunctors
+            )
+          {
+            SetB<BoxType, TIndices...>::visitIntersections(
+                IntersectOptions(), visitor, dataContainer, ifunctor, 
+                dataContainer, qfunctors...);
+          }
+
 
 
 
@@ -524,7 +1022,19 @@ typedef typename
   
   static const std::vector<const key_type *>
   createPtrVector (const std::vector<key_type> & container) {
-    std::vector<const key_type *> ptrVector(container.size());
+    std::vector<const key_type *> ptrVector;
+    fillPtrVector(container, ptrVector);
+    return ptrVector;
+  }
+
+  /** 
+   * Like \ref createPtrVector, but overwrite ptrVector, such that its 
+   * memory can be reused.
+   */
+  static void
+  fillPtrVector (const std::vector<key_type> & container, 
+    std::vector<const key_type *> & ptrVector) {
+    ptrVector.resize(container.size());
     typename std::vector<key_type>::const_iterator it = container.begin();
     std::size_t i = 0;
     while (it != container.end()){
@@ -532,7 +1042,6 @@ typedef typename
       ++it;
       ++i;
     }
-    return ptrVector;
   }
 
 
@@ -674,13 +1183,135 @@ typedef typename
     return (size_t)(log((double)numElements));
   }
 
-}; //end class tree
-
-
+  /**
+   * Record an intersection found by the \ref OneWayScanner in the 
+   * adjacency list, in both directions.
+   */
+  static inline void 
+  addEdge(ResultType & resultVector, const std::size_t edgeHead, 
+    const std::size_t edgeTail)
+  {
+    resultVector[edgeHead].insert(resultVector[edgeHead].end(),static_cast<IntType>(edgeTail));
+    resultVector[edgeTail].insert(resultVector[edgeTail].end(),static_cast<IntType>(edgeHead));
+  }
 
+  /**
+   * Pass an intersection found by the \ref OneWayScanner to a user defined
+   * visitor instead, see \ref SetB::visitIntersections.
+   */
+  template <class Visitor>
+  static inline void 
+  addEdge(Visitor & visitor, const std::size_t edgeHead, 
+    const std::size_t edgeTail)
+  {
+    visitor(static_cast<IntType>(edgeHead), static_cast<IntType>(edgeTail));
+  }
 
+  /**
+   * Record an intersection between the keys point and interval found by 
+   * the \ref OneWayScanner in the sink.
+   * \param[in] pointsContainQueries True if point is a query key.
+   */
+  template <class Sink>
+  static inline void 
+  addEdge(Sink & sink, const State & state, const bool pointsContainQueries,
+    const key_type * point, const key_type * interval)
+  {
+    addEdge(sink, state.calculate(pointsContainQueries, point), 
+      state.calculate(!pointsContainQueries, interval));
+  }
 
-template <typename BoxType, std::size_t ... TIndices>
+  /**
+   * Record an intersection in the row of the query box, along with the
+   * number of the query functor and optionally the overlap.
+   */
+  static inline void 
+  addEdge(AnnotatedResultType & result, const State & state, 
+    const bool pointsContainQueries, const key_type * point, 
+    const key_type * interval)
+  {
+    const key_type * query = pointsContainQueries ? point : interval;
+    const key_type * data = pointsContainQueries ? interval : point;
+    const std::size_t head = state.calculate(true, query);
+    result.edges_[head].push_back(typename AnnotatedResultType::edge_type(
+      static_cast<IntType>(state.calculate(false, data)),
+      static_cast<IntType>(state.functor(query))));
+    if (!result.overlaps_.empty()) {
+      key_type overlap;
+      OverlapCalculator<0, NUMDIMS>::compute(*query, *data, overlap);
+      result.overlaps_[head].push_back(overlap);
+    }
+  }
+
+  /**
+   * Score an intersection and offer it to the heap of the query box.
+   */
+  template <class Scorer, class BoxContainer, class QContainer>
+  static inline void 
+  addEdge(TopKCollector<Scorer, BoxContainer, QContainer> & collector, 
+    const State & state, const bool pointsContainQueries, 
+    const key_type * point, const key_type * interval)
+  {
+    collector.add(
+      state.calculate(true, pointsContainQueries ? point : interval),
+      state.calculate(false, pointsContainQueries ? interval : point));
+  }
+
+  /**
+   * Sort keys along a Morton (Z-order) curve over their centers, see
+   * \ref IntersectOptions::spatialOrder_.
+   *
+   * \param[in,out] keys The keys to reorder.
+   * \return For every new position, the position the key had before.
+   */
+  static std::vector<IntType>
+  sortAlongCurve(std::vector<key_type> & keys)
+  {
+    // split the 64 bit code evenly between the dimensions
+    const unsigned int bits = std::min<unsigned int>(32, 64 / NUMDIMS);
+    const double maxCell = static_cast<double>((uint64_t(1) << bits) - 1);
+    double lower[NUMDIMS], upper[NUMDIMS], scale[NUMDIMS];
+    std::fill(lower, lower + NUMDIMS, std::numeric_limits<double>::max());
+    std::fill(upper, upper + NUMDIMS, -std::numeric_limits<double>::max());
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      CurveEncoder<0, NUMDIMS>::bounds(keys[i], lower, upper);
+    }
+    for (std::size_t d = 0; d < NUMDIMS; ++d) {
+      scale[d] = (lower[d] < upper[d]) ? maxCell / (upper[d] - lower[d]) : 0.0;
+    }
+
+    std::vector<std::pair<uint64_t, IntType> > codes(keys.size());
+    uint64_t cells[NUMDIMS];
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      CurveEncoder<0, NUMDIMS>::cells(keys[i], lower, scale, maxCell, cells);
+      uint64_t code = 0;
+      for (unsigned int b = bits; b-- > 0; ) {
+        for (std::size_t d = 0; d < NUMDIMS; ++d) {
+          code = (code << 1) | ((cells[d] >> b) & 1);
+        }
+      }
+      codes[i] = std::make_pair(code, static_cast<IntType>(i));
+    }
+    std::sort(codes.begin(), codes.end());
+
+    std::vector<IntType> order(keys.size());
+    std::vector<key_type> sorted;
+    sorted.reserve(keys.size());
+    for (std::size_t i = 0; i < codes.size(); ++i) {
+      order[i] = codes[i].second;
+      sorted.push_back(keys[order[i]]);
+    }
+    keys.swap(sorted);
+    return order;
+  }
+
+}; //end class tree
+
+
+
+
+
+template <typename BoxType, std::size_t ... TIndices>
 template <typename QBoxType, std::size_t ... QIndices>
 struct SetA<BoxType, TIndices...>::
 SetB {
@@ -720,6 +1351,53 @@ typedef typename
     "CompTypes don't match");
 
  public:
+  /**
+   * \class Workspace
+   * \brief Scratch memory of a scan: the keys of both sets and the pointers
+   * to them.
+   *
+   * Pass the same workspace to consecutive calls of \ref intersect to reuse
+   * these buffers instead of allocating and first touching them in every 
+   * call, see fbi/batch.h. The data buffers are only used by scans with a
+   * single partition (see \ref IntersectOptions::partitions_), the query 
+   * buffers by all scans. A workspace must not be used by two scans at the
+   * same time.
+   */
+  class Workspace {
+   public:
+    Workspace() {}
+
+    /** Bytes currently reserved by the buffers */
+    std::size_t capacity() const {
+      return (dataKeys_.capacity() + queryKeys_.capacity()) * 
+        sizeof(key_type) + (dataPtrs_.capacity() + queryPtrs_.capacity()) *
+        sizeof(const key_type *);
+    }
+
+    /** Give the memory of the buffers back */
+    void release() {
+      std::vector<key_type>().swap(dataKeys_);
+      std::vector<key_type>().swap(queryKeys_);
+      std::vector<const key_type *>().swap(dataPtrs_);
+      std::vector<const key_type *>().swap(queryPtrs_);
+    }
+
+   private:
+    friend struct SetB;
+    /** Not copyable, the buffers belong to one thread */
+    Workspace(const Workspace &);
+    Workspace & operator=(const Workspace &);
+
+    std::vector<key_type> dataKeys_;
+    std::vector<key_type> queryKeys_;
+    std::vector<const key_type *> dataPtrs_;
+    std::vector<const key_type *> queryPtrs_;
+#ifdef __LIBFBI_USE_MULTITHREADING__
+    /** Guards the sink of the scan, see \ref State::setSinkMutex */
+    std::mutex sinkMutex_;
+#endif
+  };
+
   /**
    * \callgraph
    * \brief The public interface for the user to start the algorithm. 
@@ -826,18 +1504,306 @@ typedef typename
   > static
   ResultType thetaIntersect(
       const size_t cutoff,
-      const BoxContainer & dataContainer, 
-      const IntervalFunctor & ifunctor, 
+      const BoxContainer & dataContainer,
+      const IntervalFunctor & ifunctor,
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    IntersectOptions options;
+    options.cutoff_ = cutoff;
+    return intersect(options, dataContainer, ifunctor, qdataContainer, qfunctors...);
+  }
+
+  /**
+   * \callgraph
+   * \brief Like \ref intersect, but with explicit tuning parameters.
+   *
+   * \param[in] options See \ref IntersectOptions, the result is the same
+   * for all options.
+   * \see \ref intersect for the remaining parameters
+   */
+   template <
+  class BoxContainer,
+        typename = typename std::enable_if<std::is_same<typename BoxContainer::value_type, value_type>::value>::type,
+        class QContainer,
+        typename = typename std::enable_if<std::is_same<typename QContainer::value_type, qvalue_type>::value>::type,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+  > static
+  ResultType intersect(
+      const IntersectOptions & options,
+      const BoxContainer & dataContainer,
+      const IntervalFunctor & ifunctor,
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+
+    return intersectImpl(
+        mpl::Bool2Type<
+        mpl::TypeExtractor<Traits<value_type>, TIndices...>::ExtractionSuccessful &&
+        mpl::TypeExtractor<Traits<qvalue_type>, QIndices...>::ExtractionSuccessful
+        >(),
+      options, 0, dataContainer, ifunctor, qdataContainer, qfunctors...);
+  }
+
+  /**
+   * \brief Like \ref intersect, but create the keys in the buffers of a 
+   * \ref Workspace.
+   *
+   * \param[in,out] workspace Keeps its memory between calls, pass the same
+   * workspace to all calls on one thread to save the allocations.
+   * \see \ref intersect for the remaining parameters
+   */
+   template <
+  class BoxContainer,
+        typename = typename std::enable_if<std::is_same<typename BoxContainer::value_type, value_type>::value>::type,
+        class QContainer,
+        typename = typename std::enable_if<std::is_same<typename QContainer::value_type, qvalue_type>::value>::type,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+  > static
+  ResultType intersect(
+      const IntersectOptions & options,
+      Workspace & workspace,
+      const BoxContainer & dataContainer,
+      const IntervalFunctor & ifunctor,
       const QContainer & qdataContainer,
       const QueryFunctors& ... qfunctors
       ) {
 
     return intersectImpl(
         mpl::Bool2Type<
-        mpl::TypeExtractor<Traits<value_type>, TIndices...>::ExtractionSuccessful && 
+        mpl::TypeExtractor<Traits<value_type>, TIndices...>::ExtractionSuccessful &&
         mpl::TypeExtractor<Traits<qvalue_type>, QIndices...>::ExtractionSuccessful
         >(),
-      cutoff, dataContainer, ifunctor, qdataContainer, qfunctors...);
+      options, &workspace, dataContainer, ifunctor, qdataContainer, 
+      qfunctors...);
+  }
+
+  /**
+   * \brief Find the intersections like \ref intersect, but also report 
+   * which query functor produced every edge.
+   *
+   * This replaces running the intersection once per query functor to find 
+   * out which one matched, e.g. which isotope shift or adduct.
+   *
+   * \param[in] options See \ref IntersectOptions, set overlaps_ to also
+   * get the overlap of the two keys of every edge.
+   * \return See \ref AnnotatedResultType, edges_ has 
+   * |dataContainer + qdataContainer| rows (|dataContainer| for a self-join),
+   * only the rows of query boxes can be non-empty.
+   * \see \ref intersect for the remaining parameters
+   */
+  template <
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > static
+  AnnotatedResultType annotatedIntersect(
+      const IntersectOptions & options,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    static_assert(
+      std::is_same<typename BoxContainer::value_type, value_type>::value &&
+      std::is_same<typename QContainer::value_type, qvalue_type>::value,
+      "The containers have to hold the types the sets were created with");
+    typedef typename AnnotatedResultType::edge_type Edge;
+    AnnotatedResultType result;
+    if (dataContainer.empty()) { return result; }
+    const std::size_t offset = 
+        (reinterpret_cast<const char* const>(&(dataContainer)) == 
+        reinterpret_cast<const char* const>(&(qdataContainer))) ? 0 : dataContainer.size();
+    result.edges_.resize(offset + qdataContainer.size());
+    if (options.overlaps_) {
+      result.overlaps_.resize(result.edges_.size());
+    }
+    scanImpl(result, options, 0, dataContainer, ifunctor, qdataContainer, 
+      qfunctors...);
+
+    // sort every row and remove duplicate edges (along with their overlaps)
+    std::vector<std::pair<Edge, std::size_t> > order;
+    std::vector<key_type> overlaps;
+    for (std::size_t i = 0; i < result.edges_.size(); ++i) {
+      std::vector<Edge> & edges = result.edges_[i];
+      if (result.overlaps_.empty()) {
+        std::sort(edges.begin(), edges.end());
+        edges.resize(std::unique(edges.begin(), edges.end()) - edges.begin());
+        continue;
+      }
+      order.clear();
+      for (std::size_t j = 0; j < edges.size(); ++j) {
+        order.push_back(std::make_pair(edges[j], j));
+      }
+      std::sort(order.begin(), order.end());
+      edges.clear();
+      overlaps.clear();
+      for (std::size_t j = 0; j < order.size(); ++j) {
+        if (j > 0 && order[j].first == order[j-1].first) continue;
+        edges.push_back(order[j].first);
+        overlaps.push_back(result.overlaps_[i][order[j].second]);
+      }
+      result.overlaps_[i].swap(overlaps);
+    }
+    return result;
+  }
+
+  /**
+   * \brief Find the intersections like \ref intersect, but score every
+   * intersecting pair and only keep the k best neighbors per query box.
+   *
+   * The scorer is called when the scanners find an intersection; a bounded
+   * heap per query box keeps the k lowest scores, so the result never holds
+   * more than k neighbors per query.
+   *
+   * \param[in] options See \ref IntersectOptions, memoryBudget_ and 
+   * overlaps_ do not apply.
+   * \param[in] k Maximum number of neighbors per query box.
+   * \param[in] scorer Called as 
+   * \verbatim double scorer(const QBoxType & query, const BoxType & data) \endverbatim,
+   * lower scores are better and must not be NaN. In a self-join, every box
+   * is a candidate for its own neighbors if its query keys intersect its
+   * data key.
+   * \return See \ref ScoredResultType, it has 
+   * |dataContainer + qdataContainer| rows (|dataContainer| for a self-join),
+   * only the rows of query boxes can be non-empty.
+   * \note Both containers have to provide operator[].
+   * \see \ref intersect for the remaining parameters
+   */
+  template <
+  class Scorer,
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > static
+  ScoredResultType scoredIntersect(
+      const IntersectOptions & options,
+      const std::size_t k,
+      const Scorer & scorer,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    static_assert(
+      std::is_same<typename BoxContainer::value_type, value_type>::value &&
+      std::is_same<typename QContainer::value_type, qvalue_type>::value,
+      "The containers have to hold the types the sets were created with");
+    const std::size_t offset = 
+        (reinterpret_cast<const char* const>(&(dataContainer)) == 
+        reinterpret_cast<const char* const>(&(qdataContainer))) ? 0 : dataContainer.size();
+    ScoredResultType result;
+    if (dataContainer.empty()) { return result; }
+    result.resize(offset + qdataContainer.size());
+    if (k == 0) { return result; }
+    TopKCollector<Scorer, BoxContainer, QContainer> collector(
+      result, k, scorer, dataContainer, qdataContainer, offset);
+    scanImpl(collector, options, 0, dataContainer, ifunctor, 
+      qdataContainer, qfunctors...);
+    collector.finish();
+    return result;
+  }
+
+  /** \brief \ref scoredIntersect with the default options */
+  template <
+  class Scorer,
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > static
+  ScoredResultType scoredIntersect(
+      const std::size_t k,
+      const Scorer & scorer,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    return scoredIntersect(IntersectOptions(), k, scorer, dataContainer, 
+      ifunctor, qdataContainer, qfunctors...);
+  }
+
+  /** \brief \ref annotatedIntersect with the default options */
+  template <
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > static
+  AnnotatedResultType annotatedIntersect(
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    return annotatedIntersect(IntersectOptions(), dataContainer, ifunctor, 
+      qdataContainer, qfunctors...);
+  }
+
+  /**
+   * \brief Find the intersections like \ref intersect, but pass every
+   * intersecting pair to a visitor instead of building the adjacency list.
+   *
+   * Only the keys are held in memory, which makes this the basis for
+   * algorithms that do not need the edges themselves (e.g. clustering with
+   * a union-find visitor, see fbi/cluster.h).
+   *
+   * \param[in,out] visitor Called as 
+   * \verbatim visitor(IntType head, IntType tail) \endverbatim for every
+   * pair of intersecting boxes; the indices are the same as in the result of
+   * \ref intersect. A pair can be reported more than once, in either order.
+   * If multithreading is enabled, the two scanners call the visitor
+   * one at a time.
+   * \param[in] options See \ref IntersectOptions, memoryBudget_ and 
+   * overlaps_ do not apply.
+   * \see \ref intersect for the remaining parameters
+   */
+  template <
+  class Visitor,
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > static
+  void visitIntersections(
+      const IntersectOptions & options,
+      Visitor & visitor,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    static_assert(
+      std::is_same<typename BoxContainer::value_type, value_type>::value &&
+      std::is_same<typename QContainer::value_type, qvalue_type>::value,
+      "The containers have to hold the types the sets were created with");
+    scanImpl(visitor, options, 0, dataContainer, ifunctor, 
+      qdataContainer, qfunctors...);
+  }
+
+  /** \brief \ref visitIntersections with the default options */
+  template <
+  class Visitor,
+        typename = typename std::enable_if<!std::is_same<typename std::remove_const<Visitor>::type, IntersectOptions>::value>::type,
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > static
+  void visitIntersections(
+      Visitor & visitor,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    visitIntersections(IntersectOptions(), visitor, dataContainer, ifunctor,
+      qdataContainer, qfunctors...);
   }
 
    template <
@@ -851,7 +1817,8 @@ typedef typename
   ResultType static 
       intersectImpl(
       mpl::Bool2Type<false>,
-      const size_t cutoff,
+      const IntersectOptions & options,
+      Workspace * workspace,
       const BoxContainer & dataContainer, 
       const IntervalFunctor & ifunctor, 
       const QContainer & qdataContainer,
@@ -871,7 +1838,8 @@ typedef typename
   ResultType static 
       intersectImpl(
       mpl::Bool2Type<true>,
-      const size_t cutoff,
+      const IntersectOptions & options,
+      Workspace * workspace,
       const BoxContainer & dataContainer, 
       const IntervalFunctor & ifunctor, 
       const QContainer & qdataContainer,
@@ -880,95 +1848,24 @@ typedef typename
     static_assert( (sizeof...(QueryFunctors) > 0), 
       "Need at least one query functor.");
     if (dataContainer.empty()) { return ResultType();}
-    // Generate the set of query boxes. The BoxType is an arbitrary,
-    // user-specified type, that does not necessarily have any notion of
-    // dimensionality. This call converts the BoxType data into the 
-    // K-dimenstional boxes for fast box intersection.
-    const auto queryIntervalVector = KeyCreator<QIndices...>::
-      getVector(qdataContainer, qfunctors...);
-    // Generate the set of data boxes. See above, just for the QueryBoxType.
-    const auto dataIntervalVector = KeyCreator<TIndices...>::
-      getVector(dataContainer, ifunctor);
-
-    key_type limits = 
-      make_tuple(
-        std::get<TIndices>(Traits<value_type>::getLimits())
-      ... );
-
-    //const std::size_t numQueryFunctors = sizeof...(QueryFunctors); 
-    const std::size_t numQueryFunctors = 
-        mpl::FunctorChecker::count(qfunctors...); 
     //if we're looking at two different sets, use different indices for the elements!
     const std::size_t offset = 
         (reinterpret_cast<const char* const>(&(dataContainer)) == 
         reinterpret_cast<const char* const>(&(qdataContainer))) ? 0 : dataContainer.size();
-    State state(
-        limits,
-        numQueryFunctors,
-        &(queryIntervalVector[0]),
-        &(dataIntervalVector[0]),
-        offset,
-        cutoff
-        );
-
-    // Create a vector of pointers that reference the above query boxes. This
-    // allows us to work on pointers and save a bit of memory.
-    std::vector<const key_type *> pointsPtrVector = 
-      createPtrVector(queryIntervalVector);
-    std::vector<const key_type *> intervalsPtrVector = 
-      createPtrVector(dataIntervalVector);
-
     ResultType resultVector(offset + qdataContainer.size());
-    auto dimLimits = std::get<0>(state.getLimits()); 
-
-#ifdef __LIBFBI_USE_MULTITHREADING__
-    // Call the hybrid algorithm for stabbing queries in the interval vector.
-    std::thread t(std::bind(
-    HybridScanner<true, NUMDIMS>::
-      scan,
-        std::cref(pointsPtrVector), 
-        std::cref(intervalsPtrVector), 
-        dimLimits.first, 
-        dimLimits.second,
-        std::ref(state), 
-        std::ref(resultVector))
-      );
-    // Reverse the previous call: queries in the "point" vector.
-    std::thread u(std::bind(
-    HybridScanner<false, NUMDIMS>::
-      scan,
-        std::cref(intervalsPtrVector), 
-        std::cref(pointsPtrVector), 
-        dimLimits.first, 
-        dimLimits.second,
-        std::ref(state), 
-        std::ref(resultVector))
-      );
-
-  t.join();
-  u.join();
-#endif
-#ifndef __LIBFBI_USE_MULTITHREADING__
-    HybridScanner<true, NUMDIMS>::
-      scan(
-        pointsPtrVector, 
-        intervalsPtrVector, 
-        dimLimits.first, 
-        dimLimits.second,
-        state, 
-        resultVector 
-      );
-    // Reverse the previous call: queries in the "point" vector.
-    HybridScanner<false, NUMDIMS>::
-      scan(
-        intervalsPtrVector, 
-        pointsPtrVector, 
-        dimLimits.first, 
-        dimLimits.second,
-        state, 
-        resultVector
-      );
-#endif
+    if (options.memoryBudget_ != 0 && adjacencyListMemory(
+          resultVector.size(), estimateEdges(options, dataContainer, 
+            ifunctor, qdataContainer, qfunctors...)) > 
+        options.memoryBudget_) {
+      EdgeSpool spool(spoolCapacity(options.memoryBudget_));
+      scanImpl(spool, options, workspace, dataContainer, ifunctor, 
+        qdataContainer, qfunctors...);
+      // fill() sorts the rows and removes duplicate edges
+      spool.fill(resultVector);
+      return resultVector;
+    }
+    scanImpl(resultVector, options, workspace, dataContainer, ifunctor, 
+      qdataContainer, qfunctors...);
 
 #ifndef __LIBFBI_USE_SET_FOR_RESULT__
   	for (ResultType::size_type i = 0; i < resultVector.size(); ++i) {
@@ -984,10 +1881,746 @@ typedef typename
 
 
 
-}; //end class SetB
 
-template <typename BoxType, std::size_t ... TIndices>
-template <std::size_t ... KeyCreatorIndices>
+  /**
+   * \brief Find the intersections like \ref intersect, but return them in
+   * compressed sparse row form.
+   *
+   * The edges are collected in a flat array, see 
+   * \ref IntersectOptions::memoryBudget_ to spill it to a temporary file.
+   * \return See \ref CompactResultType, with one row per box like the 
+   * result of \ref intersect.
+   * \see \ref intersect for the remaining parameters
+   */
+  template <
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > static
+  CompactResultType compactIntersect(
+      const IntersectOptions & options,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    static_assert(
+      std::is_same<typename BoxContainer::value_type, value_type>::value &&
+      std::is_same<typename QContainer::value_type, qvalue_type>::value,
+      "The containers have to hold the types the sets were created with");
+    CompactResultType result;
+    if (dataContainer.empty()) {
+      result.offsets_.assign(1, 0);
+      return result;
+    }
+    const std::size_t offset = 
+        (reinterpret_cast<const char* const>(&(dataContainer)) == 
+        reinterpret_cast<const char* const>(&(qdataContainer))) ? 0 : dataContainer.size();
+    EdgeSpool spool(options.memoryBudget_ == 0 ? 0 : 
+      spoolCapacity(options.memoryBudget_));
+    scanImpl(spool, options, 0, dataContainer, ifunctor, qdataContainer, 
+      qfunctors...);
+    spool.fill(result, offset + qdataContainer.size());
+    return result;
+  }
+
+  /** \brief \ref compactIntersect with the default options */
+  template <
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > static
+  CompactResultType compactIntersect(
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    return compactIntersect(IntersectOptions(), dataContainer, ifunctor, 
+      qdataContainer, qfunctors...);
+  }
+
+  /**
+   * \brief Estimate the number of intersecting pairs, the runtime and the
+   * peak memory of \ref intersect with the same arguments, before 
+   * running it.
+   *
+   * The pairs are counted for at most estimateSampleSize query boxes,
+   * evenly spread over qdataContainer, against all data boxes. The 
+   * runtime is the time of recording the pairs, measured on the sampled
+   * edges, plus the time of the scan, a * n log n fitted to 
+   * \ref intersect on evenly spread samples of 1/16, 1/4 and all of 
+   * estimateTimingSize boxes of both containers (sampling both sets at
+   * rate f leaves f^2 of the edges, too few to time the edges with).
+   * This takes a fraction of the time of the intersection for large
+   * inputs.
+   * \return See \ref IntersectEstimate
+   * \see \ref intersect for the parameters
+   */
+  template <
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > static
+  IntersectEstimate estimate(
+      const IntersectOptions & options,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    static_assert(
+      std::is_same<typename BoxContainer::value_type, value_type>::value &&
+      std::is_same<typename QContainer::value_type, qvalue_type>::value,
+      "The containers have to hold the types the sets were created with");
+    IntersectEstimate result;
+    if (dataContainer.empty() || qdataContainer.empty()) return result;
+    const bool selfJoin = 
+        (reinterpret_cast<const char* const>(&(dataContainer)) == 
+        reinterpret_cast<const char* const>(&(qdataContainer)));
+
+    // pairs: the mean count of the sampled query boxes, with the standard
+    // error of a sample without replacement
+    std::vector<typename EdgeSpool::Edge> edges;
+    const std::vector<std::size_t> counts = sampleEdges(options, &edges,
+      dataContainer, ifunctor, qdataContainer, qfunctors...);
+    const double m = static_cast<double>(counts.size());
+    const double numQueries = static_cast<double>(qdataContainer.size());
+    double sum = 0.0, sumSquares = 0.0;
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+      sum += static_cast<double>(counts[i]);
+      sumSquares += static_cast<double>(counts[i]) * counts[i];
+    }
+    const double mean = sum / m;
+    const double variance = (counts.size() > 1) ? 
+      std::max(0.0, (sumSquares - m * mean * mean) / (m - 1.0)) : 0.0;
+    const double error = numQueries * std::sqrt(variance / m * 
+      std::max(0.0, 1.0 - m / numQueries));
+    result.pairs_.value_ = numQueries * mean;
+    result.pairs_.low_ = std::max(sum, result.pairs_.value_ - 1.96 * error);
+    result.pairs_.high_ = result.pairs_.value_ + 1.96 * error;
+    result.sampleSize_ = counts.size();
+
+    const double numRows = (selfJoin ? 0.0 : 
+      static_cast<double>(dataContainer.size())) + numQueries;
+    const double perEdge = edges.empty() ? 0.0 :
+      timeEdges(edges, static_cast<std::size_t>(numRows)) / edges.size();
+    result.seconds_ = extrapolateSeconds(options, selfJoin, perEdge, 
+      result.pairs_, dataContainer, ifunctor, qdataContainer, qfunctors...);
+
+    // keys and their pointers, the HybridScanner partitions copies of the
+    // pointers
+    const std::size_t numQueryFunctors = 
+      mpl::FunctorChecker::count(qfunctors...);
+    const std::size_t batchSize = (options.queryBatchSize_ == 0) ? 
+      numQueryFunctors : std::min(options.queryBatchSize_, numQueryFunctors);
+    const double keys = (static_cast<double>(dataContainer.size()) * 
+      mpl::FunctorChecker::count(ifunctor) + numQueries * batchSize) * 
+      (sizeof(key_type) + 2 * sizeof(const key_type *));
+    // every pair adds an entry to two rows, rows grow to up to twice 
+    // their size unless the edges are spooled (see memoryBudget_)
+    const double rows = numRows * sizeof(typename ResultType::value_type);
+    const double entry = static_cast<double>(sizeof(IntType));
+    const bool spool = options.memoryBudget_ != 0 && 
+      adjacencyListMemory(static_cast<std::size_t>(numRows), 
+        result.pairs_.value_) > options.memoryBudget_;
+    const double buffer = spool ? 
+      static_cast<double>(options.memoryBudget_) : 0.0;
+    result.peakBytes_.value_ = keys + rows + buffer + 
+      (spool ? 2.0 : 3.0) * entry * result.pairs_.value_;
+    result.peakBytes_.low_ = keys + rows + buffer + 
+      (spool ? 1.0 : 2.0) * entry * result.pairs_.low_;
+    result.peakBytes_.high_ = keys + rows + buffer + 
+      (spool ? 2.0 : 4.0) * entry * result.pairs_.high_;
+    return result;
+  }
+
+  /** Count the edges of every sampled query box, see \ref sampleEdges */
+  struct SampleCounter {
+    std::vector<std::size_t> & counts_;
+    /** Index of the first sampled query box */
+    const std::size_t offset_;
+    /** Edges in the rows of the full result, if not null */
+    std::vector<typename EdgeSpool::Edge> * edges_;
+    /** Row of the first sampled query box in the full result */
+    const std::size_t queryRow_;
+    /** Distance of the sampled query boxes in qdataContainer */
+    const std::size_t step_;
+    SampleCounter(std::vector<std::size_t> & counts, const std::size_t offset,
+      std::vector<typename EdgeSpool::Edge> * edges, const std::size_t queryRow, 
+      const std::size_t step)
+      : counts_(counts), offset_(offset), edges_(edges), queryRow_(queryRow),
+        step_(step) {}
+    void operator()(const IntType head, const IntType tail) { 
+      const std::size_t query = std::max(head, tail) - offset_;
+      ++counts_[query]; 
+      if (edges_ != 0 && edges_->size() < estimateEdgeSampleSize) {
+        edges_->push_back(typename EdgeSpool::Edge(std::min(head, tail), 
+          static_cast<IntType>(queryRow_ + query * step_)));
+      }
+    }
+  };
+
+  enum {
+    /** Number of query boxes \ref sampleEdges scans */
+    estimateSampleSize = 2000,
+    /** Number of boxes per container of the largest timed sample */
+    estimateTimingSize = 8000,
+    /** Number of sampled edges \ref timeEdges records */
+    estimateEdgeSampleSize = 1 << 20
+  };
+
+  /** Distance of the objects \ref sampleBoxes copies */
+  static std::size_t sampleStep(const std::size_t size, 
+    const std::size_t sampleSize)
+  {
+    return std::max<std::size_t>(1, size / std::max<std::size_t>(1, sampleSize));
+  }
+
+  /** Copy at most sampleSize evenly spread objects of container */
+  template <class Container>
+  static std::vector<typename Container::value_type> 
+  sampleBoxes(const Container & container, const std::size_t sampleSize)
+  {
+    std::vector<typename Container::value_type> result;
+    if (container.empty() || sampleSize == 0) return result;
+    const std::size_t step = sampleStep(container.size(), sampleSize);
+    result.reserve(container.size() / step + 1);
+    typename Container::const_iterator it = container.begin();
+    for (std::size_t i = 0; i < container.size(); ++i, ++it) {
+      if (i % step == 0) result.push_back(*it);
+    }
+    return result;
+  }
+
+  /**
+   * Scan at most estimateSampleSize query boxes, evenly spread over 
+   * qdataContainer, against all data boxes.
+   * \param[out] edges If not null, up to estimateEdgeSampleSize of the
+   * edges, with the rows the boxes have in the result of \ref intersect.
+   * \return The number of edges the scanners reported for every sampled 
+   * query box (counting repeated ones).
+   * \see \ref intersect for the other parameters
+   */
+  template <
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > 
+  static std::vector<std::size_t> sampleEdges(
+      const IntersectOptions & options,
+      std::vector<typename EdgeSpool::Edge> * edges,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    std::vector<std::size_t> counts;
+    if (dataContainer.empty()) return counts;
+    const std::vector<qvalue_type> sample = 
+      sampleBoxes(qdataContainer, estimateSampleSize);
+    counts.assign(sample.size(), 0);
+    IntersectOptions sampleOptions = options;
+    sampleOptions.memoryBudget_ = 0;
+    const bool selfJoin = 
+        (reinterpret_cast<const char* const>(&(dataContainer)) == 
+        reinterpret_cast<const char* const>(&(qdataContainer)));
+    SampleCounter counter(counts, dataContainer.size(), edges, 
+      selfJoin ? 0 : dataContainer.size(), 
+      sampleStep(qdataContainer.size(), estimateSampleSize));
+    scanImpl(counter, sampleOptions, 0, dataContainer, ifunctor, sample, 
+      qfunctors...);
+    return counts;
+  }
+
+  /**
+   * Estimate the number of edges the scanners report (counting repeated
+   * ones) from \ref sampleEdges.
+   * \see \ref intersect for the parameters
+   */
+  template <
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > 
+  static double estimateEdges(
+      const IntersectOptions & options,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    const std::vector<std::size_t> counts = sampleEdges(options, 0,
+      dataContainer, ifunctor, qdataContainer, qfunctors...);
+    if (counts.empty()) return 0.0;
+    double sum = 0.0;
+    for (std::size_t i = 0; i < counts.size(); ++i) sum += counts[i];
+    return sum * qdataContainer.size() / counts.size();
+  }
+
+  /**
+   * Seconds it takes to record edges in the query rows of a result with 
+   * numRows rows and to sort these rows, see \ref estimate. The rows of
+   * the sampled query boxes grow to their full size, like all rows of 
+   * the result of \ref intersect.
+   */
+  static double timeEdges(const std::vector<typename EdgeSpool::Edge> & edges, 
+    const std::size_t numRows)
+  {
+    typedef std::chrono::steady_clock Clock;
+    ResultType result(numRows);
+    const Clock::time_point start = Clock::now();
+    for (std::size_t i = 0; i < edges.size(); ++i) {
+      result[edges[i].second].insert(result[edges[i].second].end(), 
+        edges[i].first);
+    }
+#ifndef __LIBFBI_USE_SET_FOR_RESULT__
+    for (std::size_t i = 0; i < edges.size(); ++i) {
+      ResultType::value_type & vec = result[edges[i].second];
+      if (!std::is_sorted(vec.begin(), vec.end())) {
+        std::sort(vec.begin(), vec.end());
+      }
+    }
+#endif
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  /**
+   * Time \ref intersect on three samples of both containers and 
+   * extrapolate to all boxes, see \ref estimate.
+   * \param[in] perEdge Seconds to record an edge, see \ref timeEdges.
+   * \param[in] pairs Estimated edges of the intersection of all boxes.
+   * \see \ref intersect for the other parameters
+   */
+  template <
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > 
+  static IntersectEstimate::Range extrapolateSeconds(
+      const IntersectOptions & options,
+      const bool selfJoin,
+      const double perEdge,
+      const IntersectEstimate::Range & pairs,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    typedef std::chrono::steady_clock Clock;
+    const double numBoxes = static_cast<double>(dataContainer.size()) + 
+      (selfJoin ? 0.0 : static_cast<double>(qdataContainer.size()));
+    const double largest = static_cast<double>(std::max(
+      dataContainer.size(), qdataContainer.size()));
+    const double fraction = std::min(1.0, estimateTimingSize / largest);
+    // work per box at n boxes, and the seconds left for it after the 
+    // edges of the sample are recorded
+    double g[3], y[3];
+    for (int k = 0; k < 3; ++k) {
+      const double f = fraction / static_cast<double>(1 << (4 - 2 * k));
+      const std::vector<value_type> data = sampleBoxes(dataContainer, 
+        static_cast<std::size_t>(std::ceil(f * dataContainer.size())));
+      const std::vector<qvalue_type> queries = selfJoin ? 
+        std::vector<qvalue_type>() : sampleBoxes(qdataContainer, 
+          static_cast<std::size_t>(std::ceil(f * qdataContainer.size())));
+      const Clock::time_point start = Clock::now();
+      const ResultType sampleResult = selfJoin ? 
+        intersect(options, data, ifunctor, data, qfunctors...) :
+        intersect(options, data, ifunctor, queries, qfunctors...);
+      y[k] = std::chrono::duration<double>(Clock::now() - start).count();
+      // a self-join stores every reported edge once, others twice
+      double numEntries = 0.0;
+      for (std::size_t i = 0; i < sampleResult.size(); ++i) {
+        numEntries += sampleResult[i].size();
+      }
+      y[k] = std::max(0.0, 
+        y[k] - perEdge * numEntries / (selfJoin ? 1.0 : 2.0));
+      const double n = std::max(2.0, 
+        static_cast<double>(data.size() + queries.size()));
+      g[k] = n * std::log(n);
+    }
+    // least squares fit of y = a * g
+    double gg = 0.0, gy = 0.0;
+    for (int k = 0; k < 3; ++k) {
+      gg += g[k] * g[k];
+      gy += g[k] * y[k];
+    }
+    const double a = gy / gg;
+    double margin = 0.25;
+    for (int k = 0; k < 3; ++k) {
+      if (y[k] > 0.0) {
+        margin = std::max(margin, std::fabs(a * g[k] - y[k]) / y[k]);
+      }
+    }
+    const double n = std::max(2.0, numBoxes);
+    const double scan = a * n * std::log(n);
+    IntersectEstimate::Range seconds;
+    seconds.value_ = scan + perEdge * pairs.value_;
+    seconds.low_ = scan / (1.0 + margin) + perEdge * pairs.low_;
+    seconds.high_ = (scan + perEdge * pairs.high_) * (1.0 + margin);
+    return seconds;
+  }
+
+  /**
+   * Bytes of an adjacency list with numRows rows for numEdges reported 
+   * edges: every edge is stored in two rows, which grow to up to twice 
+   * their size.
+   */
+  static double adjacencyListMemory(const std::size_t numRows, 
+    const double numEdges) {
+    return static_cast<double>(numRows) * 
+      sizeof(typename ResultType::value_type) + 
+      4.0 * numEdges * sizeof(IntType);
+  }
+
+  /** Number of edges an \ref EdgeSpool may buffer within budget bytes */
+  static std::size_t spoolCapacity(const std::size_t budget) {
+    return std::max<std::size_t>(4096, 
+      budget / sizeof(typename EdgeSpool::Edge));
+  }
+
+  /**
+   * The keys of the data boxes [firstData_, lastData_) of one partition, 
+   * see \ref IntersectOptions::partitions_
+   */
+  struct PartitionKeys {
+    std::size_t firstData_;
+    std::size_t lastData_;
+    std::vector<key_type> keys_;
+    std::vector<const key_type *> ptrs_;
+    /** Original positions of the keys if they are in spatial order */
+    std::vector<IntType> order_;
+  };
+
+  /**
+   * Create the keys and run the scanners, every intersecting pair is passed
+   * to \ref addEdge with the sink. The data keys of every partition are 
+   * created by its own worker and kept for all query batches, the query 
+   * keys of a batch are created once and shared read-only by all 
+   * partitions.
+   * \param workspace Buffers to reuse, see \ref Workspace; 0 to allocate
+   * new ones.
+   */
+  template <
+  class Sink,
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor, 
+        typename ... QueryFunctors
+  > 
+  static void scanImpl(
+      Sink & sink,
+      const IntersectOptions & options,
+      Workspace * workspace,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      const QContainer & qdataContainer,
+      const QueryFunctors& ... qfunctors
+      ) {
+    static_assert( (sizeof...(QueryFunctors) > 0), 
+      "Need at least one query functor.");
+    if (dataContainer.empty()) { return; }
+    Workspace local;
+    Workspace & scratch = workspace ? *workspace : local;
+    const std::size_t numPartitions = std::min(dataContainer.size(), 
+      std::max<std::size_t>(1, options.partitions_));
+    std::vector<PartitionKeys> partitions(numPartitions);
+    for (std::size_t p = 0; p < numPartitions; ++p) {
+      partitions[p].firstData_ = dataContainer.size() * p / numPartitions;
+      partitions[p].lastData_ = dataContainer.size() * (p + 1) / numPartitions;
+    }
+    // A single partition creates its keys in the buffers of the workspace.
+    if (numPartitions == 1) {
+      partitions[0].keys_.swap(scratch.dataKeys_);
+      partitions[0].ptrs_.swap(scratch.dataPtrs_);
+    }
+    // Generate the set of data boxes. The BoxType is an arbitrary,
+    // user-specified type, that does not necessarily have any notion of
+    // dimensionality. This call converts the BoxType data into the 
+    // K-dimenstional boxes for fast box intersection.
+#ifdef __LIBFBI_USE_MULTITHREADING__
+    if (numPartitions > 1) {
+      std::vector<std::thread> workers;
+      for (std::size_t p = 0; p < numPartitions; ++p) {
+        workers.push_back(std::thread(std::bind(
+          &SetB::template createPartitionKeys<BoxContainer, IntervalFunctor>,
+          std::cref(options),
+          p,
+          numPartitions,
+          std::cref(dataContainer),
+          std::cref(ifunctor),
+          std::ref(partitions[p]))
+        ));
+      }
+      for (std::size_t p = 0; p < numPartitions; ++p) {
+        workers[p].join();
+      }
+    } else {
+      createPartitionKeys(options, 0, 1, dataContainer, ifunctor, 
+        partitions[0]);
+    }
+#endif
+#ifndef __LIBFBI_USE_MULTITHREADING__
+    for (std::size_t p = 0; p < numPartitions; ++p) {
+      createPartitionKeys(options, p, numPartitions, dataContainer, ifunctor,
+        partitions[p]);
+    }
+#endif
+
+    //const std::size_t numQueryFunctors = sizeof...(QueryFunctors); 
+    const std::size_t numQueryFunctors = 
+        mpl::FunctorChecker::count(qfunctors...); 
+    const std::size_t batchSize = (options.queryBatchSize_ == 0) ? 
+      numQueryFunctors : std::min(options.queryBatchSize_, numQueryFunctors);
+    std::vector<key_type> & queryIntervalVector = scratch.queryKeys_;
+    std::vector<const key_type *> & pointsPtrVector = scratch.queryPtrs_;
+    std::vector<IntType> queryOrder;
+
+    // Every pass only holds the query keys of batchSize query functors
+    // (counting each element of a functor vector separately).
+    for (std::size_t first = 0; first < numQueryFunctors; first += batchSize) {
+      const std::size_t last = std::min(first + batchSize, numQueryFunctors);
+      // Generate the set of query boxes, see above.
+      KeyCreator<QIndices...>::fillVectorSlice(queryIntervalVector, 
+        qdataContainer, first, last, qfunctors...);
+      if (options.spatialOrder_) {
+        queryOrder = sortAlongCurve(queryIntervalVector);
+      }
+      // Create a vector of pointers that reference the above query boxes. 
+      // This allows us to work on pointers and save a bit of memory.
+      fillPtrVector(queryIntervalVector, pointsPtrVector);
+      if (numPartitions == 1) {
+        scanPartition(sink, options, scratch, partitions[0], 0, 1, first, 
+          last, queryIntervalVector, pointsPtrVector, queryOrder, 
+          dataContainer, qdataContainer);
+        continue;
+      }
+#ifdef __LIBFBI_USE_MULTITHREADING__
+      // One worker per partition, the sink is guarded by the mutex of 
+      // scratch and only locked to add batches of edges, see \ref EdgeBatch.
+      std::vector<std::thread> workers;
+      for (std::size_t p = 0; p < numPartitions; ++p) {
+        workers.push_back(std::thread(std::bind(
+          &SetB::template scanPartition<Sink, BoxContainer, QContainer>,
+          std::ref(sink),
+          std::cref(options),
+          std::ref(scratch),
+          std::cref(partitions[p]),
+          p,
+          numPartitions,
+          first,
+          last,
+          std::cref(queryIntervalVector),
+          std::cref(pointsPtrVector),
+          std::cref(queryOrder),
+          std::cref(dataContainer),
+          std::cref(qdataContainer))
+        ));
+      }
+      for (std::size_t p = 0; p < numPartitions; ++p) {
+        workers[p].join();
+      }
+#endif
+#ifndef __LIBFBI_USE_MULTITHREADING__
+      for (std::size_t p = 0; p < numPartitions; ++p) {
+        scanPartition(sink, options, scratch, partitions[p], p, 
+          numPartitions, first, last, queryIntervalVector, pointsPtrVector,
+          queryOrder, dataContainer, qdataContainer);
+      }
+#endif
+    }
+    if (numPartitions == 1) {
+      partitions[0].keys_.swap(scratch.dataKeys_);
+      partitions[0].ptrs_.swap(scratch.dataPtrs_);
+    }
+  }
+
+  /**
+   * Create the keys of the data boxes of partition of numPartitions, see 
+   * \ref IntersectOptions::partitions_. A single partition overwrites the
+   * buffers of keys, such that their memory is reused.
+   */
+  template <
+  class BoxContainer,
+        typename IntervalFunctor
+  > 
+  static void createPartitionKeys(
+      const IntersectOptions & options,
+      const std::size_t partition,
+      const std::size_t numPartitions,
+      const BoxContainer & dataContainer, 
+      const IntervalFunctor & ifunctor, 
+      PartitionKeys & keys
+      ) {
+    pinPartition(options, partition, numPartitions);
+    if (numPartitions == 1) {
+      KeyCreator<TIndices...>::fillVector(keys.keys_, dataContainer,
+        ifunctor);
+    } else {
+      keys.keys_ = KeyCreator<TIndices...>::getVectorRange(
+        dataContainer, keys.firstData_, keys.lastData_, ifunctor);
+    }
+    // Optionally bring the keys into spatial order; State maps the new
+    // positions back to the original ones.
+    if (options.spatialOrder_) {
+      keys.order_ = sortAlongCurve(keys.keys_);
+    }
+    fillPtrVector(keys.keys_, keys.ptrs_);
+  }
+
+  /**
+   * Pin the calling worker of a multi-partition scan to the node of its 
+   * partition if \ref IntersectOptions::pinPartitions_ asks for it.
+   */
+  static void pinPartition(const IntersectOptions & options, 
+    const std::size_t partition, const std::size_t numPartitions) {
+#ifdef __LIBFBI_USE_MULTITHREADING__
+    if (numPartitions > 1 && options.pinPartitions_) {
+      NumaTopology::get().pinCurrentThread(partition);
+    }
+#endif
+  }
+
+  /**
+   * Run the scanners on the data keys of one partition and the query keys
+   * of the query functors [first, last), see \ref scanImpl.
+   */
+  template <
+  class Sink,
+  class BoxContainer,
+        class QContainer
+  > 
+  static void scanPartition(
+      Sink & sink,
+      const IntersectOptions & options,
+      Workspace & workspace,
+      const PartitionKeys & keys,
+      const std::size_t partition,
+      const std::size_t numPartitions,
+      const std::size_t first,
+      const std::size_t last,
+      const std::vector<key_type> & queryIntervalVector,
+      const std::vector<const key_type *> & pointsPtrVector,
+      const std::vector<IntType> & queryOrder,
+      const BoxContainer & dataContainer, 
+      const QContainer & qdataContainer
+      ) {
+    pinPartition(options, partition, numPartitions);
+    key_type limits = 
+      make_tuple(
+        std::get<TIndices>(Traits<value_type>::getLimits())
+      ... );
+    //if we're looking at two different sets, use different indices for the elements!
+    const std::size_t offset = 
+        (reinterpret_cast<const char* const>(&(dataContainer)) == 
+        reinterpret_cast<const char* const>(&(qdataContainer))) ? 0 : dataContainer.size();
+    State state(
+        limits,
+        last - first,
+        &(queryIntervalVector[0]),
+        &(keys.keys_[0]),
+        offset,
+        options.cutoff_
+        );
+    if (options.spatialOrder_) {
+      state.setOrder(queryOrder.data(), keys.order_.data());
+    }
+    state.setFirstFunctor(first);
+    state.setFirstData(keys.firstData_);
+    state.setScanDimensions(options.scanDimensions_);
+#ifdef __LIBFBI_USE_MULTITHREADING__
+    state.setSinkMutex(&workspace.sinkMutex_);
+#endif
+    scanKeys(sink, state, options.engine_, pointsPtrVector, keys.ptrs_);
+  }
+
+  /**
+   * Run the two scanners on one set of query and data keys, or the 
+   * \ref SweepScanner or \ref GridScanner if engine asks for it.
+   */
+  template <class Sink>
+  static void scanKeys(
+      Sink & sink,
+      State & state,
+      const IntersectOptions::Engine engine,
+      const std::vector<const key_type *> & pointsPtrVector,
+      const std::vector<const key_type *> & intervalsPtrVector
+      ) {
+    if (engine == IntersectOptions::ENGINE_SWEEP || 
+      (NUMDIMS == 1 && engine == IntersectOptions::ENGINE_AUTO)) {
+      SweepScanner::scan(pointsPtrVector, intervalsPtrVector, state, sink);
+      return;
+    }
+    if (engine != IntersectOptions::ENGINE_SEGMENT_TREE) {
+      GridScanner grid(pointsPtrVector, intervalsPtrVector);
+      if (grid.suitable(engine == IntersectOptions::ENGINE_GRID, 
+            state.getCutoff())) {
+        grid.scan(pointsPtrVector, intervalsPtrVector, state, sink);
+        return;
+      }
+    }
+    auto dimLimits = std::get<0>(state.getLimits()); 
+
+#ifdef __LIBFBI_USE_MULTITHREADING__
+    // Call the hybrid algorithm for stabbing queries in the interval vector.
+    std::thread t(std::bind(
+    HybridScanner<true, NUMDIMS>::
+      template scan<Sink>,
+        std::cref(pointsPtrVector), 
+        std::cref(intervalsPtrVector), 
+        dimLimits.first, 
+        dimLimits.second,
+        std::ref(state), 
+        std::ref(sink))
+      );
+    // Reverse the previous call: queries in the "point" vector.
+    std::thread u(std::bind(
+    HybridScanner<false, NUMDIMS>::
+      template scan<Sink>,
+        std::cref(intervalsPtrVector), 
+        std::cref(pointsPtrVector), 
+        dimLimits.first, 
+        dimLimits.second,
+        std::ref(state), 
+        std::ref(sink))
+      );
+
+  t.join();
+  u.join();
+#endif
+#ifndef __LIBFBI_USE_MULTITHREADING__
+    HybridScanner<true, NUMDIMS>::
+      scan(
+        pointsPtrVector, 
+        intervalsPtrVector, 
+        dimLimits.first, 
+        dimLimits.second,
+        state, 
+        sink 
+      );
+    // Reverse the previous call: queries in the "point" vector.
+    HybridScanner<false, NUMDIMS>::
+      scan(
+        intervalsPtrVector, 
+        pointsPtrVector, 
+        dimLimits.first, 
+        dimLimits.second,
+        state, 
+        sink
+      );
+#endif
+  }
+
+}; //end class SetB
+
+template <typename BoxType, std::size_t ... TIndices>
+template <std::size_t ... KeyCreatorIndices>
 struct SetA<BoxType, TIndices...>::
 KeyCreator{
 
@@ -1008,11 +2641,24 @@ KeyCreator{
   template <class Container, class ... Functors>
   static std::vector<key_type>
   getVector(const Container & container, const Functors& ...functors){
+    std::vector<key_type> intervalVector;
+    fillVector(intervalVector, container, functors...);
+    return intervalVector;
+  }
+
+  /**
+   * Like \ref getVector, but overwrite intervalVector with the keys, such 
+   * that its memory can be reused.
+   */
+  template <class Container, class ... Functors>
+  static void
+  fillVector(std::vector<key_type> & intervalVector, 
+    const Container & container, const Functors& ...functors){
     /** If there is no functor, we can't extract data from the boxes.*/
     static_assert(sizeof...(Functors) > 0, 
       "You need at least one functor to access your objects"); 
     typename Container::const_iterator it = container.begin();
-    std::vector<key_type> intervalVector(
+    intervalVector.resize(
         container.size()* mpl::FunctorChecker::count(functors...)); 
 
     typename std::vector<key_type>::iterator intervalIt= intervalVector.begin();
@@ -1021,9 +2667,120 @@ KeyCreator{
       createKeys(intervalIt, *it, functors...);
       ++it;
     }
+  }
+
+  /**
+   * Like \ref getVector with a single functor, but only create the keys of
+   * the objects [begin, end) of container.
+   */
+  template <class Container, class Functor>
+  static std::vector<key_type>
+  getVectorRange(const Container & container, const std::size_t begin, 
+    const std::size_t end, const Functor & functor){
+    typename Container::const_iterator it = container.begin();
+    std::advance(it, begin);
+    std::vector<key_type> intervalVector;
+    intervalVector.reserve(end - begin);
+    for (std::size_t i = begin; i < end; ++i, ++it) {
+      intervalVector.push_back(createKey(*it, functor));
+    }
     return intervalVector;
   }
 
+  /**
+   * Like \ref getVector, but only create the keys of the functors 
+   * [first, last), every element of a functor vector counts as one functor.
+   * The keys are stored box by box, i.e. there are last - first keys 
+   * per object in container.
+   * \param container A STL container with value_type objects, 
+   * has to provide a forward iterator.
+   * \param first Index of the first functor to use
+   * \param last One past the index of the last functor to use
+   * \param functors See \ref getVector
+   */
+  template <class Container, class ... Functors>
+  static std::vector<key_type>
+  getVectorSlice(const Container & container, const std::size_t first, 
+    const std::size_t last, const Functors& ...functors){
+    std::vector<key_type> intervalVector;
+    fillVectorSlice(intervalVector, container, first, last, functors...);
+    return intervalVector;
+  }
+
+  /**
+   * Like \ref getVectorSlice, but overwrite intervalVector with the keys, 
+   * such that its memory can be reused.
+   */
+  template <class Container, class ... Functors>
+  static void
+  fillVectorSlice(std::vector<key_type> & intervalVector, 
+    const Container & container, const std::size_t first, 
+    const std::size_t last, const Functors& ...functors){
+    static_assert(sizeof...(Functors) > 0, 
+      "You need at least one functor to access your objects"); 
+    typename Container::const_iterator it = container.begin();
+    intervalVector.resize(container.size() * (last - first)); 
+
+    typename std::vector<key_type>::iterator intervalIt= intervalVector.begin();
+    while (it != container.end())
+    {
+      std::size_t slot = 0;
+      createKeySlice(intervalIt, slot, first, last, *it, functors...);
+      ++it;
+    }
+  }
+
+  /**
+   * Tail of the recursion in \ref createKeySlice.
+   */
+  template <typename T>
+  static void
+  createKeySlice(typename std::vector<key_type>::iterator & intervalIt,
+    std::size_t & slot, const std::size_t first, const std::size_t last,
+    const T & dataValue) {}
+
+  /**
+   * Like \ref createKeys, but skip the functors outside of [first, last).
+   * \param slot Index of functor, incremented for every functor seen.
+   */
+  template <typename T, typename Functor, typename ...Functors>
+  static void 
+  createKeySlice(
+      typename std::vector<key_type>::iterator & intervalIt,
+      std::size_t & slot, const std::size_t first, const std::size_t last,
+      const T & dataValue, 
+      const Functor & functor, 
+      const Functors & ...functors) {
+    if (first <= slot && slot < last) {
+      *intervalIt = createKey(dataValue, functor); 
+      ++intervalIt;
+    }
+    ++slot;
+    createKeySlice(intervalIt, slot, first, last, dataValue, functors...);
+  }
+
+  /**
+   * Like \ref createKeys, but skip the functors outside of [first, last).
+   * \param slot Index of functor, incremented for every functor seen.
+   */
+  template <typename T, typename Functor, typename ...Functors>
+  static void 
+  createKeySlice(
+      typename std::vector<key_type>::iterator & intervalIt,
+      std::size_t & slot, const std::size_t first, const std::size_t last,
+      const T & dataValue, 
+      const std::vector<Functor> & functor, 
+      const Functors & ...functors) 
+  {
+    for (std::size_t i = 0; i < functor.size(); ++i, ++slot) {
+      if (first <= slot && slot < last) {
+        *intervalIt = createKey(dataValue, functor[i]);
+        ++intervalIt;
+      }
+    }
+    createKeySlice(intervalIt, slot, first, last, dataValue, functors...);
+  }
+
   /**
    * This is the tail of a recursive call which uses different 
    * functors to produce several queries.
@@ -1155,6 +2912,36 @@ State
    *  we're passing pointers to the vector containing the dataIntervals.
    */
   const key_type * dataVectorPtrToFirstElement_;
+  /**
+   * If the keys were reordered before the scan (see
+   * \ref IntersectOptions::spatialOrder_), these hold the original position
+   * of every key in the query and data vector, otherwise they are 0.
+   */
+  const IntType * queryOrder_;
+  /** \see queryOrder_ */
+  const IntType * dataOrder_;
+  /** 
+   * Number of the first query functor whose keys are in the query vector, 
+   * see \ref IntersectOptions::queryBatchSize_
+   */
+  std::size_t firstFunctor_;
+  /** 
+   * Index of the first data box whose keys are in the data vector,
+   * see \ref IntersectOptions::partitions_
+   */
+  std::size_t firstData_;
+  /** 
+   * Number of dimensions the HybridScanner recurses into, see
+   * \ref IntersectOptions::scanDimensions_
+   */
+  std::size_t scanDimensions_;
+#ifdef __LIBFBI_USE_MULTITHREADING__
+  /** 
+   * Serializes the calls to the sink of the scan, the global mutex unless
+   * \ref setSinkMutex is used.
+   */
+  std::mutex * sinkMutex_;
+#endif
 
   //Randomizer section
   /** Random seed engine, has to be non-const as using the engine changes it. */
@@ -1215,37 +3002,120 @@ State
       numModifications_(numMod), 
       queryVectorPtrToFirstElement_(queryVectorPtr), 
       dataVectorPtrToFirstElement_(dataVectorPtr),
+      queryOrder_(0),
+      dataOrder_(0),
+      firstFunctor_(0),
+      firstData_(0),
+      scanDimensions_(NUMDIMS),
+#ifdef __LIBFBI_USE_MULTITHREADING__
+      sinkMutex_(&fbi::mutex::__libfbi_mut_),
+#endif
       offset_(offset),
       cutoffSize_(cutoffSize),
       heightCalculator_(heightCalculator)    
   {}
 
- /** 
-  * As we pass pointers around during our algorithm,
-  * it is necessary to find the corresponding index
-  * of the objects when writing pairs as results.
-  * To do this, we first save the pointer to the
-  * respective first object, using our knowledge of
-  * the memory representation a simple pointer subtraction
-  * yields the original index.
-  * Note that for two different sets A and B, the boxes in B
-  * get an offset of |A|.
-  * \param[in] isQueryVectorPtr We have to keep track if
-  * a pointer refers to a box in the first or second 
-  * input set as that changes its index.
-  * \param[in] objectPtr a pointer to a key, can be either
-  * generated from the first or second type of boxes.
-  */
-  inline 
-  std::size_t calculate(bool isQueryVectorPtr, const key_type * objectPtr) const
+ /** 
+  * As we pass pointers around during our algorithm,
+  * it is necessary to find the corresponding index
+  * of the objects when writing pairs as results.
+  * To do this, we first save the pointer to the
+  * respective first object, using our knowledge of
+  * the memory representation a simple pointer subtraction
+  * yields the original index.
+  * Note that for two different sets A and B, the boxes in B
+  * get an offset of |A|.
+  * \param[in] isQueryVectorPtr We have to keep track if
+  * a pointer refers to a box in the first or second 
+  * input set as that changes its index.
+  * \param[in] objectPtr a pointer to a key, can be either
+  * generated from the first or second type of boxes.
+  */
+  inline
+  std::size_t calculate(bool isQueryVectorPtr, const key_type * objectPtr) const
+  {
+    if (isQueryVectorPtr)
+    {
+      return offset_ + queryPosition(objectPtr) / this->numModifications_;
+    }
+    std::size_t position = objectPtr - this->dataVectorPtrToFirstElement_;
+    if (dataOrder_) position = dataOrder_[position];
+    return firstData_ + position;
+  }
+
+  /**
+   * The number of the query functor that created a query key.
+   * \param[in] objectPtr a pointer to a key in the query vector.
+   */
+  inline
+  std::size_t functor(const key_type * objectPtr) const
+  {
+    return firstFunctor_ + queryPosition(objectPtr) % this->numModifications_;
+  }
+
+  /**
+   * Position of a query key in the vector the \ref KeyCreator created.
+   */
+  inline
+  std::size_t queryPosition(const key_type * objectPtr) const
+  {
+    std::size_t position = objectPtr - this->queryVectorPtrToFirstElement_;
+    if (queryOrder_) position = queryOrder_[position];
+    return position;
+  }
+
+  /**
+   * Set the number of the first query functor in the query vector, see
+   * \ref functor.
+   */
+  void setFirstFunctor(const std::size_t firstFunctor)
+  {
+    firstFunctor_ = firstFunctor;
+  }
+
+  /**
+   * Set the index of the first data box in the data vector, see
+   * \ref calculate.
+   */
+  void setFirstData(const std::size_t firstData)
+  {
+    firstData_ = firstData;
+  }
+
+  /**
+   * Limit the number of dimensions to build segment trees over, 0 means
+   * all of them.
+   */
+  void setScanDimensions(const std::size_t scanDimensions)
+  {
+    scanDimensions_ = (scanDimensions == 0) ? 
+      std::size_t(NUMDIMS) : scanDimensions;
+  }
+
+#ifdef __LIBFBI_USE_MULTITHREADING__
+  /**
+   * Use sinkMutex instead of the global mutex to guard the sink, such that
+   * scans with different sinks do not wait for each other.
+   */
+  void setSinkMutex(std::mutex * sinkMutex)
   {
-    if (isQueryVectorPtr)
-    {
-      return 
-        offset_ + (objectPtr - this->queryVectorPtrToFirstElement_) / 
-          this->numModifications_;
-    }
-    return (objectPtr - this->dataVectorPtrToFirstElement_);
+    sinkMutex_ = sinkMutex;
+  }
+
+  /** Getter */
+  std::mutex & sinkMutex() const { return *sinkMutex_; }
+#endif
+
+  /**
+   * Register the original positions of reordered keys, see
+   * \ref calculate.
+   * \param[in] queryOrder Original position of every key in the query vector
+   * \param[in] dataOrder Original position of every key in the data vector
+   */
+  void setOrder(const IntType * queryOrder, const IntType * dataOrder)
+  {
+    queryOrder_ = queryOrder;
+    dataOrder_ = dataOrder;
   }
 /** 
  * In \ref getApproxMedian we have to pick a random object,
@@ -1274,6 +3144,8 @@ State
   }
   /** Getter*/
   std::size_t getCutoff() const{ return cutoffSize_; }
+  /** Getter*/
+  std::size_t getScanDimensions() const{ return scanDimensions_; }
 };
 
 
@@ -1284,13 +3156,36 @@ template <bool PointsContainQueries, std::size_t DimsLeft>
 struct SetA<BoxType, TIndices...>::
 HybridScanner{
 
+  enum {
+    Dim = SETA::NUMDIMS - DimsLeft
+  };
+  //Workaround, that way we can partially specialize for the case that DimsLeft == 1
+  //which isn't a variable dependent on a template parameter.
+
+  /** Type of the bounds in the current dimension */
+  typedef typename std::tuple_element<Dim, key_type>::type::first_type Bound;
+
+  /**
+   * A node of the virtual segment tree that still has to be split: the 
+   * points and the intervals between two bounds. A task owns its vectors
+   * and does not depend on any other task, see \ref scan.
+   */
+  struct Task {
+    std::vector<const key_type *> points_;
+    std::vector<const key_type *> intervals_;
+    Bound lowerBound_;
+    Bound upperBound_;
+    Task(const Bound & lowerBound, const Bound & upperBound)
+      : lowerBound_(lowerBound), upperBound_(upperBound) {}
+  };
+
   /** 
    * \brief Find intersections by solving the 1-dimensional problems of 
    *  overlapping intervals.
    *
-   * This is the main recursion function, it is a 
-   *  divide & conquer algorithm, quite similar to quicksort.
-   * By creating the nodes of a virtual segment tree in post-order, 
+   * This is the main function, it is a divide & conquer algorithm, quite 
+   *  similar to quicksort.
+   * By creating the nodes of a virtual segment tree in pre-order, 
    *  we don't have to look at the whole tree at once (saving memory).
    * In 1 iteration, we can split the intervalset in 3 separate sets: 
    *   - Two of them represent the child-nodes of the virtual segment tree we're
@@ -1298,13 +3193,19 @@ HybridScanner{
    *   - The third one is a set of solutions in the current dimension -> 
    *      we can solve the problem in the next dimension.
    *
+   * The child nodes are not visited by recursion but kept on an explicit
+   * stack of \ref Task objects, in the same order. A skewed set with a bad
+   * approximate median grows the stack instead of the call stack, which 
+   * is at most two frames deep per dimension, and the vectors of a node 
+   * are freed as soon as it is split.
+   *
    * \param[in] pointsPtrVector As we're looking at two subsets of intervals, 
    * this is the one representing the points.
    * \param[in] intervalsPtrVector These are the intervals, for this call.
-   * \param[in] lowerBound As a recursion invariant, all points 
+   * \param[in] lowerBound As an invariant, all points 
    *  represented by pointsPtrVector are inbetween the two 
-   *  bounds (check recursion), which is why all intervals spanning across these
-   *  bounds are intersecting with the points (in the current dimension).
+   *  bounds (check \ref split), which is why all intervals spanning across 
+   *  these bounds are intersecting with the points (in the current dimension).
    * \param[in] upperBound see lowerBound 
    * \param[in, out] state Contains a rng, can be used to track the 
    *  recursion and is able to calculate the indices.
@@ -1318,19 +3219,43 @@ HybridScanner{
    *   - Either set is small enough that a match in one dimension will probably 
    *      lead to a match in the others.
    */ 
-  enum {
-    Dim = SETA::NUMDIMS - DimsLeft
-  };
-  //Workaround, that way we can partially specialize for the case that DimsLeft == 1
-  //which isn't a variable dependent on a template parameter.
-
+  template <class Sink>
   static void scan(
     const std::vector<const key_type *> & pointsPtrVector, //Points
     const std::vector<const key_type *> & intervalsPtrVector,  //Intervals
-    const typename std::tuple_element<Dim, key_type>::type::first_type & lowerBound,
-    const typename std::tuple_element<Dim, key_type>::type::first_type & upperBound,
+    const Bound & lowerBound,
+    const Bound & upperBound,
+    State & state,
+    Sink & resultVector
+    ) {
+    std::vector<Task> tasks;
+    split(pointsPtrVector, intervalsPtrVector, lowerBound, upperBound, 
+      state, resultVector, tasks);
+    while (!tasks.empty()) {
+      const Task task(std::move(tasks.back()));
+      tasks.pop_back();
+      split(task.points_, task.intervals_, task.lowerBound_, 
+        task.upperBound_, state, resultVector, tasks);
+    }
+  }
+
+  /**
+   * Process one node of the virtual segment tree: scan it if it is small
+   * enough, else pass the intervals spanning the node to the next 
+   * dimension and push the tasks of the two child nodes, the left one on
+   * top.
+   * \param[in, out] tasks The stack of \ref scan.
+   * \see \ref scan for the other parameters
+   */
+  template <class Sink>
+  static void split(
+    const std::vector<const key_type *> & pointsPtrVector,
+    const std::vector<const key_type *> & intervalsPtrVector,
+    const Bound & lowerBound,
+    const Bound & upperBound,
     State & state,
-    ResultType & resultVector
+    Sink & resultVector,
+    std::vector<Task> & tasks
     ) {
 
     typedef typename std::tuple_element<Dim, key_type>::type Key;
@@ -1344,10 +3269,12 @@ HybridScanner{
     ) {
       return;
     }
-    // switch into scanning mode if set sizes fall under the threshold
+    // switch into scanning mode if set sizes fall under the threshold or
+    // this is the last dimension to build segment trees over
     if (
       pointsPtrVector.size() < state.getCutoff() || 
-      intervalsPtrVector.size() < state.getCutoff() 
+      intervalsPtrVector.size() < state.getCutoff() ||
+      Dim + 1 >= state.getScanDimensions()
     ) {
       std::vector<const key_type *> npointsPtrVector(pointsPtrVector.begin(), pointsPtrVector.end());
       std::vector<const key_type *> nintervalsPtrVector(intervalsPtrVector.begin(), intervalsPtrVector.end());
@@ -1359,7 +3286,7 @@ HybridScanner{
     }
     // Set sizes are still above the threshold. We follow a divide and conquer
     // scheme: determine the median in the current dimension and use the
-    // value to split the intervals and points for the next (recursive) call.
+    // value to split the intervals and points for the child nodes.
     std::size_t heuristicHeight = state.heuristicHeight(intervalsPtrVector.size());
 
     //Using the intervals to provide a median, it can be guaranteed
@@ -1368,8 +3295,8 @@ HybridScanner{
     typename Key::first_type median = 
       getApproxMedian<Dim>(intervalsPtrVector, heuristicHeight, state, less);
     
-    std::vector<const key_type *> 
-      intervalsMiddle, intervalsLeft, intervalsRight;
+    std::vector<const key_type *> intervalsMiddle;
+    Task left(lowerBound, median), right(median, upperBound);
 
     typename std::vector<const key_type *>::const_iterator intVectorIt = 
       intervalsPtrVector.begin();
@@ -1383,18 +3310,18 @@ HybridScanner{
           intervalsMiddle.push_back(intPtr);
           continue;
         }
-        intervalsLeft.push_back(intPtr);
+        left.intervals_.push_back(intPtr);
         if (less(median, interval.second)) {
-          intervalsRight.push_back(intPtr);
+          right.intervals_.push_back(intPtr);
         }
       } else {
         if (!less(interval.first,median)){
-          intervalsRight.push_back(intPtr);
+          right.intervals_.push_back(intPtr);
           continue;
         }
-        intervalsLeft.push_back(intPtr);
+        left.intervals_.push_back(intPtr);
         if (less(median, interval.second))
-          intervalsRight.push_back(intPtr);
+          right.intervals_.push_back(intPtr);
       }
     }
 
@@ -1419,32 +3346,28 @@ HybridScanner{
         resultVector
       );
 
-    //intervalsMiddle.swap(std::vector<const key_type *>());
     intervalsMiddle.clear();
     std::vector<const key_type *>().swap(intervalsMiddle);
 
-    std::vector<const key_type *> pointsLeft, pointsRight;
     // all points which are to the left of the 
-    // median have to be entered in pointsLeft.
+    // median have to be entered in the left node.
     typename std::vector<const key_type *>::const_iterator pntVectorIt = 
       pointsPtrVector.begin();
 
     while (pntVectorIt != pointsPtrVector.end())
     {
       typename Key::first_type point = getHead<Dim>(*pntVectorIt);
-      if (less(point, median)) pointsLeft.push_back(*pntVectorIt);
-      else  pointsRight.push_back(*pntVectorIt);
+      if (less(point, median)) left.points_.push_back(*pntVectorIt);
+      else  right.points_.push_back(*pntVectorIt);
       ++pntVectorIt;
     }
-    HybridScanner<PointsContainQueries,DimsLeft>::
-      scan(pointsLeft, intervalsLeft, lowerBound, median, state, resultVector);
-    intervalsLeft.clear();
-    std::vector<const key_type *>().swap(intervalsLeft);
-    pointsLeft.clear();
-    std::vector<const key_type *>().swap(pointsLeft);
-    HybridScanner<PointsContainQueries, DimsLeft>::
-      scan(pointsRight, intervalsRight, median, upperBound, state, resultVector);
-
+    // a child without points or intervals holds no intersections
+    if (!right.points_.empty() && !right.intervals_.empty()) {
+      tasks.push_back(std::move(right));
+    }
+    if (!left.points_.empty() && !left.intervals_.empty()) {
+      tasks.push_back(std::move(left));
+    }
   }
 
 }; //end struct HybridScanner
@@ -1485,13 +3408,14 @@ HybridScanner<PointsContainQueries, 1> {
   * \param[in, out] resultVector We pass the resultVector around to 
   *  add to it in OneWayScan
   */
+  template <class Sink>
   inline static void scan(
       const std::vector<const key_type *> & pointsPtrVector,
       const std::vector<const key_type *> & intervalsPtrVector,
       const typename std::tuple_element<LASTDIM, key_type>::type::first_type & lowerBound,
       const typename std::tuple_element<LASTDIM, key_type>::type::first_type & upperBound,
       SETA::State & state,
-      SETA::ResultType & resultVector
+      Sink & resultVector
       )
   {
      if (
@@ -1522,142 +3446,552 @@ OneWayScanner{
    * \param[in] intervalsPtrVector These are the intervals, for this call.
    * \param[in, out] state We need the state (containing 2 pointers) to 
    *  calculate the correct indices.
-   * \param[in, out] resultVector Add our results. 
+   * \param[in, out] resultVector Add our results, see \ref addEdge. 
    *  \note As the OneWayScanner isn't necessarily be called for the 
    *  last dimension only, we have to use the IntersectionTester to 
    *  check for intersections in the remaining dimensions.
    */
+  template <class Sink>
+  static void scan(
+      const std::vector<const key_type * > & pointsPtrVector, 
+      const std::vector<const key_type * > & intervalsPtrVector,
+      State & state,
+      Sink & resultVector 
+      ) {
+    scan(pointsPtrVector, intervalsPtrVector, state, resultVector, 
+      mpl::Bool2Type<FLATKEYS && (REST > 0)>());
+  }
+
+  enum {
+    /** Number of dimensions after Dim, checked for every candidate pair */
+    REST = NUMDIMS - Dim - 1
+  };
+
+  /** \see \ref scan for generic keys */
+  template <class Sink>
   static void scan(
       const std::vector<const key_type * > & pointsPtrVector, 
       const std::vector<const key_type * > & intervalsPtrVector,
       State & state,
-      ResultType & resultVector 
+      Sink & resultVector,
+      mpl::Bool2Type<false>
       ) {
     typedef typename std::tuple_element<Dim, key_type>::type::first_type Key;
     typedef typename std::tuple_element<Dim, comp_type>::type Comp; 
     typedef typename std::vector<const key_type * >::const_iterator CIT;
-    typedef std::multiset<const key_type * , lessTail<Dim> > SortTailSet;
-    SortTailSet intervalsPtrSet;
-    typedef typename SortTailSet::const_iterator SIT;
+    
+    if (intervalsPtrVector.empty())
+      return;
+
+    // The active intervals are kept in a flat, unordered vector instead of
+    // a set sorted by upper endpoint: every active interval has to be 
+    // visited for the remaining dimensions anyway, so expired ones are 
+    // dropped on the same pass. This avoids the tree rebalancing and pointer
+    // chasing that dominate once many boxes overlap in Dim, which is the 
+    // common case for high-dimensional data (see 
+    // \ref IntersectOptions::scanDimensions_).
+    std::vector<const key_type *> activeIntervals;
+    activeIntervals.reserve(std::min<std::size_t>(intervalsPtrVector.size(), 64));
+    Comp less;
+    CIT pntVectorIt = pointsPtrVector.begin();
+    CIT intVectorIt = intervalsPtrVector.begin();
+ 
+    EdgeBatch<Sink> batch(resultVector, state);
+    while (pntVectorIt != pointsPtrVector.end()){
+
+      const key_type * pntPtr = *pntVectorIt;
+      ++pntVectorIt; //don't look at the same point again!
+      const Key & lowerBound = getHead<Dim>(pntPtr);
+
+      //add all intervals whose lower endpoint is not higher than the 
+      //query point, these are the viable intervals.
+      while ( intVectorIt != intervalsPtrVector.end())
+      {
+        //if this is true, the lower endpoint of the intervals is greater than 
+        //the query point - it is impossible for the query point to be inside.
+        if (less(lowerBound,getHead<Dim>(*intVectorIt))) break;
+        activeIntervals.push_back(*intVectorIt);
+        ++intVectorIt;
+      }
+
+      //erase all intervals whose upper endpoints aren't greater than the 
+      //point (they can't encompass it, nor any of the following points) and
+      //add all intersections of the others to the results.
+      std::size_t i = 0;
+      while (i < activeIntervals.size()) {
+        const key_type * intPtr = activeIntervals[i];
+        if (!less(lowerBound, getTail<Dim>(intPtr))) {
+          activeIntervals[i] = activeIntervals.back();
+          activeIntervals.pop_back();
+          continue;
+        }
+        if (IntersectionTester<Dim+1, NUMDIMS>::test(pntPtr, intPtr)) {
+          batch.add(PointsContainQueries, pntPtr, intPtr);
+        }
+        ++i;
+      } //end add all intersections to the results.
+    } //end while qContainerIt != pointsContainer.end() 
+    // do loop for every query point.
+  } //end scan
+
+
+  /**
+   * An active interval with its upper endpoint in Dim and its endpoints in
+   * the REST dimensions after Dim in place, see \ref scan for flat keys.
+   */
+  struct FlatInterval {
+    flat_type tail_;
+    flat_type lower_[REST > 0 ? REST : 1];
+    flat_type upper_[REST > 0 ? REST : 1];
+    const key_type * key_;
+  };
+
+  /**
+   * \see \ref scan for keys of a single arithmetic type with std::less 
+   * (\ref FLATKEYS): the active intervals carry their endpoints, so
+   * the inner loop does not follow the key pointers, and every remaining 
+   * dimension is compared without branches.
+   */
+  template <class Sink>
+  static void scan(
+      const std::vector<const key_type * > & pointsPtrVector, 
+      const std::vector<const key_type * > & intervalsPtrVector,
+      State & state,
+      Sink & resultVector,
+      mpl::Bool2Type<true>
+      ) {
+    typedef typename std::vector<const key_type * >::const_iterator CIT;
+    
+    if (intervalsPtrVector.empty())
+      return;
+
+    std::vector<FlatInterval> activeIntervals;
+    activeIntervals.reserve(std::min<std::size_t>(intervalsPtrVector.size(), 64));
+    CIT pntVectorIt = pointsPtrVector.begin();
+    CIT intVectorIt = intervalsPtrVector.begin();
+    flat_type lower[REST], upper[REST];
+ 
+    EdgeBatch<Sink> batch(resultVector, state);
+    while (pntVectorIt != pointsPtrVector.end()){
+
+      const key_type * pntPtr = *pntVectorIt;
+      ++pntVectorIt; //don't look at the same point again!
+      const flat_type lowerBound = getHead<Dim>(pntPtr);
+
+      while ( intVectorIt != intervalsPtrVector.end())
+      {
+        if (lowerBound < getHead<Dim>(*intVectorIt)) break;
+        FlatInterval interval;
+        interval.tail_ = getTail<Dim>(*intVectorIt);
+        FlatCopier<Dim+1, NUMDIMS>::copy(**intVectorIt, interval.lower_, 
+          interval.upper_);
+        interval.key_ = *intVectorIt;
+        activeIntervals.push_back(interval);
+        ++intVectorIt;
+      }
+      FlatCopier<Dim+1, NUMDIMS>::copy(*pntPtr, lower, upper);
+
+      std::size_t i = 0;
+      while (i < activeIntervals.size()) {
+        const FlatInterval & interval = activeIntervals[i];
+        if (!(lowerBound < interval.tail_)) {
+          activeIntervals[i] = activeIntervals.back();
+          activeIntervals.pop_back();
+          continue;
+        }
+        // the same test as the IntersectionTester, which stops at the 
+        // first dimension without an overlap
+        bool intersects = true;
+        for (std::size_t d = 0; d < REST; ++d) {
+          const bool before = lower[d] < interval.lower_[d];
+          if (!((before & (interval.lower_[d] < upper[d])) | 
+              (!before & (lower[d] < interval.upper_[d])))) {
+            intersects = false;
+            break;
+          }
+        }
+        if (intersects) {
+          batch.add(PointsContainQueries, pntPtr, interval.key_);
+        }
+        ++i;
+      }
+    }
+  }
+
+}; //end struct OneWayScanner
+
+
+/**
+ * \brief Check in \f$ O(Limit - Dim) \f$ if two intervals intersect by 
+ *  comparing in all dimensions till it's either false
+ *  or all tests evaluated to true.
+ *   
+ *
+ * \tparam Dim The dimension of the _key_ we're primarily working on, 
+ * this can differ from the actual dimension in value_type.
+ * \tparam Limit As we're looking for intersections in the 
+ *  Dim, we have to check for every intersection-pair
+ *  if they're also matching in the other dimensions, the 
+ *  parameter is used for termination.
+ * 
+ */
+
+template <typename BoxType, std::size_t ...TIndices>
+template <std::size_t Dim, std::size_t Limit>
+struct SetA<BoxType, TIndices...>::
+IntersectionTester {
+/**
+ * Check for intersection between its two inputs
+ * \param x Pointer to first interval.
+ * \param y Pointer to second interval.
+ */
+  static bool test(const key_type * x, const key_type * y)
+  {
+    bool result;
+    typedef typename std::tuple_element<Dim, key_type>::type Key;
+    typedef typename std::tuple_element<Dim, comp_type>::type Comp;
+    Key firstKey = getKey<Dim>(x);
+    Key secondKey = getKey<Dim>(y);
+    Comp less;
+    if (less(firstKey.first, secondKey.first)){
+      if (less(secondKey.first, firstKey.second)) result = true;
+      else result = false;
+    }
+    else {
+      if (less(firstKey.first, secondKey.second)) result = true;
+      else result = false;
+    }
+
+    //bool short-circuiting saves us from comparing useless dimensions
+    return result &&  IntersectionTester<Dim+1, Limit>::test(x, y); 
+
+  }
+};
+
+template <typename BoxType, std::size_t ...TIndices>
+template <std::size_t Limit>
+struct SetA<BoxType, TIndices...>::
+IntersectionTester<Limit, Limit> {
+  typedef SetA<BoxType, TIndices...>::key_type key_type;
+  static bool test(const key_type * x, const key_type * y){ return true; }
+};
+
+/**
+ * \brief Copy the endpoints of a key in all dimensions in [Dim, Limit) to
+ * the flat arrays used by the \ref OneWayScanner for \ref FLATKEYS.
+ */
+template <typename BoxType, std::size_t ...TIndices>
+template <std::size_t Dim, std::size_t Limit>
+struct SetA<BoxType, TIndices...>::
+FlatCopier {
+  /**
+   * \param[in] key The key to copy.
+   * \param[out] lower Lower endpoints, starting with Dim.
+   * \param[out] upper Upper endpoints, starting with Dim.
+   */
+  template <typename T>
+  static void copy(const key_type & key, T * lower, T * upper)
+  {
+    *lower = getHead<Dim>(key);
+    *upper = getTail<Dim>(key);
+    FlatCopier<Dim+1, Limit>::copy(key, lower + 1, upper + 1);
+  }
+};
+
+template <typename BoxType, std::size_t ...TIndices>
+template <std::size_t Limit>
+struct SetA<BoxType, TIndices...>::
+FlatCopier<Limit, Limit> {
+  typedef SetA<BoxType, TIndices...>::key_type key_type;
+  template <typename T>
+  static void copy(const key_type &, T *, T *) {}
+};
+
+
+/**
+ * Bin both key sets into the cells of a uniform grid over the first 
+ * (at most) two dimensions, with the largest extent of all keys as cell 
+ * size. Two keys can only intersect if their lower endpoints are less 
+ * than one extent apart in every dimension, i.e. if their cells are equal
+ * or neighbors. The keys are bucketed by sorting them by cell, every 
+ * data cell then looks up its (up to 9) neighbors by binary search and 
+ * tests all pairs with the \ref IntersectionTester. Every pair of query 
+ * and data key is looked at exactly once.
+ */
+template <typename BoxType, std::size_t ...TIndices>
+struct SetA<BoxType, TIndices...>::
+GridScanner {
+  enum {
+    /** Number of dimensions the grid spans */
+    GRIDDIMS = (NUMDIMS < 2) ? NUMDIMS : 2
+  };
+
+  /** The grid needs numbers that are ordered the usual way */
+  template <std::size_t Dim>
+  struct Usable {
+    typedef typename std::tuple_element<Dim, key_type>::type::first_type T;
+    typedef typename std::tuple_element<Dim, comp_type>::type Comp;
+    enum {
+      value = std::is_arithmetic<T>::value && 
+        std::is_same<Comp, std::less<T> >::value
+    };
+  };
+
+  enum {
+    USABLE = Usable<0>::value && Usable<GRIDDIMS - 1>::value
+  };
+
+  /** A key and the coordinates of its cell */
+  struct Cell {
+    int64_t x_;
+    int64_t y_;
+    const key_type * key_;
+    bool operator<(const Cell & other) const {
+      return x_ < other.x_ || (x_ == other.x_ && y_ < other.y_);
+    }
+  };
+
+  /**
+   * Collect the bounds and extents of both key sets in the grid 
+   * dimensions.
+   */
+  GridScanner(const std::vector<const key_type *> & pointsPtrVector,
+    const std::vector<const key_type *> & intervalsPtrVector)
+    : numKeys_(std::min(pointsPtrVector.size(), intervalsPtrVector.size()))
+  {
+    for (std::size_t d = 0; d < 2; ++d) {
+      lower_[d] = std::numeric_limits<double>::max();
+      upper_[d] = -std::numeric_limits<double>::max();
+      maxExtent_[d] = 0.0;
+      sumExtent_[d] = 0.0;
+      cellSize_[d] = 1.0;
+    }
+    addExtents(pointsPtrVector, mpl::Bool2Type<USABLE>());
+    addExtents(intervalsPtrVector, mpl::Bool2Type<USABLE>());
+    numExtents_ = pointsPtrVector.size() + intervalsPtrVector.size();
+    finite_ = true;
+    for (std::size_t d = 0; d < GRIDDIMS; ++d) {
+      // infinite or NaN ends (e.g. open limits) have no cell
+      finite_ = finite_ && std::isfinite(upper_[d] - lower_[d]) && 
+        std::isfinite(sumExtent_[d]);
+    }
+  }
+
+  /**
+   * Check if the grid applies to the keys: never if a bound in a grid 
+   * dimension is not finite, otherwise always if force is set, or if both
+   * sets hold at least cutoff keys, the mean extent is at least half of 
+   * the largest and there are at least four cells in every grid dimension.
+   */
+  bool suitable(const bool force, const std::size_t cutoff) const
+  {
+    if (!USABLE || numKeys_ == 0 || !finite_) return false;
+    if (force) return true;
+    if (numKeys_ < cutoff) return false;
+    for (std::size_t d = 0; d < GRIDDIMS; ++d) {
+      if (!(maxExtent_[d] > 0.0) || 
+        sumExtent_[d] / numExtents_ < 0.5 * maxExtent_[d] ||
+        upper_[d] - lower_[d] < 4.0 * maxExtent_[d]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Report all intersections between query keys (points) and data keys 
+   * (intervals) to the sink.
+   */
+  template <class Sink>
+  void scan(const std::vector<const key_type *> & pointsPtrVector,
+    const std::vector<const key_type *> & intervalsPtrVector,
+    State & state, Sink & sink)
+  {
+    for (std::size_t d = 0; d < GRIDDIMS; ++d) {
+      // nothing has an extent, so nothing can intersect
+      if (!(maxExtent_[d] > 0.0)) return;
+      // a little larger than the largest extent to be safe from rounding;
+      // cap the number of cells so that they fit into an int64_t 
+      cellSize_[d] = std::max(maxExtent_[d] * (1.0 + 1E-6), 
+        (upper_[d] - lower_[d]) * 1E-15);
+    }
+    std::vector<Cell> queries = createCells(pointsPtrVector, 
+      mpl::Bool2Type<USABLE>());
+    std::vector<Cell> data = createCells(intervalsPtrVector, 
+      mpl::Bool2Type<USABLE>());
+    std::sort(queries.begin(), queries.end());
+    std::sort(data.begin(), data.end());
+
+    EdgeBatch<Sink> batch(sink, state);
+    typename std::vector<Cell>::const_iterator cellBegin = data.begin();
+    while (cellBegin != data.end()) {
+      typename std::vector<Cell>::const_iterator cellEnd = cellBegin;
+      while (cellEnd != data.end() && !(*cellBegin < *cellEnd)) ++cellEnd;
+      const int64_t yRange = (GRIDDIMS > 1) ? 1 : 0;
+      for (int64_t dx = -1; dx <= 1; ++dx) {
+        for (int64_t dy = -yRange; dy <= yRange; ++dy) {
+          Cell neighbor;
+          neighbor.x_ = cellBegin->x_ + dx;
+          neighbor.y_ = cellBegin->y_ + dy;
+          typename std::vector<Cell>::const_iterator q = 
+            std::lower_bound(queries.begin(), queries.end(), neighbor);
+          for (; q != queries.end() && !(neighbor < *q); ++q) {
+            for (typename std::vector<Cell>::const_iterator i = cellBegin; 
+              i != cellEnd; ++i) {
+              if (IntersectionTester<0, NUMDIMS>::test(q->key_, i->key_)) {
+                batch.add(true, q->key_, i->key_);
+              }
+            }
+          }
+        }
+      }
+      cellBegin = cellEnd;
+    }
+  }
+
+ private:
+  /** Number of keys in the smaller set */
+  std::size_t numKeys_;
+  /** Number of keys in both sets */
+  std::size_t numExtents_;
+  /** False if a bound in a grid dimension is infinite or NaN */
+  bool finite_;
+  /** Smallest lower endpoint per grid dimension */
+  double lower_[2];
+  /** Largest upper endpoint per grid dimension */
+  double upper_[2];
+  double maxExtent_[2];
+  double sumExtent_[2];
+  double cellSize_[2];
 
-    
-    if (intervalsPtrVector.empty())
-      return;
+  template <std::size_t Dim>
+  void addExtent(const key_type * key)
+  {
+    const double head = static_cast<double>(getHead<Dim>(key));
+    const double tail = static_cast<double>(getTail<Dim>(key));
+    lower_[Dim] = std::min(lower_[Dim], head);
+    upper_[Dim] = std::max(upper_[Dim], tail);
+    maxExtent_[Dim] = std::max(maxExtent_[Dim], tail - head);
+    sumExtent_[Dim] += tail - head;
+  }
 
-    Comp less;
-    CIT pntVectorIt = pointsPtrVector.begin();
-    CIT intVectorIt = intervalsPtrVector.begin();
- 
-#ifdef __LIBFBI_USE_MULTITHREADING__
-    std::lock_guard<std::mutex> lck(fbi::mutex::__libfbi_mut_);
-#endif    
-    while (pntVectorIt != pointsPtrVector.end()){
+  void addExtents(const std::vector<const key_type *> &, mpl::Bool2Type<false>)
+  {}
 
-      const key_type * pntPtr = *pntVectorIt;
-      ++pntVectorIt; //don't look at the same point again!
-      //const Key point = getHead<Dim>(pntPtr);
-      key_type point = *pntPtr;
-      Key lowerBound = std::get<Dim>(point).first; 
-      std::get<Dim>(point).second = lowerBound;
+  void addExtents(const std::vector<const key_type *> & keys, 
+    mpl::Bool2Type<true>)
+  {
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      addExtent<0>(keys[i]);
+      if (GRIDDIMS > 1) addExtent<GRIDDIMS - 1>(keys[i]);
+    }
+  }
 
+  template <std::size_t Dim>
+  int64_t cell(const key_type * key) const
+  {
+    return static_cast<int64_t>(std::floor(
+      (static_cast<double>(getHead<Dim>(key)) - lower_[Dim]) / cellSize_[Dim]));
+  }
 
-      CIT oldIntVectorIt = intVectorIt; 
-      while ( intVectorIt != intervalsPtrVector.end())
-      {
-        //if this is true, the lower endpoint of the intervals is greater than 
-        //the query point - it is impossible for the query point to be inside.
-        if (less(lowerBound,getHead<Dim>(*intVectorIt))) break;
-        ++intVectorIt;
-      }
-      //add all intervals that weren't in the intervalSet yet whose lower end 
-      //is not higher than the query point, these are the viable intervals.
-      intervalsPtrSet.insert(oldIntVectorIt, intVectorIt);
-
-      //return an iterator to the first object whose upper endpoint is 
-      //greater than the point
-      SIT activeSetIt = intervalsPtrSet.upper_bound(&point);
-      //erase all intervals whose upper endpoints aren't greater than the point.
-      intervalsPtrSet.erase(intervalsPtrSet.begin(), activeSetIt);
-      //iterate through the data intervals till we find one whose 
-      //lower endpoint is too big
-      //fill up the intervalSet with all intervals before. 
-
-      //erase all intervals from the active set whose upper endpoint are
-      //lower than the query point, these can't encompass it.
-
-      //add all intersections to the results
-      SIT intersectionSetIt = intervalsPtrSet.begin();
-      SIT intersectionSetEnd = intervalsPtrSet.end();
-      for(; intersectionSetIt != intersectionSetEnd; ++intersectionSetIt) {
-        if (IntersectionTester<Dim+1, NUMDIMS>::
-              test(pntPtr, *intersectionSetIt) ) {
-            
-          std::size_t edgeHead = state.calculate(PointsContainQueries, pntPtr);
-          std::size_t edgeTail = state.calculate(!PointsContainQueries, *intersectionSetIt);
-          resultVector[edgeHead].insert(resultVector[edgeHead].end(),static_cast<IntType>(edgeTail));
-          resultVector[edgeTail].insert(resultVector[edgeTail].end(),static_cast<IntType>(edgeHead));
-        }
-      } //end add all intersections to the results.
-    } //end while qContainerIt != pointsContainer.end() 
-    // do loop for every query point.
-  } //end scan
+  std::vector<Cell> createCells(const std::vector<const key_type *> &, 
+    mpl::Bool2Type<false>) const
+  {
+    return std::vector<Cell>();
+  }
 
-}; //end struct OneWayScanner
+  std::vector<Cell> createCells(const std::vector<const key_type *> & keys, 
+    mpl::Bool2Type<true>) const
+  {
+    std::vector<Cell> cells(keys.size());
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      cells[i].x_ = cell<0>(keys[i]);
+      cells[i].y_ = (GRIDDIMS > 1) ? cell<GRIDDIMS - 1>(keys[i]) : 0;
+      cells[i].key_ = keys[i];
+    }
+    return cells;
+  }
+};
 
 
 /**
- * \brief Check in \f$ O(Limit - Dim) \f$ if two intervals intersect by 
- *  comparing in all dimensions till it's either false
- *  or all tests evaluated to true.
- *   
- *
- * \tparam Dim The dimension of the _key_ we're primarily working on, 
- * this can differ from the actual dimension in value_type.
- * \tparam Limit As we're looking for intersections in the 
- *  Dim, we have to check for every intersection-pair
- *  if they're also matching in the other dimensions, the 
- *  parameter is used for termination.
- * 
+ * Merge both key sets in the order of their lower endpoint in the first
+ * dimension. Every key that comes up is tested against the keys of the 
+ * other set that are still open, i.e. whose upper endpoint lies beyond 
+ * its lower endpoint, and then opens itself. Keys that are closed are 
+ * dropped from the (unordered) lists on the way. On equal lower endpoints
+ * data keys come first, so every pair is looked at once, when the one 
+ * that starts later comes up. This reports the same pairs in the first 
+ * dimension as the two \ref OneWayScanner passes together, including 
+ * empty intervals that start where the other key starts.
  */
-
 template <typename BoxType, std::size_t ...TIndices>
-template <std::size_t Dim, std::size_t Limit>
 struct SetA<BoxType, TIndices...>::
-IntersectionTester {
-/**
- * Check for intersection between its two inputs
- * \param x Pointer to first interval.
- * \param y Pointer to second interval.
- */
-  static bool test(const key_type * x, const key_type * y)
+SweepScanner {
+  typedef typename std::tuple_element<0, key_type>::type::first_type Key;
+  typedef typename std::tuple_element<0, comp_type>::type Comp;
+
+  /**
+   * Report all intersections between query keys (points) and data keys 
+   * (intervals) to the sink.
+   */
+  template <class Sink>
+  static void scan(const std::vector<const key_type *> & pointsPtrVector,
+    const std::vector<const key_type *> & intervalsPtrVector,
+    State & state, Sink & sink)
   {
-    bool result;
-    typedef typename std::tuple_element<Dim, key_type>::type Key;
-    typedef typename std::tuple_element<Dim, comp_type>::type Comp;
-    Key firstKey = getKey<Dim>(x);
-    Key secondKey = getKey<Dim>(y);
+    if (pointsPtrVector.empty() || intervalsPtrVector.empty()) return;
+    std::vector<const key_type *> queries(pointsPtrVector);
+    std::vector<const key_type *> data(intervalsPtrVector);
+    sortContainerHead<0>(queries);
+    sortContainerHead<0>(data);
+    std::vector<const key_type *> openQueries, openData;
+    EdgeBatch<Sink> batch(sink, state);
+
     Comp less;
-    if (less(firstKey.first, secondKey.first)){
-      if (less(secondKey.first, firstKey.second)) result = true;
-      else result = false;
-    }
-    else {
-      if (less(firstKey.first, secondKey.second)) result = true;
-      else result = false;
+    std::size_t q = 0, d = 0;
+    while (q < queries.size() || d < data.size()) {
+      const bool isData = d < data.size() && (q == queries.size() || 
+        !less(getHead<0>(queries[q]), getHead<0>(data[d])));
+      const key_type * key = isData ? data[d++] : queries[q++];
+      sweep(key, isData, isData ? openQueries : openData, batch);
+      (isData ? openData : openQueries).push_back(key);
     }
-
-    //bool short-circuiting saves us from comparing useless dimensions
-    return result &&  IntersectionTester<Dim+1, Limit>::test(x, y); 
-
   }
-};
 
-template <typename BoxType, std::size_t ...TIndices>
-template <std::size_t Limit>
-struct SetA<BoxType, TIndices...>::
-IntersectionTester<Limit, Limit> {
-  typedef SetA<BoxType, TIndices...>::key_type key_type;
-  static bool test(const key_type * x, const key_type * y){ return true; }
+ private:
+  /**
+   * Test key against the open keys of the other set, drop the ones that 
+   * closed before key starts.
+   */
+  template <class Sink>
+  static void sweep(const key_type * key, const bool isData,
+    std::vector<const key_type *> & open, EdgeBatch<Sink> & batch)
+  {
+    Comp less;
+    const Key head = getHead<0>(key);
+    std::size_t i = 0;
+    while (i < open.size()) {
+      const key_type * other = open[i];
+      if (!less(head, getTail<0>(other))) {
+        if (less(getHead<0>(other), head)) {
+          // closed before key starts, and so before all following keys
+          open[i] = open.back();
+          open.pop_back();
+          continue;
+        }
+        // an empty interval that starts where key starts
+        if (!less(head, getTail<0>(key))) {
+          ++i;
+          continue;
+        }
+      }
+      if (IntersectionTester<1, NUMDIMS>::test(key, other)) {
+        batch.add(true, isData ? other : key, isData ? key : other);
+      }
+      ++i;
+    }
+  }
 };
 
 
@@ -1778,6 +4112,447 @@ KeyPrinter<N,N>
       }
 };
 
+
+/**
+ * \brief Compute the grid cells of a key's center for the space-filling
+ *  curve in \ref sortAlongCurve.
+ * \tparam Dim The dimension to start with.
+ * \tparam Limit Number of dimensions the key_type possesses.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+template <std::size_t Dim, std::size_t Limit>
+struct SetA<BoxType, TIndices...>::
+CurveEncoder
+{
+  typedef typename std::tuple_element<Dim, key_type>::type::first_type
+    ValType;
+
+  /** Center of an arithmetic interval, NaN if it is unbounded. */
+  static double center(const key_type & key, mpl::Bool2Type<true>) {
+    return 0.5 * static_cast<double>(getHead<Dim>(key)) +
+      0.5 * static_cast<double>(getTail<Dim>(key));
+  }
+
+  /** Other key types do not have a center, keep them in one cell. */
+  static double center(const key_type & key, mpl::Bool2Type<false>) {
+    return 0.0;
+  }
+
+  static double center(const key_type & key) {
+    return center(key, mpl::Bool2Type<std::is_arithmetic<ValType>::value>());
+  }
+
+  /**
+   * Widen [lower, upper] so that the (finite) center of key is inside.
+   * \param[in] key The key
+   * \param[in,out] lower Lower bound of the centers in every dimension
+   * \param[in,out] upper Upper bound of the centers in every dimension
+   */
+  static void bounds(const key_type & key, double * lower, double * upper) {
+    const double c = center(key);
+    if (std::isfinite(c)) {
+      lower[Dim] = std::min(lower[Dim], c);
+      upper[Dim] = std::max(upper[Dim], c);
+    }
+    CurveEncoder<Dim+1, Limit>::bounds(key, lower, upper);
+  }
+
+  /**
+   * Map the center of key to a cell in [0, maxCell] in every dimension.
+   * \param[in] key The key
+   * \param[in] lower Lower bound of the centers, see \ref bounds
+   * \param[in] scale Number of cells per unit in every dimension
+   * \param[in] maxCell The highest cell
+   * \param[out] cells The cell in every dimension
+   */
+  static void cells(const key_type & key, const double * lower,
+    const double * scale, const double maxCell, uint64_t * cells) {
+    const double cell = (center(key) - lower[Dim]) * scale[Dim];
+    // comparisons with NaN fail, so unbounded keys end up in cell 0
+    if (!(cell > 0.0)) cells[Dim] = 0;
+    else if (cell > maxCell) cells[Dim] = static_cast<uint64_t>(maxCell);
+    else cells[Dim] = static_cast<uint64_t>(cell);
+    CurveEncoder<Dim+1, Limit>::cells(key, lower, scale, maxCell, cells);
+  }
+};
+
+/**
+ * \brief Terminate the recursion of \ref CurveEncoder.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+template <std::size_t N>
+struct SetA<BoxType, TIndices...>::
+CurveEncoder<N,N>
+{
+  /** Use the key_type of its parent struct*/
+  typedef SetA<BoxType, TIndices...>::key_type key_type;
+  static void bounds(const key_type &, double *, double *) {}
+  static void cells(const key_type &, const double *, const double *,
+    const double, uint64_t *) {}
+};
+
+
+/**
+ * \brief Compute the interval two keys have in common in every dimension,
+ *  which is only meaningful if they intersect.
+ * \tparam Dim The dimension to start with.
+ * \tparam Limit Number of dimensions the key_type possesses.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+template <std::size_t Dim, std::size_t Limit>
+struct SetA<BoxType, TIndices...>::
+OverlapCalculator
+{
+  /**
+   * \param[in] x First key
+   * \param[in] y Second key
+   * \param[out] overlap The intersection of x and y
+   */
+  static void compute(const key_type & x, const key_type & y, 
+    key_type & overlap) {
+    typename std::tuple_element<Dim, comp_type>::type less;
+    std::get<Dim>(overlap).first = less(getHead<Dim>(x), getHead<Dim>(y)) ? 
+      getHead<Dim>(y) : getHead<Dim>(x);
+    std::get<Dim>(overlap).second = less(getTail<Dim>(x), getTail<Dim>(y)) ? 
+      getTail<Dim>(x) : getTail<Dim>(y);
+    OverlapCalculator<Dim+1, Limit>::compute(x, y, overlap);
+  }
+};
+
+/**
+ * \brief Terminate the recursion of \ref OverlapCalculator.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+template <std::size_t N>
+struct SetA<BoxType, TIndices...>::
+OverlapCalculator<N,N>
+{
+  /** Use the key_type of its parent struct*/
+  typedef SetA<BoxType, TIndices...>::key_type key_type;
+  static void compute(const key_type &, const key_type &, key_type &) {}
+};
+
+
+/**
+ * \brief Bounded max-heaps of the best scoring neighbors, stored in the rows
+ *  of the result itself.
+ * \tparam Scorer See \ref SetB::scoredIntersect
+ * \tparam BoxContainer The container of data boxes
+ * \tparam QContainer The container of query boxes
+ */
+template <typename BoxType, std::size_t ... TIndices>
+template <class Scorer, class BoxContainer, class QContainer>
+struct SetA<BoxType, TIndices...>::
+TopKCollector
+{
+  ScoredResultType & result_;
+  const std::size_t k_;
+  const Scorer & scorer_;
+  const BoxContainer & data_;
+  const QContainer & queries_;
+  /** Index of the first query box, see \ref State::calculate */
+  const std::size_t offset_;
+
+  TopKCollector(ScoredResultType & result, const std::size_t k, 
+    const Scorer & scorer, const BoxContainer & data, 
+    const QContainer & queries, const std::size_t offset)
+    : result_(result), k_(k), scorer_(scorer), data_(data), 
+      queries_(queries), offset_(offset) {}
+
+  /** Order by score, then by index, the heap top is the worst neighbor */
+  static bool better(const ScoredEdge & x, const ScoredEdge & y) {
+    if (x.second < y.second) return true;
+    if (y.second < x.second) return false;
+    return x.first < y.first;
+  }
+
+  /**
+   * Offer a neighbor to the heap of a query box. The same pair can be 
+   * found more than once (e.g. by several query functors); as the score 
+   * only depends on the boxes, it is enough to skip neighbors already in 
+   * the heap.
+   * \param[in] query Index of the query box, see \ref State::calculate
+   * \param[in] neighbor Index of the data box
+   */
+  void add(const std::size_t query, const std::size_t neighbor) {
+    std::vector<ScoredEdge> & heap = result_[query];
+    for (std::size_t i = 0; i < heap.size(); ++i) {
+      if (heap[i].first == neighbor) return;
+    }
+    const ScoredEdge candidate(static_cast<IntType>(neighbor), 
+      static_cast<double>(scorer_(queries_[query - offset_], data_[neighbor])));
+    if (heap.size() < k_) {
+      heap.push_back(candidate);
+      std::push_heap(heap.begin(), heap.end(), &better);
+    } else if (better(candidate, heap.front())) {
+      std::pop_heap(heap.begin(), heap.end(), &better);
+      heap.back() = candidate;
+      std::push_heap(heap.begin(), heap.end(), &better);
+    }
+  }
+
+  /** Sort the neighbors of every query box by ascending score */
+  void finish() {
+    for (std::size_t i = 0; i < result_.size(); ++i) {
+      std::sort_heap(result_[i].begin(), result_[i].end(), &better);
+    }
+  }
+};
+
+/**
+ * \brief Edges as (smaller, larger) index pairs in a buffer of bounded 
+ *  size. Whenever the buffer is full, it is sorted, freed of duplicates 
+ *  and appended to a temporary file. The scanners call it like a visitor, 
+ *  see \ref SetB::visitIntersections.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+struct SetA<BoxType, TIndices...>::
+EdgeSpool
+{
+  typedef std::pair<IntType, IntType> Edge;
+  /** The edges that have not been written to file_ */
+  std::vector<Edge> buffer_;
+  /** Number of edges buffer_ holds at most, 0 means no limit */
+  std::size_t capacity_;
+  /** The spilled edges, 0 until the buffer is full for the first time */
+  FILE * file_;
+  /** Number of edges in file_ */
+  std::size_t spilled_;
+
+  explicit EdgeSpool(const std::size_t capacity) 
+    : capacity_(capacity), file_(0), spilled_(0) {}
+
+  ~EdgeSpool() {
+    if (file_) fclose(file_);
+  }
+
+  /** Add an edge, spill the buffer if it is full */
+  void operator()(const IntType head, const IntType tail) {
+    buffer_.push_back(head < tail ? Edge(head, tail) : Edge(tail, head));
+    if (capacity_ != 0 && buffer_.size() >= capacity_) spill();
+  }
+
+  /** 
+   * Write the buffer to the file, unless removing its duplicates freed
+   * half of it. If there is no temporary file or it is full, the edges 
+   * stay in memory from now on.
+   */
+  void spill() {
+    compact();
+    if (2 * buffer_.size() < capacity_) return;
+    if (file_ == 0) file_ = tmpfile();
+    const std::size_t written = (file_ == 0) ? 0 : 
+      fwrite(&buffer_[0], sizeof(Edge), buffer_.size(), file_);
+    // a partially written buffer only duplicates edges
+    spilled_ += written;
+    if (written == buffer_.size()) {
+      buffer_.clear();
+    } else {
+      capacity_ = 0;
+    }
+  }
+
+  /** Sort the buffer and remove duplicate edges */
+  void compact() {
+    std::sort(buffer_.begin(), buffer_.end());
+    buffer_.erase(std::unique(buffer_.begin(), buffer_.end()), 
+      buffer_.end());
+  }
+
+  /** 
+   * Store the edges in an adjacency list with result.size() rows, in both
+   * directions. Every row is allocated once with its final size.
+   */
+  void fill(ResultType & result) {
+    compact();
+    std::vector<std::size_t> counts(result.size(), 0);
+    RowCounter counter(counts);
+    forEach(counter);
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      reserveRow(result[i], counts[i]);
+    }
+    std::vector<std::size_t>().swap(counts);
+    RowInserter inserter(result);
+    forEach(inserter);
+#ifndef __LIBFBI_USE_SET_FOR_RESULT__
+    // edges spilled in different runs can still be duplicates
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      std::sort(result[i].begin(), result[i].end());
+      result[i].erase(std::unique(result[i].begin(), result[i].end()), 
+        result[i].end());
+    }
+#endif
+  }
+
+  /** Store the edges in compressed sparse row form with numBoxes rows */
+  void fill(CompactResultType & result, const std::size_t numBoxes) {
+    compact();
+    std::vector<std::size_t> & offsets = result.offsets_;
+    offsets.assign(numBoxes + 1, 0);
+    RowCounter counter(offsets, 1);
+    forEach(counter);
+    for (std::size_t i = 0; i < numBoxes; ++i) {
+      offsets[i + 1] += offsets[i];
+    }
+    result.targets_.resize(offsets.back());
+    std::vector<std::size_t> next(offsets.begin(), offsets.end() - 1);
+    TargetInserter inserter(result.targets_, next);
+    forEach(inserter);
+    std::vector<std::size_t>().swap(next);
+    // sort every row, remove duplicates and close the gaps
+    std::size_t end = 0;
+    for (std::size_t i = 0; i < numBoxes; ++i) {
+      typename std::vector<IntType>::iterator first = 
+        result.targets_.begin() + offsets[i];
+      typename std::vector<IntType>::iterator last = 
+        result.targets_.begin() + offsets[i + 1];
+      std::sort(first, last);
+      last = std::unique(first, last);
+      offsets[i] = end;
+      end = std::copy(first, last, result.targets_.begin() + end) - 
+        result.targets_.begin();
+    }
+    offsets[numBoxes] = end;
+    result.targets_.resize(end);
+  }
+
+ private:
+  /** Count the neighbors of every box, at counts[box + shift] */
+  struct RowCounter {
+    std::vector<std::size_t> & counts_;
+    const std::size_t shift_;
+    RowCounter(std::vector<std::size_t> & counts, const std::size_t shift = 0)
+      : counts_(counts), shift_(shift) {}
+    void operator()(const IntType head, const IntType tail) {
+      ++counts_[head + shift_];
+      if (head != tail) ++counts_[tail + shift_];
+    }
+  };
+
+  /** Append both directions of every edge to the rows of result */
+  struct RowInserter {
+    ResultType & result_;
+    explicit RowInserter(ResultType & result) : result_(result) {}
+    void operator()(const IntType head, const IntType tail) {
+      result_[head].insert(result_[head].end(), tail);
+      if (head != tail) result_[tail].insert(result_[tail].end(), head);
+    }
+  };
+
+  /** Write both directions of every edge to the next free target slots */
+  struct TargetInserter {
+    std::vector<IntType> & targets_;
+    std::vector<std::size_t> & next_;
+    TargetInserter(std::vector<IntType> & targets, 
+      std::vector<std::size_t> & next) : targets_(targets), next_(next) {}
+    void operator()(const IntType head, const IntType tail) {
+      targets_[next_[head]++] = tail;
+      if (head != tail) targets_[next_[tail]++] = head;
+    }
+  };
+
+  static void reserveRow(std::vector<IntType> & row, const std::size_t n) {
+    row.reserve(n);
+  }
+
+  static void reserveRow(std::set<IntType> &, const std::size_t) {}
+
+  /** Call f(head, tail) for the spilled edges and those in the buffer */
+  template <class F>
+  void forEach(F & f) {
+    if (file_ != 0 && spilled_ > 0) {
+      rewind(file_);
+      std::vector<Edge> chunk(std::min<std::size_t>(spilled_, 
+        std::max<std::size_t>(capacity_, 1 << 16)));
+      std::size_t left = spilled_;
+      while (left > 0) {
+        const std::size_t n = fread(&chunk[0], sizeof(Edge), 
+          std::min(left, chunk.size()), file_);
+        if (n == 0) break;
+        for (std::size_t i = 0; i < n; ++i) f(chunk[i].first, chunk[i].second);
+        left -= n;
+      }
+      fseek(file_, 0, SEEK_END);
+    }
+    for (std::size_t i = 0; i < buffer_.size(); ++i) {
+      f(buffer_[i].first, buffer_[i].second);
+    }
+  }
+
+  /** Not copyable, it owns the file */
+  EdgeSpool(const EdgeSpool &);
+  EdgeSpool & operator=(const EdgeSpool &);
+};
+
+/**
+ * \brief The scanners of all partitions (see 
+ *  \ref IntersectOptions::partitions_) and both HybridScanner threads 
+ *  share one sink. Instead of locking the sink mutex for a whole scan, 
+ *  every scanner collects the pairs of keys it finds and adds them under
+ *  the mutex once CAPACITY of them are pending, so the scans themselves 
+ *  run in parallel. Without multithreading every pair is added directly.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+template <class Sink>
+struct SetA<BoxType, TIndices...>::
+EdgeBatch
+{
+  enum { CAPACITY = 1024 };
+
+  EdgeBatch(Sink & sink, const State & state) 
+    : sink_(sink), state_(state), size_(0) {}
+
+  ~EdgeBatch() { flush(); }
+
+  /** Record an intersection, see \ref addEdge */
+  void add(const bool pointsContainQueries, const key_type * point, 
+    const key_type * interval) 
+  {
+#ifdef __LIBFBI_USE_MULTITHREADING__
+    Pending & pending = pending_[size_++];
+    pending.pointsContainQueries_ = pointsContainQueries;
+    pending.point_ = point;
+    pending.interval_ = interval;
+    if (size_ == CAPACITY) flush();
+#endif
+#ifndef __LIBFBI_USE_MULTITHREADING__
+    addEdge(sink_, state_, pointsContainQueries, point, interval);
+#endif
+  }
+
+  /** Add the pending intersections to the sink */
+  void flush() 
+  {
+#ifdef __LIBFBI_USE_MULTITHREADING__
+    if (size_ == 0) return;
+    std::lock_guard<std::mutex> lck(state_.sinkMutex());
+    for (std::size_t i = 0; i < size_; ++i) {
+      addEdge(sink_, state_, pending_[i].pointsContainQueries_, 
+        pending_[i].point_, pending_[i].interval_);
+    }
+    size_ = 0;
+#endif
+  }
+
+ private:
+  struct Pending {
+    bool pointsContainQueries_;
+    const key_type * point_;
+    const key_type * interval_;
+  };
+
+  Sink & sink_;
+  const State & state_;
+  std::size_t size_;
+#ifdef __LIBFBI_USE_MULTITHREADING__
+  Pending pending_[CAPACITY];
+#endif
+
+  /** Not copyable, the pending edges would be added twice */
+  EdgeBatch(const EdgeBatch &);
+  EdgeBatch & operator=(const EdgeBatch &);
+};
+
 } //end namespace hybridtree;
 
 
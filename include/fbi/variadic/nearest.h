@@ -0,0 +1,324 @@
+/* $Id: nearest.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __LIBFBI_INCLUDE_FBI_NEAREST_H__
+#define __LIBFBI_INCLUDE_FBI_NEAREST_H__
+
+//C99
+#include <stdint.h>
+//C++
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+//c++0x
+#include <tuple>
+
+#include <fbi/config.h>
+#include <fbi/traits.h>
+#include <fbi/tuplegenerator.h>
+
+namespace fbi {
+
+/**
+ * \class BoxGapMetric
+ * \brief Default per-dimension distance for \ref Nearest: the gap between two
+ * intervals, 0 if they overlap.
+ *
+ * A metric has to provide a
+ * \verbatim double get<N>(const std::pair<T,T> & query, const std::pair<T,T> & data) const; \endverbatim
+ * method for every indexed dimension N, just like the box functors provide
+ * get<N>(const BoxType &). The distance must not increase if the data
+ * interval grows (e.g. ppm or seconds derived from the interval gap), as
+ * \ref Nearest uses half-open intervals to bound the distance of the boxes it
+ * has not looked at yet.
+ */
+struct BoxGapMetric
+{
+  template <std::size_t N, typename T>
+  double get(const std::pair<T, T> & query, const std::pair<T, T> & data) const
+  {
+    if (data.second < query.first) return query.first - data.second;
+    if (query.second < data.first) return data.first - query.second;
+    return 0.0;
+  }
+};
+
+/**
+ * \class Nearest
+ *
+ * \brief Find the k closest data boxes for every query box.
+ *
+ * Keys are created exactly as in \ref SetA, i.e. by calling the get<N>
+ * methods of the box functors for all TIndices, so the same Traits and
+ * functors can be used for intersection and nearest box queries. The
+ * distance between two boxes is the sum of the per-dimension distances
+ * returned by the metric.
+ *
+ * The data boxes are sorted by their lower endpoint in the first indexed
+ * dimension. A query walks outwards from its own position in that order and
+ * stops as soon as the distance in the first dimension alone exceeds the k-th
+ * best distance found so far.
+ *
+ * \tparam BoxType The data objects, Traits<BoxType> has to be available.
+ * \tparam TIndices The dimensions used for the distance calculation. The
+ *  first one is used for sorting and should be the most selective one.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+class Nearest {
+
+ private:
+  /** Keep ctor private, Nearest is not meant to be instantiated.*/
+  Nearest();
+
+  enum {NUMDIMS = sizeof...(TIndices)};
+
+  static_assert(Traits<BoxType>::defined == 1,
+                "Please define Traits for your custom type"
+                );
+
+  /** The reduced key_type, see SetA::key_type */
+  typedef typename 
+    mpl::TypeExtractor<Traits<BoxType>, TIndices...>::key_type key_type;
+
+  /** The type of the endpoints in the first (sorting) dimension */
+  typedef typename std::tuple_element<0, key_type>::type::first_type 
+    SortType;
+
+  static_assert(std::numeric_limits<SortType>::is_specialized,
+                "Nearest requires an arithmetic type in the first dimension");
+
+  template <std::size_t Dim, std::size_t Limit>
+  struct DistanceCalculator;
+
+ public:
+  /** Indices into the data container, see SetA::IntType */
+  typedef uint32_t IntType;
+
+  /** A neighbor is represented by its index and its distance to the query */
+  typedef std::pair<IntType, double> Neighbor;
+
+  /**
+   * For every query, the found neighbors are sorted by ascending distance
+   * (ties are broken by index).
+   */
+  typedef std::vector<std::vector<Neighbor> > ResultType;
+
+  /**
+   * \brief Find the k nearest data boxes for every query box.
+   *
+   * \param[in] k Maximum number of neighbors to report per query.
+   * \param[in] dataContainer STL container holding the data boxes.
+   * \param[in] ifunctor A class with a public
+   * \verbatim get<Dim>(const BoxType & ) const; \endverbatim method.
+   * \param[in] qdataContainer STL container holding the query boxes.
+   * \param[in] qfunctor Like ifunctor, for the objects in qdataContainer.
+   * It is called with the same TIndices.
+   * \param[in] metric Per-dimension distance, see \ref BoxGapMetric.
+   * \param[in] maxDistance Neighbors further away than maxDistance are not
+   * reported, hence queries may have less than k (or no) neighbors.
+   * \return One vector of neighbors per query object, data boxes are
+   * identified by their index in dataContainer.
+   */
+  template <
+  class BoxContainer,
+        class QContainer,
+        typename IntervalFunctor,
+        typename QueryFunctor,
+        typename Metric
+          >
+          static
+          ResultType find(
+            const std::size_t k,
+            const BoxContainer & dataContainer,
+            const IntervalFunctor & ifunctor,
+            const QContainer & qdataContainer,
+            const QueryFunctor & qfunctor,
+            const Metric & metric,
+            const double maxDistance = std::numeric_limits<double>::max()
+            )
+          {
+            ResultType resultVector(qdataContainer.size());
+            if (k == 0 || dataContainer.empty()) return resultVector;
+
+            std::vector<key_type> dataKeys;
+            dataKeys.reserve(dataContainer.size());
+            typename BoxContainer::const_iterator it = dataContainer.begin();
+            for (; it != dataContainer.end(); ++it) {
+              dataKeys.push_back(createKey(*it, ifunctor));
+            }
+
+            // sort by the lower endpoint in the first dimension and remember
+            // the widest interval to bound the boxes left of the query.
+            std::vector<IntType> order(dataKeys.size());
+            for (std::size_t i = 0; i < order.size(); ++i) {
+              order[i] = static_cast<IntType>(i);
+            }
+            std::sort(order.begin(), order.end(), lessHead(dataKeys));
+            std::vector<SortType> heads(order.size());
+            SortType maxWidth = SortType();
+            for (std::size_t i = 0; i < order.size(); ++i) {
+              const std::pair<SortType, SortType> & interval = 
+                std::get<0>(dataKeys[order[i]]);
+              heads[i] = interval.first;
+              maxWidth = std::max<SortType>(maxWidth, 
+                interval.second - interval.first);
+            }
+
+            typedef std::priority_queue<Neighbor, std::vector<Neighbor>, 
+              lessNeighbor> Heap;
+            std::size_t q = 0;
+            typename QContainer::const_iterator qit = qdataContainer.begin();
+            for (; qit != qdataContainer.end(); ++qit, ++q) {
+              const key_type query = createKey(*qit, qfunctor);
+              const std::pair<SortType, SortType> & sortKey = 
+                std::get<0>(query);
+              Heap heap;
+              const std::size_t start = 
+                std::lower_bound(heads.begin(), heads.end(), sortKey.first)
+                - heads.begin();
+
+              // walk right: all remaining boxes lie in [heads[j], max)
+              for (std::size_t j = start; j < heads.size(); ++j) {
+                const double bound = metric.template 
+                  get<mpl::IndexAt<0, TIndices...>::value>(sortKey, 
+                    std::make_pair(heads[j], 
+                      std::numeric_limits<SortType>::max()));
+                if (!accept(heap, k, bound, maxDistance)) break;
+                consider(heap, k, order[j], 
+                  DistanceCalculator<0, NUMDIMS>::get(
+                    query, dataKeys[order[j]], metric),
+                  maxDistance);
+              }
+              // walk left: all remaining boxes lie in (lowest, heads[j]+maxWidth]
+              for (std::size_t j = start; j > 0; --j) {
+                const double bound = metric.template 
+                  get<mpl::IndexAt<0, TIndices...>::value>(sortKey,
+                    std::make_pair(std::numeric_limits<SortType>::lowest(), 
+                      static_cast<SortType>(heads[j-1] + maxWidth)));
+                if (!accept(heap, k, bound, maxDistance)) break;
+                consider(heap, k, order[j-1], 
+                  DistanceCalculator<0, NUMDIMS>::get(
+                    query, dataKeys[order[j-1]], metric),
+                  maxDistance);
+              }
+
+              std::vector<Neighbor> & neighbors = resultVector[q];
+              neighbors.resize(heap.size());
+              for (std::size_t n = heap.size(); n > 0; --n) {
+                neighbors[n-1] = heap.top();
+                heap.pop();
+              }
+            }
+            return resultVector;
+          }
+
+ private:
+
+  /** Order neighbors by distance, then by index */
+  struct lessNeighbor {
+    bool operator()(const Neighbor & x, const Neighbor & y) const {
+      if (x.second < y.second) return true;
+      if (y.second < x.second) return false;
+      return x.first < y.first;
+    }
+  };
+
+  /** Sort indices by the lower endpoint of their keys in the first dimension */
+  struct lessHead {
+    const std::vector<key_type> & keys_;
+    lessHead(const std::vector<key_type> & keys) : keys_(keys) {}
+    bool operator()(const IntType x, const IntType y) const {
+      return std::get<0>(keys_[x]).first < std::get<0>(keys_[y]).first;
+    }
+  };
+
+  /** Create the reduced key for a box, see SetA::KeyCreator::createKey */
+  template <typename T, typename Functor>
+  static inline key_type createKey(const T & val, const Functor & functor) {
+    return std::make_tuple(functor.template get<TIndices>(val)...);
+  }
+
+  /**
+   * Return false if no box with a distance of at least bound can make it
+   * into the heap anymore.
+   */
+  template <typename Heap>
+  static inline bool accept(const Heap & heap, const std::size_t k,
+    const double bound, const double maxDistance) {
+    if (maxDistance < bound) return false;
+    return heap.size() < k || !(heap.top().second < bound);
+  }
+
+  /** Add a candidate to the heap if it is among the k best so far */
+  template <typename Heap>
+  static inline void consider(Heap & heap, const std::size_t k, 
+    const IntType index, const double distance, const double maxDistance) {
+    if (maxDistance < distance) return;
+    const Neighbor candidate(index, distance);
+    if (heap.size() < k) {
+      heap.push(candidate);
+    } else if (lessNeighbor()(candidate, heap.top())) {
+      heap.pop();
+      heap.push(candidate);
+    }
+  }
+};
+
+/**
+ * \brief Sum up the per-dimension distances in [Dim, Limit), similar to 
+ * SetA::IntersectionTester.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+template <std::size_t Dim, std::size_t Limit>
+struct Nearest<BoxType, TIndices...>::
+DistanceCalculator {
+  template <typename Metric>
+  static inline double get(const key_type & x, const key_type & y, 
+    const Metric & metric) {
+    return metric.template get<mpl::IndexAt<Dim, TIndices...>::value>(
+        std::get<Dim>(x), std::get<Dim>(y)) + 
+      DistanceCalculator<Dim+1, Limit>::get(x, y, metric);
+  }
+};
+
+template <typename BoxType, std::size_t ... TIndices>
+template <std::size_t Limit>
+struct Nearest<BoxType, TIndices...>::
+DistanceCalculator<Limit, Limit> {
+  template <typename Metric>
+  static inline double get(const key_type & x, const key_type & y, 
+    const Metric & metric) {
+    return 0.0;
+  }
+};
+
+} //end namespace fbi
+
+#endif
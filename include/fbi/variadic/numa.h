@@ -0,0 +1,155 @@
+/* $Id: numa.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+
+#ifndef __LIBFBI_INCLUDE_FBI_NUMA_H__
+#define __LIBFBI_INCLUDE_FBI_NUMA_H__
+
+//C++
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+//POSIX
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <fbi/config.h>
+
+namespace fbi {
+
+/**
+ * \class NumaTopology
+ * \brief The CPUs of every NUMA node of the machine.
+ *
+ * On Linux, the nodes and their CPUs are read from 
+ * /sys/devices/system/node, elsewhere (or if that fails) the machine is
+ * treated as a single node without known CPUs. Worker threads can pin
+ * themselves to a node before allocating the memory they work on; Linux
+ * places pages on the node of the thread that touches them first, so the
+ * memory of the worker then is local.
+ */
+class NumaTopology {
+ public:
+  /** The topology of this machine, detected on first use */
+  static const NumaTopology & get() 
+  {
+    static const NumaTopology topology;
+    return topology;
+  }
+
+  /** Number of nodes, at least 1 */
+  std::size_t numNodes() const { return cpus_.size(); }
+
+  /** The CPUs of a node, empty if unknown */
+  const std::vector<int> & cpus(const std::size_t node) const 
+  { 
+    return cpus_[node]; 
+  }
+
+  /**
+   * Restrict the calling thread to the CPUs of a node. Threads it creates
+   * afterwards inherit the restriction.
+   * \return false if the CPUs of the node are unknown or pinning failed.
+   */
+  bool pinCurrentThread(const std::size_t node) const
+  {
+    const std::vector<int> & cpus = cpus_[node % cpus_.size()];
+    if (cpus.empty()) return false;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (std::size_t i = 0; i < cpus.size(); ++i) {
+      if (cpus[i] < CPU_SETSIZE) CPU_SET(cpus[i], &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+  /** 
+   * Parse a Linux cpu list such as "0-3,8-11" 
+   * \return false if the list is malformed.
+   */
+  static bool parseList(const std::string & list, std::vector<int> & values)
+  {
+    std::istringstream iss(list);
+    std::string range;
+    while (std::getline(iss, range, ',')) {
+      if (range.empty() || range == "\n") continue;
+      char * end;
+      const long first = std::strtol(range.c_str(), &end, 10);
+      if (end == range.c_str()) return false;
+      long last = first;
+      if (*end == '-') {
+        const char * begin = end + 1;
+        last = std::strtol(begin, &end, 10);
+        if (end == begin) return false;
+      }
+      for (long v = first; v <= last; ++v) {
+        values.push_back(static_cast<int>(v));
+      }
+    }
+    return true;
+  }
+
+ private:
+  NumaTopology() 
+  {
+#if defined(__linux__)
+    const std::string path = "/sys/devices/system/node/";
+    std::vector<int> nodes;
+    std::string list;
+    std::ifstream online((path + "online").c_str());
+    if (std::getline(online, list) && parseList(list, nodes)) {
+      for (std::size_t i = 0; i < nodes.size(); ++i) {
+        std::ostringstream name;
+        name << path << "node" << nodes[i] << "/cpulist";
+        std::ifstream ifs(name.str().c_str());
+        std::vector<int> cpus;
+        if (std::getline(ifs, list) && parseList(list, cpus) && 
+          !cpus.empty()) {
+          cpus_.push_back(cpus);
+        }
+      }
+    }
+#endif
+    if (cpus_.empty()) cpus_.push_back(std::vector<int>());
+  }
+
+  std::vector<std::vector<int> > cpus_;
+};
+
+} // end namespace fbi
+
+#endif
@@ -0,0 +1,396 @@
+/* $Id: pipeline.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __LIBFBI_INCLUDE_FBI_PIPELINE_H__
+#define __LIBFBI_INCLUDE_FBI_PIPELINE_H__
+
+//C++
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <fbi/config.h>
+#include <fbi/fbi.h>
+
+#ifdef __LIBFBI_USE_MULTITHREADING__
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace fbi {
+
+#ifdef __LIBFBI_USE_MULTITHREADING__
+/**
+ * \class BoundedQueue
+ * \brief A blocking FIFO with a fixed capacity to connect pipeline stages.
+ *
+ * push() blocks while the queue is full, pop() blocks while it is empty.
+ * After close(), pop() drains the remaining elements and then returns false.
+ */
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(const std::size_t capacity)
+    : capacity_(std::max<std::size_t>(capacity, 1)), closed_(false) {}
+
+  /** Append value, wait for a free slot if necessary */
+  void push(T & value) {
+    std::unique_lock<std::mutex> lck(mutex_);
+    while (queue_.size() >= capacity_) notFull_.wait(lck);
+    queue_.push_back(T());
+    std::swap(queue_.back(), value);
+    notEmpty_.notify_one();
+  }
+
+  /** 
+   * Remove the first element and swap it into value.
+   * \return false if the queue has been closed and is empty.
+   */
+  bool pop(T & value) {
+    std::unique_lock<std::mutex> lck(mutex_);
+    while (queue_.empty() && !closed_) notEmpty_.wait(lck);
+    if (queue_.empty()) return false;
+    std::swap(value, queue_.front());
+    queue_.pop_front();
+    notFull_.notify_one();
+    return true;
+  }
+
+  /** Signal that no more elements will be pushed */
+  void close() {
+    std::lock_guard<std::mutex> lck(mutex_);
+    closed_ = true;
+    notEmpty_.notify_all();
+  }
+
+ private:
+  std::deque<T> queue_;
+  const std::size_t capacity_;
+  bool closed_;
+  std::mutex mutex_;
+  std::condition_variable notFull_;
+  std::condition_variable notEmpty_;
+};
+#endif
+
+/** A slab filter that keeps all edges. */
+struct NoSlabFilter {
+  template <typename ResultType>
+  void operator()(ResultType &) const {}
+};
+
+/**
+ * \class SlabPipeline
+ *
+ * \brief Read, join and merge a stream of box segments in a single pass.
+ *
+ * Many data sets arrive ordered along one dimension (e.g. mass spectra
+ * ordered by scan number) and boxes can only intersect if their segments are
+ * at most \c overlap segments apart. The pipeline cuts the stream into slabs
+ * of \c segmentSize + \c overlap segments (advancing by \c segmentSize), 
+ * intersects every slab with \ref SetA::intersect and merges the slab results
+ * into one adjacency list for the whole stream.
+ *
+ * With multithreading enabled, reading, slab assembly, joining and merging 
+ * run as concurrent stages connected by \ref BoundedQueue objects, such that
+ * I/O and computation overlap while memory is bounded by the queue sizes.
+ * Otherwise the stages are executed one after the other for every slab.
+ *
+ * \tparam BoxType The type of the boxes in the stream.
+ * \tparam TIndices The dimensions to intersect in, see \ref SetA.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+class SlabPipeline {
+ public:
+  typedef SetA<BoxType, TIndices...> SetType;
+  typedef typename SetType::ResultType ResultType;
+  typedef typename SetType::IntType IntType;
+  /** A segment is the unit the reader produces, e.g. one spectrum. */
+  typedef std::vector<BoxType> Segment;
+
+  /**
+   * \param segmentSize Number of segments by which consecutive slabs advance.
+   * \param overlap Number of segments shared by consecutive slabs, boxes 
+   * further apart are never tested for intersection.
+   * \param queueSize Capacity of the queues between the stages.
+   * \param numJoinThreads Number of slabs that are joined concurrently.
+   */
+  SlabPipeline(const std::size_t segmentSize, const std::size_t overlap,
+    const std::size_t queueSize = 16, const std::size_t numJoinThreads = 1)
+    : segmentSize_(std::max<std::size_t>(segmentSize, 1)), overlap_(overlap),
+      queueSize_(queueSize), numJoinThreads_(std::max<std::size_t>(numJoinThreads, 1))
+  {}
+
+  /**
+   * \brief Run the pipeline.
+   *
+   * \param[in,out] reader A functor with a 
+   * \verbatim bool operator()(std::vector<BoxType> & segment); \endverbatim
+   * method that appends the boxes of the next segment and returns false at
+   * the end of the stream. It is only called from a single thread.
+   * \param[in] filter Called as filter(adjList) on every slab result before
+   * it is merged, e.g. to drop small clusters. With several join threads it
+   * is called concurrently.
+   * \param[out] boxes All boxes in stream order, the indices in the result
+   * refer to this vector.
+   * \param[in] ifunctor see \ref SetA::intersect
+   * \param[in] qfunctors see \ref SetA::intersect
+   * \return The adjacency list of all boxes in the stream.
+   */
+  template <
+  class Reader,
+        class SlabFilter,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+  ResultType run(
+      Reader & reader,
+      SlabFilter & filter,
+      std::vector<BoxType> & boxes,
+      const IntervalFunctor & ifunctor,
+      const QueryFunctors & ... qfunctors) const
+  {
+    boxes.clear();
+    ResultType resultVector;
+    SlabBuilder builder(segmentSize_, overlap_, boxes);
+#ifdef __LIBFBI_USE_MULTITHREADING__
+    BoundedQueue<Segment> segmentQueue(queueSize_);
+    BoundedQueue<Slab> slabQueue(queueSize_);
+    BoundedQueue<Slab> joinedQueue(queueSize_);
+
+    std::thread readThread(std::bind(
+      &SlabPipeline::template readStage<Reader>,
+        std::ref(reader), 
+        std::ref(segmentQueue)));
+    std::thread slabThread(std::bind(
+      &SlabPipeline::slabStage,
+        std::ref(builder), 
+        std::ref(segmentQueue), 
+        std::ref(slabQueue)));
+    std::vector<std::thread> joinThreads;
+    for (std::size_t i = 0; i < numJoinThreads_; ++i) {
+      joinThreads.push_back(std::thread(std::bind(
+        &SlabPipeline::template joinStage<SlabFilter, IntervalFunctor, 
+          QueryFunctors...>,
+          std::ref(slabQueue),
+          std::ref(joinedQueue),
+          std::ref(filter),
+          std::cref(ifunctor), 
+          std::cref(qfunctors)...)));
+    }
+    // close the output queue once all join threads are done
+    std::thread closeThread(std::bind(
+      &SlabPipeline::closeStage,
+        std::ref(joinThreads), 
+        std::ref(joinedQueue)));
+
+    Slab slab;
+    while (joinedQueue.pop(slab)) {
+      merge(slab, resultVector);
+    }
+    readThread.join();
+    slabThread.join();
+    closeThread.join();
+#else
+    Segment segment;
+    Slab slab;
+    bool more = true;
+    while (more) {
+      segment.clear();
+      more = reader(segment);
+      if (more ? builder.add(segment, slab) : builder.finish(slab)) {
+        join(slab, filter, ifunctor, qfunctors...);
+        merge(slab, resultVector);
+      }
+    }
+#endif
+    resultVector.resize(boxes.size());
+#ifndef __LIBFBI_USE_SET_FOR_RESULT__
+    // consecutive slabs share segments and report some edges twice
+    for (typename ResultType::size_type i = 0; i < resultVector.size(); ++i) {
+      typename ResultType::value_type & vec = resultVector[i];
+      std::sort(vec.begin(), vec.end());
+      vec.resize(std::unique(vec.begin(), vec.end()) - vec.begin());
+    }
+#endif
+    return resultVector;
+  }
+
+  /** \brief Run the pipeline without filtering the slab results. */
+  template <
+  class Reader,
+        typename IntervalFunctor,
+        typename ... QueryFunctors
+          >
+  ResultType run(
+      Reader & reader,
+      std::vector<BoxType> & boxes,
+      const IntervalFunctor & ifunctor,
+      const QueryFunctors & ... qfunctors) const
+  {
+    NoSlabFilter filter;
+    return run(reader, filter, boxes, ifunctor, qfunctors...);
+  }
+
+ private:
+  /** A slab travels through the pipeline, first with boxes, then with edges */
+  struct Slab {
+    /** Index of the first box of the slab in the whole stream */
+    std::size_t firstIndex_;
+    std::vector<BoxType> boxes_;
+    ResultType adjList_;
+  };
+
+  /** Cut the stream of segments into overlapping slabs */
+  class SlabBuilder {
+   public:
+    SlabBuilder(const std::size_t segmentSize, const std::size_t overlap,
+      std::vector<BoxType> & boxes)
+      : segmentSize_(segmentSize), overlap_(overlap), boxes_(boxes),
+        firstIndex_(0), fresh_(0) {}
+
+    /** Add a segment, return true if slab holds a complete slab */
+    bool add(Segment & segment, Slab & slab) {
+      boxes_.insert(boxes_.end(), segment.begin(), segment.end());
+      segments_.push_back(Segment());
+      segments_.back().swap(segment);
+      ++fresh_;
+      if (segments_.size() < segmentSize_ + overlap_) return false;
+      fill(slab);
+      for (std::size_t i = 0; i < segmentSize_; ++i) {
+        firstIndex_ += segments_.front().size();
+        segments_.pop_front();
+      }
+      return true;
+    }
+
+    /** Return true if slab holds the remaining, not yet joined segments */
+    bool finish(Slab & slab) {
+      if (fresh_ == 0) return false;
+      fill(slab);
+      segments_.clear();
+      return true;
+    }
+
+   private:
+    void fill(Slab & slab) {
+      slab.firstIndex_ = firstIndex_;
+      slab.boxes_.clear();
+      slab.adjList_.clear();
+      typename std::deque<Segment>::const_iterator it = segments_.begin();
+      for (; it != segments_.end(); ++it) {
+        slab.boxes_.insert(slab.boxes_.end(), it->begin(), it->end());
+      }
+      fresh_ = 0;
+    }
+
+    const std::size_t segmentSize_;
+    const std::size_t overlap_;
+    std::vector<BoxType> & boxes_;
+    std::deque<Segment> segments_;
+    std::size_t firstIndex_;
+    std::size_t fresh_;
+  };
+
+  /** Intersect the boxes of a slab and release them */
+  template <class SlabFilter, typename IntervalFunctor, typename ... QueryFunctors>
+  static void join(Slab & slab, SlabFilter & filter,
+    const IntervalFunctor & ifunctor, const QueryFunctors & ... qfunctors)
+  {
+    slab.adjList_ = SetType::intersect(slab.boxes_, ifunctor, qfunctors...);
+    std::vector<BoxType>().swap(slab.boxes_);
+    filter(slab.adjList_);
+  }
+
+  /** Add the edges of a slab to the result, using global indices */
+  static void merge(const Slab & slab, ResultType & resultVector) {
+    const std::size_t offset = slab.firstIndex_;
+    if (resultVector.size() < offset + slab.adjList_.size()) {
+      resultVector.resize(offset + slab.adjList_.size());
+    }
+    for (std::size_t i = 0; i < slab.adjList_.size(); ++i) {
+      typename ResultType::value_type & target = resultVector[offset + i];
+      typename ResultType::value_type::const_iterator it = 
+        slab.adjList_[i].begin();
+      for (; it != slab.adjList_[i].end(); ++it) {
+        target.insert(target.end(), static_cast<IntType>(*it + offset));
+      }
+    }
+  }
+
+#ifdef __LIBFBI_USE_MULTITHREADING__
+  template <class Reader>
+  static void readStage(Reader & reader, BoundedQueue<Segment> & out) {
+    Segment segment;
+    while (reader(segment)) {
+      out.push(segment);
+      segment.clear();
+    }
+    out.close();
+  }
+
+  static void slabStage(SlabBuilder & builder, BoundedQueue<Segment> & in,
+    BoundedQueue<Slab> & out) {
+    Segment segment;
+    Slab slab;
+    while (in.pop(segment)) {
+      if (builder.add(segment, slab)) out.push(slab);
+    }
+    if (builder.finish(slab)) out.push(slab);
+    out.close();
+  }
+
+  template <class SlabFilter, typename IntervalFunctor, typename ... QueryFunctors>
+  static void joinStage(BoundedQueue<Slab> & in, BoundedQueue<Slab> & out,
+    SlabFilter & filter, const IntervalFunctor & ifunctor, 
+    const QueryFunctors & ... qfunctors) {
+    Slab slab;
+    while (in.pop(slab)) {
+      join(slab, filter, ifunctor, qfunctors...);
+      out.push(slab);
+    }
+  }
+
+  static void closeStage(std::vector<std::thread> & threads, 
+    BoundedQueue<Slab> & out) {
+    for (std::size_t i = 0; i < threads.size(); ++i) threads[i].join();
+    out.close();
+  }
+#endif
+
+  const std::size_t segmentSize_;
+  const std::size_t overlap_;
+  const std::size_t queueSize_;
+  const std::size_t numJoinThreads_;
+};
+
+} //end namespace fbi
+
+#endif
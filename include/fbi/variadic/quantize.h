@@ -0,0 +1,390 @@
+/* $Id: quantize.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef __LIBFBI_INCLUDE_FBI_QUANTIZE_H__
+#define __LIBFBI_INCLUDE_FBI_QUANTIZE_H__
+
+//C++
+#include <array>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+//c++0x
+#include <tuple>
+
+#include <fbi/config.h>
+#include <fbi/traits.h>
+#include <fbi/tuplegenerator.h>
+
+namespace fbi {
+
+/**
+ * \class OutwardRounding
+ * \brief Convert an interval into a narrower key type without shrinking it.
+ *
+ * The lower end is rounded down and the upper end up, hence two intervals
+ * that intersect before the conversion still intersect afterwards (the
+ * converse does not hold, see \ref ExactFilter).
+ *
+ * Floating point targets (e.g. double to float) are rounded to the next
+ * representable value. Integral targets are used as fixed-point numbers:
+ * the interval is multiplied by scale before rounding to the next integer.
+ * Values outside the range of T are clamped, they must not occur in
+ * practice.
+ */
+template <typename T, bool IsIntegral = std::is_integral<T>::value>
+struct OutwardRounding;
+
+template <typename T>
+struct OutwardRounding<T, false> {
+  template <typename S>
+  static std::pair<T, T> apply(const std::pair<S, S> & interval, 
+    const double scale = 1.0)
+  {
+    if (scale == 1.0) {
+      return std::make_pair(down(interval.first), up(interval.second));
+    }
+    // nudge the scaled values outward as the multiplication itself rounds
+    const double lo = std::nextafter(
+      static_cast<double>(interval.first) * scale, 
+      -std::numeric_limits<double>::max());
+    const double hi = std::nextafter(
+      static_cast<double>(interval.second) * scale, 
+      std::numeric_limits<double>::max());
+    return std::make_pair(down(lo), up(hi));
+  }
+
+ private:
+  template <typename S>
+  static T down(const S & value) 
+  {
+    if (!(value > std::numeric_limits<T>::lowest())) {
+      return std::numeric_limits<T>::lowest();
+    }
+    if (!(value < std::numeric_limits<T>::max())) {
+      return std::numeric_limits<T>::max();
+    }
+    T result = static_cast<T>(value);
+    if (result > value) {
+      result = std::nextafter(result, std::numeric_limits<T>::lowest());
+    }
+    return result;
+  }
+
+  template <typename S>
+  static T up(const S & value) 
+  {
+    if (!(value < std::numeric_limits<T>::max())) {
+      return std::numeric_limits<T>::max();
+    }
+    if (!(value > std::numeric_limits<T>::lowest())) {
+      return std::numeric_limits<T>::lowest();
+    }
+    T result = static_cast<T>(value);
+    if (result < value) {
+      result = std::nextafter(result, std::numeric_limits<T>::max());
+    }
+    return result;
+  }
+};
+
+template <typename T>
+struct OutwardRounding<T, true> {
+  template <typename S>
+  static std::pair<T, T> apply(const std::pair<S, S> & interval, 
+    const double scale = 1.0)
+  {
+    // nudge the scaled values outward as the multiplication itself rounds
+    const double lo = std::nextafter(
+      static_cast<double>(interval.first) * scale, 
+      -std::numeric_limits<double>::max());
+    const double hi = std::nextafter(
+      static_cast<double>(interval.second) * scale, 
+      std::numeric_limits<double>::max());
+    return std::make_pair(clamp(std::floor(lo)), clamp(std::ceil(hi)));
+  }
+
+ private:
+  static T clamp(const double value) 
+  {
+    if (!(value > static_cast<double>(std::numeric_limits<T>::min()))) {
+      return std::numeric_limits<T>::min();
+    }
+    if (!(value < static_cast<double>(std::numeric_limits<T>::max()))) {
+      return std::numeric_limits<T>::max();
+    }
+    return static_cast<T>(value);
+  }
+};
+
+/**
+ * \class Quantized
+ * \brief Box functor adapter that compresses the keys of a wider functor.
+ *
+ * Declare the narrower types in Traits<BoxType> (e.g. float instead of
+ * double, or int32_t for fixed-point values) and keep the original functor
+ * returning the full precision intervals. Quantized calls the original
+ * functor and rounds its intervals outward into the key types of
+ * Traits<BoxType>, halving the memory the keys occupy during the scan.
+ * @verbatim
+ * namespace fbi {
+ * template<>
+ * struct Traits<Centroid> : mpl::TraitsGenerator<float, float, float> {};
+ * }
+ * // BoxGenerator::get<N> still returns std::pair<double, double>
+ * SetA<Centroid, 0, 1, 2>::intersect(centroids, 
+ *   quantize<Centroid>(BoxGenerator(...)), 
+ *   quantize<Centroid>(BoxGenerator(...)));
+ * @endverbatim
+ * All boxes that are compared with each other must be quantized with the
+ * same scales.
+ *
+ * \tparam BoxType The box type whose Traits define the compressed key.
+ * \tparam Functor The original box functor.
+ */
+template <typename BoxType, typename Functor>
+class Quantized {
+ public:
+  typedef typename Traits<BoxType>::key_type key_type;
+
+  enum {NUMDIMS = std::tuple_size<key_type>::value};
+
+  /** Per-dimension scale factors for fixed-point (integral) keys */
+  typedef std::array<double, NUMDIMS> ScaleType;
+
+  Quantized(const Functor & functor) : functor_(functor) 
+  {
+    scales_.fill(1.0);
+  }
+
+  Quantized(const Functor & functor, const ScaleType & scales) 
+    : functor_(functor), scales_(scales) {}
+
+  template <std::size_t N>
+  typename std::tuple_element<N, key_type>::type 
+  get(const BoxType & box) const
+  {
+    typedef typename std::tuple_element<N, key_type>::type::first_type T;
+    return OutwardRounding<T>::apply(functor_.template get<N>(box), 
+      scales_[N]);
+  }
+
+  /** The wrapped functor, i.e. the exact keys, see \ref ExactFilter */
+  const Functor & functor() const { return functor_; }
+
+ private:
+  Functor functor_;
+  ScaleType scales_;
+};
+
+/**
+ * Create a \ref Quantized functor for BoxType
+ */
+template <typename BoxType, typename Functor>
+Quantized<BoxType, Functor> quantize(const Functor & functor)
+{
+  return Quantized<BoxType, Functor>(functor);
+}
+
+template <typename BoxType, typename Functor>
+Quantized<BoxType, Functor> quantize(const Functor & functor,
+  const typename Quantized<BoxType, Functor>::ScaleType & scales)
+{
+  return Quantized<BoxType, Functor>(functor, scales);
+}
+
+/**
+ * \class ExactFilter
+ * \brief Remove the edges that were only found because of outward rounding.
+ *
+ * After an intersection with \ref Quantized functors the result is a
+ * superset of the exact one. ExactFilter re-tests every edge with the
+ * original, full precision functors and removes the ones whose boxes do not
+ * intersect, using the comparators of Traits<BoxType> like the scanners.
+ * The parameters are the same as for SetA::intersect and 
+ * SetA::SetB::intersect, with the original functors instead of the
+ * quantized ones (vectors of functors are supported as well). The
+ * containers have to provide operator[].
+ *
+ * \tparam BoxType The type of the data objects
+ * \tparam TIndices The dimensions that were intersected
+ */
+template <typename BoxType, std::size_t ... TIndices>
+struct ExactFilter {
+  /** 
+   * The comparator of a dimension of the quantized keys for the full 
+   * precision values T: std::less and std::greater compare T instead, 
+   * other comparators have to accept T themselves.
+   */
+  template <class Comp, typename T>
+  struct ExactComp { typedef Comp type; };
+  template <typename U, typename T>
+  struct ExactComp<std::less<U>, T> { typedef std::less<T> type; };
+  template <typename U, typename T>
+  struct ExactComp<std::greater<U>, T> { typedef std::greater<T> type; };
+
+  template <typename QBoxType, std::size_t ... QIndices>
+  struct SetB {
+    static_assert(sizeof...(TIndices) == sizeof...(QIndices), 
+      "Number of dimensions of data and query boxes differ");
+
+    template <class ResultType, class BoxContainer, class QContainer,
+      typename IntervalFunctor, typename ... QueryFunctors>
+    static void filter(
+        ResultType & result,
+        const BoxContainer & dataContainer,
+        const IntervalFunctor & ifunctor,
+        const QContainer & qdataContainer,
+        const QueryFunctors & ... qfunctors)
+    {
+      const bool selfJoin = 
+        reinterpret_cast<const char *>(&dataContainer) == 
+        reinterpret_cast<const char *>(&qdataContainer);
+      const std::size_t offset = selfJoin ? 0 : dataContainer.size();
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        typename ResultType::value_type kept;
+        typename ResultType::value_type::const_iterator it = result[i].begin();
+        for (; it != result[i].end(); ++it) {
+          const std::size_t j = *it;
+          bool keep;
+          if (selfJoin) {
+            keep = matches(dataContainer[i], ifunctor, qdataContainer[j], 
+                qfunctors...) || 
+              matches(dataContainer[j], ifunctor, qdataContainer[i], 
+                qfunctors...);
+          } else if (i < offset) {
+            keep = j >= offset && matches(dataContainer[i], ifunctor, 
+              qdataContainer[j - offset], qfunctors...);
+          } else {
+            keep = j < offset && matches(dataContainer[j], ifunctor, 
+              qdataContainer[i - offset], qfunctors...);
+          }
+          if (keep) kept.insert(kept.end(), *it);
+        }
+        result[i].swap(kept);
+      }
+    }
+
+   private:
+    /** 
+     * Open intervals compared with the comparator of the dimension, as in
+     * SetA::IntersectionTester
+     */
+    template <std::size_t Index, typename S, typename T>
+    static bool overlap(const std::pair<S, S> & x, const std::pair<T, T> & y)
+    {
+      typename ExactComp<typename std::tuple_element<Index, 
+        typename Traits<BoxType>::dim_type>::type::second_type, 
+        typename std::common_type<S, T>::type>::type less;
+      if (less(x.first, y.first)) return less(y.first, x.second);
+      return less(x.first, y.second);
+    }
+
+    template <typename IntervalFunctor, typename QueryFunctor>
+    static bool intersects(const BoxType & box, const IntervalFunctor & ifunctor, 
+      const QBoxType & qbox, const QueryFunctor & qfunctor)
+    {
+      const bool overlaps[] = {overlap<TIndices>(
+          ifunctor.template get<TIndices>(box), 
+          qfunctor.template get<QIndices>(qbox))...};
+      for (std::size_t d = 0; d < sizeof...(TIndices); ++d) {
+        if (!overlaps[d]) return false;
+      }
+      return true;
+    }
+
+    template <typename IntervalFunctor, typename ... QueryFunctors>
+    static bool matches(const BoxType & box, const IntervalFunctor & ifunctor,
+      const QBoxType & qbox, const QueryFunctors & ... qfunctors)
+    {
+      return test(box, ifunctor, qbox, qfunctors...);
+    }
+
+    template <typename IntervalFunctor, typename ... QueryFunctors>
+    static bool matches(const BoxType & box, 
+      const std::vector<IntervalFunctor> & ifunctor,
+      const QBoxType & qbox, const QueryFunctors & ... qfunctors)
+    {
+      for (std::size_t i = 0; i < ifunctor.size(); ++i) {
+        if (test(box, ifunctor[i], qbox, qfunctors...)) return true;
+      }
+      return false;
+    }
+
+    template <typename IntervalFunctor>
+    static bool test(const BoxType &, const IntervalFunctor &, 
+      const QBoxType &) 
+    {
+      return false;
+    }
+
+    template <typename IntervalFunctor, typename QueryFunctor, 
+      typename ... QueryFunctors>
+    static bool test(const BoxType & box, const IntervalFunctor & ifunctor, 
+      const QBoxType & qbox, const QueryFunctor & qfunctor, 
+      const QueryFunctors & ... qfunctors)
+    {
+      return intersects(box, ifunctor, qbox, qfunctor) || 
+        test(box, ifunctor, qbox, qfunctors...);
+    }
+
+    template <typename IntervalFunctor, typename QueryFunctor, 
+      typename ... QueryFunctors>
+    static bool test(const BoxType & box, const IntervalFunctor & ifunctor, 
+      const QBoxType & qbox, const std::vector<QueryFunctor> & qfunctor, 
+      const QueryFunctors & ... qfunctors)
+    {
+      for (std::size_t i = 0; i < qfunctor.size(); ++i) {
+        if (intersects(box, ifunctor, qbox, qfunctor[i])) return true;
+      }
+      return test(box, ifunctor, qbox, qfunctors...);
+    }
+  };
+
+  /**
+   * Filter the result of SetA::intersect, see \ref SetB::filter
+   */
+  template <class ResultType, class BoxContainer, 
+    typename IntervalFunctor, typename ... QueryFunctors>
+  static void filter(
+      ResultType & result,
+      const BoxContainer & dataContainer,
+      const IntervalFunctor & ifunctor,
+      const QueryFunctors & ... qfunctors)
+  {
+    SetB<BoxType, TIndices...>::filter(result, dataContainer, ifunctor, 
+      dataContainer, qfunctors...);
+  }
+};
+
+} //end namespace fbi
+
+#endif
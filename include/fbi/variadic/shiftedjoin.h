@@ -0,0 +1,349 @@
+/* $Id: shiftedjoin.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#ifndef __LIBFBI_INCLUDE_FBI_SHIFTEDJOIN_H__
+#define __LIBFBI_INCLUDE_FBI_SHIFTEDJOIN_H__
+
+//C99
+#include <stdint.h>
+//C++
+#include <algorithm>
+#include <utility>
+#include <vector>
+//c++0x
+#include <tuple>
+
+#include <fbi/config.h>
+#include <fbi/fbi.h>
+#include <fbi/connectedcomponents.h>
+#include <fbi/sortedjoin.h>
+
+namespace fbi {
+
+/**
+ * \class ShiftedJoin
+ * \brief Intersect query boxes under several translations with a set of
+ *  data boxes in a single pass.
+ *
+ * Translating keys does not change their order, so the keys of both sets
+ * are created and sorted by their lower endpoint in the first dimension only
+ * once. Every offset then costs two linear sweeps over the sorted keys, one
+ * with the shifted query heads as points and one with the data heads; the
+ * shifted coordinates are computed on the fly. This replaces K query
+ * functors that only differ in a translation (e.g. the isotope shifts in
+ * example-isotope-patterns) and reports which offset produced each pair.
+ *
+ * Boxes overlapping in the first dimension are tested in the remaining ones
+ * one by one, so the first dimension should be the most selective.
+ *
+ * \tparam BoxType The type of the boxes, Traits<BoxType> has to be defined.
+ * \tparam TIndices The dimensions to intersect in, see \ref SetA.
+ */
+template <typename BoxType, std::size_t ... TIndices>
+class ShiftedJoin {
+ public:
+  typedef uint32_t IntType;
+  typedef typename 
+    mpl::TypeExtractor<Traits<BoxType>, TIndices...>::key_type key_type;
+  typedef typename 
+    mpl::TypeExtractor<Traits<BoxType>, TIndices...>::comp_type comp_type;
+  /** A translation, one value per dimension */
+  typedef std::tuple<
+    typename std::tuple_element<TIndices, 
+      typename Traits<BoxType>::key_type>::type::first_type ...
+    > offset_type;
+  /**
+   * result[q] holds a (d, k) pair for every data box d that intersects 
+   * query box q translated by offsets[k], sorted.
+   */
+  typedef std::vector<std::vector<std::pair<IntType, IntType> > > ResultType;
+
+ private:
+  enum {NUMDIMS = sizeof...(TIndices)};
+  typedef typename std::tuple_element<0, key_type>::type::first_type HeadType;
+  typedef typename std::tuple_element<0, comp_type>::type HeadLess;
+
+  /**
+   * Check if a translated query key intersects a data key in [Dim,Limit):
+   * in every dimension, one of the lower endpoints has to lie in the 
+   * half-open interval [head, tail) of the other key. For keys that are not
+   * degenerate this is the same test as in \ref SetA::intersect.
+   */
+  template <std::size_t Dim, std::size_t Limit>
+  struct Tester {
+    static bool test(const key_type & q, const offset_type & t, 
+      const key_type & d)
+    {
+      typedef typename std::tuple_element<Dim, key_type>::type::first_type T;
+      typename std::tuple_element<Dim, comp_type>::type less;
+      const T qHead = std::get<Dim>(q).first + std::get<Dim>(t);
+      const T dHead = std::get<Dim>(d).first;
+      const T qTail = std::get<Dim>(q).second + std::get<Dim>(t);
+      bool result;
+      if (less(qHead, dHead)) result = less(dHead, qTail);
+      else if (less(dHead, qHead)) result = less(qHead, std::get<Dim>(d).second);
+      else result = less(qHead, std::get<Dim>(d).second) || less(dHead, qTail);
+      return result && Tester<Dim+1, Limit>::test(q, t, d);
+    }
+  };
+
+  template <std::size_t Limit>
+  struct Tester<Limit, Limit> {
+    static bool test(const key_type &, const offset_type &, const key_type &)
+    {
+      return true;
+    }
+  };
+
+  /** Order keys by their lower endpoint in the first dimension */
+  struct KeyLess {
+    bool operator()(const key_type & a, const key_type & b) const {
+      return HeadLess()(std::get<0>(a).first, std::get<0>(b).first);
+    }
+  };
+
+  /** The keys of one set, created and sorted once for all offsets */
+  typedef sortedjoin::SortedTuples<key_type, KeyLess, TIndices...> SortedKeys;
+
+  /**
+   * Report every pair of query and data boxes that intersect if the 
+   * queries are translated by t.
+   *
+   * The active intervals are kept in a plain vector: every point has to 
+   * look at all of them anyway, so expired intervals are dropped on the way
+   * instead of keeping them ordered by their upper endpoint.
+   */
+  template <class Visitor>
+  static void sweep(Visitor & visitor, const SortedKeys & queries, 
+    const SortedKeys & data, const offset_type & t, const IntType k)
+  {
+    const std::vector<key_type> & qkeys = queries.tuples_;
+    const std::vector<key_type> & dkeys = data.tuples_;
+    const HeadType shift = std::get<0>(t);
+    HeadLess less;
+    std::vector<std::size_t> active;
+
+    // query heads inside [head, tail) of a data interval
+    std::size_t next = 0;
+    for (std::size_t q = 0; q < qkeys.size(); ++q) {
+      const HeadType point = std::get<0>(qkeys[q]).first + shift;
+      while (next < dkeys.size() && 
+        !less(point, std::get<0>(dkeys[next]).first)) {
+        active.push_back(next++);
+      }
+      for (std::size_t j = 0; j < active.size(); ) {
+        const std::size_t d = active[j];
+        if (!less(point, std::get<0>(dkeys[d]).second)) {
+          active[j] = active.back();
+          active.pop_back();
+          continue;
+        }
+        if (Tester<1, NUMDIMS>::test(qkeys[q], t, dkeys[d])) {
+          visitor(queries.index_[q], data.index_[d], k);
+        }
+        ++j;
+      }
+    }
+
+    // data heads inside [head, tail) of a translated query interval, 
+    // skipping equal heads that the first sweep has reported
+    active.clear();
+    next = 0;
+    for (std::size_t d = 0; d < dkeys.size(); ++d) {
+      const HeadType point = std::get<0>(dkeys[d]).first;
+      const bool pointIsEmpty = !less(point, std::get<0>(dkeys[d]).second);
+      while (next < qkeys.size() && 
+        !less(point, HeadType(std::get<0>(qkeys[next]).first + shift))) {
+        active.push_back(next++);
+      }
+      for (std::size_t j = 0; j < active.size(); ) {
+        const std::size_t q = active[j];
+        if (!less(point, HeadType(std::get<0>(qkeys[q]).second + shift))) {
+          active[j] = active.back();
+          active.pop_back();
+          continue;
+        }
+        ++j;
+        if (!pointIsEmpty && 
+          !less(HeadType(std::get<0>(qkeys[q]).first + shift), point)) {
+          continue;
+        }
+        if (Tester<1, NUMDIMS>::test(qkeys[q], t, dkeys[d])) {
+          visitor(queries.index_[q], data.index_[d], k);
+        }
+      }
+    }
+  }
+
+  typedef std::tuple<IntType, IntType, IntType> Edge;
+
+  /** Sweep the offsets [begin, end) for \ref intersect */
+  struct OffsetSweep {
+    const SortedKeys & queries_;
+    const SortedKeys & data_;
+    const std::vector<offset_type> & offsets_;
+
+    OffsetSweep(const SortedKeys & queries, const SortedKeys & data, 
+      const std::vector<offset_type> & offsets)
+      : queries_(queries), data_(data), offsets_(offsets) {}
+
+    template <class Visitor>
+    void operator()(Visitor & visitor, const std::size_t begin, 
+      const std::size_t end) const 
+    {
+      for (std::size_t k = begin; k < end; ++k) {
+        sweep(visitor, queries_, data_, offsets_[k], static_cast<IntType>(k));
+      }
+    }
+  };
+
+  /** Sort the rows [begin, end) of a result */
+  struct RowSorter {
+    ResultType & result_;
+    explicit RowSorter(ResultType & result) : result_(result) {}
+    void operator()(const std::size_t begin, const std::size_t end, 
+      const std::size_t) const 
+    {
+      for (std::size_t i = begin; i < end; ++i) {
+        std::sort(result_[i].begin(), result_[i].end());
+      }
+    }
+  };
+
+ public:
+  /**
+   * Call visitor(q, d, k) for every query box q in queries and data box d 
+   * that intersect once q is translated by offsets[k]. Every triple is 
+   * reported exactly once.
+   *
+   * \param[in,out] visitor Called with three IntType values.
+   * \param[in] data Container of data boxes.
+   * \param[in] ifunctor Creates the keys of the data boxes, like the 
+   *  interval functor of \ref SetA::intersect (a single functor).
+   * \param[in] queries Container of query boxes, can be data.
+   * \param[in] qfunctor Creates the untranslated keys of the query boxes.
+   * \param[in] offsets The translations, added to both endpoints of the
+   *  query keys in every dimension.
+   */
+  template <class Visitor, class Container, class QContainer,
+    class IntervalFunctor, class QueryFunctor>
+  static void visit(Visitor & visitor, const Container & data, 
+    const IntervalFunctor & ifunctor, const QContainer & queries, 
+    const QueryFunctor & qfunctor, const std::vector<offset_type> & offsets)
+  {
+    const SortedKeys dataKeys(data, ifunctor);
+    const SortedKeys queryKeys(queries, qfunctor);
+    for (std::size_t k = 0; k < offsets.size(); ++k) {
+      sweep(visitor, queryKeys, dataKeys, offsets[k], static_cast<IntType>(k));
+    }
+  }
+
+  /** Self-join version of \ref visit, the queries are the data boxes. */
+  template <class Visitor, class Container, 
+    class IntervalFunctor, class QueryFunctor>
+  static void visit(Visitor & visitor, const Container & data, 
+    const IntervalFunctor & ifunctor, const QueryFunctor & qfunctor, 
+    const std::vector<offset_type> & offsets)
+  {
+    visit(visitor, data, ifunctor, data, qfunctor, offsets);
+  }
+
+  /**
+   * Like \ref visit, but collect the pairs per query box.
+   * \param[in] numThreads The offsets are split between that many threads
+   *  if multithreading is enabled.
+   * \return See \ref ResultType, one entry per query box.
+   */
+  template <class Container, class QContainer,
+    class IntervalFunctor, class QueryFunctor>
+  static ResultType intersect(const Container & data, 
+    const IntervalFunctor & ifunctor, const QContainer & queries, 
+    const QueryFunctor & qfunctor, const std::vector<offset_type> & offsets,
+    const std::size_t numThreads = defaultNumThreads())
+  {
+    const SortedKeys dataKeys(data, ifunctor);
+    const SortedKeys queryKeys(queries, qfunctor);
+    std::vector<std::vector<Edge> > edges = 
+      sortedjoin::collectEdges<Edge>(offsets.size(), numThreads, 
+        OffsetSweep(queryKeys, dataKeys, offsets));
+
+    ResultType result(queryKeys.size());
+    for (std::size_t t = 0; t < edges.size(); ++t) {
+      for (std::size_t i = 0; i < edges[t].size(); ++i) {
+        const Edge & e = edges[t][i];
+        result[std::get<0>(e)].push_back(
+          std::make_pair(std::get<1>(e), std::get<2>(e)));
+      }
+      std::vector<Edge>().swap(edges[t]);
+    }
+    forEachRange(result.size(), numThreads, RowSorter(result));
+    return result;
+  }
+
+  /** Self-join version of \ref intersect, the queries are the data boxes. */
+  template <class Container, class IntervalFunctor, class QueryFunctor>
+  static ResultType intersect(const Container & data, 
+    const IntervalFunctor & ifunctor, const QueryFunctor & qfunctor, 
+    const std::vector<offset_type> & offsets,
+    const std::size_t numThreads = defaultNumThreads())
+  {
+    return intersect(data, ifunctor, data, qfunctor, offsets, numThreads);
+  }
+
+  /**
+   * Drop the offsets of a self-join result and make it undirected, which
+   * gives the result SetA::intersect has with one query functor per offset.
+   */
+  static typename SetA<BoxType, TIndices...>::ResultType
+  toAdjacencyList(const ResultType & result)
+  {
+    typename SetA<BoxType, TIndices...>::ResultType adjacencyList(
+      result.size());
+    for (std::size_t q = 0; q < result.size(); ++q) {
+      for (std::size_t i = 0; i < result[q].size(); ++i) {
+        const IntType d = result[q][i].first;
+        adjacencyList[q].insert(adjacencyList[q].end(), d);
+        adjacencyList[d].insert(adjacencyList[d].end(), 
+          static_cast<IntType>(q));
+      }
+    }
+#ifndef __LIBFBI_USE_SET_FOR_RESULT__
+    for (std::size_t i = 0; i < adjacencyList.size(); ++i) {
+      std::sort(adjacencyList[i].begin(), adjacencyList[i].end());
+      adjacencyList[i].resize(std::unique(adjacencyList[i].begin(), 
+        adjacencyList[i].end()) - adjacencyList[i].begin());
+    }
+#endif
+    return adjacencyList;
+  }
+};
+
+} // end namespace fbi
+
+#endif
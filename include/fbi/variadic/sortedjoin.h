@@ -0,0 +1,156 @@
+/* $Id: sortedjoin.h 1 2010-10-30 01:14:03Z mkirchner $
+ *
+ * Copyright (c) 2010 Buote Xu <buote.xu@gmail.com>
+ * Copyright (c) 2010 Marc Kirchner <marc.kirchner@childrens.harvard.edu>
+ *
+ * This file is part of libfbi.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without  restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions: 
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR  OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#ifndef __LIBFBI_INCLUDE_FBI_SORTEDJOIN_H__
+#define __LIBFBI_INCLUDE_FBI_SORTEDJOIN_H__
+
+//C99
+#include <stdint.h>
+//C++
+#include <algorithm>
+#include <vector>
+//c++0x
+#include <tuple>
+
+#include <fbi/config.h>
+#include <fbi/connectedcomponents.h>
+
+namespace fbi {
+
+/**
+ * Building blocks of the joins that sort both sets along their first 
+ * dimension once and then sweep them, see \ref ShiftedJoin and 
+ * \ref EpsilonJoin.
+ */
+namespace sortedjoin {
+
+typedef uint32_t IntType;
+
+/**
+ * \struct SortedTuples
+ * \brief The keys or points of one set, created with functor.get<N> for 
+ *  every N in TIndices and sorted by HeadLess. 
+ *
+ * The tuples themselves are stored in sorted order (and not only their 
+ * indices), so that the sweeps run through memory in order.
+ *
+ * \tparam Tuple The type of the keys or points.
+ * \tparam HeadLess Compares two tuples by their first dimension.
+ */
+template <typename Tuple, class HeadLess, std::size_t ... TIndices>
+struct SortedTuples {
+  std::vector<Tuple> tuples_;
+  /** The index of the element every tuple belongs to */
+  std::vector<IntType> index_;
+
+  template <class Container, class Functor>
+  SortedTuples(const Container & elements, const Functor & functor) 
+  {
+    std::vector<Tuple> tuples;
+    tuples.reserve(elements.size());
+    typename Container::const_iterator it = elements.begin();
+    for (; it != elements.end(); ++it) {
+      tuples.push_back(
+        std::make_tuple(functor.template get<TIndices>(*it)...));
+    }
+    index_.resize(tuples.size());
+    for (std::size_t i = 0; i < index_.size(); ++i) {
+      index_[i] = static_cast<IntType>(i);
+    }
+    std::sort(index_.begin(), index_.end(), LessIndex(tuples));
+    tuples_.reserve(tuples.size());
+    for (std::size_t i = 0; i < index_.size(); ++i) {
+      tuples_.push_back(tuples[index_[i]]);
+    }
+  }
+
+  std::size_t size() const { return tuples_.size(); }
+
+ private:
+  /** Order tuple indices by HeadLess */
+  struct LessIndex {
+    const std::vector<Tuple> * tuples_;
+    explicit LessIndex(const std::vector<Tuple> & tuples) 
+      : tuples_(&tuples) {}
+    bool operator()(const IntType a, const IntType b) const {
+      return HeadLess()((*tuples_)[a], (*tuples_)[b]);
+    }
+  };
+};
+
+/** Visitor that stores the pairs (or triples) reported to one thread */
+template <typename Edge>
+struct EdgeCollector {
+  std::vector<Edge> * edges_;
+  void operator()(const IntType a, const IntType b) {
+    edges_->push_back(Edge(a, b));
+  }
+  void operator()(const IntType a, const IntType b, const IntType c) {
+    edges_->push_back(Edge(a, b, c));
+  }
+};
+
+/** Run sweep(collector, begin, end) with the collector of every thread */
+template <typename Edge, class Sweep>
+struct RangeCollector {
+  const Sweep & sweep_;
+  std::vector<std::vector<Edge> > & edges_;
+
+  RangeCollector(const Sweep & sweep, std::vector<std::vector<Edge> > & edges)
+    : sweep_(sweep), edges_(edges) {}
+
+  void operator()(const std::size_t begin, const std::size_t end, 
+    const std::size_t thread) const 
+  {
+    EdgeCollector<Edge> collector = { &edges_[thread] };
+    sweep_(collector, begin, end);
+  }
+};
+
+/**
+ * Split [0, n) between up to numThreads threads (see \ref forEachRange) and 
+ * let sweep report the edges of every range.
+ * \return The edges of every thread.
+ */
+template <typename Edge, class Sweep>
+std::vector<std::vector<Edge> > collectEdges(const std::size_t n, 
+  const std::size_t numThreads, const Sweep & sweep)
+{
+  const std::size_t numRanges = std::max<std::size_t>(1, 
+    std::min(numThreads, n));
+  std::vector<std::vector<Edge> > edges(numRanges);
+  forEachRange(n, numRanges, RangeCollector<Edge, Sweep>(sweep, edges));
+  return edges;
+}
+
+} // end namespace sortedjoin
+
+} // end namespace fbi
+
+#endif
@@ -33,6 +33,7 @@
 //c++0x
 #include <tuple> //for tuple_element and std::get
 #include <array>
+#include <type_traits>
 
 namespace fbi {
 
@@ -238,6 +239,89 @@ struct IndexChecker<T>{
 };
 
 
+/**
+ * Return the N-th entry of an index pack, i.e. map a dimension of the
+ * (reduced) key_type back to the dimension of the original Traits key_type.
+ */
+template <std::size_t N, std::size_t ... Indices>
+struct IndexAt;
+
+template <std::size_t N, std::size_t FirstIndex, std::size_t ... Indices>
+struct IndexAt<N, FirstIndex, Indices...> {
+  enum {
+    value = IndexAt<N - 1, Indices...>::value
+  };
+};
+
+template <std::size_t FirstIndex, std::size_t ... Indices>
+struct IndexAt<0, FirstIndex, Indices...> {
+  enum {
+    value = FirstIndex
+  };
+};
+
+/**
+ * Move the N-th entry of an index pack to the front and keep the order of
+ * the others, type is the resulting Indices<...>.
+ * Done collects the entries skipped so far.
+ */
+template <std::size_t N, class Done, std::size_t ... Indices>
+struct MoveToFront;
+
+template <std::size_t N, std::size_t ... DoneIndices,
+  std::size_t FirstIndex, std::size_t ... Indices>
+struct MoveToFront<N, mpl::Indices<DoneIndices...>, FirstIndex, Indices...> {
+  typedef typename MoveToFront<N - 1,
+    mpl::Indices<DoneIndices..., FirstIndex>, Indices...>::type type;
+};
+
+template <std::size_t ... DoneIndices,
+  std::size_t FirstIndex, std::size_t ... Indices>
+struct MoveToFront<0, mpl::Indices<DoneIndices...>, FirstIndex, Indices...> {
+  typedef mpl::Indices<FirstIndex, DoneIndices..., Indices...> type;
+};
+
+/** value is true if all types are the same */
+template <typename T, typename ... Ts>
+struct AllSame;
+
+template <typename T, typename First, typename ... Ts>
+struct AllSame<T, First, Ts...> {
+  enum {
+    value = std::is_same<T, First>::value && AllSame<T, Ts...>::value
+  };
+};
+
+template <typename T>
+struct AllSame<T> {
+  enum {
+    value = true
+  };
+};
+
+/**
+ * Check if the keys of a key_type and comp_type (see \ref TypeExtractor) 
+ * can be handled as flat arrays of lower and upper endpoints: value is 
+ * true if all dimensions hold the same arithmetic type, compared with 
+ * std::less. value_type is that type.
+ */
+template <class KeyType, class CompType>
+struct FlatKey {
+  enum {
+    value = false
+  };
+  typedef void value_type;
+};
+
+template <typename T, typename ... Ts>
+struct FlatKey<std::tuple<std::pair<T, T>, std::pair<Ts, Ts>...>, 
+  std::tuple<std::less<T>, std::less<Ts>...> > {
+  enum {
+    value = std::is_arithmetic<T>::value && AllSame<T, Ts...>::value
+  };
+  typedef T value_type;
+};
+
 template <class TraitsType, std::size_t ... TIndices>
 struct TypeExtractor {
   
@@ -36,9 +36,17 @@
 // hack for testing purposes
 #define private public
 #include <fbi/fbi.h>
+#include <fbi/nearest.h>
 #undef private
 #include <fbi/tuplegenerator.h>
 #include <fbi/connectedcomponents.h>
+#include <fbi/pipeline.h>
+#include <fbi/quantize.h>
+#include <fbi/cluster.h>
+#include <fbi/shiftedjoin.h>
+#include <fbi/epsilonjoin.h>
+#include <fbi/dimensionorder.h>
+#include <fbi/batch.h>
 using namespace vigra;
 
 
@@ -115,6 +123,54 @@ struct Traits<ValueType<Dimensions...> >: public mpl::TraitsGenerator<Dimensions
 
 }
 
+// Reference test for overlap in all dimensions of a key, N counts down
+template <typename Key, std::size_t N = std::tuple_size<Key>::value>
+struct BruteForceOverlap {
+  static bool test(const Key & a, const Key & b) {
+    return std::get<N-1>(a).first < std::get<N-1>(b).second &&
+      std::get<N-1>(b).first < std::get<N-1>(a).second &&
+      BruteForceOverlap<Key, N-1>::test(a, b);
+  }
+};
+
+template <typename Key>
+struct BruteForceOverlap<Key, 0> {
+  static bool test(const Key &, const Key &) { return true; }
+};
+
+// Check that two adjacency lists (or lists of sorted rows) are equal
+template <class Expected, class Result>
+void checkSameResult(const Expected & expected, const Result & result)
+{
+  shouldEqual(expected.size(), result.size());
+  for (std::size_t i = 0; i < expected.size(); ++i) {
+    shouldEqual(expected[i].size(), result[i].size());
+    should(std::equal(expected[i].begin(), expected[i].end(), 
+      result[i].begin()));
+  }
+}
+
+typedef ValueType<double, int> RandomBox;
+
+// n data and n query boxes with heads uniform in [0, range), the data 
+// boxes 1.0 x 3 and the query boxes 1.5 x 2 wide
+void createRandomBoxes(const unsigned int seed, const std::size_t n, 
+  const double range, std::vector<RandomBox> & data, 
+  std::vector<RandomBox> & queries)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> x(0.0, range);
+  std::uniform_int_distribution<int> y(0, static_cast<int>(range));
+  for (std::size_t i = 0; i < n; ++i) {
+    double a = x(rng);
+    int b = y(rng);
+    data.push_back(RandomBox(a, a + 1.0, b, b + 3));
+    a = x(rng);
+    b = y(rng);
+    queries.push_back(RandomBox(a, a + 1.5, b, b + 2));
+  }
+}
+
 struct HybridSetATestSuite : vigra::test_suite {
   HybridSetATestSuite() : vigra::test_suite("HybridSetA") {
     add(testCase(&HybridSetATestSuite::testSetAType));
@@ -151,6 +207,18 @@ struct HybridSetATestSuite : vigra::test_suite {
     add(testCase(&HybridSetATestSuite::testHybridScanOnlyPoints));
     add(testCase(&HybridSetATestSuite::testHybridScanAllPointsOutside));
     add(testCase(&HybridSetATestSuite::testHybridScanFunctorVectors));
+    add(testCase(&HybridSetATestSuite::testSpatialOrder));
+    add(testCase(&HybridSetATestSuite::testQueryBatches));
+    add(testCase(&HybridSetATestSuite::testAnnotatedIntersect));
+    add(testCase(&HybridSetATestSuite::testScoredIntersect));
+    add(testCase(&HybridSetATestSuite::testPartitions));
+    add(testCase(&HybridSetATestSuite::testHighDimensions));
+    add(testCase(&HybridSetATestSuite::testGridEngine));
+    add(testCase(&HybridSetATestSuite::testSweepEngine));
+    add(testCase(&HybridSetATestSuite::testMemoryBudget));
+    add(testCase(&HybridSetATestSuite::testEstimate));
+    add(testCase(&HybridSetATestSuite::testSkewedSplits));
+    add(testCase(&HybridSetATestSuite::testFlatKeys));
   }
 
   //typedef std::pair<int, std::less<int> > IntDimension;
@@ -1343,12 +1411,706 @@ void testHybridScanFunctorVectors()
 
 }
 
+  void testSpatialOrder()
+  {
+    typedef ValueType<double, int> Map;
+    typedef fbi::SetA<Map, 0,1> TTT;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+    typedef OffsetQueryAccessor<Map> IntervalMover;
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> x(0.0, 1000.0);
+    std::uniform_int_distribution<int> y(0, 1000);
+    std::vector<Map> testVector, queryVector;
+    for (std::size_t i = 0; i < 5000; ++i) {
+      double a = x(rng);
+      int b = y(rng);
+      testVector.push_back(Map(a, a + 3.0, b, b + 5));
+      a = x(rng);
+      b = y(rng);
+      queryVector.push_back(Map(a, a + 2.0, b, b + 8));
+    }
+    std::vector<IntervalMover> movers;
+    movers.push_back(IntervalMover(0,0));
+    movers.push_back(IntervalMover(1.5,-2));
+
+    fbi::IntersectOptions options;
+    options.spatialOrder_ = true;
+    options.cutoff_ = 50;
+
+    auto plain = TTT::intersect(testVector, StandardFunctor(), movers);
+    auto ordered = TTT::intersect(options, testVector, StandardFunctor(), movers);
+    checkSameResult(plain, ordered);
+
+    typedef TTT::SetB<Map, 0,1> TTTB;
+    plain = TTTB::intersect(testVector, StandardFunctor(), 
+      queryVector, movers, IntervalMover(0,4));
+    ordered = TTTB::intersect(options, testVector, StandardFunctor(), 
+      queryVector, movers, IntervalMover(0,4));
+    checkSameResult(plain, ordered);
+    std::size_t edges = 0;
+    for (std::size_t i = 0; i < plain.size(); ++i) {
+      edges += plain[i].size();
+    }
+    should(edges > 0);
+  }
+
+  void testQueryBatches()
+  {
+    typedef RandomBox Map;
+    typedef fbi::SetA<Map, 0,1> TTT;
+    typedef TTT::SetB<Map, 0,1> TTTB;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+    typedef OffsetQueryAccessor<Map> IntervalMover;
+
+    std::vector<Map> testVector, queryVector;
+    createRandomBoxes(11, 3000, 500.0, testVector, queryVector);
+    std::vector<IntervalMover> movers;
+    for (int i = 0; i < 5; ++i) {
+      movers.push_back(IntervalMover(1.1 * i, -i));
+    }
 
+    auto selfJoin = TTT::intersect(testVector, StandardFunctor(), 
+      movers, IntervalMover(0,7));
+    auto bipartite = TTTB::intersect(testVector, StandardFunctor(), 
+      queryVector, IntervalMover(0,7), movers);
+    fbi::IntersectOptions options;
+    options.cutoff_ = 40;
+    for (std::size_t batchSize = 1; batchSize <= 7; batchSize += 2) {
+      options.queryBatchSize_ = batchSize;
+      options.spatialOrder_ = (batchSize == 3);
+      auto batched = TTT::intersect(options, testVector, StandardFunctor(), 
+        movers, IntervalMover(0,7));
+      checkSameResult(selfJoin, batched);
+      batched = TTTB::intersect(options, testVector, StandardFunctor(), 
+        queryVector, IntervalMover(0,7), movers);
+      checkSameResult(bipartite, batched);
+    }
+  }
 
+  void testPartitions()
+  {
+    typedef RandomBox Map;
+    typedef fbi::SetA<Map, 0,1> TTT;
+    typedef TTT::SetB<Map, 0,1> TTTB;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+    typedef OffsetQueryAccessor<Map> IntervalMover;
 
+    std::vector<Map> testVector, queryVector;
+    createRandomBoxes(12, 4000, 300.0, testVector, queryVector);
+    std::vector<IntervalMover> movers;
+    movers.push_back(IntervalMover(0.5, 1));
+    movers.push_back(IntervalMover(-2.0, 0));
+
+    auto selfJoin = TTT::intersect(testVector, StandardFunctor(), movers);
+    auto bipartite = TTTB::intersect(testVector, StandardFunctor(), 
+      queryVector, StandardFunctor(), movers);
+    fbi::IntersectOptions options;
+    options.cutoff_ = 40;
+    for (std::size_t partitions = 2; partitions <= 5; ++partitions) {
+      options.partitions_ = partitions;
+      options.pinPartitions_ = (partitions % 2 == 0);
+      options.spatialOrder_ = (partitions == 3);
+      options.queryBatchSize_ = (partitions == 5) ? 1 : 0;
+      auto partitioned = TTT::intersect(options, testVector, 
+        StandardFunctor(), movers);
+      checkSameResult(selfJoin, partitioned);
+      partitioned = TTTB::intersect(options, testVector, StandardFunctor(), 
+        queryVector, StandardFunctor(), movers);
+      checkSameResult(bipartite, partitioned);
+    }
 
+    std::vector<int> cpus;
+    should(fbi::NumaTopology::parseList("0-3,8,10-11\n", cpus));
+    shouldEqual(cpus.size(), 7u);
+    shouldEqual(cpus[4], 8);
+    shouldEqual(cpus[6], 11);
+    should(!fbi::NumaTopology::parseList("a-b", cpus));
+    should(fbi::NumaTopology::get().numNodes() >= 1);
+  }
 
+  void testHighDimensions()
+  {
+    typedef ValueType<double, double, double, double, 
+      double, double, double, double> Map;
+    typedef fbi::SetA<Map, 0,1,2,3,4,5,6,7> TTT;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
 
+    std::mt19937 rng(8);
+    std::uniform_real_distribution<double> x(0.0, 100.0);
+    auto interval = [&]() { 
+      double a = x(rng); 
+      return std::make_pair(a, a + 35.0); 
+    };
+    std::vector<Map> testVector;
+    for (std::size_t i = 0; i < 1500; ++i) {
+      Map::key_type key;
+      key = std::make_tuple(interval(), interval(), interval(), interval(), 
+        interval(), interval(), interval(), interval());
+      testVector.push_back(Map(key));
+    }
+
+    std::size_t numEdges = 0;
+    TTT::ResultType expected(testVector.size());
+    for (std::size_t i = 0; i < testVector.size(); ++i) {
+      for (std::size_t j = 0; j < testVector.size(); ++j) {
+        if (BruteForceOverlap<Map::key_type>::test(testVector[i].key_, 
+              testVector[j].key_)) {
+          expected[i].push_back(j);
+          ++numEdges;
+        }
+      }
+    }
+    should(numEdges > 2 * testVector.size());
+
+    fbi::IntersectOptions options;
+    options.cutoff_ = 20;
+    for (std::size_t scanDimensions = 0; scanDimensions <= 8; ++scanDimensions) {
+      options.scanDimensions_ = scanDimensions;
+      TTT::ResultType result = TTT::intersect(options, testVector, 
+        StandardFunctor(), StandardFunctor());
+      checkSameResult(expected, result);
+    }
+  }
+
+  void testGridEngine()
+  {
+    typedef ValueType<double, int, double> Map;
+    typedef fbi::SetA<Map, 0,1,2> TTT;
+    typedef TTT::SetB<Map, 0,1,2> TTTB;
+    typedef fbi::SetA<Map, 1> TTT1;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+    typedef OffsetQueryAccessor<Map> IntervalMover;
+
+    // nearly uniform extents like XIC boxes, integer heads give ties
+    std::mt19937 rng(44);
+    std::uniform_real_distribution<double> x(400.0, 1600.0);
+    std::uniform_int_distribution<int> y(0, 500);
+    std::uniform_real_distribution<double> z(0.0, 10.0);
+    std::vector<Map> testVector, queryVector;
+    for (std::size_t i = 0; i < 3000; ++i) {
+      double a = x(rng);
+      int b = y(rng);
+      double c = z(rng);
+      testVector.push_back(Map(a, a * (1 + 2E-4), b, b + 4, c, c + 5.0));
+      a = x(rng);
+      b = y(rng);
+      queryVector.push_back(Map(a, a * (1 + 2E-4), b, b + 3, c, c + 1.0));
+    }
+    std::vector<IntervalMover> movers;
+    movers.push_back(IntervalMover(0.0, 0, 0.0));
+    movers.push_back(IntervalMover(0.1, 2, 0.0));
+
+    fbi::IntersectOptions trees, grid, automatic;
+    trees.engine_ = fbi::IntersectOptions::ENGINE_SEGMENT_TREE;
+    grid.engine_ = fbi::IntersectOptions::ENGINE_GRID;
+    auto expected = TTT::intersect(trees, testVector, StandardFunctor(), 
+      movers);
+    std::size_t numEdges = 0;
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+      numEdges += expected[i].size();
+    }
+    should(numEdges > testVector.size());
+    checkSameResult(expected, TTT::intersect(grid, testVector, 
+      StandardFunctor(), movers));
+    checkSameResult(expected, TTT::intersect(automatic, testVector, 
+      StandardFunctor(), movers));
+    checkSameResult(
+      TTTB::intersect(trees, testVector, StandardFunctor(), queryVector, 
+        StandardFunctor()), 
+      TTTB::intersect(grid, testVector, StandardFunctor(), queryVector, 
+        StandardFunctor()));
+    checkSameResult(
+      TTT1::intersect(trees, testVector, StandardFunctor(), movers), 
+      TTT1::intersect(grid, testVector, StandardFunctor(), movers));
+
+    grid.queryBatchSize_ = 1;
+    grid.partitions_ = 3;
+    auto annotated = TTT::annotatedIntersect(trees, testVector, 
+      StandardFunctor(), movers);
+    auto gridAnnotated = TTT::annotatedIntersect(grid, testVector, 
+      StandardFunctor(), movers);
+    for (std::size_t i = 0; i < annotated.edges_.size(); ++i) {
+      std::sort(annotated.edges_[i].begin(), annotated.edges_[i].end());
+      annotated.edges_[i].erase(std::unique(annotated.edges_[i].begin(), 
+        annotated.edges_[i].end()), annotated.edges_[i].end());
+      std::sort(gridAnnotated.edges_[i].begin(), 
+        gridAnnotated.edges_[i].end());
+    }
+    checkSameResult(annotated.edges_, gridAnnotated.edges_);
+
+    // a few huge boxes: the automatic choice has to fall back, 
+    // forcing the grid still gives the same result
+    for (std::size_t i = 0; i < 10; ++i) {
+      testVector[i] = Map(400.0, 1600.0, 0, 500, 0.0, 10.0);
+    }
+    expected = TTT::intersect(trees, testVector, StandardFunctor(), movers);
+    checkSameResult(expected, TTT::intersect(automatic, testVector, 
+      StandardFunctor(), movers));
+    checkSameResult(expected, TTT::intersect(grid, testVector, 
+      StandardFunctor(), movers));
+
+    // open ended and NaN boxes have no cell, forcing the grid has to fall
+    // back to the trees
+    testVector[0] = Map(400.0, std::numeric_limits<double>::infinity(), 
+      0, 500, 0.0, 10.0);
+    testVector[1] = Map(-std::numeric_limits<double>::infinity(), 500.0, 
+      0, 500, 0.0, 10.0);
+    expected = TTT::intersect(trees, testVector, StandardFunctor(), movers);
+    checkSameResult(expected, TTT::intersect(grid, testVector, 
+      StandardFunctor(), movers));
+    // NaN breaks the order of the trees as well, so put it into the second
+    // grid dimension and let the trees only sort the first one (see 
+    // IntersectOptions::scanDimensions_), which only compare it box by box.
+    // Forcing the grid has to fall back to them.
+    typedef ValueType<int, double, double> NanMap;
+    typedef fbi::SetA<NanMap, 0,1,2> NanSet;
+    typedef ValueTypeStandardAccessor<NanMap> NanFunctor;
+    std::vector<NanMap> nanVector;
+    for (std::size_t i = 0; i < 1000; ++i) {
+      int b = y(rng);
+      double a = x(rng);
+      double c = z(rng);
+      nanVector.push_back(NanMap(b, b + 4, a, a * (1 + 2E-4), c, c + 5.0));
+    }
+    nanVector[0] = NanMap(0, 500, std::numeric_limits<double>::quiet_NaN(),
+      1600.0, 0.0, 10.0);
+    grid.scanDimensions_ = 1;
+    fbi::IntersectOptions fallback = grid;
+    fallback.engine_ = fbi::IntersectOptions::ENGINE_SEGMENT_TREE;
+    auto nanExpected = NanSet::intersect(fallback, nanVector, NanFunctor(), 
+      NanFunctor());
+    checkSameResult(nanExpected, NanSet::intersect(grid, nanVector, 
+      NanFunctor(), NanFunctor()));
+  }
+
+  template <class Result, class CompactResult>
+  void checkCompactResult(const Result & expected, 
+    const CompactResult & result)
+  {
+    shouldEqual(expected.size() + 1, result.offsets_.size());
+    shouldEqual(result.offsets_.back(), result.targets_.size());
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+      shouldEqual(expected[i].size(), 
+        result.offsets_[i + 1] - result.offsets_[i]);
+      should(std::equal(expected[i].begin(), expected[i].end(), 
+        result.targets_.begin() + result.offsets_[i]));
+    }
+  }
+
+  void testMemoryBudget()
+  {
+    typedef ValueType<double, double> Map;
+    typedef fbi::SetA<Map, 0, 1> TTT;
+    typedef TTT::SetB<Map, 0, 1> TTTB;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+    typedef OffsetQueryAccessor<Map> IntervalMover;
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<double> pos(0.0, 100.0);
+    std::uniform_real_distribution<double> width(0.0, 8.0);
+    std::vector<Map> testVector, queryVector;
+    for (std::size_t i = 0; i < 3000; ++i) {
+      double x = pos(rng), y = pos(rng);
+      testVector.push_back(Map(x, x + width(rng), y, y + width(rng)));
+      x = pos(rng);
+      y = pos(rng);
+      queryVector.push_back(Map(x, x + width(rng), y, y + width(rng)));
+    }
+    // the same pairs from both functors
+    std::vector<IntervalMover> movers;
+    movers.push_back(IntervalMover(0.0, 0.0));
+    movers.push_back(IntervalMover(0.0, 0.0));
+
+    fbi::IntersectOptions options;
+    TTT::ResultType expected = TTT::intersect(options, testVector, 
+      StandardFunctor(), movers);
+    // every functor reports each pair in both directions and every box
+    // with itself, i.e. once per entry of the result; with more than 
+    // estimateSampleSize boxes, only a sample of the queries is scanned
+    std::vector<Map> largeVector(testVector);
+    for (std::size_t i = 0; i < 9000; ++i) {
+      const double x = pos(rng), y = pos(rng);
+      largeVector.push_back(Map(x, x + width(rng), y, y + width(rng)));
+    }
+    TTT::ResultType large = TTT::intersect(largeVector, StandardFunctor(), 
+      StandardFunctor());
+    std::size_t numEdges = 0;
+    for (std::size_t i = 0; i < large.size(); ++i) {
+      numEdges += large[i].size();
+    }
+    const double estimate = TTTB::estimateEdges(options, largeVector, 
+      StandardFunctor(), largeVector, movers);
+    const double reported = 2.0 * numEdges;
+    should(estimate > 0.85 * reported && estimate < 1.15 * reported);
+    should(TTTB::adjacencyListMemory(large.size(), estimate) > 4096);
+
+    // too small to hold all edges, they go through the temporary file
+    options.memoryBudget_ = 4096;
+    checkSameResult(expected, TTT::intersect(options, testVector, 
+      StandardFunctor(), movers));
+    checkCompactResult(expected, TTT::compactIntersect(options, testVector,
+      StandardFunctor(), movers));
+    options.memoryBudget_ = std::size_t(1) << 30;
+    checkSameResult(expected, TTT::intersect(options, testVector, 
+      StandardFunctor(), movers));
+    options.memoryBudget_ = 0;
+    checkCompactResult(expected, TTT::compactIntersect(options, testVector,
+      StandardFunctor(), movers));
+
+    TTT::ResultType bipartite = TTTB::intersect(testVector, 
+      StandardFunctor(), queryVector, StandardFunctor());
+    options.memoryBudget_ = 4096;
+    options.partitions_ = 3;
+    checkSameResult(bipartite, TTTB::intersect(options, testVector, 
+      StandardFunctor(), queryVector, StandardFunctor()));
+    checkCompactResult(bipartite, TTTB::compactIntersect(options, 
+      testVector, StandardFunctor(), queryVector, StandardFunctor()));
+    checkCompactResult(TTT::ResultType(), TTTB::compactIntersect(
+      std::vector<Map>(), StandardFunctor(), queryVector, 
+      StandardFunctor()));
+  }
+
+  void testEstimate()
+  {
+    typedef ValueType<double, double> Map;
+    typedef fbi::SetA<Map, 0, 1> TTT;
+    typedef TTT::SetB<Map, 0, 1> TTTB;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+
+    std::mt19937 rng(48);
+    std::uniform_real_distribution<double> pos(0.0, 200.0);
+    std::uniform_real_distribution<double> width(0.0, 8.0);
+    std::vector<Map> testVector, queryVector;
+    for (std::size_t i = 0; i < 12000; ++i) {
+      double x = pos(rng), y = pos(rng);
+      testVector.push_back(Map(x, x + width(rng), y, y + width(rng)));
+      x = pos(rng);
+      y = pos(rng);
+      queryVector.push_back(Map(x, x + width(rng), y, y + width(rng)));
+    }
+    fbi::IntersectOptions options;
+    // a self-join reports each pair in both directions and every box with
+    // itself, i.e. once per entry of the result
+    fbi::IntersectEstimate estimate = TTT::estimate(options, testVector,
+      StandardFunctor(), StandardFunctor());
+    TTT::ResultType result = TTT::intersect(options, testVector, 
+      StandardFunctor(), StandardFunctor());
+    std::size_t numEdges = 0;
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      numEdges += result[i].size();
+    }
+    shouldEqual(estimate.sampleSize_, std::size_t(2000));
+    should(estimate.pairs_.low_ <= estimate.pairs_.value_);
+    should(estimate.pairs_.value_ <= estimate.pairs_.high_);
+    should(estimate.pairs_.low_ < 1.05 * numEdges);
+    should(estimate.pairs_.high_ > 0.95 * numEdges);
+    should(estimate.seconds_.low_ > 0.0);
+    should(estimate.seconds_.low_ <= estimate.seconds_.high_);
+    should(estimate.peakBytes_.low_ > numEdges * sizeof(unsigned int));
+    should(estimate.peakBytes_.low_ <= estimate.peakBytes_.high_);
+
+    estimate = TTTB::estimate(options, testVector, StandardFunctor(),
+      queryVector, StandardFunctor());
+    TTT::ResultType bipartite = TTTB::intersect(options, testVector, 
+      StandardFunctor(), queryVector, StandardFunctor());
+    // bipartite pairs are reported once
+    numEdges = 0;
+    for (std::size_t i = 0; i < testVector.size(); ++i) {
+      numEdges += bipartite[i].size();
+    }
+    should(estimate.pairs_.low_ < 1.05 * numEdges);
+    should(estimate.pairs_.high_ > 0.95 * numEdges);
+    // a budget smaller than the result caps the estimated peak
+    const double unbounded = estimate.peakBytes_.high_;
+    options.memoryBudget_ = 4096;
+    estimate = TTTB::estimate(options, testVector, StandardFunctor(),
+      queryVector, StandardFunctor());
+    should(estimate.peakBytes_.high_ < unbounded);
+
+    estimate = TTTB::estimate(options, std::vector<Map>(), 
+      StandardFunctor(), queryVector, StandardFunctor());
+    shouldEqual(estimate.sampleSize_, std::size_t(0));
+    shouldEqual(estimate.pairs_.high_, 0.0);
+  }
+
+  void testSkewedSplits()
+  {
+    typedef ValueType<double, double> Map;
+    typedef fbi::SetA<Map, 0, 1> TTT;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+
+    // coordinates crowd towards zero and a quarter of the boxes are 
+    // copies of one box, which makes for lopsided splits of the tree
+    std::mt19937 rng(49);
+    std::uniform_int_distribution<int> exponent(0, 200);
+    std::uniform_real_distribution<double> width(0.0, 1e-3);
+    auto coordinate = [&]() { return 100.0 * std::pow(0.9, exponent(rng)); };
+    std::vector<Map> testVector;
+    for (std::size_t i = 0; i < 2000; ++i) {
+      if (i % 4 == 0) {
+        testVector.push_back(Map(1.0, 2.0, 1.0, 2.0));
+        continue;
+      }
+      const double x = coordinate(), y = coordinate();
+      testVector.push_back(Map(x, x * 1.05 + width(rng), y, 
+        y * 1.05 + width(rng)));
+    }
+    TTT::ResultType expected(testVector.size());
+    for (std::size_t i = 0; i < testVector.size(); ++i) {
+      for (std::size_t j = 0; j < testVector.size(); ++j) {
+        if (BruteForceOverlap<Map::key_type>::test(testVector[i].key_, 
+              testVector[j].key_)) {
+          expected[i].push_back(j);
+        }
+      }
+    }
+    fbi::IntersectOptions options;
+    options.engine_ = fbi::IntersectOptions::ENGINE_SEGMENT_TREE;
+    for (std::size_t cutoff = 2; cutoff <= 32; cutoff *= 4) {
+      options.cutoff_ = cutoff;
+      TTT::ResultType result = TTT::intersect(options, testVector, 
+        StandardFunctor(), StandardFunctor());
+      checkSameResult(expected, result);
+    }
+  }
+
+  void testFlatKeys()
+  {
+    typedef std::pair<double, double> D;
+    typedef std::pair<float, float> F;
+    should((fbi::mpl::FlatKey<std::tuple<D, D>, 
+      std::tuple<std::less<double>, std::less<double> > >::value));
+    should(!(fbi::mpl::FlatKey<std::tuple<D, F>, 
+      std::tuple<std::less<double>, std::less<float> > >::value));
+    should(!(fbi::mpl::FlatKey<std::tuple<D, D>, 
+      std::tuple<std::less<double>, std::greater<double> > >::value));
+    should(!(fbi::mpl::FlatKey<std::tuple<std::pair<std::string, 
+      std::string> >, std::tuple<std::less<std::string> > >::value));
+
+    typedef ValueType<float, float, float> Map;
+    typedef fbi::SetA<Map, 0, 1, 2> TTT;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+    std::mt19937 rng(50);
+    std::uniform_real_distribution<float> x(0.0f, 50.0f);
+    std::vector<Map> testVector;
+    for (std::size_t i = 0; i < 1500; ++i) {
+      const float a = x(rng), b = x(rng), c = x(rng);
+      testVector.push_back(Map(a, a + 6.0f, b, b + 6.0f, c, c + 6.0f));
+    }
+    TTT::ResultType expected(testVector.size());
+    for (std::size_t i = 0; i < testVector.size(); ++i) {
+      for (std::size_t j = 0; j < testVector.size(); ++j) {
+        if (BruteForceOverlap<Map::key_type>::test(testVector[i].key_, 
+              testVector[j].key_)) {
+          expected[i].push_back(j);
+        }
+      }
+    }
+    fbi::IntersectOptions options;
+    options.engine_ = fbi::IntersectOptions::ENGINE_SEGMENT_TREE;
+    options.cutoff_ = 8;
+    for (std::size_t scanDimensions = 1; scanDimensions <= 3; ++scanDimensions) {
+      options.scanDimensions_ = scanDimensions;
+      TTT::ResultType result = TTT::intersect(options, testVector, 
+        StandardFunctor(), StandardFunctor());
+      checkSameResult(expected, result);
+    }
+  }
+
+  void testSweepEngine()
+  {
+    typedef ValueType<int, double> Map;
+    typedef fbi::SetA<Map, 0> TTT1;
+    typedef fbi::SetA<Map, 0, 1> TTT2;
+    typedef TTT1::SetB<Map, 0> TTTB1;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+    typedef OffsetQueryAccessor<Map> IntervalMover;
+
+    // small integer ranges give many equal endpoints, and some empty 
+    // intervals
+    std::mt19937 rng(45);
+    std::uniform_int_distribution<int> x(0, 2000);
+    std::uniform_int_distribution<int> width(0, 6);
+    std::uniform_real_distribution<double> y(0.0, 100.0);
+    std::vector<Map> testVector, queryVector;
+    for (std::size_t i = 0; i < 3000; ++i) {
+      int a = x(rng);
+      double b = y(rng);
+      testVector.push_back(Map(a, a + width(rng), b, b + 30.0));
+      a = x(rng);
+      b = y(rng);
+      queryVector.push_back(Map(a, a + width(rng), b, b + 5.0));
+    }
+    std::vector<IntervalMover> movers;
+    movers.push_back(IntervalMover(0, 0.0));
+    movers.push_back(IntervalMover(3, 1.0));
+
+    fbi::IntersectOptions trees, sweep, automatic;
+    trees.engine_ = fbi::IntersectOptions::ENGINE_SEGMENT_TREE;
+    sweep.engine_ = fbi::IntersectOptions::ENGINE_SWEEP;
+    auto expected = TTT1::intersect(trees, testVector, StandardFunctor(), 
+      movers);
+    checkSameResult(expected, TTT1::intersect(sweep, testVector, 
+      StandardFunctor(), movers));
+    checkSameResult(expected, TTT1::intersect(automatic, testVector, 
+      StandardFunctor(), movers));
+    checkSameResult(
+      TTTB1::intersect(trees, testVector, StandardFunctor(), queryVector, 
+        StandardFunctor()), 
+      TTTB1::intersect(automatic, testVector, StandardFunctor(), 
+        queryVector, StandardFunctor()));
+
+    sweep.partitions_ = 2;
+    sweep.queryBatchSize_ = 1;
+    checkSameResult(
+      TTT2::intersect(trees, testVector, StandardFunctor(), movers), 
+      TTT2::intersect(sweep, testVector, StandardFunctor(), movers));
+  }
+
+  void testAnnotatedIntersect()
+  {
+    typedef RandomBox Map;
+    typedef fbi::SetA<Map, 0,1> TTT;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+    typedef OffsetQueryAccessor<Map> IntervalMover;
+
+    std::vector<Map> testVector, queryVector;
+    createRandomBoxes(13, 3000, 300.0, testVector, queryVector);
+    std::vector<IntervalMover> movers;
+    for (int i = 0; i < 3; ++i) {
+      movers.push_back(IntervalMover(0.7 * i, i));
+    }
+    const IntervalMover last(0, -2);
+
+    fbi::IntersectOptions options;
+    options.overlaps_ = true;
+    TTT::AnnotatedResultType annotated = 
+      TTT::annotatedIntersect(options, testVector, StandardFunctor(), 
+        movers, last);
+    shouldEqual(annotated.edges_.size(), testVector.size());
+    shouldEqual(annotated.overlaps_.size(), testVector.size());
+
+    // every functor on its own gives the edges annotated with it
+    for (std::size_t k = 0; k <= movers.size(); ++k) {
+      TTT::ResultType expected = (k < movers.size()) ? 
+        TTT::intersect(testVector, StandardFunctor(), movers[k]) :
+        TTT::intersect(testVector, StandardFunctor(), last);
+      std::vector<std::set<TTT::IntType> > edges(testVector.size());
+      for (std::size_t q = 0; q < annotated.edges_.size(); ++q) {
+        for (std::size_t i = 0; i < annotated.edges_[q].size(); ++i) {
+          if (annotated.edges_[q][i].second != k) continue;
+          TTT::IntType d = annotated.edges_[q][i].first;
+          edges[q].insert(d);
+          edges[d].insert((TTT::IntType)q);
+        }
+      }
+      checkSameResult(expected, edges);
+    }
+
+    // the overlaps are the intersections of the query and data keys
+    for (std::size_t q = 0; q < annotated.edges_.size(); ++q) {
+      shouldEqual(annotated.edges_[q].size(), annotated.overlaps_[q].size());
+      for (std::size_t i = 0; i < annotated.edges_[q].size(); ++i) {
+        const std::size_t k = annotated.edges_[q][i].second;
+        auto query = (k < movers.size()) ? 
+          movers[k].get<0>(testVector[q]) : last.get<0>(testVector[q]);
+        auto data = std::get<0>(testVector[annotated.edges_[q][i].first].key_);
+        auto overlap = std::get<0>(annotated.overlaps_[q][i]);
+        shouldEqual(overlap.first, std::max(query.first, data.first));
+        shouldEqual(overlap.second, std::min(query.second, data.second));
+      }
+    }
+
+    // batching and reordering do not change the annotations
+    options.overlaps_ = false;
+    options.queryBatchSize_ = 2;
+    options.spatialOrder_ = true;
+    options.cutoff_ = 30;
+    TTT::AnnotatedResultType batched = 
+      TTT::annotatedIntersect(options, testVector, StandardFunctor(), 
+        movers, last);
+    should(batched.overlaps_.empty());
+    should(batched.edges_ == annotated.edges_);
+  }
+
+  struct CenterDistance {
+    double operator()(const ValueType<double, int> & query, 
+      const ValueType<double, int> & data) const {
+      return std::fabs(std::get<0>(query.key_).first - 
+        std::get<0>(data.key_).first) + 
+        std::abs(std::get<1>(query.key_).first - 
+        std::get<1>(data.key_).first);
+    }
+  };
+
+  void testScoredIntersect()
+  {
+    typedef ValueType<double, int> Map;
+    typedef fbi::SetA<Map, 0,1> TTT;
+    typedef TTT::SetB<Map, 0,1> TTTB;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+    typedef OffsetQueryAccessor<Map> IntervalMover;
+
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<double> x(0.0, 100.0);
+    std::uniform_int_distribution<int> y(0, 100);
+    std::vector<Map> testVector, queryVector;
+    for (std::size_t i = 0; i < 2000; ++i) {
+      double a = x(rng);
+      int b = y(rng);
+      testVector.push_back(Map(a, a + 1.0, b, b + 4));
+      a = x(rng);
+      b = y(rng);
+      queryVector.push_back(Map(a, a + 3.0, b, b + 6));
+    }
+    std::vector<IntervalMover> movers;
+    movers.push_back(IntervalMover(0, 0));
+    movers.push_back(IntervalMover(0.5, 1));
+
+    for (std::size_t k = 1; k <= 4; k += 3) {
+      TTT::ScoredResultType scored = TTTB::scoredIntersect(k, 
+        CenterDistance(), testVector, StandardFunctor(), queryVector, movers);
+      TTT::ResultType all = TTTB::intersect(testVector, StandardFunctor(),
+        queryVector, movers);
+      shouldEqual(scored.size(), all.size());
+      std::size_t neighbors = 0;
+      for (std::size_t i = 0; i < all.size(); ++i) {
+        if (i < testVector.size()) {
+          should(scored[i].empty());
+          continue;
+        }
+        // score all neighbors and keep the k best
+        TTT::ScoredResultType::value_type expected;
+        for (auto it = all[i].begin(); it != all[i].end(); ++it) {
+          expected.push_back(TTT::ScoredEdge(*it, CenterDistance()(
+            queryVector[i - testVector.size()], testVector[*it])));
+        }
+        std::sort(expected.begin(), expected.end(), 
+          TTT::TopKCollector<CenterDistance, std::vector<Map>, 
+            std::vector<Map> >::better);
+        if (expected.size() > k) expected.resize(k);
+        should(scored[i] == expected);
+        neighbors += scored[i].size();
+      }
+      should(neighbors > 0);
+      fbi::IntersectOptions options;
+      options.engine_ = fbi::IntersectOptions::ENGINE_SWEEP;
+      options.partitions_ = 2;
+      options.queryBatchSize_ = 1;
+      should(scored == TTTB::scoredIntersect(options, k, CenterDistance(), 
+        testVector, StandardFunctor(), queryVector, movers));
+    }
+
+    // self-join: every box is a candidate for itself
+    TTT::ScoredResultType self = TTT::scoredIntersect(1, CenterDistance(), 
+      testVector, StandardFunctor(), movers);
+    shouldEqual(self.size(), testVector.size());
+    for (std::size_t i = 0; i < self.size(); ++i) {
+      shouldEqual(self[i].size(), 1u);
+      shouldEqual(self[i][0].second, 0.0);
+    }
+  }
 
 }; //end HybridSetATestSuite
 
@@ -1421,6 +2183,7 @@ struct ConnectedComponentsTestSuite : vigra::test_suite {
   ConnectedComponentsTestSuite() : vigra::test_suite("ConnectedComponents")
   {
     add(testCase(&ConnectedComponentsTestSuite::testConnectedComponents));
+    add(testCase(&ConnectedComponentsTestSuite::testParallelConnectedComponents));
   }
 
   void testConnectedComponents(){
@@ -1456,15 +2219,933 @@ struct ConnectedComponentsTestSuite : vigra::test_suite {
       }
     }
   }
+
+  void testParallelConnectedComponents(){
+    typedef uint32_t IntType;
+    const IntType nodes = 5000;
+    std::mt19937 engine(3);
+    std::uniform_int_distribution<IntType> node(0, nodes - 1);
+    std::vector<std::vector<IntType> > adjacencyList(nodes);
+    for (IntType e = 0; e < 3000; ++e) {
+      IntType a = node(engine), b = node(engine);
+      adjacencyList[a].push_back(b);
+      adjacencyList[b].push_back(a);
+    }
+    std::vector<IntType> offsets(1, 0), targets;
+    for (IntType i = 0; i < nodes; ++i) {
+      targets.insert(targets.end(), adjacencyList[i].begin(), adjacencyList[i].end());
+      offsets.push_back(targets.size());
+    }
+    std::vector<IntType> labels;
+    IntType nComponents = findConnectedComponents(adjacencyList, labels);
+
+    for (std::size_t threads = 1; threads <= 4; threads += 3) {
+      std::vector<IntType> parallelLabels;
+      shouldEqual(findConnectedComponentsParallel(adjacencyList, 
+        parallelLabels, threads), nComponents);
+      should(parallelLabels == labels);
+      std::vector<IntType> csrLabels;
+      shouldEqual(findConnectedComponentsParallel(offsets, targets, 
+        csrLabels, threads), nComponents);
+      should(csrLabels == labels);
+    }
+    std::vector<std::vector<IntType> > empty;
+    shouldEqual(findConnectedComponentsParallel(empty, labels), 0u);
+    shouldEqual(labels.size(), 0u);
+  }
+};
+
+
+
+
+
+
+
+
+
+struct NearestTestSuite : vigra::test_suite {
+  NearestTestSuite() : vigra::test_suite("Nearest")
+  {
+    add(testCase(&NearestTestSuite::testNearestBruteForce));
+    add(testCase(&NearestTestSuite::testNearestMaxDistance));
+  }
+
+  void testNearestBruteForce(){
+    typedef ValueType<double, double> Map;
+    typedef fbi::Nearest<Map, 1, 0> NNN;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+
+    std::mt19937 engine(42);
+    std::uniform_real_distribution<double> pos(0.0, 100.0);
+    std::uniform_real_distribution<double> width(0.0, 3.0);
+    std::vector<Map> testVector, queryVector;
+    for (size_t i = 0; i < 500; ++i) {
+      double x = pos(engine), y = pos(engine);
+      testVector.push_back(Map(x, x + width(engine), y, y + width(engine)));
+    }
+    for (size_t i = 0; i < 50; ++i) {
+      double x = pos(engine), y = pos(engine);
+      queryVector.push_back(Map(x, x + width(engine), y, y + width(engine)));
+    }
+    const size_t k = 5;
+    NNN::ResultType results = NNN::find(k, testVector, StandardFunctor(),
+      queryVector, StandardFunctor(), fbi::BoxGapMetric());
+    shouldEqual(results.size(), queryVector.size());
+
+    fbi::BoxGapMetric metric;
+    for (size_t q = 0; q < queryVector.size(); ++q) {
+      std::vector<NNN::Neighbor> expected;
+      for (size_t i = 0; i < testVector.size(); ++i) {
+        double d = 
+          metric.get<1>(std::get<1>(queryVector[q].key_), std::get<1>(testVector[i].key_)) +
+          metric.get<0>(std::get<0>(queryVector[q].key_), std::get<0>(testVector[i].key_));
+        expected.push_back(NNN::Neighbor((NNN::IntType)i, d));
+      }
+      std::sort(expected.begin(), expected.end(), NNN::lessNeighbor());
+      expected.resize(k);
+      shouldEqual(results[q].size(), k);
+      for (size_t n = 0; n < k; ++n) {
+        if (results[q][n].first != expected[n].first) {
+          std::cout << q << ": " << results[q][n].first << " " 
+            << expected[n].first << std::endl;
+          failTest("nearest gave a wrong neighbor");
+        }
+      }
+    }
+  }
+
+  void testNearestMaxDistance(){
+    typedef ValueType<int, double> Map;
+    typedef fbi::Nearest<Map, 1> NNN;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+
+    std::vector<Map> testVector;
+    for (int i = 0; i < 10; ++i) {
+      testVector.push_back(Map(0, 0, 10.0 * i, 10.0 * i + 1.0));
+    }
+    std::vector<Map> queryVector;
+    queryVector.push_back(Map(0, 0, 22.0, 23.0));
+    queryVector.push_back(Map(0, 0, 500.0, 501.0));
+
+    NNN::ResultType results = NNN::find(3, testVector, StandardFunctor(),
+      queryVector, StandardFunctor(), fbi::BoxGapMetric(), 10.0);
+    shouldEqual(results[0].size(), 2u);
+    shouldEqual(results[0][0].first, 2u);
+    shouldEqual(results[0][0].second, 1.0);
+    shouldEqual(results[0][1].first, 3u);
+    shouldEqual(results[0][1].second, 7.0);
+    shouldEqual(results[1].size(), 0u);
+  }
+};
+
+template <typename Map>
+struct SegmentReader {
+  const std::vector<std::vector<Map> > & segments_;
+  size_t next_;
+  SegmentReader(const std::vector<std::vector<Map> > & segments) 
+    : segments_(segments), next_(0) {}
+  bool operator()(std::vector<Map> & segment) {
+    if (next_ == segments_.size()) return false;
+    segment.insert(segment.end(), segments_[next_].begin(), segments_[next_].end());
+    ++next_;
+    return true;
+  }
+};
+
+struct SlabPipelineTestSuite : vigra::test_suite {
+  SlabPipelineTestSuite() : vigra::test_suite("SlabPipeline")
+  {
+    add(testCase(&SlabPipelineTestSuite::testPipelineMatchesIntersect));
+  }
+
+  void testPipelineMatchesIntersect(){
+    typedef ValueType<double, double> Map;
+    typedef fbi::SetA<Map, 0, 1> TTT;
+    typedef fbi::SlabPipeline<Map, 0, 1> PPP;
+    typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+
+    // boxes only reach into the neighboring segments
+    std::mt19937 engine(7);
+    std::uniform_real_distribution<double> pos(0.0, 20.0);
+    std::vector<std::vector<Map> > segments(37);
+    std::vector<Map> testVector;
+    for (size_t s = 0; s < segments.size(); ++s) {
+      for (size_t i = 0; i < s % 5; ++i) {
+        double y = pos(engine);
+        segments[s].push_back(Map(s - 0.6, s + 0.6, y, y + 1.5));
+      }
+      testVector.insert(testVector.end(), segments[s].begin(), segments[s].end());
+    }
+    TTT::ResultType correctResults = 
+      TTT::intersect(testVector, StandardFunctor(), StandardFunctor());
+
+    SegmentReader<Map> reader(segments);
+    std::vector<Map> boxes;
+    PPP pipeline(4, 1, 2);
+    PPP::ResultType results = 
+      pipeline.run(reader, boxes, StandardFunctor(), StandardFunctor());
+
+    shouldEqual(boxes.size(), testVector.size());
+    shouldEqual(results.size(), correctResults.size());
+    for (size_t i = 0; i < correctResults.size(); ++i) {
+      if (results[i] != correctResults[i]) {
+        std::cout << "wrong adjacency for box " << i << std::endl;
+        failTest("pipeline gave a wrong result");
+      }
+    }
+  }
+};
+
+// The same boxes as ValueType<double, double>, but with compressed keys.
+struct FloatKeyBox : ValueType<double, double> {
+  FloatKeyBox(double a, double b, double c, double d) 
+    : ValueType<double, double>(a, b, c, d) {}
+};
+
+struct FixedPointKeyBox : ValueType<double, double> {
+  FixedPointKeyBox(double a, double b, double c, double d) 
+    : ValueType<double, double>(a, b, c, d) {}
+};
+
+// Compares cells of 4e-6 instead of the values, ends in one cell touch.
+struct CoarseLess {
+  template <typename T>
+  bool operator()(const T & a, const T & b) const {
+    return std::floor(a * 250000.0) < std::floor(b * 250000.0);
+  }
 };
 
+struct CoarseKeyBox : ValueType<double, double> {
+  CoarseKeyBox(const key_type & key) : ValueType<double, double>(key) {}
+};
+
+struct CoarseFloatKeyBox : ValueType<double, double> {
+  CoarseFloatKeyBox(double a, double b, double c, double d) 
+    : ValueType<double, double>(a, b, c, d) {}
+};
+
+template <typename T>
+struct CoarseTraits {
+  typedef std::tuple<std::pair<T, CoarseLess>, 
+    std::pair<T, CoarseLess> > dim_type;
+  typedef std::tuple<std::pair<T, T>, std::pair<T, T> > key_type;
+  static key_type getLimits() {
+    return std::make_tuple(
+      std::make_pair(-std::numeric_limits<T>::max(), 
+        std::numeric_limits<T>::max()),
+      std::make_pair(-std::numeric_limits<T>::max(), 
+        std::numeric_limits<T>::max()));
+  }
+  enum {
+    defined = 1
+  };
+};
 
+namespace fbi {
+template<>
+struct Traits<FloatKeyBox> : public mpl::TraitsGenerator<float, float> {};
+template<>
+struct Traits<FixedPointKeyBox> : public mpl::TraitsGenerator<int32_t, int32_t> {};
+template<>
+struct Traits<CoarseKeyBox> : public CoarseTraits<double> {};
+template<>
+struct Traits<CoarseFloatKeyBox> : public CoarseTraits<float> {};
+}
 
+struct QuantizeTestSuite : vigra::test_suite {
+  QuantizeTestSuite() : vigra::test_suite("Quantize")
+  {
+    add(testCase(&QuantizeTestSuite::testOutwardRounding));
+    add(testCase(&QuantizeTestSuite::testFloatKeys));
+    add(testCase(&QuantizeTestSuite::testFixedPointKeys));
+    add(testCase(&QuantizeTestSuite::testCustomComparator));
+  }
 
+  typedef ValueType<double, double> Map2;
+
+  void testOutwardRounding(){
+    std::pair<float, float> f = 
+      fbi::OutwardRounding<float>::apply(std::make_pair(0.1, 0.3));
+    should(f.first <= 0.1 && f.second >= 0.3);
+    should(f.first == 0.1f || f.first == std::nextafter(0.1f, 0.0f));
+    std::pair<float, float> exact = 
+      fbi::OutwardRounding<float>::apply(std::make_pair(0.5, 2.0));
+    shouldEqual(exact.first, 0.5f);
+    shouldEqual(exact.second, 2.0f);
+    std::pair<int32_t, int32_t> i = 
+      fbi::OutwardRounding<int32_t>::apply(std::make_pair(1.23456, 1.5), 1e4);
+    shouldEqual(i.first, 12345);
+    shouldEqual(i.second, 15001);
+    std::pair<int16_t, int16_t> clamped = 
+      fbi::OutwardRounding<int16_t>::apply(std::make_pair(-1e6, 1e6));
+    shouldEqual(clamped.first, std::numeric_limits<int16_t>::min());
+    shouldEqual(clamped.second, std::numeric_limits<int16_t>::max());
+  }
 
+  /* boxes whose ends are closer than the float resolution */
+  template <typename Box>
+  void createBoxes(std::vector<Map2> & exact, std::vector<Box> & compressed)
+  {
+    std::mt19937 engine(11);
+    std::uniform_int_distribution<int> pos(0, 2000);
+    std::uniform_int_distribution<int> width(1, 40);
+    for (size_t i = 0; i < 800; ++i) {
+      double x = 500.0 + pos(engine) * 1e-6;
+      double w = width(engine) * 1e-6;
+      double y = 1000.0 + pos(engine) * 1e-6;
+      double h = width(engine) * 1e-6;
+      exact.push_back(Map2(x, x + w, y, y + h));
+      compressed.push_back(Box(x, x + w, y, y + h));
+    }
+  }
 
+  template <typename Box, typename Functor>
+  void checkCompressedResult(const std::vector<Map2> & exact, 
+    const std::vector<Box> & compressed, const Functor & functor)
+  {
+    typedef fbi::SetA<Map2, 0, 1> TTT;
+    typedef fbi::SetA<Box, 0, 1> CCC;
+    typedef ValueTypeStandardAccessor<Map2> StandardFunctor;
+
+    TTT::ResultType correctResults = 
+      TTT::intersect(exact, StandardFunctor(), StandardFunctor());
+    typename CCC::ResultType results = 
+      CCC::intersect(compressed, functor, functor);
+    shouldEqual(results.size(), correctResults.size());
+    size_t correctEdges = 0, edges = 0;
+    for (size_t i = 0; i < correctResults.size(); ++i) {
+      if (!std::includes(results[i].begin(), results[i].end(), 
+          correctResults[i].begin(), correctResults[i].end())) {
+        std::cout << "lost an edge of box " << i << std::endl;
+        failTest("quantization lost an intersection");
+      }
+      correctEdges += correctResults[i].size();
+      edges += results[i].size();
+    }
+    // the test data is meant to produce false positives
+    should(edges > correctEdges);
+
+    fbi::ExactFilter<Box, 0, 1>::filter(results, compressed, 
+      functor.functor(), functor.functor());
+    for (size_t i = 0; i < correctResults.size(); ++i) {
+      if (results[i] != correctResults[i]) {
+        std::cout << "wrong adjacency for box " << i << std::endl;
+        failTest("exact filter gave a wrong result");
+      }
+    }
+  }
 
+  void testFloatKeys(){
+    std::vector<Map2> exact;
+    std::vector<FloatKeyBox> compressed;
+    createBoxes(exact, compressed);
+    checkCompressedResult(exact, compressed, 
+      fbi::quantize<FloatKeyBox>(ValueTypeStandardAccessor<Map2>()));
+  }
 
+  void testFixedPointKeys(){
+    std::vector<Map2> exact;
+    std::vector<FixedPointKeyBox> compressed;
+    createBoxes(exact, compressed);
+    std::array<double, 2> scales = {{1e5, 1e5}};
+    checkCompressedResult(exact, compressed, 
+      fbi::quantize<FixedPointKeyBox>(ValueTypeStandardAccessor<Map2>(), 
+        scales));
+  }
+
+  /* the exact filter has to compare like the scanners, not with < */
+  void testCustomComparator(){
+    typedef fbi::SetA<Map2, 0, 1> TTT;
+    typedef fbi::SetA<CoarseKeyBox, 0, 1> EEE;
+    typedef fbi::SetA<CoarseFloatKeyBox, 0, 1> CCC;
+    typedef ValueTypeStandardAccessor<Map2> StandardFunctor;
+    std::vector<Map2> exact;
+    std::vector<CoarseFloatKeyBox> compressed;
+    createBoxes(exact, compressed);
+    std::vector<CoarseKeyBox> coarse;
+    for (size_t i = 0; i < exact.size(); ++i) {
+      coarse.push_back(CoarseKeyBox(exact[i].key_));
+    }
+    EEE::ResultType correctResults = 
+      EEE::intersect(coarse, StandardFunctor(), StandardFunctor());
+    // the test data is meant to tell the comparators apart
+    should(correctResults != 
+      TTT::intersect(exact, StandardFunctor(), StandardFunctor()));
+
+    auto functor = fbi::quantize<CoarseFloatKeyBox>(StandardFunctor());
+    CCC::ResultType results = CCC::intersect(compressed, functor, functor);
+    fbi::ExactFilter<CoarseFloatKeyBox, 0, 1>::filter(results, compressed, 
+      functor.functor(), functor.functor());
+    shouldEqual(results.size(), correctResults.size());
+    for (size_t i = 0; i < correctResults.size(); ++i) {
+      if (results[i] != correctResults[i]) {
+        std::cout << "wrong adjacency for box " << i << std::endl;
+        failTest("exact filter ignored the comparator");
+      }
+    }
+  }
+};
+
+struct EdgeCollector {
+  std::vector<std::vector<uint32_t> > & edges_;
+  EdgeCollector(std::vector<std::vector<uint32_t> > & edges) : edges_(edges) {}
+  void operator()(uint32_t head, uint32_t tail) {
+    edges_[head].push_back(tail);
+    edges_[tail].push_back(head);
+  }
+};
+
+struct ClusteringTestSuite : vigra::test_suite {
+  ClusteringTestSuite() : vigra::test_suite("Clustering")
+  {
+    add(testCase(&ClusteringTestSuite::testVisitIntersections));
+    add(testCase(&ClusteringTestSuite::testLabelsMatchComponents));
+    add(testCase(&ClusteringTestSuite::testReducers));
+    add(testCase(&ClusteringTestSuite::testAggregate));
+  }
+
+  typedef ValueType<double, double> Map;
+  typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+
+  std::vector<Map> createBoxes(size_t n)
+  {
+    std::mt19937 engine(5);
+    std::uniform_real_distribution<double> pos(0.0, 100.0);
+    std::uniform_real_distribution<double> width(0.0, 1.0);
+    std::vector<Map> boxes;
+    for (size_t i = 0; i < n; ++i) {
+      double x = pos(engine), y = pos(engine);
+      boxes.push_back(Map(x, x + width(engine), y, y + width(engine)));
+    }
+    return boxes;
+  }
+
+  void testVisitIntersections(){
+    typedef fbi::SetA<Map, 0, 1> TTT;
+    std::vector<Map> testVector = createBoxes(2000);
+    TTT::ResultType correctResults = 
+      TTT::intersect(testVector, StandardFunctor(), StandardFunctor());
+    fbi::IntersectOptions options;
+    options.engine_ = fbi::IntersectOptions::ENGINE_GRID;
+    options.partitions_ = 3;
+    for (size_t run = 0; run < 2; ++run) {
+      std::vector<std::vector<uint32_t> > edges(testVector.size());
+      EdgeCollector collector(edges);
+      if (run == 0) {
+        TTT::visitIntersections(collector, testVector, StandardFunctor(), 
+          StandardFunctor());
+      } else {
+        TTT::visitIntersections(options, collector, testVector, 
+          StandardFunctor(), StandardFunctor());
+      }
+      for (size_t i = 0; i < edges.size(); ++i) {
+        std::sort(edges[i].begin(), edges[i].end());
+        edges[i].erase(std::unique(edges[i].begin(), edges[i].end()), edges[i].end());
+      }
+      checkSameResult(correctResults, edges);
+    }
+  }
+
+  void testLabelsMatchComponents(){
+    typedef fbi::SetA<Map, 0, 1> TTT;
+    typedef fbi::Clustering<Map, 0, 1> CCC;
+    std::vector<Map> testVector = createBoxes(3000);
+    TTT::ResultType results = 
+      TTT::intersect(testVector, StandardFunctor(), StandardFunctor());
+    std::vector<uint32_t> correctLabels, labels;
+    uint32_t nComponents = findConnectedComponents(results, correctLabels);
+    shouldEqual(CCC::label(labels, testVector, StandardFunctor(), 
+      StandardFunctor()), nComponents);
+    should(labels == correctLabels);
+  }
+
+  void testReducers(){
+    typedef fbi::Clustering<Map, 0, 1> CCC;
+    std::vector<Map> testVector;
+    testVector.push_back(Map(0.0, 1.0, 0.0, 1.0));
+    testVector.push_back(Map(10.0, 11.0, 0.0, 1.0));
+    testVector.push_back(Map(0.5, 1.5, 0.5, 1.5));
+    testVector.push_back(Map(1.0, 3.0, 1.0, 2.0));
+    std::vector<uint32_t> labels;
+    std::vector<std::tuple<size_t, double, double, double, double> > summaries = 
+      CCC::cluster(labels, testVector, fbi::reducers(fbi::Count(), 
+        fbi::sum(LowerX()), fbi::mean(LowerX()), fbi::minimum(LowerX()), 
+        fbi::maximum(LowerX())), StandardFunctor(), StandardFunctor());
+    shouldEqual(summaries.size(), 2u);
+    shouldEqual(labels[0], 1u);
+    shouldEqual(labels[1], 2u);
+    shouldEqual(labels[2], 1u);
+    shouldEqual(labels[3], 1u);
+    shouldEqual(std::get<0>(summaries[0]), 3u);
+    shouldEqual(std::get<1>(summaries[0]), 1.5);
+    shouldEqual(std::get<2>(summaries[0]), 0.5);
+    shouldEqual(std::get<3>(summaries[0]), 0.0);
+    shouldEqual(std::get<4>(summaries[0]), 1.0);
+    shouldEqual(std::get<0>(summaries[1]), 1u);
+    shouldEqual(std::get<2>(summaries[1]), 10.0);
+  }
+
+  void testAggregate(){
+    std::vector<Map> testVector = createBoxes(5000);
+    std::mt19937 engine(9);
+    const uint32_t numClusters = 700;
+    std::uniform_int_distribution<uint32_t> cluster(1, numClusters);
+    std::vector<uint32_t> labels;
+    for (size_t i = 0; i < testVector.size(); ++i) {
+      labels.push_back(cluster(engine));
+    }
+    // serial reference, boxes are added in index order
+    std::vector<double> sums(numClusters, 0.0);
+    std::vector<size_t> counts(numClusters, 0);
+    for (size_t i = 0; i < testVector.size(); ++i) {
+      sums[labels[i] - 1] += LowerX()(testVector[i]);
+      ++counts[labels[i] - 1];
+    }
+    fbi::LabelGrouping<uint32_t> grouping = fbi::groupByLabel(labels, numClusters, 3);
+    shouldEqual(grouping.numClusters(), numClusters);
+    for (size_t c = 0; c < numClusters; ++c) {
+      shouldEqual(grouping.offsets_[c + 1] - grouping.offsets_[c], counts[c]);
+      for (size_t k = grouping.offsets_[c]; k < grouping.offsets_[c + 1]; ++k) {
+        shouldEqual(labels[grouping.order_[k]], c + 1);
+        if (k > grouping.offsets_[c]) {
+          should(grouping.order_[k - 1] < grouping.order_[k]);
+        }
+      }
+    }
+    // labels with more than one radix digit, most clusters are empty
+    std::uniform_int_distribution<uint32_t> sparse(1, 3000000);
+    std::vector<uint32_t> sparseLabels;
+    for (size_t i = 0; i < testVector.size(); ++i) {
+      sparseLabels.push_back(sparse(engine));
+    }
+    std::vector<uint32_t> expected(testVector.size());
+    for (size_t i = 0; i < expected.size(); ++i) expected[i] = i;
+    std::stable_sort(expected.begin(), expected.end(), 
+      [&](uint32_t a, uint32_t b) { return sparseLabels[a] < sparseLabels[b]; });
+    for (size_t threads = 1; threads <= 4; ++threads) {
+      grouping = fbi::groupByLabel(sparseLabels, 3000000, threads);
+      should(grouping.order_ == expected);
+      shouldEqual(grouping.numClusters(), 3000000u);
+      for (size_t k = 0; k < expected.size(); ++k) {
+        const uint32_t label = sparseLabels[expected[k]];
+        should(grouping.offsets_[label - 1] <= k);
+        should(k < grouping.offsets_[label]);
+      }
+      shouldEqual(grouping.offsets_.back(), testVector.size());
+    }
+    for (size_t threads = 1; threads <= 5; threads += 2) {
+      std::vector<std::tuple<size_t, double> > summaries = 
+        fbi::aggregate(testVector, labels, numClusters, 
+          fbi::reducers(fbi::Count(), fbi::sum(LowerX())), threads);
+      shouldEqual(summaries.size(), numClusters);
+      for (size_t c = 0; c < numClusters; ++c) {
+        shouldEqual(std::get<0>(summaries[c]), counts[c]);
+        shouldEqual(std::get<1>(summaries[c]), sums[c]);
+      }
+    }
+  }
+
+  struct LowerX {
+    double operator()(const Map & box) const { return std::get<0>(box.key_).first; }
+  };
+};
+
+struct ShiftedJoinTestSuite : vigra::test_suite {
+  ShiftedJoinTestSuite() : vigra::test_suite("ShiftedJoin")
+  {
+    add(testCase(&ShiftedJoinTestSuite::testSelfJoinMatchesIntersect));
+    add(testCase(&ShiftedJoinTestSuite::testOffsetAnnotations));
+  }
+
+  typedef ValueType<double, int> Map;
+  typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+  typedef OffsetQueryAccessor<Map> IntervalMover;
+  typedef fbi::ShiftedJoin<Map, 0, 1> Join;
+
+  std::vector<Map> createBoxes(size_t n, unsigned int seed)
+  {
+    std::mt19937 engine(seed);
+    std::uniform_real_distribution<double> pos(0.0, 200.0);
+    std::uniform_real_distribution<double> width(0.0, 1.0);
+    std::uniform_int_distribution<int> y(0, 50);
+    std::vector<Map> boxes;
+    for (size_t i = 0; i < n; ++i) {
+      double x = pos(engine);
+      int b = y(engine);
+      boxes.push_back(Map(x, x + width(engine), b, b + 2));
+    }
+    // shared endpoints
+    boxes.push_back(Map(10.0, 11.0, 3, 5));
+    boxes.push_back(Map(10.0, 10.5, 3, 4));
+    boxes.push_back(Map(11.0, 12.0, 5, 7));
+    return boxes;
+  }
+
+  void testSelfJoinMatchesIntersect(){
+    std::vector<Map> boxes = createBoxes(5000, 3);
+    std::vector<IntervalMover> movers;
+    std::vector<Join::offset_type> offsets;
+    for (int k = 0; k < 6; ++k) {
+      movers.push_back(IntervalMover(0.5 * k, k % 3 - 1));
+      offsets.push_back(Join::offset_type(0.5 * k, k % 3 - 1));
+    }
+    fbi::SetA<Map, 0, 1>::ResultType expected = fbi::SetA<Map, 0, 1>::
+      intersect(boxes, StandardFunctor(), movers);
+    fbi::SetA<Map, 0, 1>::ResultType result = Join::toAdjacencyList(
+      Join::intersect(boxes, StandardFunctor(), StandardFunctor(), offsets));
+    checkSameResult(expected, result);
+  }
+
+  void testOffsetAnnotations(){
+    std::vector<Map> data = createBoxes(3000, 4);
+    std::vector<Map> queries = createBoxes(2000, 5);
+    std::vector<Join::offset_type> offsets;
+    offsets.push_back(Join::offset_type(0.0, 0));
+    offsets.push_back(Join::offset_type(1.0/3.0, 0));
+    offsets.push_back(Join::offset_type(-2.0, 4));
+    Join::ResultType result = Join::intersect(data, StandardFunctor(), 
+      queries, StandardFunctor(), offsets);
+    shouldEqual(result.size(), queries.size());
+
+    std::vector<std::vector<std::pair<Join::IntType, Join::IntType> > > 
+      expected(queries.size());
+    for (size_t k = 0; k < offsets.size(); ++k) {
+      typedef fbi::SetA<Map, 0, 1>::SetB<Map, 0, 1> Bipartite;
+      fbi::SetA<Map, 0, 1>::ResultType edges = Bipartite::intersect(data, 
+        StandardFunctor(), queries, IntervalMover(std::get<0>(offsets[k]), 
+          std::get<1>(offsets[k])));
+      for (size_t q = 0; q < queries.size(); ++q) {
+        const fbi::SetA<Map, 0, 1>::ResultType::value_type & row = 
+          edges[data.size() + q];
+        for (auto it = row.begin(); it != row.end(); ++it) {
+          expected[q].push_back(std::make_pair(*it, (Join::IntType)k));
+        }
+      }
+    }
+    size_t pairs = 0;
+    for (size_t q = 0; q < queries.size(); ++q) {
+      std::sort(expected[q].begin(), expected[q].end());
+      pairs += result[q].size();
+    }
+    checkSameResult(expected, result);
+    should(pairs > 0);
+
+    // the visitor sees the same triples
+    size_t visited = 0;
+    struct Counter {
+      size_t * count_;
+      void operator()(Join::IntType, Join::IntType, Join::IntType) 
+      { ++*count_; }
+    } counter = { &visited };
+    Join::visit(counter, data, StandardFunctor(), queries, StandardFunctor(),
+      offsets);
+    shouldEqual(visited, pairs);
+  }
+};
+
+struct EpsilonJoinTestSuite : vigra::test_suite {
+  EpsilonJoinTestSuite() : vigra::test_suite("EpsilonJoin")
+  {
+    add(testCase(&EpsilonJoinTestSuite::testSelfJoinMatchesIntersect));
+    add(testCase(&EpsilonJoinTestSuite::testBipartiteMatchesIntersect));
+  }
+
+  typedef ValueType<double, double> Point;
+  typedef fbi::EpsilonJoin<Point, 0, 1> Join;
+  typedef fbi::SetA<Point, 0, 1>::ResultType ResultType;
+
+  /** The coordinates of a point are the lower endpoints of its key */
+  struct PointFunctor {
+    template <size_t N>
+    double get(const Point & point) const {
+      return std::get<N>(point.key_).first;
+    }
+  };
+
+  /** Build the tolerance intervals by hand, like the example generators */
+  struct BoxFunctor {
+    template <size_t N>
+    std::pair<double, double> get(const Point & point) const;
+  };
+
+  static Join::tolerance_type tolerances()
+  {
+    Join::tolerance_type t = {{ fbi::Tolerance::ppm(10.0), 
+      fbi::Tolerance::absolute(0.5) }};
+    return t;
+  }
+
+  std::vector<Point> createPoints(size_t n, unsigned int seed)
+  {
+    std::mt19937 engine(seed);
+    std::uniform_real_distribution<double> mz(400.0, 401.0);
+    std::uniform_int_distribution<int> rt(0, 100);
+    std::vector<Point> points;
+    for (size_t i = 0; i < n; ++i) {
+      double x = mz(engine);
+      double y = rt(engine);
+      points.push_back(Point(x, x, y, y));
+    }
+    // duplicates and intervals that touch
+    points.push_back(Point(400.5, 400.5, 7.0, 7.0));
+    points.push_back(Point(400.5, 400.5, 7.0, 7.0));
+    points.push_back(Point(400.5, 400.5, 8.0, 8.0));
+    return points;
+  }
+
+  size_t checkEqual(const ResultType & expected, const ResultType & result)
+  {
+    checkSameResult(expected, result);
+    size_t pairs = 0;
+    for (size_t i = 0; i < result.size(); ++i) {
+      pairs += result[i].size();
+    }
+    return pairs;
+  }
+
+  void testSelfJoinMatchesIntersect(){
+    std::vector<Point> points = createPoints(5000, 6);
+    ResultType expected = fbi::SetA<Point, 0, 1>::intersect(points, 
+      BoxFunctor(), BoxFunctor());
+    should(checkEqual(expected, Join::intersect(points, PointFunctor(), 
+      tolerances())) > points.size());
+    checkEqual(expected, Join::intersect(points, PointFunctor(), 
+      tolerances(), 3));
+
+    size_t visited = 0, pairs = 0;
+    struct Counter {
+      size_t * count_;
+      void operator()(Join::IntType, Join::IntType) { ++*count_; }
+    } counter = { &visited };
+    Join::visit(counter, points, PointFunctor(), tolerances());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      pairs += expected[i].size();
+    }
+    // every pair but the self matches is in two rows
+    shouldEqual(2 * visited, pairs + points.size());
+  }
+
+  void testBipartiteMatchesIntersect(){
+    std::vector<Point> data = createPoints(3000, 7);
+    std::vector<Point> queries = createPoints(2000, 8);
+    typedef fbi::SetA<Point, 0, 1>::SetB<Point, 0, 1> Bipartite;
+    ResultType expected = Bipartite::intersect(data, BoxFunctor(), 
+      queries, BoxFunctor());
+    should(checkEqual(expected, Join::intersect(data, PointFunctor(), 
+      queries, PointFunctor(), tolerances())) > 0);
+    checkEqual(expected, Join::intersect(data, PointFunctor(), queries, 
+      PointFunctor(), tolerances(), 4));
+  }
+};
+
+template <>
+std::pair<double, double> 
+EpsilonJoinTestSuite::BoxFunctor::get<0>(const Point & point) const
+{
+  const double x = std::get<0>(point.key_).first;
+  return std::make_pair(x * (1 - 10.0 * 1E-6), x * (1 + 10.0 * 1E-6));
+}
+
+template <>
+std::pair<double, double> 
+EpsilonJoinTestSuite::BoxFunctor::get<1>(const Point & point) const
+{
+  const double y = std::get<1>(point.key_).first;
+  return std::make_pair(y - 0.5, y + 0.5);
+}
+
+struct DimensionOrderTestSuite : vigra::test_suite {
+  DimensionOrderTestSuite() : vigra::test_suite("DimensionOrder")
+  {
+    add(testCase(&DimensionOrderTestSuite::testMoveToFront));
+    add(testCase(&DimensionOrderTestSuite::testSelectivity));
+    add(testCase(&DimensionOrderTestSuite::testMatchesIntersect));
+  }
+
+  typedef ValueType<double, int, double> Map;
+  typedef fbi::DimensionOrder<Map, 0, 1, 2> Order;
+  typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+
+  /** Wide intervals in dimension 0, narrow ones in 1, medium ones in 2 */
+  std::vector<Map> createBoxes(size_t n, unsigned int seed)
+  {
+    std::mt19937 engine(seed);
+    std::uniform_real_distribution<double> x(0.0, 100.0);
+    std::uniform_int_distribution<int> y(0, 10000);
+    std::vector<Map> boxes;
+    for (size_t i = 0; i < n; ++i) {
+      double a = x(engine);
+      int b = y(engine);
+      double c = x(engine);
+      boxes.push_back(Map(a, a + 50.0, b, b + 20, c, c + 10.0));
+    }
+    return boxes;
+  }
+
+  void testMoveToFront()
+  {
+    should((std::is_same<fbi::mpl::MoveToFront<0, fbi::mpl::Indices<>, 
+      3, 1, 2>::type, fbi::mpl::Indices<3, 1, 2> >::value));
+    should((std::is_same<fbi::mpl::MoveToFront<2, fbi::mpl::Indices<>, 
+      3, 1, 2>::type, fbi::mpl::Indices<2, 3, 1> >::value));
+    should((std::is_same<fbi::mpl::MoveToFront<1, fbi::mpl::Indices<>, 
+      3, 1, 2, 0>::type, fbi::mpl::Indices<1, 3, 2, 0> >::value));
+  }
+
+  void testSelectivity()
+  {
+    std::vector<Map> boxes = createBoxes(2000, 17);
+    std::vector<double> selectivity = Order::selectivity(
+      Order::defaultSampleSize, boxes, StandardFunctor(), 
+      boxes, StandardFunctor());
+    shouldEqual(selectivity.size(), 3u);
+    should(selectivity[1] < selectivity[2]);
+    should(selectivity[2] < selectivity[0]);
+    shouldEqual(Order::leadingDimension(selectivity), 1u);
+
+    std::vector<Map> empty;
+    selectivity = Order::selectivity(Order::defaultSampleSize, empty, 
+      StandardFunctor(), boxes, StandardFunctor());
+    shouldEqual(Order::leadingDimension(selectivity), 0u);
+  }
+
+  void testMatchesIntersect()
+  {
+    typedef fbi::SetA<Map, 0, 1, 2> SetA;
+    std::vector<Map> boxes = createBoxes(3000, 5);
+    std::vector<Map> queries = createBoxes(1000, 6);
+    std::vector<OffsetQueryAccessor<Map> > movers;
+    movers.push_back(OffsetQueryAccessor<Map>(1.0, 15, 0.0));
+    movers.push_back(OffsetQueryAccessor<Map>(0.0, -7, 2.0));
+
+    fbi::IntersectOptions options;
+    checkSameResult(SetA::intersect(options, boxes, StandardFunctor(), movers), 
+      Order::intersect(options, boxes, StandardFunctor(), movers));
+    options.scanDimensions_ = 1;
+    checkSameResult(SetA::intersect(options, boxes, StandardFunctor(), movers), 
+      Order::intersect(options, boxes, StandardFunctor(), movers));
+
+    options = fbi::IntersectOptions();
+    Order::ResultType expected = SetA::SetB<Map, 0, 1, 2>::intersect(
+      options, boxes, StandardFunctor(), queries, StandardFunctor());
+    checkSameResult(expected, Order::SetB<Map, 0, 1, 2>::intersect(options, 
+      boxes, StandardFunctor(), queries, StandardFunctor()));
+
+    Order::ResultType visited(expected.size());
+    EdgeCollector collector(visited);
+    Order::SetB<Map, 0, 1, 2>::visitIntersections(collector, boxes, 
+      StandardFunctor(), queries, StandardFunctor());
+    for (size_t i = 0; i < visited.size(); ++i) {
+      std::sort(visited[i].begin(), visited[i].end());
+      visited[i].erase(std::unique(visited[i].begin(), visited[i].end()), 
+        visited[i].end());
+    }
+    checkSameResult(expected, visited);
+  }
+};
+
+struct BatchTestSuite : vigra::test_suite {
+  BatchTestSuite() : vigra::test_suite("Batch")
+  {
+    add(testCase(&BatchTestSuite::testMatchesIntersect));
+    add(testCase(&BatchTestSuite::testMemoryLimits));
+  }
+
+  typedef ValueType<double, double> Map;
+  typedef fbi::SetA<Map, 0, 1> SetA;
+  typedef fbi::Batch<Map, 0, 1> Batch;
+  typedef ValueTypeStandardAccessor<Map> StandardFunctor;
+  typedef OffsetQueryAccessor<Map> IntervalMover;
+  typedef fbi::BatchJob<std::vector<Map>, StandardFunctor, 
+    std::vector<IntervalMover> > Job;
+
+  /** Runs of very different sizes, one of them empty */
+  std::vector<std::vector<Map> > createRuns()
+  {
+    std::mt19937 engine(46);
+    std::uniform_real_distribution<double> pos(0.0, 100.0);
+    std::uniform_real_distribution<double> width(0.0, 2.0);
+    const size_t sizes[] = {4000, 10, 0, 1500, 300, 2500, 1};
+    std::vector<std::vector<Map> > runs;
+    for (size_t r = 0; r < sizeof(sizes) / sizeof(sizes[0]); ++r) {
+      runs.push_back(std::vector<Map>());
+      for (size_t i = 0; i < sizes[r]; ++i) {
+        double x = pos(engine), y = pos(engine);
+        runs.back().push_back(
+          Map(x, x + width(engine), y, y + width(engine)));
+      }
+    }
+    return runs;
+  }
+
+  std::vector<IntervalMover> createMovers()
+  {
+    std::vector<IntervalMover> movers;
+    movers.push_back(IntervalMover(0.0, 0.0));
+    movers.push_back(IntervalMover(1.5, 0.0));
+    movers.push_back(IntervalMover(0.0, -3.0));
+    return movers;
+  }
+
+  void checkResults(const std::vector<std::vector<Map> > & runs,
+    const std::vector<SetA::ResultType> & results)
+  {
+    shouldEqual(runs.size(), results.size());
+    for (size_t r = 0; r < runs.size(); ++r) {
+      checkSameResult(SetA::intersect(runs[r], StandardFunctor(), 
+        createMovers()), results[r]);
+    }
+  }
+
+  void testMatchesIntersect()
+  {
+    std::vector<std::vector<Map> > runs = createRuns();
+    std::vector<Job> jobs;
+    for (size_t r = 0; r < runs.size(); ++r) {
+      jobs.push_back(fbi::makeBatchJob(runs[r], StandardFunctor(), 
+        createMovers()));
+    }
+    Batch batch(3);
+    shouldEqual(batch.numThreads(), 3u);
+    checkResults(runs, batch.run(jobs));
+    // the workspaces now hold the keys of the large runs
+    std::reverse(runs.begin(), runs.end());
+    jobs.clear();
+    for (size_t r = 0; r < runs.size(); ++r) {
+      jobs.push_back(fbi::makeBatchJob(runs[r], StandardFunctor(), 
+        createMovers()));
+    }
+    checkResults(runs, batch.run(jobs));
+    batch.release();
+    should(batch.run(std::vector<Job>()).empty());
+  }
+
+  void testMemoryLimits()
+  {
+    std::vector<std::vector<Map> > runs = createRuns();
+    const std::size_t oneQuery = Batch::keyMemory(
+      fbi::makeBatchJob(runs[0], StandardFunctor(), createMovers()), 1);
+    const std::size_t allQueries = Batch::keyMemory(
+      fbi::makeBatchJob(runs[0], StandardFunctor(), createMovers()), 0);
+    should(oneQuery < allQueries);
+    shouldEqual(allQueries, Batch::keyMemory(
+      fbi::makeBatchJob(runs[0], StandardFunctor(), createMovers()), 3));
+
+    // a job limit below the keys of all queries, a total limit below two
+    // of the largest jobs, and a job that does not fit at all
+    std::vector<Job> jobs;
+    for (size_t r = 0; r < runs.size(); ++r) {
+      jobs.push_back(fbi::makeBatchJob(runs[r], StandardFunctor(), 
+        createMovers(), oneQuery));
+    }
+    jobs[3].memoryLimit_ = 1;
+    Batch batch(4, oneQuery * 3 / 2);
+    // the total limit also counts the estimated edges of the results
+    should(batch.resultMemory(jobs[0]) > 
+      runs[0].size() * sizeof(Batch::ResultType::value_type));
+    checkResults(runs, batch.run(jobs));
+  }
+};
 
 int main() {
 
@@ -1481,7 +3162,40 @@ int main() {
   std::cout << profile.report() << std::endl;
 
 
-  return success || success1 || success2;
+  NearestTestSuite nearestTest;
+  int success3 = nearestTest.run();
+  std::cout << nearestTest.report() << std::endl;
+
+  SlabPipelineTestSuite pipelineTest;
+  int success4 = pipelineTest.run();
+  std::cout << pipelineTest.report() << std::endl;
+
+  QuantizeTestSuite quantizeTest;
+  int success5 = quantizeTest.run();
+  std::cout << quantizeTest.report() << std::endl;
+
+  ClusteringTestSuite clusteringTest;
+  int success6 = clusteringTest.run();
+  std::cout << clusteringTest.report() << std::endl;
+
+  ShiftedJoinTestSuite shiftedJoinTest;
+  int success7 = shiftedJoinTest.run();
+  std::cout << shiftedJoinTest.report() << std::endl;
+
+  EpsilonJoinTestSuite epsilonJoinTest;
+  int success8 = epsilonJoinTest.run();
+  std::cout << epsilonJoinTest.report() << std::endl;
+
+  DimensionOrderTestSuite dimensionOrderTest;
+  int success9 = dimensionOrderTest.run();
+  std::cout << dimensionOrderTest.report() << std::endl;
+
+  BatchTestSuite batchTest;
+  int success10 = batchTest.run();
+  std::cout << batchTest.report() << std::endl;
+
+  return success || success1 || success2 || success3 || success4 || success5 
+    || success6 || success7 || success8 || success9 || success10;
 
   //return success || success1;
 }